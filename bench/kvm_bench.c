@@ -0,0 +1,981 @@
+/**
+* @file kvm_bench.c
+*
+* @brief Load generator and latency benchmark for Key/Value Management System.
+*
+* Each thread owns a share of the connections and sends requests in
+* batches: up to <pipeline depth> requests are written to every connection,
+* then the replies are read back. The client library waits for every reply
+* before returning, so requests are written as v1 frames straight to the
+* socket instead.
+*
+* Closed loop mode starts the next batch as soon as the previous one
+* completes. Open loop mode (--rate) schedules requests at fixed intervals
+* and measures latency from the scheduled send time, so a stalled server
+* is charged for the requests which would have been sent while it stalled
+* (coordinated omission correction). Service time, measured from the
+* actual send, is reported separately.
+*
+*/
+
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "kvm_requests.h"
+#include "kvm_replies.h"
+#include "kvm_stats.h"
+#include "kvm_utils.h"
+#include "kvm_protocol.h"
+
+#define MAX_KEY_SIZE        1024
+#define MAX_VALUE_SIZE      ((uint32_t) 64 * 1024 * 1024)
+#define SPIN_NS             50000   /* Waits shorter than this spin instead of sleeping */
+
+typedef struct size_range_s
+{
+    uint32_t min;
+    uint32_t max;
+} size_range_t;
+
+typedef struct options_s
+{
+    const char *    ip;
+    uint16_t        port;
+    const char *    unix_path;      /* Unix domain socket instead of TCP if not NULL */
+    uint32_t        threads;
+    uint32_t        connections;    /* For all threads */
+    uint32_t        pipeline;       /* Outstanding requests per connection */
+    double          duration;       /* Seconds */
+    double          warmup;         /* Seconds, not recorded */
+    uint64_t        keyspace;
+    size_range_t    key_size;
+    size_range_t    value_size;
+    double          read_ratio;
+    double          zipf_theta;     /* 0 - uniform */
+    double          rate;           /* Requests per second for all threads, 0 - closed loop */
+    int             preload;
+    int             json;
+} options_t;
+
+/* Zipfian generator of Gray et al. as used by YCSB */
+typedef struct zipf_s
+{
+    uint64_t    n;
+    double      theta;
+    double      alpha;
+    double      zetan;
+    double      eta;
+    double      half_pow_theta;
+} zipf_t;
+
+typedef struct op_s
+{
+    uint8_t     id;             /* KVM_REQUST_GET or KVM_REQUST_PUT */
+    uint64_t    key;
+    uint64_t    scheduled;
+    uint64_t    sent;
+} op_t;
+
+typedef struct buffer_s
+{
+    uint8_t *   data;
+    uint32_t    size;
+    uint32_t    capacity;
+} buffer_t;
+
+typedef struct worker_s
+{
+    pthread_t   thread;
+    uint32_t    index;
+    uint64_t    rng;
+
+    int *       sockets;
+    buffer_t *  requests;       /* Pending frames by connection */
+    uint32_t    connection_count;
+    buffer_t    reply;
+    op_t *      ops;            /* connection_count * pipeline */
+
+    uint64_t    gets;
+    uint64_t    puts;
+    uint64_t    misses;
+    uint64_t    errors;
+    uint64_t    latency_max;
+    uint64_t    latency_sum;
+    uint64_t    service_max;
+    uint64_t    service_sum;
+    uint64_t    latency[KVM_HISTOGRAM_BUCKETS];     /* From scheduled send, ns */
+    uint64_t    service[KVM_HISTOGRAM_BUCKETS];     /* From actual send, ns */
+} worker_t;
+
+static options_t options =
+{
+    NULL, 0, NULL, 1, 1, 1, 10.0, 0.0, 100000, {16, 16}, {100, 100}, 0.9, 0.0, 0.0, 0, 0
+};
+
+static zipf_t zipf;
+static uint8_t * value_data;
+static uint64_t start_ns;                   /* Start of the warmup */
+static uint64_t end_ns;
+
+/* Start of the measurement, earlier requests like preload are not recorded */
+static uint64_t measure_ns = UINT64_MAX;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void wait_until(uint64_t deadline)
+{
+    uint64_t now = now_ns();
+    if (now + SPIN_NS < deadline)
+    {
+        const uint64_t sleep_until = deadline - SPIN_NS;
+        struct timespec ts;
+        ts.tv_sec = sleep_until / 1000000000;
+        ts.tv_nsec = sleep_until % 1000000000;
+        while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+        {
+        }
+    }
+
+    while (now_ns() < deadline)
+    {
+    }
+}
+
+static uint64_t splitmix64(uint64_t * state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static double random_unit(uint64_t * state)
+{
+    return (double) (splitmix64(state) >> 11) / (double) (1ULL << 53);
+}
+
+static uint32_t random_size(uint64_t * state, const size_range_t * range)
+{
+    return range->min + (uint32_t) (splitmix64(state) % ((uint64_t) range->max - range->min + 1));
+}
+
+static double zeta(uint64_t n, double theta)
+{
+    double sum = 0;
+    for (uint64_t i = 1; i <= n; ++i)
+    {
+        sum += 1.0 / pow((double) i, theta);
+    }
+    return sum;
+}
+
+static void zipf_init(zipf_t * z, uint64_t n, double theta)
+{
+    z->n = n;
+    z->theta = theta;
+    z->alpha = 1.0 / (1.0 - theta);
+    z->zetan = zeta(n, theta);
+    z->eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta(2, theta) / z->zetan);
+    z->half_pow_theta = 1.0 + pow(0.5, theta);
+}
+
+static uint64_t zipf_next(const zipf_t * z, uint64_t * state)
+{
+    const double u = random_unit(state);
+    const double uz = u * z->zetan;
+
+    if (uz < 1.0)
+    {
+        return 0;
+    }
+    if (uz < z->half_pow_theta)
+    {
+        return 1;
+    }
+
+    const uint64_t rank = (uint64_t) (z->n * pow(z->eta * u - z->eta + 1.0, z->alpha));
+    return (rank < z->n) ? rank : z->n - 1;
+}
+
+static uint64_t next_key(worker_t * worker)
+{
+    if (0 == options.zipf_theta)
+    {
+        return splitmix64(&worker->rng) % options.keyspace;
+    }
+    return zipf_next(&zipf, &worker->rng);
+}
+
+/* Every key has the same size on each run, zero padded decimal index. */
+static uint32_t make_key(uint64_t key, char * out)
+{
+    uint64_t state = key;
+    const uint32_t size = random_size(&state, &options.key_size);
+    char digits[32];
+    const int digit_count = snprintf(digits, sizeof(digits), "%llu", (unsigned long long) key);
+
+    memset(out, '0', size - digit_count);
+    memcpy(out + size - digit_count, digits, digit_count);
+    return size;
+}
+
+static int reserve(buffer_t * buffer, uint32_t size)
+{
+    if (buffer->capacity - buffer->size >= size)
+    {
+        return 1;
+    }
+
+    const uint32_t capacity = buffer->size + size + buffer->capacity;
+    uint8_t * data = (uint8_t *) realloc(buffer->data, capacity);
+    if (NULL == data)
+    {
+        return 0;
+    }
+    buffer->data = data;
+    buffer->capacity = capacity;
+    return 1;
+}
+
+static void append(buffer_t * buffer, const void * data, uint32_t size)
+{
+    memcpy(buffer->data + buffer->size, data, size);
+    buffer->size += size;
+}
+
+static int append_request(worker_t * worker, buffer_t * buffer, const op_t * op)
+{
+    char key[MAX_KEY_SIZE];
+    const uint32_t key_size = make_key(op->key, key);
+    const uint32_t value_size = (KVM_REQUST_PUT == op->id) ? random_size(&worker->rng, &options.value_size) : 0;
+    const uint32_t fields_size = (KVM_REQUST_PUT == op->id) ? sizeof(kvm_request_put_t) : sizeof(kvm_request_get_t);
+    const uint32_t request_size = sizeof(kvm_request_generic_t) + fields_size + key_size + value_size;
+
+    if (!reserve(buffer, sizeof(uint32_t) + request_size))
+    {
+        return 0;
+    }
+
+    const uint32_t frame_size = kvm_util_host_to_transport32(request_size);
+    append(buffer, &frame_size, sizeof(frame_size));
+    append(buffer, &op->id, sizeof(op->id));
+
+    if (KVM_REQUST_PUT == op->id)
+    {
+        kvm_request_put_t put;
+        put.key_size = kvm_util_host_to_transport32(key_size);
+        put.value_size = kvm_util_host_to_transport32(value_size);
+        append(buffer, &put, sizeof(put));
+        append(buffer, key, key_size);
+        append(buffer, value_data, value_size);
+    }
+    else
+    {
+        kvm_request_get_t get;
+        get.key_size = kvm_util_host_to_transport32(key_size);
+        append(buffer, &get, sizeof(get));
+        append(buffer, key, key_size);
+    }
+
+    return 1;
+}
+
+static int send_all(int s, const uint8_t * data, uint32_t size)
+{
+    while (0 != size)
+    {
+        const ssize_t written = send(s, data, size, MSG_NOSIGNAL);
+        if (written <= 0)
+        {
+            if (-1 == written && EINTR == errno)
+            {
+                continue;
+            }
+            return 0;
+        }
+        data += written;
+        size -= written;
+    }
+    return 1;
+}
+
+static int recv_all(int s, uint8_t * data, uint32_t size)
+{
+    while (0 != size)
+    {
+        const ssize_t read_len = recv(s, data, size, MSG_WAITALL);
+        if (read_len <= 0)
+        {
+            if (-1 == read_len && EINTR == errno)
+            {
+                continue;
+            }
+            return 0;
+        }
+        data += read_len;
+        size -= read_len;
+    }
+    return 1;
+}
+
+/* Reads a reply and returns its status, -1 if the connection failed. */
+static int read_reply(worker_t * worker, int s)
+{
+    uint32_t size;
+    if (!recv_all(s, (uint8_t *) &size, sizeof(size)))
+    {
+        return -1;
+    }
+
+    size = kvm_util_transport_to_host32(size);
+    if (0 == size || size > MAX_VALUE_SIZE + 64)
+    {
+        return -1;
+    }
+
+    worker->reply.size = 0;
+    if (!reserve(&worker->reply, size) || !recv_all(s, worker->reply.data, size))
+    {
+        return -1;
+    }
+
+    return ((const kvm_reply_generic_t *) worker->reply.data)->status;
+}
+
+static void record(worker_t * worker, const op_t * op, int status, uint64_t done)
+{
+    if (op->scheduled < measure_ns)
+    {
+        return;
+    }
+
+    if (KVM_REQUST_GET == op->id)
+    {
+        worker->gets++;
+        if (KVM_REPLY_BAD_REQUEST == status)
+        {
+            /* Reply to GET of a missing key */
+            worker->misses++;
+        }
+        else if (KVM_REPLY_STATUS_OK != status)
+        {
+            worker->errors++;
+        }
+    }
+    else
+    {
+        worker->puts++;
+        if (KVM_REPLY_STATUS_OK != status)
+        {
+            worker->errors++;
+        }
+    }
+
+    const uint64_t latency = done - op->scheduled;
+    const uint64_t service = done - op->sent;
+
+    worker->latency[kvm_histogram_index(latency)]++;
+    worker->service[kvm_histogram_index(service)]++;
+    worker->latency_sum += latency;
+    worker->service_sum += service;
+    if (latency > worker->latency_max)
+    {
+        worker->latency_max = latency;
+    }
+    if (service > worker->service_max)
+    {
+        worker->service_max = service;
+    }
+}
+
+/* Sends the requests spread over the connections and reads the replies.
+   Returns 0 if a connection failed. */
+static int run_batch(worker_t * worker, op_t * ops, uint32_t count)
+{
+    const uint32_t connections = (count < worker->connection_count) ? count : worker->connection_count;
+
+    for (uint32_t c = 0; c < connections; ++c)
+    {
+        buffer_t * buffer = &worker->requests[c];
+        buffer->size = 0;
+        for (uint32_t i = c; i < count; i += worker->connection_count)
+        {
+            if (!append_request(worker, buffer, &ops[i]))
+            {
+                fprintf(stderr, "Failed to allocate request\n");
+                return 0;
+            }
+        }
+
+        const uint64_t sent = now_ns();
+        for (uint32_t i = c; i < count; i += worker->connection_count)
+        {
+            ops[i].sent = sent;
+        }
+
+        if (!send_all(worker->sockets[c], buffer->data, buffer->size))
+        {
+            fprintf(stderr, "Failed to send requests: %s\n", strerror(errno));
+            return 0;
+        }
+    }
+
+    for (uint32_t c = 0; c < connections; ++c)
+    {
+        for (uint32_t i = c; i < count; i += worker->connection_count)
+        {
+            const int status = read_reply(worker, worker->sockets[c]);
+            if (-1 == status)
+            {
+                fprintf(stderr, "Failed to receive reply\n");
+                return 0;
+            }
+            record(worker, &ops[i], status, now_ns());
+        }
+    }
+
+    return 1;
+}
+
+static int preload(worker_t * worker)
+{
+    const uint32_t batch_size = worker->connection_count * options.pipeline;
+    uint32_t count = 0;
+
+    for (uint64_t key = worker->index; key < options.keyspace; key += options.threads)
+    {
+        op_t * op = &worker->ops[count++];
+        op->id = KVM_REQUST_PUT;
+        op->key = key;
+        op->scheduled = 0;
+
+        if (count == batch_size && !run_batch(worker, worker->ops, count))
+        {
+            return 0;
+        }
+        count %= batch_size;
+    }
+
+    return 0 == count || run_batch(worker, worker->ops, count);
+}
+
+static void * run_worker(void * arg)
+{
+    worker_t * worker = (worker_t *) arg;
+    const uint32_t batch_size = worker->connection_count * options.pipeline;
+
+    /* Threads are spread over the interval to avoid sending in bursts. */
+    const double interval = (0 != options.rate) ? options.threads * 1e9 / options.rate : 0;
+    double next = start_ns + interval * worker->index / options.threads;
+
+    uint64_t now = now_ns();
+    while (now < end_ns)
+    {
+        uint32_t count = 0;
+
+        if (0 == options.rate)
+        {
+            for (; count < batch_size; ++count)
+            {
+                worker->ops[count].scheduled = now;
+            }
+        }
+        else
+        {
+            if (now < (uint64_t) next)
+            {
+                wait_until((uint64_t) next);
+                now = now_ns();
+            }
+
+            /* Everything due is sent at once, requests which could not be
+               sent in time keep their schedule. */
+            for (; count < batch_size && (uint64_t) next <= now; ++count)
+            {
+                worker->ops[count].scheduled = (uint64_t) next;
+                next += interval;
+            }
+        }
+
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            op_t * op = &worker->ops[i];
+            op->id = (random_unit(&worker->rng) < options.read_ratio) ? KVM_REQUST_GET : KVM_REQUST_PUT;
+            op->key = next_key(worker);
+        }
+
+        if (!run_batch(worker, worker->ops, count))
+        {
+            worker->errors++;
+            break;
+        }
+
+        now = now_ns();
+    }
+
+    return NULL;
+}
+
+static void * run_preload(void * arg)
+{
+    worker_t * worker = (worker_t *) arg;
+    if (!preload(worker))
+    {
+        worker->errors++;
+    }
+    return NULL;
+}
+
+static int connect_unix(void)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, options.unix_path);
+
+    const int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 != s && -1 == connect(s, (struct sockaddr *) &addr, sizeof(addr)))
+    {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+static int connect_server(void)
+{
+    if (NULL != options.unix_path)
+    {
+        return connect_unix();
+    }
+
+    const int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (-1 == s)
+    {
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(options.port);
+
+    if (1 != inet_pton(AF_INET, options.ip, &addr.sin_addr) ||
+        -1 == connect(s, (struct sockaddr *) &addr, sizeof(addr)))
+    {
+        close(s);
+        return -1;
+    }
+
+    const int no_delay = 1;
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+    return s;
+}
+
+static int init_worker(worker_t * worker, uint32_t index)
+{
+    memset(worker, 0, sizeof(*worker));
+    worker->index = index;
+    worker->rng = ((uint64_t) getpid() << 32) ^ now_ns() ^ ((uint64_t) index << 48);
+
+    /* Connections are spread over threads as evenly as possible. */
+    worker->connection_count = options.connections / options.threads +
+        ((index < options.connections % options.threads) ? 1 : 0);
+
+    worker->sockets = (int *) malloc(worker->connection_count * sizeof(int));
+    worker->requests = (buffer_t *) calloc(worker->connection_count, sizeof(buffer_t));
+    worker->ops = (op_t *) calloc((size_t) worker->connection_count * options.pipeline, sizeof(op_t));
+    if (NULL == worker->sockets || NULL == worker->requests || NULL == worker->ops)
+    {
+        worker->connection_count = 0;
+        return 0;
+    }
+
+    for (uint32_t c = 0; c < worker->connection_count; ++c)
+    {
+        worker->sockets[c] = connect_server();
+        if (-1 == worker->sockets[c])
+        {
+            if (NULL != options.unix_path)
+            {
+                fprintf(stderr, "Failed to connect to %s: %s\n", options.unix_path, strerror(errno));
+            }
+            else
+            {
+                fprintf(stderr, "Failed to connect to %s:%u: %s\n", options.ip, options.port, strerror(errno));
+            }
+            worker->connection_count = c;
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static void uninit_worker(worker_t * worker)
+{
+    for (uint32_t c = 0; c < worker->connection_count; ++c)
+    {
+        close(worker->sockets[c]);
+        free(worker->requests[c].data);
+    }
+    free(worker->sockets);
+    free(worker->requests);
+    free(worker->ops);
+    free(worker->reply.data);
+}
+
+static int run_threads(worker_t * workers, void * (* routine)(void *))
+{
+    uint32_t started = 0;
+    for (; started < options.threads; ++started)
+    {
+        if (0 != pthread_create(&workers[started].thread, NULL, routine, &workers[started]))
+        {
+            fprintf(stderr, "Failed to start thread\n");
+            break;
+        }
+    }
+
+    int failed = (started != options.threads);
+    for (uint32_t i = 0; i < started; ++i)
+    {
+        pthread_join(workers[i].thread, NULL);
+        failed |= (0 != workers[i].errors);
+    }
+
+    return !failed;
+}
+
+static void print_latency(const char * name, const uint64_t * histogram, uint64_t sum, uint64_t max)
+{
+    const uint64_t count = kvm_histogram_count(histogram);
+
+    if (options.json)
+    {
+        printf(",\"%s_ns\":{\"mean\":%.0f,\"p50\":%llu,\"p99\":%llu,\"p99.9\":%llu,\"max\":%llu}",
+            name,
+            (0 != count) ? (double) sum / count : 0.0,
+            (unsigned long long) kvm_histogram_percentile(histogram, 50),
+            (unsigned long long) kvm_histogram_percentile(histogram, 99),
+            (unsigned long long) kvm_histogram_percentile(histogram, 99.9),
+            (unsigned long long) max);
+        return;
+    }
+
+    printf("%-12s mean %9.1f us  p50 %9.1f us  p99 %9.1f us  p99.9 %9.1f us  max %9.1f us\n",
+        name,
+        (0 != count) ? (double) sum / count / 1e3 : 0.0,
+        kvm_histogram_percentile(histogram, 50) / 1e3,
+        kvm_histogram_percentile(histogram, 99) / 1e3,
+        kvm_histogram_percentile(histogram, 99.9) / 1e3,
+        max / 1e3);
+}
+
+static void print_report(const worker_t * workers, double elapsed)
+{
+    static uint64_t latency[KVM_HISTOGRAM_BUCKETS];
+    static uint64_t service[KVM_HISTOGRAM_BUCKETS];
+    uint64_t gets = 0, puts = 0, misses = 0, errors = 0;
+    uint64_t latency_sum = 0, latency_max = 0, service_sum = 0, service_max = 0;
+
+    for (uint32_t t = 0; t < options.threads; ++t)
+    {
+        const worker_t * w = &workers[t];
+        gets += w->gets;
+        puts += w->puts;
+        misses += w->misses;
+        errors += w->errors;
+        latency_sum += w->latency_sum;
+        service_sum += w->service_sum;
+        latency_max = (w->latency_max > latency_max) ? w->latency_max : latency_max;
+        service_max = (w->service_max > service_max) ? w->service_max : service_max;
+
+        for (uint32_t b = 0; b < KVM_HISTOGRAM_BUCKETS; ++b)
+        {
+            latency[b] += w->latency[b];
+            service[b] += w->service[b];
+        }
+    }
+
+    const uint64_t requests = gets + puts;
+    const double throughput = requests / elapsed;
+
+    if (options.json)
+    {
+        printf("{\"threads\":%u,\"connections\":%u,\"pipeline\":%u,\"rate\":%.0f,\"duration_s\":%.3f,"
+               "\"keyspace\":%llu,\"read_ratio\":%g,\"zipf_theta\":%g,"
+               "\"requests\":%llu,\"gets\":%llu,\"puts\":%llu,\"misses\":%llu,\"errors\":%llu,"
+               "\"throughput\":%.1f",
+            options.threads, options.connections, options.pipeline, options.rate, elapsed,
+            (unsigned long long) options.keyspace, options.read_ratio, options.zipf_theta,
+            (unsigned long long) requests, (unsigned long long) gets, (unsigned long long) puts,
+            (unsigned long long) misses, (unsigned long long) errors, throughput);
+        print_latency("latency", latency, latency_sum, latency_max);
+        print_latency("service", service, service_sum, service_max);
+        printf("}\n");
+        return;
+    }
+
+    printf("%u threads, %u connections, pipeline %u, ", options.threads, options.connections, options.pipeline);
+    if (0 != options.rate)
+    {
+        printf("open loop at %.0f req/s\n", options.rate);
+    }
+    else
+    {
+        printf("closed loop\n");
+    }
+    printf("%-12s %llu in %.3f s (%llu GET, %llu PUT)\n", "requests",
+        (unsigned long long) requests, elapsed, (unsigned long long) gets, (unsigned long long) puts);
+    printf("%-12s %.1f req/s\n", "throughput", throughput);
+    printf("%-12s %llu\n", "misses", (unsigned long long) misses);
+    printf("%-12s %llu\n", "errors", (unsigned long long) errors);
+    print_latency("latency", latency, latency_sum, latency_max);
+    if (0 != options.rate)
+    {
+        print_latency("service", service, service_sum, service_max);
+    }
+}
+
+static int parse_range(const char * text, size_range_t * range, uint32_t limit)
+{
+    char * end;
+    const unsigned long min = strtoul(text, &end, 10);
+    unsigned long max = min;
+
+    if ('-' == *end)
+    {
+        max = strtoul(end + 1, &end, 10);
+    }
+
+    if ('\0' != *end || end == text || 0 == min || min > max || max > limit)
+    {
+        return 0;
+    }
+
+    range->min = (uint32_t) min;
+    range->max = (uint32_t) max;
+    return 1;
+}
+
+static void print_usage(const char * name)
+{
+    printf("Usage: %s [options] <IP>:<PORT> | unix:<PATH>\n"
+           "  -t, --threads N          Threads (%u)\n"
+           "  -c, --connections N      Connections for all threads, at least one per thread (%u)\n"
+           "  -P, --pipeline N         Outstanding requests per connection (%u)\n"
+           "  -d, --duration SEC       Measured time (%.0f)\n"
+           "  -w, --warmup SEC         Time before measuring (%.0f)\n"
+           "  -n, --keys N             Key space size (%llu)\n"
+           "  -k, --key-size N[-M]     Key size or range (%u)\n"
+           "  -v, --value-size N[-M]   Value size or range (%u)\n"
+           "  -r, --read-ratio R       Share of GET requests, the rest are PUT (%.2f)\n"
+           "  -z, --zipf THETA         Zipfian key distribution, 0 < THETA < 1, uniform by default\n"
+           "  -R, --rate N             Open loop requests per second for all threads, closed loop by default\n"
+           "  -l, --preload            PUT every key before the run\n"
+           "  -j, --json               Print the report as JSON\n",
+        name, options.threads, options.connections, options.pipeline, options.duration, options.warmup,
+        (unsigned long long) options.keyspace, options.key_size.min, options.value_size.min, options.read_ratio);
+}
+
+static int parse_options(int argc, char * argv[])
+{
+    static const struct option long_options[] =
+    {
+        {"threads",     required_argument,  NULL, 't'},
+        {"connections", required_argument,  NULL, 'c'},
+        {"pipeline",    required_argument,  NULL, 'P'},
+        {"duration",    required_argument,  NULL, 'd'},
+        {"warmup",      required_argument,  NULL, 'w'},
+        {"keys",        required_argument,  NULL, 'n'},
+        {"key-size",    required_argument,  NULL, 'k'},
+        {"value-size",  required_argument,  NULL, 'v'},
+        {"read-ratio",  required_argument,  NULL, 'r'},
+        {"zipf",        required_argument,  NULL, 'z'},
+        {"rate",        required_argument,  NULL, 'R'},
+        {"preload",     no_argument,        NULL, 'l'},
+        {"json",        no_argument,        NULL, 'j'},
+        {"help",        no_argument,        NULL, 'h'},
+        {NULL,          0,                  NULL, 0}
+    };
+
+    int c;
+    while (-1 != (c = getopt_long(argc, argv, "t:c:P:d:w:n:k:v:r:z:R:ljh", long_options, NULL)))
+    {
+        switch (c)
+        {
+            case 't': options.threads = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'c': options.connections = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'P': options.pipeline = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'd': options.duration = strtod(optarg, NULL); break;
+            case 'w': options.warmup = strtod(optarg, NULL); break;
+            case 'n': options.keyspace = strtoull(optarg, NULL, 10); break;
+            case 'r': options.read_ratio = strtod(optarg, NULL); break;
+            case 'z': options.zipf_theta = strtod(optarg, NULL); break;
+            case 'R': options.rate = strtod(optarg, NULL); break;
+            case 'l': options.preload = 1; break;
+            case 'j': options.json = 1; break;
+            case 'k':
+                if (!parse_range(optarg, &options.key_size, MAX_KEY_SIZE))
+                {
+                    fprintf(stderr, "Invalid key size: %s\n", optarg);
+                    return 0;
+                }
+                break;
+            case 'v':
+                if (!parse_range(optarg, &options.value_size, MAX_VALUE_SIZE))
+                {
+                    fprintf(stderr, "Invalid value size: %s\n", optarg);
+                    return 0;
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                return 0;
+        }
+    }
+
+    if (optind + 1 != argc)
+    {
+        print_usage(argv[0]);
+        return 0;
+    }
+
+    const size_t prefix_size = sizeof(KVM_UNIX_ADDRESS_PREFIX) - 1;
+    static char ip[64];
+    const char * colon = strrchr(argv[optind], ':');
+    if (0 == strncmp(argv[optind], KVM_UNIX_ADDRESS_PREFIX, prefix_size))
+    {
+        options.unix_path = argv[optind] + prefix_size;
+        if ('\0' == options.unix_path[0] || strlen(options.unix_path) >= sizeof(((struct sockaddr_un *) 0)->sun_path))
+        {
+            fprintf(stderr, "Invalid Unix domain socket path: %s\n", options.unix_path);
+            return 0;
+        }
+    }
+    else if (NULL == colon || (size_t) (colon - argv[optind]) >= sizeof(ip))
+    {
+        fprintf(stderr, "Please specify server IP and port in <IP>:<PORT> format, or unix:<PATH>\n");
+        return 0;
+    }
+    else
+    {
+        memcpy(ip, argv[optind], colon - argv[optind]);
+        ip[colon - argv[optind]] = '\0';
+        options.ip = ip;
+        options.port = (uint16_t) strtoul(colon + 1, NULL, 10);
+    }
+
+    if (0 == options.connections)
+    {
+        options.connections = options.threads;
+    }
+
+    char digits[32];
+    const uint32_t digit_count = (uint32_t) snprintf(digits, sizeof(digits), "%llu",
+        (unsigned long long) (options.keyspace - 1));
+
+    if (0 == options.threads || options.connections < options.threads || 0 == options.pipeline ||
+        options.duration <= 0 || options.warmup < 0 || 0 == options.keyspace ||
+        options.read_ratio < 0 || options.read_ratio > 1 ||
+        options.zipf_theta < 0 || options.zipf_theta >= 1 || options.rate < 0)
+    {
+        fprintf(stderr, "Invalid options, see --help\n");
+        return 0;
+    }
+
+    if (options.key_size.min < digit_count)
+    {
+        fprintf(stderr, "Key size must be at least %u to fit %llu keys\n",
+            digit_count, (unsigned long long) options.keyspace);
+        return 0;
+    }
+
+    return 1;
+}
+
+int main(int argc, char * argv[])
+{
+    if (!parse_options(argc, argv))
+    {
+        return 1;
+    }
+
+    if (0 != options.zipf_theta)
+    {
+        zipf_init(&zipf, options.keyspace, options.zipf_theta);
+    }
+
+    value_data = (uint8_t *) malloc(options.value_size.max);
+    worker_t * workers = (worker_t *) calloc(options.threads, sizeof(worker_t));
+    if (NULL == value_data || NULL == workers)
+    {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    uint64_t state = 0;
+    for (uint32_t i = 0; i < options.value_size.max; ++i)
+    {
+        value_data[i] = (uint8_t) splitmix64(&state);
+    }
+
+    int result = 0;
+    uint32_t initialized = 0;
+    for (; initialized < options.threads; ++initialized)
+    {
+        if (!init_worker(&workers[initialized], initialized))
+        {
+            initialized++;
+            result = 1;
+            break;
+        }
+    }
+
+    if (0 == result && options.preload && !run_threads(workers, run_preload))
+    {
+        fprintf(stderr, "Preload failed\n");
+        result = 1;
+    }
+
+    if (0 == result)
+    {
+        start_ns = now_ns();
+        measure_ns = start_ns + (uint64_t) (options.warmup * 1e9);
+        end_ns = measure_ns + (uint64_t) (options.duration * 1e9);
+
+        if (!run_threads(workers, run_worker))
+        {
+            result = 1;
+        }
+
+        print_report(workers, (now_ns() - measure_ns) / 1e9);
+    }
+
+    for (uint32_t t = 0; t < initialized; ++t)
+    {
+        uninit_worker(&workers[t]);
+    }
+    free(workers);
+    free(value_data);
+    return result;
+}
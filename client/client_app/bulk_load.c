@@ -0,0 +1,382 @@
+/**
+* @file bulk_load.c
+*
+* @brief The module contains bulk loading implementation.
+*
+* The main thread parses the input into batches and queues them, a thread
+* per connection sends them. The client library waits for every reply, so
+* a connection has one BATCH request in flight; up to KVM_BATCH_MAX_OPS
+* pairs in each make up for the round trip. Batches cycle between a free
+* stack and a ready queue, both no longer than the window.
+*
+*/
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kvm_client.h"
+#include "bulk_load.h"
+#include "bulk_reader.h"
+
+typedef struct batch_slot_s
+{
+    kvm_batch_handle_t  h_batch;
+    uint32_t            count;
+    uint64_t            bytes;      /* Key and value data */
+} batch_slot_t;
+
+typedef struct loader_s
+{
+    pthread_mutex_t     lock;
+    pthread_cond_t      ready_cond;     /* Signalled when a batch is queued or the input ends */
+    pthread_cond_t      free_cond;      /* Signalled when a batch is sent */
+
+    batch_slot_t *      slots;
+    batch_slot_t **     free;           /* Stack */
+    uint32_t            free_count;
+    batch_slot_t **     ready;          /* Ring */
+    uint32_t            ready_head;
+    uint32_t            ready_count;
+    uint32_t            window;
+    int                 done;
+
+    uint64_t            loaded;
+    uint64_t            failed;
+    uint64_t            bytes;
+    kvm_result_t        error;          /* First failed batch */
+} loader_t;
+
+typedef struct worker_s
+{
+    loader_t *          loader;
+    kvm_client_handle_t h_client;
+    pthread_t           thread;
+} worker_t;
+
+static double now_s(void);
+static batch_slot_t * take_free(loader_t * loader);
+static void queue_ready(loader_t * loader, batch_slot_t * slot);
+static void * run_worker(void * arg);
+static int init_loader(loader_t * loader, uint32_t window);
+static void uninit_loader(loader_t * loader);
+static void print_progress(loader_t * loader, double elapsed, const char * prefix);
+
+int bulk_load(const char * server_ip, uint32_t server_port, const bulk_load_options_t * options)
+{
+    FILE * file = (0 == strcmp(options->path, "-")) ? stdin : fopen(options->path, "rb");
+    if (NULL == file)
+    {
+        printf("Can not open %s\n", options->path);
+        return 1;
+    }
+
+    loader_t loader;
+    worker_t * workers = (worker_t *) calloc(options->connections, sizeof(worker_t));
+    if (NULL == workers || !init_loader(&loader, options->window))
+    {
+        printf("Memory allocation failed\n");
+        free(workers);
+        if (stdin != file)
+        {
+            fclose(file);
+        }
+        return 1;
+    }
+
+    int failed = 0;
+    bulk_reader_t reader;
+    if (!bulk_reader_init(&reader, file, options->format))
+    {
+        printf("%s is not in the binary bulk format\n", options->path);
+        failed = 1;
+    }
+
+    /* Connect all first, so a wrong address fails before reading. */
+    for (uint32_t i = 0; i < options->connections && !failed; ++i)
+    {
+        workers[i].loader = &loader;
+        const kvm_result_t result = kvm_client_open(&workers[i].h_client, server_ip, server_port);
+        if (KVM_RESULT_OK != result)
+        {
+            printf("kvm_client_open failed: error %d\n", result);
+            failed = 1;
+        }
+    }
+
+    uint32_t started = 0;
+    for (; started < options->connections && !failed; ++started)
+    {
+        if (0 != pthread_create(&workers[started].thread, NULL, run_worker, &workers[started]))
+        {
+            printf("Thread creation failed\n");
+            failed = 1;
+            break;
+        }
+    }
+
+    const double start = now_s();
+    double reported = start;
+    uint64_t skipped = 0;
+
+    batch_slot_t * slot = NULL;
+    bulk_read_status_t status = failed ? BULK_READ_END : BULK_READ_RECORD;
+    while (BULK_READ_RECORD == status || BULK_READ_INVALID == status)
+    {
+        kvm_const_dlob_data_t key;
+        kvm_const_dlob_data_t value;
+        uint32_t ttl;
+        status = bulk_reader_read(&reader, &key, &value, &ttl);
+
+        if (BULK_READ_RECORD == status)
+        {
+            if (NULL == slot)
+            {
+                slot = take_free(&loader);
+            }
+
+            kvm_result_t result = kvm_client_batch_put(slot->h_batch, &key, &value, ttl);
+            if (KVM_RESULT_INVALID_PARAM == result && 0 != slot->count)
+            {
+                /* The batch is full to the frame limit, the pair starts the next one. */
+                queue_ready(&loader, slot);
+                slot = take_free(&loader);
+                result = kvm_client_batch_put(slot->h_batch, &key, &value, ttl);
+            }
+
+            if (KVM_RESULT_OK == result)
+            {
+                slot->count++;
+                slot->bytes += (uint64_t) key.size + value.size;
+            }
+            else
+            {
+                printf("record %llu: can not be sent, error %d\n", (unsigned long long) reader.record, result);
+                status = BULK_READ_INVALID;
+            }
+        }
+
+        if (BULK_READ_INVALID == status)
+        {
+            skipped++;
+        }
+        else if (BULK_READ_ERROR == status)
+        {
+            failed = 1;
+        }
+
+        const int last = (BULK_READ_END == status || BULK_READ_ERROR == status);
+        if (NULL != slot && 0 != slot->count &&
+            (last || slot->count >= options->batch_ops || slot->bytes >= options->batch_bytes))
+        {
+            queue_ready(&loader, slot);
+            slot = NULL;
+        }
+
+        const double now = now_s();
+        if (now - reported >= 1.0)
+        {
+            reported = now;
+            print_progress(&loader, now - start, "");
+        }
+    }
+
+    pthread_mutex_lock(&loader.lock);
+    if (NULL != slot)
+    {
+        /* Every pair was skipped, the batch is empty. */
+        loader.free[loader.free_count++] = slot;
+    }
+    loader.done = 1;
+    pthread_cond_broadcast(&loader.ready_cond);
+    pthread_mutex_unlock(&loader.lock);
+
+    for (uint32_t i = 0; i < started; ++i)
+    {
+        pthread_join(workers[i].thread, NULL);
+    }
+
+    for (uint32_t i = 0; i < options->connections; ++i)
+    {
+        if (NULL != workers[i].h_client)
+        {
+            kvm_client_close(workers[i].h_client);
+        }
+    }
+
+    if (0 != started)
+    {
+        print_progress(&loader, now_s() - start, "Done: ");
+    }
+    if (0 != skipped)
+    {
+        printf("%llu records skipped\n", (unsigned long long) skipped);
+    }
+
+    failed = failed || 0 != skipped || 0 != loader.failed;
+
+    uninit_loader(&loader);
+    free(workers);
+    bulk_reader_uninit(&reader);
+    if (stdin != file)
+    {
+        fclose(file);
+    }
+
+    return failed;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+static batch_slot_t * take_free(loader_t * loader)
+{
+    pthread_mutex_lock(&loader->lock);
+    while (0 == loader->free_count)
+    {
+        pthread_cond_wait(&loader->free_cond, &loader->lock);
+    }
+    batch_slot_t * slot = loader->free[--loader->free_count];
+    pthread_mutex_unlock(&loader->lock);
+
+    return slot;
+}
+
+static void queue_ready(loader_t * loader, batch_slot_t * slot)
+{
+    pthread_mutex_lock(&loader->lock);
+    loader->ready[(loader->ready_head + loader->ready_count) % loader->window] = slot;
+    loader->ready_count++;
+    pthread_cond_signal(&loader->ready_cond);
+    pthread_mutex_unlock(&loader->lock);
+}
+
+static void * run_worker(void * arg)
+{
+    worker_t * worker = (worker_t *) arg;
+    loader_t * loader = worker->loader;
+
+    pthread_mutex_lock(&loader->lock);
+    for (;;)
+    {
+        while (0 == loader->ready_count && !loader->done)
+        {
+            pthread_cond_wait(&loader->ready_cond, &loader->lock);
+        }
+        if (0 == loader->ready_count)
+        {
+            break;
+        }
+
+        batch_slot_t * slot = loader->ready[loader->ready_head];
+        loader->ready_head = (loader->ready_head + 1) % loader->window;
+        loader->ready_count--;
+        pthread_mutex_unlock(&loader->lock);
+
+        const kvm_result_t result = kvm_client_batch_exec(worker->h_client, slot->h_batch, NULL, NULL);
+
+        pthread_mutex_lock(&loader->lock);
+        if (KVM_RESULT_OK == result)
+        {
+            loader->loaded += slot->count;
+            loader->bytes += slot->bytes;
+        }
+        else
+        {
+            loader->failed += slot->count;
+            if (KVM_RESULT_OK == loader->error)
+            {
+                loader->error = result;
+            }
+        }
+
+        kvm_client_batch_reset(slot->h_batch);
+        slot->count = 0;
+        slot->bytes = 0;
+        loader->free[loader->free_count++] = slot;
+        pthread_cond_signal(&loader->free_cond);
+    }
+    pthread_mutex_unlock(&loader->lock);
+
+    return NULL;
+}
+
+static int init_loader(loader_t * loader, uint32_t window)
+{
+    memset(loader, 0, sizeof(*loader));
+    pthread_mutex_init(&loader->lock, NULL);
+    pthread_cond_init(&loader->ready_cond, NULL);
+    pthread_cond_init(&loader->free_cond, NULL);
+
+    loader->window = window;
+    loader->slots = (batch_slot_t *) calloc(window, sizeof(batch_slot_t));
+    loader->free = (batch_slot_t **) calloc(window, sizeof(batch_slot_t *));
+    loader->ready = (batch_slot_t **) calloc(window, sizeof(batch_slot_t *));
+    if (NULL == loader->slots || NULL == loader->free || NULL == loader->ready)
+    {
+        uninit_loader(loader);
+        return 0;
+    }
+
+    for (uint32_t i = 0; i < window; ++i)
+    {
+        if (KVM_RESULT_OK != kvm_client_batch_create(&loader->slots[i].h_batch))
+        {
+            uninit_loader(loader);
+            return 0;
+        }
+        loader->free[loader->free_count++] = &loader->slots[i];
+    }
+
+    return 1;
+}
+
+static void uninit_loader(loader_t * loader)
+{
+    if (NULL != loader->slots)
+    {
+        for (uint32_t i = 0; i < loader->window; ++i)
+        {
+            kvm_client_batch_destroy(loader->slots[i].h_batch);
+        }
+    }
+
+    free(loader->slots);
+    free(loader->free);
+    free(loader->ready);
+
+    pthread_mutex_destroy(&loader->lock);
+    pthread_cond_destroy(&loader->ready_cond);
+    pthread_cond_destroy(&loader->free_cond);
+}
+
+static void print_progress(loader_t * loader, double elapsed, const char * prefix)
+{
+    pthread_mutex_lock(&loader->lock);
+    const uint64_t loaded = loader->loaded;
+    const uint64_t failed = loader->failed;
+    const uint64_t bytes = loader->bytes;
+    const kvm_result_t error = loader->error;
+    pthread_mutex_unlock(&loader->lock);
+
+    const double seconds = (elapsed > 0) ? elapsed : 1e-9;
+    printf("%s%llu pairs loaded in %.1f s, %.0f pairs/s, %.1f MiB/s",
+        prefix,
+        (unsigned long long) loaded,
+        elapsed,
+        (double) loaded / seconds,
+        (double) bytes / seconds / (1024 * 1024));
+
+    if (0 != failed)
+    {
+        printf(", %llu failed (error %d)", (unsigned long long) failed, error);
+    }
+    printf("\n");
+    fflush(stdout);
+}
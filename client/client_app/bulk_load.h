@@ -0,0 +1,67 @@
+/**
+ * @file bulk_load.h
+ *
+ * @brief Defines non-interactive loading of key/value pairs.
+ *
+ * Pairs are read from a file or stdin and stored with BATCH requests over
+ * several connections at once. At most <window> batches are filled or in
+ * flight, so memory stays bounded whatever the size of the input.
+ *
+ */
+
+#ifndef __bulk_load_h__
+#define __bulk_load_h__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* Binary format: the magic, then records of a bulk_record_t header with
+   little endian fields followed by the key and the value. */
+#define BULK_BINARY_MAGIC       "KVMBULK1"
+#define BULK_BINARY_MAGIC_SIZE  8
+
+typedef struct bulk_record_s
+{
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t ttl;               /* Time to live in milliseconds or KVM_TTL_PERSIST */
+} bulk_record_t;
+
+typedef enum bulk_format_e
+{
+    BULK_FORMAT_TEXT,           /* <key>=<value> lines, split at the first '=' */
+    BULK_FORMAT_BINARY
+} bulk_format_t;
+
+typedef struct bulk_load_options_s
+{
+    const char *    path;           /* "-" for stdin */
+    bulk_format_t   format;
+    uint32_t        connections;
+    uint32_t        batch_ops;      /* Pairs per BATCH request, up to KVM_BATCH_MAX_OPS */
+    uint32_t        batch_bytes;    /* A batch is sent once its pairs reach this size */
+    uint32_t        window;         /* Batches filled or in flight over all connections */
+} bulk_load_options_t;
+
+/*!
+*******************************************************************************
+** Loads all pairs of the input, printing the progress every second.
+**
+** @param[in]   server_ip   Server address as kvm_client_open() takes it.
+** @param[in]   server_port Server port.
+** @param[in]   options     Input and sending options.
+**
+** @return
+**      - 0 if every pair was stored, 1 otherwise.
+*/
+int bulk_load(const char * server_ip, uint32_t server_port, const bulk_load_options_t * options);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __bulk_load_h__ */
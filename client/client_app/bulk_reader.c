@@ -0,0 +1,146 @@
+/**
+* @file bulk_reader.c
+*
+* @brief The module contains reading of the bulk load formats.
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "kvm_protocol.h"
+#include "kvm_requests.h"
+#include "kvm_utils.h"
+#include "bulk_reader.h"
+
+static bulk_read_status_t read_text(bulk_reader_t * reader, kvm_const_dlob_data_t * key, kvm_const_dlob_data_t * value);
+static bulk_read_status_t read_binary(bulk_reader_t * reader, kvm_const_dlob_data_t * key, kvm_const_dlob_data_t * value, uint32_t * ttl);
+
+int bulk_reader_init(bulk_reader_t * reader, FILE * file, bulk_format_t format)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->file = file;
+    reader->format = format;
+
+    if (BULK_FORMAT_BINARY == format)
+    {
+        char magic[BULK_BINARY_MAGIC_SIZE];
+        if (1 != fread(magic, sizeof(magic), 1, file) || 0 != memcmp(magic, BULK_BINARY_MAGIC, sizeof(magic)))
+        {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void bulk_reader_uninit(bulk_reader_t * reader)
+{
+    free(reader->buffer);
+    reader->buffer = NULL;
+    reader->capacity = 0;
+}
+
+bulk_read_status_t bulk_reader_read(bulk_reader_t * reader, kvm_const_dlob_data_t * key, kvm_const_dlob_data_t * value, uint32_t * ttl)
+{
+    if (BULK_FORMAT_TEXT == reader->format)
+    {
+        *ttl = KVM_TTL_PERSIST;
+        return read_text(reader, key, value);
+    }
+
+    return read_binary(reader, key, value, ttl);
+}
+
+static bulk_read_status_t read_text(bulk_reader_t * reader, kvm_const_dlob_data_t * key, kvm_const_dlob_data_t * value)
+{
+    char * line;
+    size_t size = 0;
+    while (0 == size)
+    {
+        line = (char *) reader->buffer;
+        const ssize_t length = getline(&line, &reader->capacity, reader->file);
+        reader->buffer = (uint8_t *) line;
+        if (length < 0)
+        {
+            return ferror(reader->file) ? BULK_READ_ERROR : BULK_READ_END;
+        }
+
+        /* Blank lines are skipped silently. */
+        size = (size_t) length;
+        while (0 != size && ('\n' == line[size - 1] || '\r' == line[size - 1]))
+        {
+            size--;
+        }
+    }
+    reader->record++;
+
+    const char * delimiter = (const char *) memchr(line, '=', size);
+    if (NULL == delimiter || delimiter == line)
+    {
+        printf("line %llu: expected <key>=<value>\n", (unsigned long long) reader->record);
+        return BULK_READ_INVALID;
+    }
+
+    key->data = (const uint8_t *) line;
+    key->size = (uint32_t) (delimiter - line);
+    value->data = (const uint8_t *) delimiter + 1;
+    value->size = (uint32_t) (size - key->size - 1);
+
+    return BULK_READ_RECORD;
+}
+
+static bulk_read_status_t read_binary(bulk_reader_t * reader, kvm_const_dlob_data_t * key, kvm_const_dlob_data_t * value, uint32_t * ttl)
+{
+    bulk_record_t record;
+    const size_t read_len = fread(&record, 1, sizeof(record), reader->file);
+    if (0 == read_len && !ferror(reader->file))
+    {
+        return BULK_READ_END;
+    }
+    reader->record++;
+
+    if (sizeof(record) != read_len)
+    {
+        printf("record %llu: truncated\n", (unsigned long long) reader->record);
+        return BULK_READ_ERROR;
+    }
+
+    record.key_size = kvm_util_transport_to_host32(record.key_size);
+    record.value_size = kvm_util_transport_to_host32(record.value_size);
+    record.ttl = kvm_util_transport_to_host32(record.ttl);
+
+    const uint64_t size = (uint64_t) record.key_size + record.value_size;
+    if (0 == record.key_size || 0 == record.ttl || size > KVM_FRAME_MAX_SIZE)
+    {
+        printf("record %llu: invalid header\n", (unsigned long long) reader->record);
+        return BULK_READ_ERROR;
+    }
+
+    if (size > reader->capacity)
+    {
+        uint8_t * buffer = (uint8_t *) realloc(reader->buffer, size);
+        if (NULL == buffer)
+        {
+            printf("Memory allocation failed\n");
+            return BULK_READ_ERROR;
+        }
+        reader->buffer = buffer;
+        reader->capacity = size;
+    }
+
+    if (0 != size && 1 != fread(reader->buffer, size, 1, reader->file))
+    {
+        printf("record %llu: truncated\n", (unsigned long long) reader->record);
+        return BULK_READ_ERROR;
+    }
+
+    key->data = reader->buffer;
+    key->size = record.key_size;
+    value->data = reader->buffer + record.key_size;
+    value->size = record.value_size;
+    *ttl = record.ttl;
+
+    return BULK_READ_RECORD;
+}
@@ -0,0 +1,84 @@
+/**
+ * @file bulk_reader.h
+ *
+ * @brief Defines reading of key/value pairs in the bulk load formats.
+ *
+ */
+
+#ifndef __bulk_reader_h__
+#define __bulk_reader_h__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "kvm_client.h"
+#include "bulk_load.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+typedef enum bulk_read_status_e
+{
+    BULK_READ_RECORD,
+    BULK_READ_INVALID,                  /* Skipped, reading goes on */
+    BULK_READ_END,
+    BULK_READ_ERROR
+} bulk_read_status_t;
+
+typedef struct bulk_reader_s
+{
+    FILE *              file;
+    bulk_format_t       format;
+    uint8_t *           buffer;
+    size_t              capacity;
+    uint64_t            record;         /* Number of the last record read, for messages */
+} bulk_reader_t;
+
+/*!
+*******************************************************************************
+** Initializes the reader, reading the magic of the binary format.
+**
+** @param[in]   reader  Reader.
+** @param[in]   file    Input, left open by bulk_reader_uninit().
+** @param[in]   format  Input format.
+**
+** @return
+**      - Non-zero if the input starts as the format expects, 0 otherwise.
+*/
+int bulk_reader_init(bulk_reader_t * reader, FILE * file, bulk_format_t format);
+
+/*!
+*******************************************************************************
+** Releases the buffer of the reader.
+**
+** @param[in]   reader  Reader.
+*/
+void bulk_reader_uninit(bulk_reader_t * reader);
+
+/*!
+*******************************************************************************
+** Reads the next pair. Blank text lines are skipped, a malformed one is
+** reported and the pair is invalid. A malformed or truncated binary record
+** is an error, as the records after it can not be found.
+**
+** @param[in]   reader  Reader.
+** @param[out]  key     Key, valid until the next call.
+** @param[out]  value   Value, valid until the next call.
+** @param[out]  ttl     Time to live, KVM_TTL_PERSIST in the text format.
+**
+** @return
+**      - BULK_READ_RECORD if a pair was read.
+**      - BULK_READ_INVALID if a malformed pair was skipped.
+**      - BULK_READ_END at the end of the input.
+**      - BULK_READ_ERROR if the input can not be read further.
+*/
+bulk_read_status_t bulk_reader_read(bulk_reader_t * reader, kvm_const_dlob_data_t * key, kvm_const_dlob_data_t * value, uint32_t * ttl);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __bulk_reader_h__ */
@@ -0,0 +1,230 @@
+/**
+ * @file dump.c
+ *
+ * @brief The module contains keyspace export implementation.
+ *
+ * The pairs of a page are written from the scan callback. A value left out
+ * of the page is read with GET_RANGE right there: the page reply is already
+ * received, so the connection is free. The record header is written with
+ * the first chunk, so a key removed in between is skipped cleanly.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kvm_requests.h"
+#include "kvm_utils.h"
+#include "dump.h"
+
+/* Buffer of the output file */
+#define DUMP_BUFFER_SIZE (1024 * 1024)
+
+typedef struct dump_context_s
+{
+    kvm_client_handle_t     h_client;
+    const dump_options_t *  options;
+    FILE *                  file;
+    FILE *                  report;
+    kvm_const_dlob_data_t * key;        /* Of the pair being streamed */
+    uint32_t                ttl;
+    int                     started;    /* The pair being streamed is partly written */
+    int                     failed;
+
+    uint64_t                dumped;
+    uint64_t                bytes;
+    uint64_t                skipped;    /* Not representable in text or removed meanwhile */
+} dump_context_t;
+
+static double now_s(void);
+static int text_safe(const uint8_t * data, uint32_t size, int is_key);
+static void write_header(dump_context_t * context, const kvm_const_dlob_data_t * key, uint32_t value_size, uint32_t ttl);
+static void write_pair(void * context, const kvm_const_dlob_data_t * key, const kvm_const_dlob_data_t * value, uint32_t value_size, uint32_t ttl);
+static void write_chunk(void * context, uint32_t value_size, uint32_t offset, const kvm_const_dlob_data_t * chunk);
+static void print_progress(dump_context_t * context, double elapsed, const char * prefix);
+
+int dump(kvm_client_handle_t h_client, const dump_options_t * options)
+{
+    dump_context_t context;
+    memset(&context, 0, sizeof(context));
+    context.h_client = h_client;
+    context.options = options;
+    context.file = (0 == strcmp(options->path, "-")) ? stdout : fopen(options->path, "wb");
+    context.report = (stdout == context.file) ? stderr : stdout;
+    if (NULL == context.file)
+    {
+        printf("Can not create %s\n", options->path);
+        return 1;
+    }
+    setvbuf(context.file, NULL, _IOFBF, DUMP_BUFFER_SIZE);
+
+    if (BULK_FORMAT_BINARY == options->format)
+    {
+        fwrite(BULK_BINARY_MAGIC, BULK_BINARY_MAGIC_SIZE, 1, context.file);
+    }
+
+    const double start = now_s();
+    double reported = start;
+
+    uint32_t cursor = 0;
+    do
+    {
+        const kvm_result_t result = kvm_client_scan(h_client, &cursor, options->page_bytes, write_pair, &context);
+        if (KVM_RESULT_OK != result)
+        {
+            fprintf(context.report, "kvm_client_scan failed: error %d\n", result);
+            context.failed = 1;
+        }
+
+        const double now = now_s();
+        if (now - reported >= 1.0)
+        {
+            reported = now;
+            print_progress(&context, now - start, "");
+        }
+    } while (0 != cursor && !context.failed);
+
+    if (0 != fflush(context.file) || ferror(context.file))
+    {
+        fprintf(context.report, "Writing %s failed\n", options->path);
+        context.failed = 1;
+    }
+    if (stdout != context.file && 0 != fclose(context.file))
+    {
+        context.failed = 1;
+    }
+
+    print_progress(&context, now_s() - start, context.failed ? "Failed: " : "Done: ");
+    if (0 != context.skipped)
+    {
+        fprintf(context.report, "%llu pairs skipped\n", (unsigned long long) context.skipped);
+    }
+
+    return context.failed;
+}
+
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/* Text lines split at the first '=', so keys can not hold it. */
+static int text_safe(const uint8_t * data, uint32_t size, int is_key)
+{
+    return NULL == memchr(data, '\n', size) && NULL == memchr(data, '\r', size) &&
+        (!is_key || NULL == memchr(data, '=', size));
+}
+
+static void write_header(dump_context_t * context, const kvm_const_dlob_data_t * key, uint32_t value_size, uint32_t ttl)
+{
+    if (BULK_FORMAT_BINARY == context->options->format)
+    {
+        bulk_record_t record;
+        record.key_size = kvm_util_host_to_transport32(key->size);
+        record.value_size = kvm_util_host_to_transport32(value_size);
+        record.ttl = kvm_util_host_to_transport32(ttl);
+        fwrite(&record, sizeof(record), 1, context->file);
+        fwrite(key->data, key->size, 1, context->file);
+    }
+    else
+    {
+        fwrite(key->data, key->size, 1, context->file);
+        fputc('=', context->file);
+    }
+}
+
+static void write_pair(void * context, const kvm_const_dlob_data_t * key, const kvm_const_dlob_data_t * value, uint32_t value_size, uint32_t ttl)
+{
+    dump_context_t * c = (dump_context_t *) context;
+    if (c->failed)
+    {
+        return;
+    }
+
+    const int text = (BULK_FORMAT_TEXT == c->options->format);
+    if (text && (!text_safe(key->data, key->size, 1) || (NULL != value && !text_safe(value->data, value->size, 0))))
+    {
+        c->skipped++;
+        return;
+    }
+
+    if (NULL != value)
+    {
+        write_header(c, key, value_size, ttl);
+        fwrite(value->data, value->size, 1, c->file);
+        c->bytes += value->size;
+    }
+    else
+    {
+        c->key = (kvm_const_dlob_data_t *) key;
+        c->ttl = ttl;
+        c->started = 0;
+
+        const kvm_result_t result = kvm_client_get_stream(c->h_client, c->key, c->options->page_bytes, write_chunk, c);
+        if (KVM_RESULT_OK != result && c->started)
+        {
+            /* The record is cut short, the file can not be loaded. */
+            fprintf(c->report, "kvm_client_get_stream failed: error %d\n", result);
+            c->failed = 1;
+        }
+        else if (KVM_RESULT_OK != result)
+        {
+            /* Removed since the page was read */
+            c->skipped++;
+        }
+
+        if (KVM_RESULT_OK != result || c->failed)
+        {
+            return;
+        }
+    }
+
+    if (text)
+    {
+        fputc('\n', c->file);
+    }
+
+    c->dumped++;
+    c->bytes += key->size;
+}
+
+static void write_chunk(void * context, uint32_t value_size, uint32_t offset, const kvm_const_dlob_data_t * chunk)
+{
+    dump_context_t * c = (dump_context_t *) context;
+    if (c->failed)
+    {
+        return;
+    }
+
+    if (BULK_FORMAT_TEXT == c->options->format && !text_safe(chunk->data, chunk->size, 0))
+    {
+        fprintf(c->report, "A value holds a line break, dump it in the binary format\n");
+        c->failed = 1;
+        return;
+    }
+
+    if (0 == offset)
+    {
+        write_header(c, c->key, value_size, c->ttl);
+        c->started = 1;
+    }
+
+    fwrite(chunk->data, chunk->size, 1, c->file);
+    c->bytes += chunk->size;
+}
+
+static void print_progress(dump_context_t * context, double elapsed, const char * prefix)
+{
+    const double seconds = (elapsed > 0) ? elapsed : 1e-9;
+    fprintf(context->report, "%s%llu pairs dumped in %.1f s, %.0f pairs/s, %.1f MiB/s\n",
+        prefix,
+        (unsigned long long) context->dumped,
+        elapsed,
+        (double) context->dumped / seconds,
+        (double) context->bytes / seconds / (1024 * 1024));
+    fflush(context->report);
+}
@@ -0,0 +1,50 @@
+/**
+ * @file dump.h
+ *
+ * @brief Defines non-interactive export of all key/value pairs.
+ *
+ * Pairs are read with SCAN requests a page at a time and written in one of
+ * the bulk load formats, so a dump can be loaded back with bulk_load().
+ * Values too large for a page are read in chunks, so memory stays bounded
+ * by the page size on both ends.
+ *
+ */
+
+#ifndef __dump_h__
+#define __dump_h__
+
+#include <stdint.h>
+
+#include "kvm_client.h"
+#include "bulk_load.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+typedef struct dump_options_s
+{
+    const char *    path;           /* "-" for stdout */
+    bulk_format_t   format;         /* The text format has no TTL and skips pairs it can not hold */
+    uint32_t        page_bytes;     /* Key and value data per SCAN request, up to KVM_SCAN_MAX_BYTES */
+} dump_options_t;
+
+/*!
+*******************************************************************************
+** Writes all pairs stored on the server, printing the progress every
+** second to stdout, or to stderr when the pairs go to stdout.
+**
+** @param[in]   h_client    Client handle.
+** @param[in]   options     Output options.
+**
+** @return
+**      - 0 if every pair was written, 1 otherwise.
+*/
+int dump(kvm_client_handle_t h_client, const dump_options_t * options);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __dump_h__ */
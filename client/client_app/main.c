@@ -1,27 +1,48 @@
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "kvm_protocol.h"
+#include "kvm_requests.h"
+#include "bulk_load.h"
+#include "dump.h"
 #include"request_handler.h"
 
 static int extract_ip_and_port(const char * input, char ** ip, uint32_t * port);
 static kvm_client_handle_t init_client(const char * command_line);
+static int run_bulk_load(const char * command_line, const bulk_load_options_t * options);
+static int run_dump(const char * command_line, const dump_options_t * options);
+static int parse_options(int argc, char * argv[], bulk_load_options_t * load, dump_options_t * dump_options);
+static void print_usage(const char * name);
 static void print_welcome_message(void);
 
 int main(int argc, char * argv[])
 {
-    if (argc != 2)
+    bulk_load_options_t load;
+    dump_options_t dump_options;
+    if (!parse_options(argc, argv, &load, &dump_options))
     {
-        printf("Please specify server IP and port in <IP>:<PORT> format\n");
+        print_usage(argv[0]);
         return 1;
     }
 
+    if (NULL != load.path)
+    {
+        return run_bulk_load(argv[optind], &load);
+    }
+
+    if (NULL != dump_options.path)
+    {
+        return run_dump(argv[optind], &dump_options);
+    }
+
     if (!init_request_handler())
     {
         return 1;
     }
 
-    const kvm_client_handle_t h_client = init_client(argv[1]);
+    const kvm_client_handle_t h_client = init_client(argv[optind]);
     if (NULL == h_client)
     {
         uninit_request_handler();
@@ -57,6 +78,15 @@ int main(int argc, char * argv[])
 
 static int extract_ip_and_port(const char * input, char ** ip, uint32_t * port)
 {
+    /* A Unix domain socket path is passed to the client as is */
+    if (0 == strncmp(input, KVM_UNIX_ADDRESS_PREFIX, sizeof(KVM_UNIX_ADDRESS_PREFIX) - 1) ||
+        0 == strncmp(input, KVM_SHM_ADDRESS_PREFIX, sizeof(KVM_SHM_ADDRESS_PREFIX) - 1))
+    {
+        *ip = strdup(input);
+        *port = 0;
+        return NULL != *ip;
+    }
+
     const char * delimiter = strchr(input, ':');
     if (NULL == delimiter)
     {
@@ -91,7 +121,7 @@ static kvm_client_handle_t init_client(const char * command_line)
 
     if (!extract_ip_and_port(command_line, &ip, &port))
     {
-        printf("Please specify server IP and port in <IP>:<PORT> format\n");
+        printf("Please specify server IP and port in <IP>:<PORT> format, or unix:<PATH> or shm:<PATH>\n");
         return NULL;
     }
 
@@ -107,13 +137,148 @@ static kvm_client_handle_t init_client(const char * command_line)
     return h_client;
 }
 
+static int run_bulk_load(const char * command_line, const bulk_load_options_t * options)
+{
+    char * ip;
+    uint32_t port;
+
+    if (!extract_ip_and_port(command_line, &ip, &port))
+    {
+        printf("Please specify server IP and port in <IP>:<PORT> format, or unix:<PATH> or shm:<PATH>\n");
+        return 1;
+    }
+
+    const int result = bulk_load(ip, port, options);
+    free(ip);
+
+    return result;
+}
+
+static int run_dump(const char * command_line, const dump_options_t * options)
+{
+    const kvm_client_handle_t h_client = init_client(command_line);
+    if (NULL == h_client)
+    {
+        return 1;
+    }
+
+    const int result = dump(h_client, options);
+    kvm_client_close(h_client);
+
+    return result;
+}
+
+static int parse_options(int argc, char * argv[], bulk_load_options_t * load, dump_options_t * dump_options)
+{
+    static const struct option long_options[] =
+    {
+        {"load",        required_argument,  NULL, 'l'},
+        {"format",      required_argument,  NULL, 'f'},
+        {"connections", required_argument,  NULL, 'c'},
+        {"batch",       required_argument,  NULL, 'b'},
+        {"batch-bytes", required_argument,  NULL, 'B'},
+        {"window",      required_argument,  NULL, 'w'},
+        {"dump",        required_argument,  NULL, 'd'},
+        {"page-bytes",  required_argument,  NULL, 'p'},
+        {"help",        no_argument,        NULL, 'h'},
+        {NULL,          0,                  NULL, 0}
+    };
+
+    memset(load, 0, sizeof(*load));
+    load->format = BULK_FORMAT_TEXT;
+    load->connections = 4;
+    load->batch_ops = 256;
+    load->batch_bytes = 1024 * 1024;
+
+    memset(dump_options, 0, sizeof(*dump_options));
+    dump_options->page_bytes = 1024 * 1024;
+
+    int c;
+    while (-1 != (c = getopt_long(argc, argv, "l:f:c:b:B:w:d:p:h", long_options, NULL)))
+    {
+        switch (c)
+        {
+            case 'l': load->path = optarg; break;
+            case 'c': load->connections = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'b': load->batch_ops = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'B': load->batch_bytes = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'w': load->window = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'd': dump_options->path = optarg; break;
+            case 'p': dump_options->page_bytes = (uint32_t) strtoul(optarg, NULL, 10); break;
+            case 'f':
+                if (0 == strcmp(optarg, "text"))
+                {
+                    load->format = BULK_FORMAT_TEXT;
+                }
+                else if (0 == strcmp(optarg, "binary"))
+                {
+                    load->format = BULK_FORMAT_BINARY;
+                }
+                else
+                {
+                    return 0;
+                }
+                break;
+            default:
+                return 0;
+        }
+    }
+
+    if (0 == load->window)
+    {
+        load->window = 2 * load->connections;
+    }
+    dump_options->format = load->format;
+
+    if (NULL != load->path && NULL != dump_options->path)
+    {
+        return 0;
+    }
+
+    /* A connection always has a batch to send while the next one is filled. */
+    return optind + 1 == argc && 0 != load->connections && 0 != load->batch_ops &&
+        load->batch_ops <= KVM_BATCH_MAX_OPS && 0 != load->batch_bytes && load->window > load->connections &&
+        0 != dump_options->page_bytes && dump_options->page_bytes <= KVM_SCAN_MAX_BYTES;
+}
+
+static void print_usage(const char * name)
+{
+    printf("Usage: %s [options] <IP>:<PORT> | unix:<PATH> | shm:<PATH>\n"
+           "Without --load or --dump requests are read interactively.\n"
+           "  -l, --load PATH          Store all pairs of the file, - for stdin, and exit\n"
+           "  -d, --dump PATH          Write all pairs stored on the server to the file, - for stdout, and exit\n"
+           "  -f, --format FORMAT      text (<key>=<value> lines) or binary with TTLs (text)\n"
+           "  -p, --page-bytes N       Key and value data per SCAN request when dumping (1048576)\n"
+           "  -c, --connections N      Parallel connections (4)\n"
+           "  -b, --batch N            Pairs per BATCH request, up to %u (256)\n"
+           "  -B, --batch-bytes N      Send a batch once its pairs reach N bytes (1048576)\n"
+           "  -w, --window N           Batches filled or in flight, more than connections (2 * connections)\n",
+        name, KVM_BATCH_MAX_OPS);
+}
+
 static void print_welcome_message(void)
 {
     printf("Welcome to KVM Client. Below are the supported requests:\n");
     printf("put <key>=<value>   - store key/value pair in server\n");
     printf("get <key>           - retrieve value with specified key from server\n");
+    printf("put-file <key>=<path> - store the content of the file in chunks\n");
+    printf("get-file <key>=<path> - write the value to the file in chunks\n");
     printf("del <key>           - delete value with specified key from server\n");
+    printf("getv <key>          - retrieve value with its version\n");
+    printf("put-if <key>=<version|absent|present>:<value> - store the pair only if the key matches\n");
+    printf("del-if <key>=<version|present> - delete the key only if it matches\n");
+    printf("incr <key>[=<delta>] - add to the integer value on the server, 1 by default\n");
+    printf("decr <key>[=<delta>] - subtract from the integer value on the server, 1 by default\n");
+    printf("append <key>=<value> - append to the value on the server\n");
+    printf("getset <key>=<value> - store the value and print the replaced one\n");
+    printf("batch <op>;<op>...  - run put, get, del, put-if and del-if operations all or none\n");
     printf("list-keys           - get all keys from the server\n");
     printf("count               - get count of key/value pairs stored on the server\n");
+    printf("expire <key>=<ms>   - set time to live of the key (0 deletes, 4294967295 persists)\n");
+    printf("ttl <key>           - get remaining time to live of the key\n");
+    printf("stats               - get request, latency and connection statistics of the server\n");
+    printf("slowlog [reset]     - get slow requests logged by the server, optionally clearing the log\n");
+    printf("hotkeys [count]     - get the most requested keys with estimated request rates\n");
+    printf("memory              - get memory used by the server by category and heap fragmentation\n");
     printf("quit                - exit from application\n");
 }
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include "kvm_requests.h"
 #include "request_handler.h"
 
 #include "apr_general.h"
@@ -8,6 +9,9 @@
 
 typedef int (*request_handler_t) (kvm_client_handle_t, const char *, const char *);
 
+/* Size of the chunks files are sent and received in */
+#define FILE_CHUNK_SIZE (1024 * 1024)
+
 static void init_apr_hashtable(void);
 static void uninit_apr_hashtable(void);
 
@@ -16,9 +20,25 @@ static void callback(void * context, const kvm_const_dlob_data_t * data);
 
 static int handle_put_request(const kvm_client_handle_t h_client, const char * key, const char * value);
 static int handle_get_request(const  kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_put_file_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_get_file_request(const kvm_client_handle_t h_client, const char * key, const char * value);
 static int handle_del_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_getv_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_put_if_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_del_if_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_incr_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_decr_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_append_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_getset_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_batch_request(const kvm_client_handle_t h_client, const char * key, const char * value);
 static int handle_list_keys_request(const kvm_client_handle_t h_client, const char * key, const char * value);
 static int handle_count_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_expire_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_ttl_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_stats_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_slowlog_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_hotkeys_request(const kvm_client_handle_t h_client, const char * key, const char * value);
+static int handle_memory_request(const kvm_client_handle_t h_client, const char * key, const char * value);
 static int handle_quit_request(const kvm_client_handle_t h_client, const char * key, const char * value);
 
 apr_hash_t * ht = NULL;
@@ -39,9 +59,25 @@ int init_request_handler(void)
 
     apr_hash_set(ht, "put", APR_HASH_KEY_STRING, (void *) handle_put_request);
     apr_hash_set(ht, "get", APR_HASH_KEY_STRING, (void *) handle_get_request);
+    apr_hash_set(ht, "put-file", APR_HASH_KEY_STRING, (void *) handle_put_file_request);
+    apr_hash_set(ht, "get-file", APR_HASH_KEY_STRING, (void *) handle_get_file_request);
     apr_hash_set(ht, "del", APR_HASH_KEY_STRING, (void *) handle_del_request);
+    apr_hash_set(ht, "getv", APR_HASH_KEY_STRING, (void *) handle_getv_request);
+    apr_hash_set(ht, "put-if", APR_HASH_KEY_STRING, (void *) handle_put_if_request);
+    apr_hash_set(ht, "del-if", APR_HASH_KEY_STRING, (void *) handle_del_if_request);
+    apr_hash_set(ht, "incr", APR_HASH_KEY_STRING, (void *) handle_incr_request);
+    apr_hash_set(ht, "decr", APR_HASH_KEY_STRING, (void *) handle_decr_request);
+    apr_hash_set(ht, "append", APR_HASH_KEY_STRING, (void *) handle_append_request);
+    apr_hash_set(ht, "getset", APR_HASH_KEY_STRING, (void *) handle_getset_request);
+    apr_hash_set(ht, "batch", APR_HASH_KEY_STRING, (void *) handle_batch_request);
     apr_hash_set(ht, "list-keys", APR_HASH_KEY_STRING, (void *) handle_list_keys_request);
     apr_hash_set(ht, "count", APR_HASH_KEY_STRING, (void *) handle_count_request);
+    apr_hash_set(ht, "expire", APR_HASH_KEY_STRING, (void *) handle_expire_request);
+    apr_hash_set(ht, "ttl", APR_HASH_KEY_STRING, (void *) handle_ttl_request);
+    apr_hash_set(ht, "stats", APR_HASH_KEY_STRING, (void *) handle_stats_request);
+    apr_hash_set(ht, "slowlog", APR_HASH_KEY_STRING, (void *) handle_slowlog_request);
+    apr_hash_set(ht, "hotkeys", APR_HASH_KEY_STRING, (void *) handle_hotkeys_request);
+    apr_hash_set(ht, "memory", APR_HASH_KEY_STRING, (void *) handle_memory_request);
     apr_hash_set(ht, "quit", APR_HASH_KEY_STRING, (void *) handle_quit_request);
 
     return 1;
@@ -215,6 +251,118 @@ static int handle_get_request(const kvm_client_handle_t h_client, const char * k
     return 1;
 }
 
+static int handle_put_file_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    if (NULL == key || NULL == value)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    FILE * file = fopen(value, "rb");
+    if (NULL == file)
+    {
+        printf("Can not open %s\n", value);
+        return 1;
+    }
+
+    long file_size = -1;
+    if (0 == fseek(file, 0, SEEK_END))
+    {
+        file_size = ftell(file);
+        rewind(file);
+    }
+
+    uint8_t * buffer = malloc(FILE_CHUNK_SIZE);
+    if (file_size < 0 || file_size > UINT32_MAX || NULL == buffer)
+    {
+        printf("Can not read %s\n", value);
+        free(buffer);
+        fclose(file);
+        return 1;
+    }
+
+    kvm_const_dlob_data_t key_blob;
+    key_blob.size = (uint32_t) strlen(key);
+    key_blob.data = (const uint8_t *) key;
+
+    /* The file is sent as read, only a chunk of it is in memory at a time. */
+    uint32_t stream;
+    kvm_result_t result = kvm_client_put_stream_begin(h_client, &key_blob, (uint32_t) file_size, KVM_TTL_PERSIST, &stream);
+    if (KVM_RESULT_OK == result)
+    {
+        uint32_t sent = 0;
+        while (KVM_RESULT_OK == result && sent < (uint32_t) file_size)
+        {
+            kvm_const_dlob_data_t chunk;
+            chunk.size = (uint32_t) fread(buffer, 1, FILE_CHUNK_SIZE, file);
+            chunk.data = buffer;
+            if (0 == chunk.size)
+            {
+                /* The file shrank, the incomplete value is dropped below. */
+                break;
+            }
+
+            result = kvm_client_put_stream_write(h_client, stream, &chunk);
+            sent += chunk.size;
+        }
+
+        const kvm_result_t end_result = kvm_client_put_stream_end(h_client, stream, KVM_RESULT_OK != result);
+        result = (KVM_RESULT_OK != result) ? result : end_result;
+    }
+
+    if (KVM_RESULT_OK != result)
+    {
+        printf("handle_put_file_request failed: error %d\n", result);
+    }
+    else
+    {
+        printf("%ld bytes of %s stored\n", file_size, value);
+    }
+
+    free(buffer);
+    fclose(file);
+    return 1;
+}
+
+static void file_chunk_callback(void * context, uint32_t value_size, uint32_t offset, const kvm_const_dlob_data_t * chunk)
+{
+    fwrite(chunk->data, 1, chunk->size, (FILE *) context);
+}
+
+static int handle_get_file_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    if (NULL == key || NULL == value)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    FILE * file = fopen(value, "wb");
+    if (NULL == file)
+    {
+        printf("Can not open %s\n", value);
+        return 1;
+    }
+
+    kvm_const_dlob_data_t key_blob;
+    key_blob.size = (uint32_t) strlen(key);
+    key_blob.data = (const uint8_t *) key;
+
+    const kvm_result_t result = kvm_client_get_stream(h_client, &key_blob, FILE_CHUNK_SIZE, file_chunk_callback, file);
+    const long file_size = ftell(file);
+    if (0 != fclose(file) || KVM_RESULT_OK != result)
+    {
+        printf("handle_get_file_request failed: error %d\n", result);
+    }
+    else
+    {
+        printf("%ld bytes written to %s\n", file_size, value);
+    }
+
+    return 1;
+}
+
 static int handle_del_request(const kvm_client_handle_t h_client, const char * key, const char * value)
 {
     if (NULL == key || NULL != value)
@@ -279,6 +427,623 @@ static int handle_count_request(const kvm_client_handle_t h_client, const char *
     return 1;
 }
 
+static int handle_getv_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    if (NULL == key || NULL != value)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    kvm_const_dlob_data_t key_blob;
+
+    key_blob.size = (uint32_t) strlen(key);
+    key_blob.data = (const uint8_t *) key;
+
+    uint64_t version;
+    const kvm_result_t result = kvm_client_get_versioned(h_client, &key_blob, callback, NULL, &version);
+    if (KVM_RESULT_OK != result)
+    {
+        printf("handle_getv_request failed: error %d\n", result);
+    }
+    else
+    {
+        printf("version %llu\n", (unsigned long long) version);
+    }
+
+    return 1;
+}
+
+/* Parses <version>, "absent" or "present" up to the end character. */
+static int parse_condition(const char * str, char end_char, kvm_condition_t * condition, uint64_t * version, const char ** end)
+{
+    *version = 0;
+    if (0 == strncmp(str, "absent", 6) && end_char == str[6])
+    {
+        *condition = KVM_IF_ABSENT;
+        *end = str + 6;
+        return 1;
+    }
+
+    if (0 == strncmp(str, "present", 7) && end_char == str[7])
+    {
+        *condition = KVM_IF_PRESENT;
+        *end = str + 7;
+        return 1;
+    }
+
+    char * num_end = NULL;
+    *version = strtoull(str, &num_end, 10);
+    *condition = KVM_IF_VERSION;
+    *end = num_end;
+
+    return num_end != str && end_char == *num_end;
+}
+
+static int handle_put_if_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    kvm_condition_t condition;
+    uint64_t version;
+    const char * end;
+    if (NULL == key || NULL == value || !parse_condition(value, ':', &condition, &version, &end))
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    kvm_const_dlob_data_t key_blob;
+    kvm_const_dlob_data_t value_blob;
+
+    key_blob.size = (uint32_t) strlen(key);
+    key_blob.data = (const uint8_t *) key;
+
+    value_blob.size = (uint32_t) strlen(end + 1);
+    value_blob.data = (const uint8_t *) end + 1;
+
+    uint64_t stored_version;
+    const kvm_result_t result = kvm_client_put_if(h_client, &key_blob, &value_blob, KVM_TTL_PERSIST, condition, version, &stored_version);
+    if (KVM_RESULT_CONFLICT == result)
+    {
+        printf("%s key does not match, nothing stored\n", key);
+    }
+    else if (KVM_RESULT_OK != result)
+    {
+        printf("handle_put_if_request failed: error %d\n", result);
+    }
+    else
+    {
+        printf("Key/Value pair successfully stored, version %llu\n", (unsigned long long) stored_version);
+    }
+
+    return 1;
+}
+
+static int handle_del_if_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    kvm_condition_t condition;
+    uint64_t version;
+    const char * end;
+    if (NULL == key || NULL == value || !parse_condition(value, '\0', &condition, &version, &end) || KVM_IF_ABSENT == condition)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    kvm_const_dlob_data_t key_blob;
+
+    key_blob.size = (uint32_t) strlen(key);
+    key_blob.data = (const uint8_t *) key;
+    const kvm_result_t result = kvm_client_delete_if(h_client, &key_blob, condition, version);
+    if (KVM_RESULT_CONFLICT == result)
+    {
+        printf("%s key does not match, nothing deleted\n", key);
+    }
+    else if (KVM_RESULT_OK != result)
+    {
+        printf("handle_del_if_request failed: error %d\n", result);
+    }
+    else
+    {
+        printf("%s key deleted\n", key);
+    }
+
+    return 1;
+}
+
+static int incr_by(const kvm_client_handle_t h_client, const char * key, const char * value, int sign)
+{
+    long long delta = 1;
+    if (NULL != value)
+    {
+        char * end = NULL;
+        delta = strtoll(value, &end, 10);
+        if ('\0' != *end || end == value || delta < 0)
+        {
+            printf("invalid input. Please try again\n");
+            return 1;
+        }
+    }
+
+    if (NULL == key)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    kvm_const_dlob_data_t key_blob;
+
+    key_blob.size = (uint32_t) strlen(key);
+    key_blob.data = (const uint8_t *) key;
+
+    int64_t result_value;
+    const kvm_result_t result = kvm_client_incr(h_client, &key_blob, sign * (int64_t) delta, &result_value);
+    if (KVM_RESULT_OK != result)
+    {
+        printf("kvm_client_incr failed: error %d\n", result);
+    }
+    else
+    {
+        printf("%lld\n", (long long) result_value);
+    }
+
+    return 1;
+}
+
+static int handle_incr_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    return incr_by(h_client, key, value, 1);
+}
+
+static int handle_decr_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    return incr_by(h_client, key, value, -1);
+}
+
+static int handle_append_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    if (NULL == key || NULL == value)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    kvm_const_dlob_data_t key_blob;
+    kvm_const_dlob_data_t value_blob;
+
+    key_blob.size = (uint32_t) strlen(key);
+    key_blob.data = (const uint8_t *) key;
+
+    value_blob.size = (uint32_t) strlen(value);
+    value_blob.data = (const uint8_t *) value;
+
+    uint32_t value_size;
+    const kvm_result_t result = kvm_client_append(h_client, &key_blob, &value_blob, &value_size);
+    if (KVM_RESULT_OK != result)
+    {
+        printf("kvm_client_append failed: error %d\n", result);
+    }
+    else
+    {
+        printf("%s value is %u bytes long\n", key, value_size);
+    }
+
+    return 1;
+}
+
+static int handle_getset_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    if (NULL == key || NULL == value)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    kvm_const_dlob_data_t key_blob;
+    kvm_const_dlob_data_t value_blob;
+
+    key_blob.size = (uint32_t) strlen(key);
+    key_blob.data = (const uint8_t *) key;
+
+    value_blob.size = (uint32_t) strlen(value);
+    value_blob.data = (const uint8_t *) value;
+
+    const kvm_result_t result = kvm_client_getset(h_client, &key_blob, &value_blob, callback, NULL);
+    if (KVM_RESULT_OK != result)
+    {
+        printf("kvm_client_getset failed: error %d\n", result);
+    }
+    else
+    {
+        printf("Key/Value pair successfully stored\n");
+    }
+
+    return 1;
+}
+
+/* Adds a put, get, del, put-if or del-if operation in the command syntax to the batch. */
+static int add_batch_op(kvm_batch_handle_t h_batch, char * op)
+{
+    char * request = NULL;
+    char * key = NULL;
+    char * value = NULL;
+    if (!parse_request(op, &request, &key, &value) || NULL == key)
+    {
+        return 0;
+    }
+
+    kvm_const_dlob_data_t key_blob;
+    kvm_const_dlob_data_t value_blob;
+
+    key_blob.size = (uint32_t) strlen(key);
+    key_blob.data = (const uint8_t *) key;
+
+    kvm_condition_t condition;
+    uint64_t version;
+    const char * end;
+    if (0 == strcmp(request, "put") && NULL != value)
+    {
+        value_blob.size = (uint32_t) strlen(value);
+        value_blob.data = (const uint8_t *) value;
+        return KVM_RESULT_OK == kvm_client_batch_put(h_batch, &key_blob, &value_blob, KVM_TTL_PERSIST);
+    }
+    if (0 == strcmp(request, "get") && NULL == value)
+    {
+        return KVM_RESULT_OK == kvm_client_batch_get(h_batch, &key_blob);
+    }
+    if (0 == strcmp(request, "del") && NULL == value)
+    {
+        return KVM_RESULT_OK == kvm_client_batch_delete(h_batch, &key_blob);
+    }
+    if (0 == strcmp(request, "put-if") && NULL != value && parse_condition(value, ':', &condition, &version, &end))
+    {
+        value_blob.size = (uint32_t) strlen(end + 1);
+        value_blob.data = (const uint8_t *) end + 1;
+        return KVM_RESULT_OK == kvm_client_batch_put_if(h_batch, &key_blob, &value_blob, KVM_TTL_PERSIST, condition, version);
+    }
+    if (0 == strcmp(request, "del-if") && NULL != value && parse_condition(value, '\0', &condition, &version, &end))
+    {
+        return KVM_RESULT_OK == kvm_client_batch_delete_if(h_batch, &key_blob, condition, version);
+    }
+
+    return 0;
+}
+
+static void batch_callback(void * context, uint32_t index, kvm_result_t result, const kvm_const_dlob_data_t * value)
+{
+    if (NULL != value)
+    {
+        printf("%u: %.*s\n", index, (int) value->size, (const char *) value->data);
+    }
+    else
+    {
+        printf("%u: %s\n", index, (KVM_RESULT_OK == result) ? "ok" : (KVM_RESULT_CONFLICT == result) ? "conflict" : "failed");
+    }
+}
+
+static int handle_batch_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    if (NULL == key)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    /* The line was split at the first '=', join it back. */
+    char * line = malloc(strlen(key) + ((NULL != value) ? strlen(value) + 1 : 0) + 1);
+    if (NULL == line)
+    {
+        printf("handle_batch_request failed: out of memory\n");
+        return 1;
+    }
+    sprintf(line, (NULL != value) ? "%s=%s" : "%s", key, value);
+
+    kvm_batch_handle_t h_batch;
+    kvm_result_t result = kvm_client_batch_create(&h_batch);
+    if (KVM_RESULT_OK != result)
+    {
+        printf("kvm_client_batch_create failed: error %d\n", result);
+        free(line);
+        return 1;
+    }
+
+    int valid = 1;
+    char * saveptr = NULL;
+    for (char * op = strtok_r(line, ";", &saveptr); NULL != op && valid; op = strtok_r(NULL, ";", &saveptr))
+    {
+        while (' ' == *op)
+        {
+            op++;
+        }
+        valid = add_batch_op(h_batch, op);
+    }
+
+    if (!valid)
+    {
+        printf("invalid input. Please try again\n");
+    }
+    else
+    {
+        result = kvm_client_batch_exec(h_client, h_batch, batch_callback, NULL);
+        if (KVM_RESULT_OK == result)
+        {
+            printf("Batch applied\n");
+        }
+        else if (KVM_RESULT_CONFLICT == result)
+        {
+            printf("Batch condition does not match, nothing applied\n");
+        }
+        else
+        {
+            printf("kvm_client_batch_exec failed: error %d, nothing applied\n", result);
+        }
+    }
+
+    kvm_client_batch_destroy(h_batch);
+    free(line);
+    return 1;
+}
+
+static int handle_expire_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    if (NULL == key || NULL == value)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    char * end = NULL;
+    const unsigned long ttl = strtoul(value, &end, 10);
+    if ('\0' != *end || ttl > KVM_TTL_PERSIST)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    kvm_const_dlob_data_t key_blob;
+
+    key_blob.size = (uint32_t) strlen(key);
+    key_blob.data = (const uint8_t *) key;
+    const kvm_result_t result = kvm_client_expire(h_client, &key_blob, (uint32_t) ttl);
+    if (KVM_RESULT_OK != result)
+    {
+        printf("kvm_client_expire failed: error %d\n", result);
+    }
+    else
+    {
+        printf("%s key expiration updated\n", key);
+    }
+
+    return 1;
+}
+
+static int handle_ttl_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    if (NULL == key || NULL != value)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    kvm_const_dlob_data_t key_blob;
+
+    key_blob.size = (uint32_t) strlen(key);
+    key_blob.data = (const uint8_t *) key;
+
+    uint32_t ttl = 0;
+    const kvm_result_t result = kvm_client_ttl(h_client, &key_blob, &ttl);
+    if (KVM_RESULT_OK != result)
+    {
+        printf("kvm_client_ttl failed: error %d\n", result);
+    }
+    else if (KVM_TTL_PERSIST == ttl)
+    {
+        printf("TTL = infinite\n");
+    }
+    else
+    {
+        printf("TTL = %u ms\n", ttl);
+    }
+
+    return 1;
+}
+
+static int handle_stats_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    if (NULL != key || NULL != value)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    kvm_stats_t * stats = (kvm_stats_t *) malloc(sizeof(kvm_stats_t));
+    if (NULL == stats)
+    {
+        printf("out of memory\n");
+        return 1;
+    }
+
+    const kvm_result_t result = kvm_client_stats(h_client, stats);
+    if (KVM_RESULT_OK != result)
+    {
+        printf("kvm_client_stats failed: error %d\n", result);
+        free(stats);
+        return 1;
+    }
+
+    printf("keys=%llu used_memory=%llu evicted=%llu\n",
+        (unsigned long long) stats->keys,
+        (unsigned long long) stats->used_memory,
+        (unsigned long long) stats->evicted_keys);
+    printf("hits=%llu misses=%llu bytes_in=%llu bytes_out=%llu\n",
+        (unsigned long long) stats->hits,
+        (unsigned long long) stats->misses,
+        (unsigned long long) stats->bytes_in,
+        (unsigned long long) stats->bytes_out);
+    printf("connections accepted=%llu closed=%llu\n",
+        (unsigned long long) stats->connections_accepted,
+        (unsigned long long) stats->connections_closed);
+
+    for (uint32_t id = 0; id < KVM_STATS_MAX_OPS; ++id)
+    {
+        if (0 == stats->requests[id])
+        {
+            continue;
+        }
+
+        const uint64_t * latency = stats->latency[id];
+        const char * name = kvm_stats_op_name(id);
+        if (NULL != name)
+        {
+            printf("%-12s", name);
+        }
+        else
+        {
+            printf("request %-4u", id);
+        }
+        printf(" count=%llu p50=%lluns p99=%lluns p99.9=%lluns max=%lluns\n",
+            (unsigned long long) stats->requests[id],
+            (unsigned long long) kvm_histogram_percentile(latency, 50),
+            (unsigned long long) kvm_histogram_percentile(latency, 99),
+            (unsigned long long) kvm_histogram_percentile(latency, 99.9),
+            (unsigned long long) kvm_histogram_percentile(latency, 100));
+    }
+
+    for (uint32_t phase = 0; phase < KVM_STATS_PHASES; ++phase)
+    {
+        const uint64_t * latency = stats->phase[phase];
+        const uint64_t count = kvm_histogram_count(latency);
+        if (0 == count)
+        {
+            continue;
+        }
+
+        printf("phase %-6s count=%llu mean=%lluns p50=%lluns p99=%lluns p99.9=%lluns max=%lluns\n",
+            kvm_stats_phase_name(phase),
+            (unsigned long long) count,
+            (unsigned long long) (stats->phase_sum[phase] / count),
+            (unsigned long long) kvm_histogram_percentile(latency, 50),
+            (unsigned long long) kvm_histogram_percentile(latency, 99),
+            (unsigned long long) kvm_histogram_percentile(latency, 99.9),
+            (unsigned long long) kvm_histogram_percentile(latency, 100));
+    }
+
+    free(stats);
+    return 1;
+}
+
+static void slowlog_callback(void * context, const kvm_slowlog_entry_t * entry)
+{
+    if (NULL == entry)
+    {
+        return;
+    }
+
+    const char * name = kvm_stats_op_name(entry->op);
+    printf("#%llu %s %-8s %lluus fd=%d key_size=%u request_size=%u reply_size=%u key=%.*s%s\n",
+        (unsigned long long) entry->id,
+        (KVM_SLOWLOG_EXECUTE == entry->kind) ? "execute" : "total",
+        (NULL != name) ? name : "unknown",
+        (unsigned long long) (entry->duration_ns / 1000),
+        entry->fd,
+        entry->key_size,
+        entry->request_size,
+        entry->reply_size,
+        (int) entry->prefix_size,
+        (const char *) entry->key_prefix,
+        (entry->prefix_size < entry->key_size) ? "..." : "");
+}
+
+static int handle_slowlog_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    const int reset = (NULL != key && 0 == strcmp(key, "reset"));
+    if ((NULL != key && !reset) || NULL != value)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    const kvm_result_t result = kvm_client_slowlog(h_client, (uint8_t) reset, slowlog_callback, NULL);
+    if (KVM_RESULT_OK != result)
+    {
+        printf("kvm_client_slowlog failed: error %d\n", result);
+    }
+
+    return 1;
+}
+
+static void hotkeys_callback(void * context, const kvm_hotkey_t * key)
+{
+    if (NULL == key)
+    {
+        return;
+    }
+
+    printf("%llu hits %u/s key_size=%u key=%.*s%s\n",
+        (unsigned long long) key->hits,
+        key->rate,
+        key->key_size,
+        (int) key->prefix_size,
+        (const char *) key->key_prefix,
+        (key->prefix_size < key->key_size) ? "..." : "");
+}
+
+static int handle_hotkeys_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    char * end = NULL;
+    const unsigned long count = (NULL != key) ? strtoul(key, &end, 10) : 0;
+    if ((NULL != key && ('\0' == key[0] || '\0' != *end)) || NULL != value)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    const kvm_result_t result = kvm_client_hotkeys(h_client, (uint32_t) count, hotkeys_callback, NULL);
+    if (KVM_RESULT_OK != result)
+    {
+        printf("kvm_client_hotkeys failed: error %d\n", result);
+    }
+
+    return 1;
+}
+
+static int handle_memory_request(const kvm_client_handle_t h_client, const char * key, const char * value)
+{
+    if (NULL != key || NULL != value)
+    {
+        printf("invalid input. Please try again\n");
+        return 1;
+    }
+
+    kvm_memory_t memory;
+    const kvm_result_t result = kvm_client_memory(h_client, &memory);
+    if (KVM_RESULT_OK != result)
+    {
+        printf("kvm_client_memory failed: error %d\n", result);
+        return 1;
+    }
+
+    printf("keys:            %llu\n", (unsigned long long) memory.keys);
+    printf("values:          %llu\n", (unsigned long long) memory.values);
+    printf("entry headers:   %llu\n", (unsigned long long) memory.entry_headers);
+    printf("entry slack:     %llu\n", (unsigned long long) memory.entry_slack);
+    printf("buckets:         %llu\n", (unsigned long long) memory.buckets);
+    printf("uploads:         %llu\n", (unsigned long long) memory.uploads);
+    printf("undo log:        %llu\n", (unsigned long long) memory.undo_log);
+    printf("retired:         %llu\n", (unsigned long long) memory.retired);
+    printf("connections:     %llu\n", (unsigned long long) memory.connections);
+    printf("rss:             %llu\n", (unsigned long long) memory.rss);
+    printf("heap in use:     %llu\n", (unsigned long long) memory.heap_in_use);
+    printf("heap free:       %llu\n", (unsigned long long) memory.heap_free);
+    printf("heap releasable: %llu\n", (unsigned long long) memory.heap_releasable);
+
+    /* Free heap the allocator can not give back is lost to fragmentation. */
+    const uint64_t heap = memory.heap_in_use + memory.heap_free;
+    const uint64_t fragmented = memory.heap_free - memory.heap_releasable;
+    printf("fragmentation:   %.1f%%\n", (0 != heap) ? 100.0 * (double) fragmented / (double) heap : 0.0);
+
+    return 1;
+}
+
 static int handle_quit_request(const kvm_client_handle_t h_client, const char * key, const char * value)
 {
     if (NULL != key || NULL != value)
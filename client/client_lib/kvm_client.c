@@ -10,6 +10,8 @@
 #include "kvm_requests.h"
 #include "kvm_replies.h"
 #include "kvm_utils.h"
+#include "kvm_lz4.h"
+#include "kvm_protocol.h"
 #include "kvm_client.h"
 #include "kvm_client_internal.h"
 
@@ -24,6 +26,89 @@ static kvm_request_generic_t * prepare_request(kvm_request_id_t id, uint32_t siz
     return request;
 }
 
+static kvm_result_t
+get_encoded(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    kvm_data_callback_t     callback,
+    void *                  user_context)
+{
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_get_encoded_t) + key->size;
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_GET_ENCODED, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+    uint8_t * ptr = (uint8_t *) (request + 1);
+
+    /* Setup GET_ENCODED request specific data. */
+    kvm_request_get_encoded_t get_req;
+    get_req.key_size = kvm_util_host_to_transport32(key->size);
+    memcpy(ptr, &get_req, sizeof(get_req));
+
+    ptr += sizeof(kvm_request_get_encoded_t);
+    memcpy(ptr, key->data, key->size);
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK == result)
+    {
+        uint8_t * ptr = reply;
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) (ptr))->status)
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+        }
+        else
+        {
+            kvm_const_dlob_data_t value;
+
+            ptr += sizeof(kvm_reply_generic_t);
+            kvm_reply_get_encoded_t get_reply;
+            memcpy(&get_reply, ptr, sizeof(get_reply));
+            ptr += sizeof(kvm_reply_get_encoded_t);
+
+            const uint32_t raw_size = kvm_util_transport_to_host32(get_reply.raw_size);
+            const uint32_t data_size = kvm_util_transport_to_host32(get_reply.value_size);
+
+            if (KVM_CODEC_NONE == get_reply.codec)
+            {
+                value.size = data_size;
+                value.data = ptr;
+                callback(user_context, &value);
+            }
+            else if (KVM_CODEC_LZ4 == get_reply.codec)
+            {
+                uint8_t * raw = (uint8_t *) malloc(raw_size);
+                if (NULL == raw)
+                {
+                    result = KVM_RESULT_SYS_CALL_FAIL;
+                }
+                else
+                {
+                    result = kvm_lz4_decompress(ptr, data_size, raw, raw_size);
+                    if (KVM_RESULT_OK == result)
+                    {
+                        value.size = raw_size;
+                        value.data = raw;
+                        callback(user_context, &value);
+                    }
+                    free(raw);
+                }
+            }
+            else
+            {
+                result = KVM_RESULT_INVALID_PARAM;
+            }
+        }
+
+        free(reply);
+    }
+
+    return result;
+}
+
 kvm_result_t
 kvm_client_open(
     kvm_client_handle_t *   h_client,
@@ -41,6 +126,8 @@ kvm_client_open(
         return KVM_RESULT_SYS_CALL_FAIL;
     }
 
+    client->accept_encoded = 0;
+
     const kvm_result_t result = kvm_transport_open(&client->h_transport, server_ip, server_port);
     if (KVM_RESULT_OK == result)
     {
@@ -50,6 +137,20 @@ kvm_client_open(
     return result;
 }
 
+kvm_result_t
+kvm_client_set_compression(
+    kvm_client_handle_t h_client,
+    uint8_t             enable)
+{
+    if (NULL == h_client)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    h_client->accept_encoded = (0 != enable);
+    return KVM_RESULT_OK;
+}
+
 kvm_result_t
 kvm_client_close(
     kvm_client_handle_t h_client)
@@ -95,6 +196,54 @@ kvm_client_put(
     uint32_t reply_size;
     uint8_t * reply;
     kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK == result)
+    {
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) (reply))->status)
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+        }
+        free(reply);
+    }
+
+    return result;
+}
+
+kvm_result_t
+kvm_client_put_ttl(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    kvm_const_dlob_data_t * value,
+    uint32_t                ttl)
+{
+    if (NULL == h_client || NULL == key || NULL == value || 0 == ttl)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_put_ttl_t) + key->size + value->size;
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_PUT_TTL, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+    uint8_t * ptr = (uint8_t *) (request + 1);
+
+    /* Setup PUT_TTL request specific data. */
+    kvm_request_put_ttl_t put_req;
+    put_req.key_size = kvm_util_host_to_transport32(key->size);
+    put_req.value_size = kvm_util_host_to_transport32(value->size);
+    put_req.ttl = kvm_util_host_to_transport32(ttl);
+    memcpy(ptr, &put_req, sizeof(put_req));
+
+    ptr += sizeof(kvm_request_put_ttl_t);
+    memcpy(ptr, key->data, key->size);
+    memcpy(ptr + key->size, value->data, value->size);
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
     if (KVM_RESULT_OK == result)
     {
         if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) (reply))->status)
@@ -119,6 +268,11 @@ kvm_client_get(
         return KVM_RESULT_INVALID_PARAM;
     }
 
+    if (h_client->accept_encoded && 0 != (kvm_transport_get_features(h_client->h_transport) & KVM_FEATURE_ENCODED_VALUES))
+    {
+        return get_encoded(h_client, key, callback, user_context);
+    }
+
     const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_get_t) + key->size;
     kvm_request_generic_t * request = prepare_request(KVM_REQUST_GET, size);
     if (NULL == request)
@@ -138,6 +292,7 @@ kvm_client_get(
     uint32_t reply_size;
     uint8_t * reply;
     kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
     if (KVM_RESULT_OK == result)
     {
         uint8_t * ptr = reply;
@@ -165,41 +320,53 @@ kvm_client_get(
 }
 
 kvm_result_t
-kvm_client_delete(
+kvm_client_put_stream_begin(
     kvm_client_handle_t     h_client,
-    kvm_const_dlob_data_t * key)
+    kvm_const_dlob_data_t * key,
+    uint32_t                value_size,
+    uint32_t                ttl,
+    uint32_t *              stream)
 {
-    if (NULL == h_client || NULL == key)
+    if (NULL == h_client || NULL == key || NULL == stream || 0 == ttl)
     {
         return KVM_RESULT_INVALID_PARAM;
     }
 
-    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_delete_t) + key->size;
-    kvm_request_generic_t * request = prepare_request(KVM_REQUST_DELETE, size);
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_put_begin_t) + key->size;
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_PUT_BEGIN, size);
     if (NULL == request)
     {
         return KVM_RESULT_SYS_CALL_FAIL;
     }
-
     uint8_t * ptr = (uint8_t *) (request + 1);
 
-    /* Setup DELETE request specific data. */
-    kvm_request_delete_t del_req;
-    del_req.key_size = kvm_util_host_to_transport32(key->size);
-    memcpy(ptr, &del_req, sizeof(del_req));
+    /* Setup PUT_BEGIN request specific data. */
+    kvm_request_put_begin_t begin_req;
+    begin_req.key_size = kvm_util_host_to_transport32(key->size);
+    begin_req.value_size = kvm_util_host_to_transport32(value_size);
+    begin_req.ttl = kvm_util_host_to_transport32(ttl);
+    memcpy(ptr, &begin_req, sizeof(begin_req));
 
-    ptr += sizeof(kvm_request_delete_t);
+    ptr += sizeof(kvm_request_put_begin_t);
     memcpy(ptr, key->data, key->size);
 
     uint32_t reply_size;
     uint8_t * reply;
     kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
     if (KVM_RESULT_OK == result)
     {
-        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) (reply))->status)
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) (reply))->status ||
+            reply_size < sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_put_begin_t))
         {
             result = KVM_RESULT_CONNECTION_FAIL;
         }
+        else
+        {
+            kvm_reply_put_begin_t begin_reply;
+            memcpy(&begin_reply, reply + sizeof(kvm_reply_generic_t), sizeof(begin_reply));
+            *stream = kvm_util_transport_to_host32(begin_reply.stream);
+        }
         free(reply);
     }
 
@@ -207,98 +374,1576 @@ kvm_client_delete(
 }
 
 kvm_result_t
-kvm_client_list_keys(
-    kvm_client_handle_t h_client,
-    kvm_data_callback_t callback,
-    void *              user_context)
+kvm_client_put_stream_write(
+    kvm_client_handle_t     h_client,
+    uint32_t                stream,
+    kvm_const_dlob_data_t * chunk)
 {
-    if (NULL == h_client || NULL == callback)
+    if (NULL == h_client || NULL == chunk)
     {
         return KVM_RESULT_INVALID_PARAM;
     }
 
-    const uint32_t size = sizeof(kvm_request_generic_t);
-    kvm_request_generic_t * request = prepare_request(KVM_REQUST_LIST, size);
+    const uint32_t first_size = (chunk->size < KVM_STREAM_CHUNK_MAX) ? chunk->size : KVM_STREAM_CHUNK_MAX;
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_PUT_CHUNK, sizeof(kvm_request_generic_t) + sizeof(kvm_request_put_chunk_t) + first_size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+    uint8_t * ptr = (uint8_t *) (request + 1);
+
+    kvm_result_t result = KVM_RESULT_OK;
+    uint32_t sent = 0;
+    do
+    {
+        const uint32_t left = chunk->size - sent;
+        const uint32_t chunk_size = (left < KVM_STREAM_CHUNK_MAX) ? left : KVM_STREAM_CHUNK_MAX;
+        const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_put_chunk_t) + chunk_size;
+
+        /* Setup PUT_CHUNK request specific data. */
+        kvm_request_put_chunk_t chunk_req;
+        chunk_req.stream = kvm_util_host_to_transport32(stream);
+        chunk_req.chunk_size = kvm_util_host_to_transport32(chunk_size);
+        memcpy(ptr, &chunk_req, sizeof(chunk_req));
+        memcpy(ptr + sizeof(chunk_req), chunk->data + sent, chunk_size);
+
+        uint32_t reply_size;
+        uint8_t * reply;
+        result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+        if (KVM_RESULT_OK == result)
+        {
+            if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) (reply))->status)
+            {
+                result = KVM_RESULT_CONNECTION_FAIL;
+            }
+            free(reply);
+        }
+
+        sent += chunk_size;
+    } while (KVM_RESULT_OK == result && sent < chunk->size);
+
+    free(request);
+    return result;
+}
+
+kvm_result_t
+kvm_client_put_stream_end(
+    kvm_client_handle_t     h_client,
+    uint32_t                stream,
+    uint8_t                 abort)
+{
+    if (NULL == h_client)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_put_end_t);
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_PUT_END, size);
     if (NULL == request)
     {
         return KVM_RESULT_SYS_CALL_FAIL;
     }
 
+    /* Setup PUT_END request specific data. */
+    kvm_request_put_end_t end_req;
+    end_req.stream = kvm_util_host_to_transport32(stream);
+    end_req.flags = (0 != abort) ? KVM_PUT_END_ABORT : 0;
+    memcpy(request + 1, &end_req, sizeof(end_req));
+
     uint32_t reply_size;
     uint8_t * reply;
     kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
     if (KVM_RESULT_OK == result)
     {
-        uint8_t * ptr = reply;
-        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) (ptr))->status)
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) (reply))->status)
         {
             result = KVM_RESULT_CONNECTION_FAIL;
         }
-        else
-        {
-            kvm_const_dlob_data_t key;
+        free(reply);
+    }
 
-            ptr += sizeof(kvm_reply_generic_t);
-            kvm_reply_list_t list_reply;
-            memcpy(&list_reply, ptr, sizeof(list_reply));
- 
-            ptr += sizeof(kvm_reply_list_t);
-            for (uint32_t i = 0; i < kvm_util_transport_to_host32(list_reply.count); ++i)
-            {
-                memcpy(&key.size, ptr, sizeof(key.size));
-                key.size = kvm_util_transport_to_host32(key.size);
-                ptr += sizeof(uint32_t);
+    return result;
+}
 
-                key.data = ptr;
-                ptr += key.size;
+kvm_result_t
+kvm_client_get_stream(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    uint32_t                chunk_size,
+    kvm_chunk_callback_t    callback,
+    void *                  user_context)
+{
+    if (NULL == h_client || NULL == key || NULL == callback || 0 == chunk_size)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
 
-                callback(user_context, &key);
-            }
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_get_range_t) + key->size;
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_GET_RANGE, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+    uint8_t * ptr = (uint8_t *) (request + 1);
+    memcpy(ptr + sizeof(kvm_request_get_range_t), key->data, key->size);
 
-            callback(user_context, NULL);
+    kvm_result_t result = KVM_RESULT_OK;
+    uint32_t offset = 0;
+    uint32_t value_size = 0;
+    uint64_t version = 0;
+    do
+    {
+        /* Setup GET_RANGE request specific data. */
+        kvm_request_get_range_t range_req;
+        range_req.key_size = kvm_util_host_to_transport32(key->size);
+        range_req.offset = kvm_util_host_to_transport32(offset);
+        range_req.max_size = kvm_util_host_to_transport32(chunk_size);
+        memcpy(ptr, &range_req, sizeof(range_req));
+
+        uint32_t reply_size;
+        uint8_t * reply;
+        result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+        if (KVM_RESULT_OK != result)
+        {
+            break;
+        }
+
+        kvm_reply_get_range_t range_reply;
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) reply)->status ||
+            reply_size < sizeof(kvm_reply_generic_t) + sizeof(range_reply))
+        {
+            free(reply);
+            result = KVM_RESULT_CONNECTION_FAIL;
+            break;
+        }
+        memcpy(&range_reply, reply + sizeof(kvm_reply_generic_t), sizeof(range_reply));
+
+        kvm_const_dlob_data_t chunk;
+        chunk.size = kvm_util_transport_to_host32(range_reply.range_size);
+        chunk.data = reply + sizeof(kvm_reply_generic_t) + sizeof(range_reply);
+
+        /* A chunk of another value, or none at all, can not continue this one. */
+        const uint64_t chunk_version = kvm_util_transport_to_host64(range_reply.version);
+        const uint32_t chunk_value_size = kvm_util_transport_to_host32(range_reply.value_size);
+        if (0 != offset && (chunk_version != version || chunk_value_size != value_size))
+        {
+            free(reply);
+            result = KVM_RESULT_CONFLICT;
+            break;
+        }
+        if (reply_size - sizeof(kvm_reply_generic_t) - sizeof(range_reply) < chunk.size ||
+            chunk_value_size - offset < chunk.size ||
+            (0 == chunk.size && offset < chunk_value_size))
+        {
+            free(reply);
+            result = KVM_RESULT_CONNECTION_FAIL;
+            break;
         }
+        version = chunk_version;
+        value_size = chunk_value_size;
+
+        callback(user_context, value_size, offset, &chunk);
+        offset += chunk.size;
         free(reply);
-    }
+    } while (offset < value_size);
 
+    free(request);
     return result;
 }
 
 kvm_result_t
-kvm_client_count(
-    kvm_client_handle_t h_client,
-    uint32_t *          count)
+kvm_client_delete(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key)
 {
-    if (NULL == h_client || NULL == count)
+    if (NULL == h_client || NULL == key)
     {
         return KVM_RESULT_INVALID_PARAM;
     }
 
-    const uint32_t size = sizeof(kvm_request_generic_t);
-    kvm_request_generic_t * request = prepare_request(KVM_REQUST_COUNT, size);
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_delete_t) + key->size;
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_DELETE, size);
     if (NULL == request)
     {
         return KVM_RESULT_SYS_CALL_FAIL;
     }
 
+    uint8_t * ptr = (uint8_t *) (request + 1);
+
+    /* Setup DELETE request specific data. */
+    kvm_request_delete_t del_req;
+    del_req.key_size = kvm_util_host_to_transport32(key->size);
+    memcpy(ptr, &del_req, sizeof(del_req));
+
+    ptr += sizeof(kvm_request_delete_t);
+    memcpy(ptr, key->data, key->size);
+
     uint32_t reply_size;
     uint8_t * reply;
     kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
     if (KVM_RESULT_OK == result)
     {
-        uint8_t * ptr = reply;
-        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) (ptr))->status)
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) (reply))->status)
         {
             result = KVM_RESULT_CONNECTION_FAIL;
         }
-        else
-        {
-            ptr += sizeof(kvm_reply_generic_t);
-            kvm_reply_count_t count_reply;
-            memcpy(&count_reply, ptr, sizeof(count_reply));
-            *count = kvm_util_transport_to_host32(count_reply.count);
-        }
         free(reply);
     }
 
     return result;
-}
\ No newline at end of file
+}
+
+kvm_result_t
+kvm_client_get_versioned(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    kvm_data_callback_t     callback,
+    void *                  user_context,
+    uint64_t *              version)
+{
+    if (NULL == h_client || NULL == key || NULL == callback || NULL == version)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_get_versioned_t) + key->size;
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_GET_VERSIONED, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+    uint8_t * ptr = (uint8_t *) (request + 1);
+
+    /* Setup GET_VERSIONED request specific data. */
+    kvm_request_get_versioned_t get_req;
+    get_req.key_size = kvm_util_host_to_transport32(key->size);
+    memcpy(ptr, &get_req, sizeof(get_req));
+
+    ptr += sizeof(kvm_request_get_versioned_t);
+    memcpy(ptr, key->data, key->size);
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK == result)
+    {
+        kvm_reply_get_versioned_t get_reply;
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) reply)->status ||
+            reply_size < sizeof(kvm_reply_generic_t) + sizeof(get_reply))
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+        }
+        else
+        {
+            memcpy(&get_reply, reply + sizeof(kvm_reply_generic_t), sizeof(get_reply));
+
+            kvm_const_dlob_data_t value;
+            value.size = kvm_util_transport_to_host32(get_reply.value_size);
+            value.data = reply + sizeof(kvm_reply_generic_t) + sizeof(get_reply);
+            if (reply_size - sizeof(kvm_reply_generic_t) - sizeof(get_reply) < value.size)
+            {
+                result = KVM_RESULT_CONNECTION_FAIL;
+            }
+            else
+            {
+                *version = kvm_util_transport_to_host64(get_reply.version);
+                callback(user_context, &value);
+            }
+        }
+
+        free(reply);
+    }
+
+    return result;
+}
+
+kvm_result_t
+kvm_client_put_if(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    kvm_const_dlob_data_t * value,
+    uint32_t                ttl,
+    kvm_condition_t         condition,
+    uint64_t                version,
+    uint64_t *              stored_version)
+{
+    if (NULL == h_client || NULL == key || NULL == value || 0 == ttl || condition > KVM_IF_PRESENT)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_put_if_t) + key->size + value->size;
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_PUT_IF, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    uint8_t * ptr = (uint8_t *) (request + 1);
+
+    /* Setup PUT_IF request specific data. */
+    kvm_request_put_if_t put_req;
+    put_req.key_size = kvm_util_host_to_transport32(key->size);
+    put_req.value_size = kvm_util_host_to_transport32(value->size);
+    put_req.ttl = kvm_util_host_to_transport32(ttl);
+    put_req.condition = condition;
+    put_req.version = kvm_util_host_to_transport64(version);
+    memcpy(ptr, &put_req, sizeof(put_req));
+
+    ptr += sizeof(kvm_request_put_if_t);
+    memcpy(ptr, key->data, key->size);
+
+    ptr += key->size;
+    memcpy(ptr, value->data, value->size);
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK == result)
+    {
+        kvm_reply_put_if_t put_reply;
+        if (KVM_REPLY_CONFLICT == ((kvm_reply_generic_t *) reply)->status)
+        {
+            result = KVM_RESULT_CONFLICT;
+        }
+        else if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) reply)->status ||
+            reply_size < sizeof(kvm_reply_generic_t) + sizeof(put_reply))
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+        }
+        else if (NULL != stored_version)
+        {
+            memcpy(&put_reply, reply + sizeof(kvm_reply_generic_t), sizeof(put_reply));
+            *stored_version = kvm_util_transport_to_host64(put_reply.version);
+        }
+        free(reply);
+    }
+
+    return result;
+}
+
+kvm_result_t
+kvm_client_delete_if(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    kvm_condition_t         condition,
+    uint64_t                version)
+{
+    if (NULL == h_client || NULL == key || (KVM_IF_VERSION != condition && KVM_IF_PRESENT != condition))
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_delete_if_t) + key->size;
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_DELETE_IF, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    uint8_t * ptr = (uint8_t *) (request + 1);
+
+    /* Setup DELETE_IF request specific data. */
+    kvm_request_delete_if_t del_req;
+    del_req.key_size = kvm_util_host_to_transport32(key->size);
+    del_req.condition = condition;
+    del_req.version = kvm_util_host_to_transport64(version);
+    memcpy(ptr, &del_req, sizeof(del_req));
+
+    ptr += sizeof(kvm_request_delete_if_t);
+    memcpy(ptr, key->data, key->size);
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK == result)
+    {
+        if (KVM_REPLY_CONFLICT == ((kvm_reply_generic_t *) reply)->status)
+        {
+            result = KVM_RESULT_CONFLICT;
+        }
+        else if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) reply)->status)
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+        }
+        free(reply);
+    }
+
+    return result;
+}
+
+kvm_result_t
+kvm_client_incr(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    int64_t                 delta,
+    int64_t *               value)
+{
+    if (NULL == h_client || NULL == key)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_incr_t) + key->size;
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_INCR, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    uint8_t * ptr = (uint8_t *) (request + 1);
+
+    /* Setup INCR request specific data. */
+    kvm_request_incr_t incr_req;
+    incr_req.key_size = kvm_util_host_to_transport32(key->size);
+    incr_req.delta = (int64_t) kvm_util_host_to_transport64((uint64_t) delta);
+    memcpy(ptr, &incr_req, sizeof(incr_req));
+
+    ptr += sizeof(kvm_request_incr_t);
+    memcpy(ptr, key->data, key->size);
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK == result)
+    {
+        kvm_reply_incr_t incr_reply;
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) reply)->status ||
+            reply_size < sizeof(kvm_reply_generic_t) + sizeof(incr_reply))
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+        }
+        else if (NULL != value)
+        {
+            memcpy(&incr_reply, reply + sizeof(kvm_reply_generic_t), sizeof(incr_reply));
+            *value = (int64_t) kvm_util_transport_to_host64((uint64_t) incr_reply.value);
+        }
+        free(reply);
+    }
+
+    return result;
+}
+
+kvm_result_t
+kvm_client_append(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    kvm_const_dlob_data_t * data,
+    uint32_t *              value_size)
+{
+    if (NULL == h_client || NULL == key || NULL == data)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_append_t) + key->size + data->size;
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_APPEND, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    uint8_t * ptr = (uint8_t *) (request + 1);
+
+    /* Setup APPEND request specific data. */
+    kvm_request_append_t append_req;
+    append_req.key_size = kvm_util_host_to_transport32(key->size);
+    append_req.value_size = kvm_util_host_to_transport32(data->size);
+    memcpy(ptr, &append_req, sizeof(append_req));
+
+    ptr += sizeof(kvm_request_append_t);
+    memcpy(ptr, key->data, key->size);
+
+    ptr += key->size;
+    memcpy(ptr, data->data, data->size);
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK == result)
+    {
+        kvm_reply_append_t append_reply;
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) reply)->status ||
+            reply_size < sizeof(kvm_reply_generic_t) + sizeof(append_reply))
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+        }
+        else if (NULL != value_size)
+        {
+            memcpy(&append_reply, reply + sizeof(kvm_reply_generic_t), sizeof(append_reply));
+            *value_size = kvm_util_transport_to_host32(append_reply.value_size);
+        }
+        free(reply);
+    }
+
+    return result;
+}
+
+kvm_result_t
+kvm_client_getset(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    kvm_const_dlob_data_t * value,
+    kvm_data_callback_t     callback,
+    void *                  user_context)
+{
+    if (NULL == h_client || NULL == key || NULL == value || NULL == callback)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_getset_t) + key->size + value->size;
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_GETSET, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    uint8_t * ptr = (uint8_t *) (request + 1);
+
+    /* Setup GETSET request specific data. */
+    kvm_request_getset_t getset_req;
+    getset_req.key_size = kvm_util_host_to_transport32(key->size);
+    getset_req.value_size = kvm_util_host_to_transport32(value->size);
+    memcpy(ptr, &getset_req, sizeof(getset_req));
+
+    ptr += sizeof(kvm_request_getset_t);
+    memcpy(ptr, key->data, key->size);
+
+    ptr += key->size;
+    memcpy(ptr, value->data, value->size);
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK == result)
+    {
+        kvm_reply_getset_t getset_reply;
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) reply)->status ||
+            reply_size < sizeof(kvm_reply_generic_t) + sizeof(getset_reply))
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+        }
+        else
+        {
+            memcpy(&getset_reply, reply + sizeof(kvm_reply_generic_t), sizeof(getset_reply));
+
+            kvm_const_dlob_data_t old_value;
+            old_value.size = kvm_util_transport_to_host32(getset_reply.value_size);
+            old_value.data = reply + sizeof(kvm_reply_generic_t) + sizeof(getset_reply);
+            if (reply_size - sizeof(kvm_reply_generic_t) - sizeof(getset_reply) < old_value.size)
+            {
+                result = KVM_RESULT_CONNECTION_FAIL;
+            }
+            else if (getset_reply.found)
+            {
+                callback(user_context, &old_value);
+            }
+        }
+        free(reply);
+    }
+
+    return result;
+}
+
+/* Appends an operation of <fields_size> fields, key and value to the batch. */
+static kvm_result_t
+batch_add(
+    kvm_batch_handle_t      h_batch,
+    kvm_request_id_t        id,
+    const void *            fields,
+    uint32_t                fields_size,
+    kvm_const_dlob_data_t * key,
+    kvm_const_dlob_data_t * value)
+{
+    const uint32_t value_size = (NULL != value) ? value->size : 0;
+    const uint64_t op_size = sizeof(kvm_request_generic_t) + (uint64_t) fields_size + key->size + value_size;
+
+    if (KVM_BATCH_MAX_OPS == h_batch->count || sizeof(uint32_t) + op_size > KVM_FRAME_MAX_SIZE - h_batch->size)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = h_batch->size + sizeof(uint32_t) + (uint32_t) op_size;
+    if (size > h_batch->capacity)
+    {
+        const uint32_t capacity = (size > 2 * h_batch->capacity) ? size : 2 * h_batch->capacity;
+        uint8_t * data = (uint8_t *) realloc(h_batch->data, capacity);
+        if (NULL == data)
+        {
+            return KVM_RESULT_SYS_CALL_FAIL;
+        }
+        h_batch->data = data;
+        h_batch->capacity = capacity;
+    }
+
+    uint8_t * ptr = h_batch->data + h_batch->size;
+    const uint32_t transport_size = kvm_util_host_to_transport32((uint32_t) op_size);
+    memcpy(ptr, &transport_size, sizeof(transport_size));
+    ptr += sizeof(transport_size);
+
+    ((kvm_request_generic_t *) ptr)->id = id;
+    ptr += sizeof(kvm_request_generic_t);
+
+    memcpy(ptr, fields, fields_size);
+    ptr += fields_size;
+    memcpy(ptr, key->data, key->size);
+    ptr += key->size;
+    if (0 != value_size)
+    {
+        memcpy(ptr, value->data, value_size);
+    }
+
+    h_batch->size = size;
+    h_batch->count++;
+
+    return KVM_RESULT_OK;
+}
+
+kvm_result_t
+kvm_client_batch_create(
+    kvm_batch_handle_t *    h_batch)
+{
+    if (NULL == h_batch)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const kvm_batch_handle_t batch = (kvm_batch_handle_t) malloc(sizeof(struct kvm_batch_s));
+    if (NULL == batch)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    batch->size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_batch_t);
+    batch->capacity = batch->size;
+    batch->count = 0;
+    batch->data = (uint8_t *) prepare_request(KVM_REQUST_BATCH, batch->capacity);
+    if (NULL == batch->data)
+    {
+        free(batch);
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    *h_batch = batch;
+    return KVM_RESULT_OK;
+}
+
+void
+kvm_client_batch_destroy(
+    kvm_batch_handle_t      h_batch)
+{
+    if (NULL != h_batch)
+    {
+        free(h_batch->data);
+        free(h_batch);
+    }
+}
+
+void
+kvm_client_batch_reset(
+    kvm_batch_handle_t      h_batch)
+{
+    if (NULL != h_batch)
+    {
+        h_batch->size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_batch_t);
+        h_batch->count = 0;
+    }
+}
+
+kvm_result_t
+kvm_client_batch_put(
+    kvm_batch_handle_t      h_batch,
+    kvm_const_dlob_data_t * key,
+    kvm_const_dlob_data_t * value,
+    uint32_t                ttl)
+{
+    if (NULL == h_batch || NULL == key || NULL == value || 0 == ttl)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    kvm_request_put_ttl_t put_req;
+    put_req.key_size = kvm_util_host_to_transport32(key->size);
+    put_req.value_size = kvm_util_host_to_transport32(value->size);
+    put_req.ttl = kvm_util_host_to_transport32(ttl);
+
+    return batch_add(h_batch, KVM_REQUST_PUT_TTL, &put_req, sizeof(put_req), key, value);
+}
+
+kvm_result_t
+kvm_client_batch_put_if(
+    kvm_batch_handle_t      h_batch,
+    kvm_const_dlob_data_t * key,
+    kvm_const_dlob_data_t * value,
+    uint32_t                ttl,
+    kvm_condition_t         condition,
+    uint64_t                version)
+{
+    if (NULL == h_batch || NULL == key || NULL == value || 0 == ttl || condition > KVM_IF_PRESENT)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    kvm_request_put_if_t put_req;
+    put_req.key_size = kvm_util_host_to_transport32(key->size);
+    put_req.value_size = kvm_util_host_to_transport32(value->size);
+    put_req.ttl = kvm_util_host_to_transport32(ttl);
+    put_req.condition = condition;
+    put_req.version = kvm_util_host_to_transport64(version);
+
+    return batch_add(h_batch, KVM_REQUST_PUT_IF, &put_req, sizeof(put_req), key, value);
+}
+
+kvm_result_t
+kvm_client_batch_get(
+    kvm_batch_handle_t      h_batch,
+    kvm_const_dlob_data_t * key)
+{
+    if (NULL == h_batch || NULL == key)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    kvm_request_get_t get_req;
+    get_req.key_size = kvm_util_host_to_transport32(key->size);
+
+    return batch_add(h_batch, KVM_REQUST_GET, &get_req, sizeof(get_req), key, NULL);
+}
+
+kvm_result_t
+kvm_client_batch_delete(
+    kvm_batch_handle_t      h_batch,
+    kvm_const_dlob_data_t * key)
+{
+    if (NULL == h_batch || NULL == key)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    kvm_request_delete_t del_req;
+    del_req.key_size = kvm_util_host_to_transport32(key->size);
+
+    return batch_add(h_batch, KVM_REQUST_DELETE, &del_req, sizeof(del_req), key, NULL);
+}
+
+kvm_result_t
+kvm_client_batch_delete_if(
+    kvm_batch_handle_t      h_batch,
+    kvm_const_dlob_data_t * key,
+    kvm_condition_t         condition,
+    uint64_t                version)
+{
+    if (NULL == h_batch || NULL == key || (KVM_IF_VERSION != condition && KVM_IF_PRESENT != condition))
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    kvm_request_delete_if_t del_req;
+    del_req.key_size = kvm_util_host_to_transport32(key->size);
+    del_req.condition = condition;
+    del_req.version = kvm_util_host_to_transport64(version);
+
+    return batch_add(h_batch, KVM_REQUST_DELETE_IF, &del_req, sizeof(del_req), key, NULL);
+}
+
+/* Maps the status of an operation reply to the result of kvm_client_xxx(). */
+static kvm_result_t batch_op_result(kvm_reply_status_t status)
+{
+    switch (status)
+    {
+        case KVM_REPLY_STATUS_OK:
+            return KVM_RESULT_OK;
+        case KVM_REPLY_NO_MEMORY:
+            return KVM_RESULT_NO_MEMORY;
+        case KVM_REPLY_CONFLICT:
+            return KVM_RESULT_CONFLICT;
+        default:
+            return KVM_RESULT_CONNECTION_FAIL;
+    }
+}
+
+kvm_result_t
+kvm_client_batch_exec(
+    kvm_client_handle_t     h_client,
+    kvm_batch_handle_t      h_batch,
+    kvm_batch_callback_t    callback,
+    void *                  user_context)
+{
+    if (NULL == h_client || NULL == h_batch || 0 == h_batch->count)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    kvm_request_batch_t batch_req;
+    batch_req.count = kvm_util_host_to_transport32(h_batch->count);
+    memcpy(h_batch->data + sizeof(kvm_request_generic_t), &batch_req, sizeof(batch_req));
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, h_batch->size, h_batch->data, &reply_size, &reply);
+    if (KVM_RESULT_OK != result)
+    {
+        return result;
+    }
+
+    /* A batch with too large replies is rejected as a whole. */
+    if (KVM_REPLY_BAD_REQUEST == ((kvm_reply_generic_t *) reply)->status)
+    {
+        free(reply);
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    kvm_reply_batch_t batch_reply;
+    if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) reply)->status ||
+        reply_size < sizeof(kvm_reply_generic_t) + sizeof(batch_reply))
+    {
+        free(reply);
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    memcpy(&batch_reply, reply + sizeof(kvm_reply_generic_t), sizeof(batch_reply));
+    const uint32_t count = kvm_util_transport_to_host32(batch_reply.count);
+
+    const uint8_t * ptr = reply + sizeof(kvm_reply_generic_t) + sizeof(batch_reply);
+    uint32_t left = reply_size - sizeof(kvm_reply_generic_t) - sizeof(batch_reply);
+
+    /* Replies follow the operations, so the requests tell GETs apart. */
+    const uint8_t * op = h_batch->data + sizeof(kvm_request_generic_t) + sizeof(kvm_request_batch_t);
+    kvm_result_t op_result = KVM_RESULT_OK;
+    for (uint32_t i = 0; i < count && i < h_batch->count; ++i)
+    {
+        uint32_t op_size;
+        memcpy(&op_size, op, sizeof(op_size));
+        op_size = kvm_util_transport_to_host32(op_size);
+        const kvm_request_id_t id = op[sizeof(op_size)];
+        op += sizeof(op_size) + op_size;
+
+        uint32_t op_reply_size;
+        if (left < sizeof(op_reply_size))
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+            break;
+        }
+        memcpy(&op_reply_size, ptr, sizeof(op_reply_size));
+        op_reply_size = kvm_util_transport_to_host32(op_reply_size);
+        ptr += sizeof(op_reply_size);
+        left -= sizeof(op_reply_size);
+
+        if (op_reply_size < sizeof(kvm_reply_generic_t) || op_reply_size > left)
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+            break;
+        }
+
+        op_result = batch_op_result(((const kvm_reply_generic_t *) ptr)->status);
+
+        kvm_const_dlob_data_t value;
+        kvm_reply_get_t get_reply;
+        const int has_value = (KVM_REQUST_GET == id && KVM_RESULT_OK == op_result &&
+            op_reply_size >= sizeof(kvm_reply_generic_t) + sizeof(get_reply));
+        if (has_value)
+        {
+            memcpy(&get_reply, ptr + sizeof(kvm_reply_generic_t), sizeof(get_reply));
+            value.size = kvm_util_transport_to_host32(get_reply.value_size);
+            value.data = ptr + sizeof(kvm_reply_generic_t) + sizeof(get_reply);
+            if (op_reply_size - sizeof(kvm_reply_generic_t) - sizeof(get_reply) < value.size)
+            {
+                result = KVM_RESULT_CONNECTION_FAIL;
+                break;
+            }
+        }
+
+        if (NULL != callback)
+        {
+            callback(user_context, i, op_result, has_value ? &value : NULL);
+        }
+
+        ptr += op_reply_size;
+        left -= op_reply_size;
+    }
+
+    if (KVM_RESULT_OK == result && !batch_reply.committed)
+    {
+        /* The last reply is the failed operation. */
+        result = (KVM_RESULT_OK != op_result) ? op_result : KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    free(reply);
+    return result;
+}
+
+kvm_result_t
+kvm_client_expire(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    uint32_t                ttl)
+{
+    if (NULL == h_client || NULL == key)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_expire_t) + key->size;
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_EXPIRE, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    uint8_t * ptr = (uint8_t *) (request + 1);
+
+    /* Setup EXPIRE request specific data. */
+    kvm_request_expire_t expire_req;
+    expire_req.key_size = kvm_util_host_to_transport32(key->size);
+    expire_req.ttl = kvm_util_host_to_transport32(ttl);
+    memcpy(ptr, &expire_req, sizeof(expire_req));
+
+    ptr += sizeof(kvm_request_expire_t);
+    memcpy(ptr, key->data, key->size);
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK == result)
+    {
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) (reply))->status)
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+        }
+        free(reply);
+    }
+
+    return result;
+}
+
+kvm_result_t
+kvm_client_ttl(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    uint32_t *              ttl)
+{
+    if (NULL == h_client || NULL == key || NULL == ttl)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_ttl_t) + key->size;
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_TTL, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    uint8_t * ptr = (uint8_t *) (request + 1);
+
+    /* Setup TTL request specific data. */
+    kvm_request_ttl_t ttl_req;
+    ttl_req.key_size = kvm_util_host_to_transport32(key->size);
+    memcpy(ptr, &ttl_req, sizeof(ttl_req));
+
+    ptr += sizeof(kvm_request_ttl_t);
+    memcpy(ptr, key->data, key->size);
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK == result)
+    {
+        uint8_t * ptr = reply;
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) (ptr))->status)
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+        }
+        else
+        {
+            ptr += sizeof(kvm_reply_generic_t);
+            kvm_reply_ttl_t ttl_reply;
+            memcpy(&ttl_reply, ptr, sizeof(ttl_reply));
+            *ttl = kvm_util_transport_to_host32(ttl_reply.ttl);
+        }
+        free(reply);
+    }
+
+    return result;
+}
+
+kvm_result_t
+kvm_client_list_keys(
+    kvm_client_handle_t h_client,
+    kvm_data_callback_t callback,
+    void *              user_context)
+{
+    if (NULL == h_client || NULL == callback)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t);
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_LIST, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK == result)
+    {
+        uint8_t * ptr = reply;
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) (ptr))->status)
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+        }
+        else
+        {
+            kvm_const_dlob_data_t key;
+
+            ptr += sizeof(kvm_reply_generic_t);
+            kvm_reply_list_t list_reply;
+            memcpy(&list_reply, ptr, sizeof(list_reply));
+ 
+            ptr += sizeof(kvm_reply_list_t);
+            for (uint32_t i = 0; i < kvm_util_transport_to_host32(list_reply.count); ++i)
+            {
+                memcpy(&key.size, ptr, sizeof(key.size));
+                key.size = kvm_util_transport_to_host32(key.size);
+                ptr += sizeof(uint32_t);
+
+                key.data = ptr;
+                ptr += key.size;
+
+                callback(user_context, &key);
+            }
+
+            callback(user_context, NULL);
+        }
+        free(reply);
+    }
+
+    return result;
+}
+
+kvm_result_t
+kvm_client_count(
+    kvm_client_handle_t h_client,
+    uint32_t *          count)
+{
+    if (NULL == h_client || NULL == count)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t);
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_COUNT, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK == result)
+    {
+        uint8_t * ptr = reply;
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) (ptr))->status)
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+        }
+        else
+        {
+            ptr += sizeof(kvm_reply_generic_t);
+            kvm_reply_count_t count_reply;
+            memcpy(&count_reply, ptr, sizeof(count_reply));
+            *count = kvm_util_transport_to_host32(count_reply.count);
+        }
+        free(reply);
+    }
+
+    return result;
+}
+
+/* Reads a histogram of STATS reply. Buckets are stored only if histogram is not NULL. */
+static kvm_result_t parse_stats_histogram(const uint8_t ** ptr, uint32_t * size, kvm_reply_stats_op_t * op, uint64_t * histogram)
+{
+    if (*size < sizeof(*op))
+    {
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+    memcpy(op, *ptr, sizeof(*op));
+    *ptr += sizeof(*op);
+    *size -= sizeof(*op);
+
+    op->requests = kvm_util_transport_to_host64(op->requests);
+    op->latency_sum = kvm_util_transport_to_host64(op->latency_sum);
+    op->bucket_count = kvm_util_transport_to_host16(op->bucket_count);
+    if (*size < (uint32_t) op->bucket_count * sizeof(kvm_reply_stats_bucket_t))
+    {
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    for (uint16_t b = 0; b < op->bucket_count; ++b)
+    {
+        kvm_reply_stats_bucket_t bucket;
+        memcpy(&bucket, *ptr, sizeof(bucket));
+        *ptr += sizeof(bucket);
+        *size -= sizeof(bucket);
+
+        const uint16_t index = kvm_util_transport_to_host16(bucket.index);
+        if (NULL != histogram && index < KVM_HISTOGRAM_BUCKETS)
+        {
+            histogram[index] = kvm_util_transport_to_host64(bucket.count);
+        }
+    }
+
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t parse_stats(const uint8_t * ptr, uint32_t size, kvm_stats_t * stats)
+{
+    kvm_reply_stats_t stats_reply;
+    if (size < sizeof(stats_reply))
+    {
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+    memcpy(&stats_reply, ptr, sizeof(stats_reply));
+    ptr += sizeof(stats_reply);
+    size -= sizeof(stats_reply);
+
+    memset(stats, 0, sizeof(*stats));
+    stats->hits = kvm_util_transport_to_host64(stats_reply.hits);
+    stats->misses = kvm_util_transport_to_host64(stats_reply.misses);
+    stats->bytes_in = kvm_util_transport_to_host64(stats_reply.bytes_in);
+    stats->bytes_out = kvm_util_transport_to_host64(stats_reply.bytes_out);
+    stats->connections_accepted = kvm_util_transport_to_host64(stats_reply.connections_accepted);
+    stats->connections_closed = kvm_util_transport_to_host64(stats_reply.connections_closed);
+    stats->keys = kvm_util_transport_to_host64(stats_reply.keys);
+    stats->used_memory = kvm_util_transport_to_host64(stats_reply.used_memory);
+    stats->evicted_keys = kvm_util_transport_to_host64(stats_reply.evicted_keys);
+
+    for (uint8_t i = 0; i < stats_reply.op_count; ++i)
+    {
+        /* Requests unknown to this library are skipped. */
+        kvm_reply_stats_op_t op;
+        const uint8_t id = (0 != size) ? ptr[0] : 0;
+        const int known = id < KVM_STATS_MAX_OPS;
+        if (KVM_RESULT_OK != parse_stats_histogram(&ptr, &size, &op, known ? stats->latency[id] : NULL))
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+
+        if (known)
+        {
+            stats->requests[id] = op.requests;
+            stats->latency_sum[id] = op.latency_sum;
+        }
+    }
+
+    /* Servers without phase statistics end here. */
+    kvm_reply_stats_phases_t phases_reply;
+    if (size < sizeof(phases_reply))
+    {
+        return KVM_RESULT_OK;
+    }
+    memcpy(&phases_reply, ptr, sizeof(phases_reply));
+    ptr += sizeof(phases_reply);
+    size -= sizeof(phases_reply);
+
+    for (uint8_t i = 0; i < phases_reply.phase_count; ++i)
+    {
+        kvm_reply_stats_op_t phase;
+        const uint8_t id = (0 != size) ? ptr[0] : 0;
+        const int known = id < KVM_STATS_PHASES;
+        if (KVM_RESULT_OK != parse_stats_histogram(&ptr, &size, &phase, known ? stats->phase[id] : NULL))
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+
+        if (known)
+        {
+            stats->phase_sum[id] = phase.latency_sum;
+        }
+    }
+
+    return KVM_RESULT_OK;
+}
+
+kvm_result_t
+kvm_client_stats(
+    kvm_client_handle_t h_client,
+    kvm_stats_t *       stats)
+{
+    if (NULL == h_client || NULL == stats)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_stats_t);
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_STATS, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK == result)
+    {
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) reply)->status)
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+        }
+        else
+        {
+            result = parse_stats(reply + sizeof(kvm_reply_generic_t), reply_size - sizeof(kvm_reply_generic_t), stats);
+        }
+        free(reply);
+    }
+
+    return result;
+}
+
+kvm_result_t
+kvm_client_slowlog(
+    kvm_client_handle_t     h_client,
+    uint8_t                 reset,
+    kvm_slowlog_callback_t  callback,
+    void *                  user_context)
+{
+    if (NULL == h_client || NULL == callback)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_slowlog_t);
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_SLOWLOG, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+    ((kvm_request_slowlog_t *) (request + 1))->flags = (0 != reset) ? KVM_SLOWLOG_FLAG_RESET : 0;
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK != result)
+    {
+        return result;
+    }
+
+    const uint8_t * ptr = reply + sizeof(kvm_reply_generic_t);
+    uint32_t left = reply_size - sizeof(kvm_reply_generic_t);
+    kvm_reply_slowlog_t slowlog_reply;
+
+    if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) reply)->status || left < sizeof(slowlog_reply))
+    {
+        free(reply);
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+    memcpy(&slowlog_reply, ptr, sizeof(slowlog_reply));
+    ptr += sizeof(slowlog_reply);
+    left -= sizeof(slowlog_reply);
+
+    const uint32_t count = kvm_util_transport_to_host32(slowlog_reply.count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        kvm_reply_slowlog_entry_t e;
+        if (left < sizeof(e))
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+            break;
+        }
+        memcpy(&e, ptr, sizeof(e));
+        ptr += sizeof(e);
+        left -= sizeof(e);
+
+        if (left < e.prefix_size || e.prefix_size > KVM_SLOWLOG_KEY_PREFIX)
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+            break;
+        }
+
+        kvm_slowlog_entry_t entry;
+        entry.id = kvm_util_transport_to_host64(e.id);
+        entry.timestamp_ms = kvm_util_transport_to_host64(e.timestamp_ms);
+        entry.duration_ns = kvm_util_transport_to_host64(e.duration_ns);
+        entry.kind = e.kind;
+        entry.op = e.op;
+        entry.fd = (int32_t) kvm_util_transport_to_host32((uint32_t) e.fd);
+        entry.key_size = kvm_util_transport_to_host32(e.key_size);
+        entry.request_size = kvm_util_transport_to_host32(e.request_size);
+        entry.reply_size = kvm_util_transport_to_host32(e.reply_size);
+        entry.prefix_size = e.prefix_size;
+        memcpy(entry.key_prefix, ptr, e.prefix_size);
+        ptr += e.prefix_size;
+        left -= e.prefix_size;
+
+        callback(user_context, &entry);
+    }
+
+    if (KVM_RESULT_OK == result)
+    {
+        callback(user_context, NULL);
+    }
+
+    free(reply);
+    return result;
+}
+
+kvm_result_t
+kvm_client_hotkeys(
+    kvm_client_handle_t     h_client,
+    uint32_t                count,
+    kvm_hotkeys_callback_t  callback,
+    void *                  user_context)
+{
+    if (NULL == h_client || NULL == callback)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_hotkeys_t);
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_HOTKEYS, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+    ((kvm_request_hotkeys_t *) (request + 1))->count = kvm_util_host_to_transport32(count);
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK != result)
+    {
+        return result;
+    }
+
+    const uint8_t * ptr = reply + sizeof(kvm_reply_generic_t);
+    uint32_t left = reply_size - sizeof(kvm_reply_generic_t);
+    kvm_reply_hotkeys_t hotkeys_reply;
+
+    if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) reply)->status || left < sizeof(hotkeys_reply))
+    {
+        free(reply);
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+    memcpy(&hotkeys_reply, ptr, sizeof(hotkeys_reply));
+    ptr += sizeof(hotkeys_reply);
+    left -= sizeof(hotkeys_reply);
+
+    const uint32_t key_count = kvm_util_transport_to_host32(hotkeys_reply.count);
+    for (uint32_t i = 0; i < key_count; ++i)
+    {
+        kvm_reply_hotkeys_entry_t e;
+        if (left < sizeof(e))
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+            break;
+        }
+        memcpy(&e, ptr, sizeof(e));
+        ptr += sizeof(e);
+        left -= sizeof(e);
+
+        if (left < e.prefix_size || e.prefix_size > KVM_HOTKEYS_KEY_PREFIX)
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+            break;
+        }
+
+        kvm_hotkey_t key;
+        key.hits = kvm_util_transport_to_host64(e.hits);
+        key.rate = kvm_util_transport_to_host32(e.rate);
+        key.key_size = kvm_util_transport_to_host32(e.key_size);
+        key.prefix_size = e.prefix_size;
+        memcpy(key.key_prefix, ptr, e.prefix_size);
+        ptr += e.prefix_size;
+        left -= e.prefix_size;
+
+        callback(user_context, &key);
+    }
+
+    if (KVM_RESULT_OK == result)
+    {
+        callback(user_context, NULL);
+    }
+
+    free(reply);
+    return result;
+}
+
+kvm_result_t
+kvm_client_memory(
+    kvm_client_handle_t     h_client,
+    kvm_memory_t *          memory)
+{
+    if (NULL == h_client || NULL == memory)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t);
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_MEMORY, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK == result)
+    {
+        kvm_reply_memory_t memory_reply;
+        if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) reply)->status ||
+            reply_size < sizeof(kvm_reply_generic_t) + sizeof(memory_reply))
+        {
+            result = KVM_RESULT_CONNECTION_FAIL;
+        }
+        else
+        {
+            memcpy(&memory_reply, reply + sizeof(kvm_reply_generic_t), sizeof(memory_reply));
+            memory->keys = kvm_util_transport_to_host64(memory_reply.keys);
+            memory->values = kvm_util_transport_to_host64(memory_reply.values);
+            memory->entry_headers = kvm_util_transport_to_host64(memory_reply.entry_headers);
+            memory->entry_slack = kvm_util_transport_to_host64(memory_reply.entry_slack);
+            memory->buckets = kvm_util_transport_to_host64(memory_reply.buckets);
+            memory->uploads = kvm_util_transport_to_host64(memory_reply.uploads);
+            memory->undo_log = kvm_util_transport_to_host64(memory_reply.undo_log);
+            memory->retired = kvm_util_transport_to_host64(memory_reply.retired);
+            memory->connections = kvm_util_transport_to_host64(memory_reply.connections);
+            memory->rss = kvm_util_transport_to_host64(memory_reply.rss);
+            memory->heap_in_use = kvm_util_transport_to_host64(memory_reply.heap_in_use);
+            memory->heap_free = kvm_util_transport_to_host64(memory_reply.heap_free);
+            memory->heap_releasable = kvm_util_transport_to_host64(memory_reply.heap_releasable);
+        }
+        free(reply);
+    }
+
+    return result;
+}
+
+kvm_result_t
+kvm_client_scan(
+    kvm_client_handle_t     h_client,
+    uint32_t *              cursor,
+    uint32_t                max_bytes,
+    kvm_scan_callback_t     callback,
+    void *                  user_context)
+{
+    if (NULL == h_client || NULL == cursor || NULL == callback || 0 == max_bytes || max_bytes > KVM_SCAN_MAX_BYTES)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const uint32_t size = sizeof(kvm_request_generic_t) + sizeof(kvm_request_scan_t);
+    kvm_request_generic_t * request = prepare_request(KVM_REQUST_SCAN, size);
+    if (NULL == request)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    kvm_request_scan_t scan_req;
+    scan_req.cursor = kvm_util_host_to_transport32(*cursor);
+    scan_req.max_bytes = kvm_util_host_to_transport32(max_bytes);
+    memcpy(request + 1, &scan_req, sizeof(scan_req));
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    kvm_result_t result = kvm_transport_send(h_client->h_transport, size, (uint8_t *) request, &reply_size, &reply);
+    free(request);
+    if (KVM_RESULT_OK != result)
+    {
+        return result;
+    }
+
+    kvm_reply_scan_t scan_reply;
+    if (KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) reply)->status ||
+        reply_size < sizeof(kvm_reply_generic_t) + sizeof(scan_reply))
+    {
+        free(reply);
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    memcpy(&scan_reply, reply + sizeof(kvm_reply_generic_t), sizeof(scan_reply));
+    const uint32_t count = kvm_util_transport_to_host32(scan_reply.count);
+
+    const uint8_t * ptr = reply + sizeof(kvm_reply_generic_t) + sizeof(scan_reply);
+    uint32_t left = reply_size - sizeof(kvm_reply_generic_t) - sizeof(scan_reply);
+
+    /* The whole page is checked first, so a broken one provides nothing. */
+    for (uint32_t pass = 0; pass < 2 && KVM_RESULT_OK == result; ++pass)
+    {
+        const uint8_t * entry_ptr = ptr;
+        uint32_t entry_left = left;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            uint32_t entry_size;
+            kvm_reply_scan_entry_t entry;
+            if (entry_left < sizeof(entry_size))
+            {
+                result = KVM_RESULT_CONNECTION_FAIL;
+                break;
+            }
+            memcpy(&entry_size, entry_ptr, sizeof(entry_size));
+            entry_size = kvm_util_transport_to_host32(entry_size);
+            entry_ptr += sizeof(entry_size);
+            entry_left -= sizeof(entry_size);
+
+            if (entry_size < sizeof(entry) || entry_size > entry_left)
+            {
+                result = KVM_RESULT_CONNECTION_FAIL;
+                break;
+            }
+            memcpy(&entry, entry_ptr, sizeof(entry));
+
+            kvm_const_dlob_data_t key;
+            kvm_const_dlob_data_t value;
+            key.size = kvm_util_transport_to_host32(entry.key_size);
+            key.data = entry_ptr + sizeof(entry);
+            value.size = kvm_util_transport_to_host32(entry.value_size);
+            value.data = key.data + key.size;
+
+            const uint64_t data_size = (uint64_t) key.size + (entry.has_value ? value.size : 0);
+            if (sizeof(entry) + data_size != entry_size)
+            {
+                result = KVM_RESULT_CONNECTION_FAIL;
+                break;
+            }
+
+            if (1 == pass)
+            {
+                callback(user_context, &key, entry.has_value ? &value : NULL, value.size, kvm_util_transport_to_host32(entry.ttl));
+            }
+
+            entry_ptr += entry_size;
+            entry_left -= entry_size;
+        }
+    }
+
+    if (KVM_RESULT_OK == result)
+    {
+        *cursor = kvm_util_transport_to_host32(scan_reply.cursor);
+    }
+
+    free(reply);
+    return result;
+}
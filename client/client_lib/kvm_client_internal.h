@@ -19,6 +19,16 @@ extern "C"
 struct kvm_client_s
 {
     kvm_transport_handle_t h_transport;
+    uint8_t accept_encoded;     /* Values are received as stored by server and decoded locally */
+};
+
+/* Batch context, data is a BATCH request with the count set on exec */
+struct kvm_batch_s
+{
+    uint8_t * data;
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t count;
 };
 
 #ifdef __cplusplus
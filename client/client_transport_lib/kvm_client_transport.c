@@ -8,12 +8,33 @@
 #include<string.h>
 #include<unistd.h>
 
+#include <poll.h>
 #include <stdlib.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
 #include <arpa/inet.h>
 
+#include "kvm_requests.h"
+#include "kvm_replies.h"
+#include "kvm_utils.h"
+#include "kvm_protocol.h"
 #include "kvm_client_transport.h"
 #include "kvm_client_transport_internal.h"
+#include "kvm_probes.h"
+
+static kvm_result_t connect_server(const char * server_ip, uint16_t server_port, int * client_socket);
+static kvm_result_t attach_shm(kvm_transport_handle_t h_transport);
+static kvm_result_t negotiate(kvm_transport_handle_t h_transport);
+static kvm_result_t write_frame(kvm_transport_handle_t h_transport, const uint8_t * header, uint32_t header_size, const uint8_t * body, uint32_t body_size);
+static kvm_result_t write_shm(kvm_transport_handle_t h_transport, const uint8_t * data, uint32_t size);
+static ssize_t receive(kvm_transport_handle_t h_transport, uint8_t * buffer, uint32_t size);
+static kvm_result_t read_all(kvm_transport_handle_t h_transport, uint8_t * buffer, uint32_t size);
+static int is_server_alive(int client_socket);
+static kvm_result_t send_v1(kvm_transport_handle_t h_transport, uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t send_v2(kvm_transport_handle_t h_transport, uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t decode_reply(kvm_request_id_t id, const uint8_t * data, uint32_t size, uint32_t * reply_size, uint8_t ** reply);
 
 kvm_result_t
 kvm_transport_open(
@@ -32,23 +53,35 @@ kvm_transport_open(
         return KVM_RESULT_SYS_CALL_FAIL;
     }
 
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = inet_addr(server_ip);
-    server_addr.sin_port = htons(server_port);
+    transport->version = KVM_PROTOCOL_V1;
+    transport->features = 0;
+    transport->shm = NULL;
+    transport->encode_buffer = NULL;
 
-    transport->client_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (-1 == transport->client_socket)
+    kvm_result_t result = connect_server(server_ip, server_port, &transport->client_socket);
+    if (KVM_RESULT_OK != result)
     {
+        transport->client_socket = -1;
         kvm_transport_close(transport);
-        return KVM_RESULT_SYS_CALL_FAIL;
+        return result;
+    }
+    KVM_PROBE1(client_connect, transport->client_socket);
+
+    if (0 == strncmp(server_ip, KVM_SHM_ADDRESS_PREFIX, sizeof(KVM_SHM_ADDRESS_PREFIX) - 1))
+    {
+        result = attach_shm(transport);
+        if (KVM_RESULT_OK != result)
+        {
+            kvm_transport_close(transport);
+            return result;
+        }
     }
 
-    if (-1 == connect(transport->client_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)))
+    result = negotiate(transport);
+    if (KVM_RESULT_OK != result)
     {
         kvm_transport_close(transport);
-        return KVM_RESULT_CONNECTION_FAIL;
+        return result;
     }
 
     *h_transport = transport;
@@ -67,11 +100,26 @@ kvm_transport_close(
             close(h_transport->client_socket);
         }
 
+        if (NULL != h_transport->shm)
+        {
+            close(h_transport->shm->request.wake_fd);
+            kvm_shm_unmap(h_transport->shm);
+            free(h_transport->shm);
+        }
+
+        free(h_transport->encode_buffer);
         free(h_transport);
     }
     return KVM_RESULT_OK;
 }
 
+uint32_t
+kvm_transport_get_features(
+    kvm_transport_handle_t h_transport)
+{
+    return (NULL != h_transport) ? h_transport->features : 0;
+}
+
 kvm_result_t
 kvm_transport_send(
     kvm_transport_handle_t  h_transport,
@@ -85,38 +133,508 @@ kvm_transport_send(
         return KVM_RESULT_INVALID_PARAM;
     }
 
-    if (-1 == send(h_transport->client_socket, (char *) &request_size, sizeof(request_size), 0))
+    KVM_PROBE2(client_request_start, request[0], request_size);
+
+    kvm_result_t result;
+    if (KVM_PROTOCOL_V2 == h_transport->version)
+    {
+        result = send_v2(h_transport, request_size, request, reply_size, reply);
+    }
+    else
+    {
+        result = send_v1(h_transport, request_size, request, reply_size, reply);
+    }
+
+    KVM_PROBE3(client_request_done, request[0], result, (KVM_RESULT_OK == result) ? *reply_size : 0);
+    return result;
+}
+
+/* Connects over TCP, or over a Unix domain socket for "unix:<path>" and
+   "shm:<path>" addresses. */
+static kvm_result_t connect_server(const char * server_ip, uint16_t server_port, int * client_socket)
+{
+    size_t prefix_size = sizeof(KVM_UNIX_ADDRESS_PREFIX) - 1;
+    int is_unix = (0 == strncmp(server_ip, KVM_UNIX_ADDRESS_PREFIX, prefix_size));
+    if (!is_unix)
+    {
+        prefix_size = sizeof(KVM_SHM_ADDRESS_PREFIX) - 1;
+        is_unix = (0 == strncmp(server_ip, KVM_SHM_ADDRESS_PREFIX, prefix_size));
+    }
+
+    struct sockaddr_storage server_addr;
+    socklen_t server_addr_size;
+    memset(&server_addr, 0, sizeof(server_addr));
+
+    if (is_unix)
+    {
+        struct sockaddr_un * addr = (struct sockaddr_un *) &server_addr;
+        const char * path = server_ip + prefix_size;
+        if ('\0' == path[0] || strlen(path) >= sizeof(addr->sun_path))
+        {
+            return KVM_RESULT_INVALID_PARAM;
+        }
+        addr->sun_family = AF_UNIX;
+        strcpy(addr->sun_path, path);
+        server_addr_size = sizeof(*addr);
+    }
+    else
+    {
+        struct sockaddr_in * addr = (struct sockaddr_in *) &server_addr;
+        addr->sin_family = AF_INET;
+        addr->sin_addr.s_addr = inet_addr(server_ip);
+        addr->sin_port = htons(server_port);
+        server_addr_size = sizeof(*addr);
+    }
+
+    const int s = socket(server_addr.ss_family, SOCK_STREAM, 0);
+    if (-1 == s)
     {
         return KVM_RESULT_SYS_CALL_FAIL;
     }
 
-    if (-1 == send(h_transport->client_socket, request, request_size, 0))
+    if (-1 == connect(s, (struct sockaddr *) &server_addr, server_addr_size))
+    {
+        close(s);
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    *client_socket = s;
+    return KVM_RESULT_OK;
+}
+
+/* Passes the rings and the wake descriptor to the server over the socket.
+   Frames after the reply go through the rings. */
+static kvm_result_t attach_shm(kvm_transport_handle_t h_transport)
+{
+    kvm_shm_t * shm = (kvm_shm_t *) malloc(sizeof(*shm));
+    if (NULL == shm)
     {
         return KVM_RESULT_SYS_CALL_FAIL;
     }
 
-    uint32_t size;
-    uint32_t read_len = read(h_transport->client_socket, &size, sizeof(size));
-    if (read_len == -1)
+    int fds[2];
+    kvm_result_t result = kvm_shm_create(KVM_SHM_RING_SIZE_DEFAULT, shm, &fds[0]);
+    if (KVM_RESULT_OK != result)
     {
+        free(shm);
+        return result;
+    }
+
+    fds[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (-1 == fds[1])
+    {
+        close(fds[0]);
+        kvm_shm_unmap(shm);
+        free(shm);
         return KVM_RESULT_SYS_CALL_FAIL;
     }
 
+    uint8_t request[sizeof(kvm_request_generic_t) + sizeof(kvm_request_shm_attach_t)];
+    ((kvm_request_generic_t *) request)->id = KVM_REQUST_SHM_ATTACH;
+
+    kvm_request_shm_attach_t attach_req;
+    attach_req.ring_size = kvm_util_host_to_transport32(KVM_SHM_RING_SIZE_DEFAULT);
+    memcpy(request + sizeof(kvm_request_generic_t), &attach_req, sizeof(attach_req));
+
+    uint32_t size = kvm_util_host_to_transport32(sizeof(request));
+    struct iovec iov[2];
+    iov[0].iov_base = &size;
+    iov[0].iov_len = sizeof(size);
+    iov[1].iov_base = request;
+    iov[1].iov_len = sizeof(request);
+
+    union
+    {
+        struct cmsghdr  header;
+        uint8_t         data[CMSG_SPACE(sizeof(fds))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    /* The frame is tiny, a Unix domain socket takes it in one call. */
+    const ssize_t sent = sendmsg(h_transport->client_socket, &msg, 0);
+    close(fds[0]);
+
+    uint8_t reply[sizeof(kvm_reply_generic_t)];
+    result = (sizeof(size) + sizeof(request) == (size_t) sent) ? KVM_RESULT_OK : KVM_RESULT_CONNECTION_FAIL;
+    if (KVM_RESULT_OK == result)
+    {
+        result = read_all(h_transport, (uint8_t *) &size, sizeof(size));
+    }
+    if (KVM_RESULT_OK == result && sizeof(reply) != kvm_util_transport_to_host32(size))
+    {
+        result = KVM_RESULT_CONNECTION_FAIL;
+    }
+    if (KVM_RESULT_OK == result)
+    {
+        result = read_all(h_transport, reply, sizeof(reply));
+    }
+    if (KVM_RESULT_OK == result && KVM_REPLY_STATUS_OK != ((kvm_reply_generic_t *) reply)->status)
+    {
+        /* Server is too old or does not accept shared memory clients. */
+        result = KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    if (KVM_RESULT_OK != result)
+    {
+        close(fds[1]);
+        kvm_shm_unmap(shm);
+        free(shm);
+        return result;
+    }
+
+    shm->request.wake_fd = fds[1];
+    h_transport->shm = shm;
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t negotiate(kvm_transport_handle_t h_transport)
+{
+    uint8_t request[sizeof(kvm_request_generic_t) + sizeof(kvm_request_hello_t)];
+    ((kvm_request_generic_t *) request)->id = KVM_REQUST_HELLO;
+
+    kvm_request_hello_t hello_req;
+    hello_req.version = KVM_PROTOCOL_VERSION;
+    hello_req.features = kvm_util_host_to_transport32(KVM_FEATURES_SUPPORTED);
+    memcpy(request + sizeof(kvm_request_generic_t), &hello_req, sizeof(hello_req));
+
+    uint32_t reply_size;
+    uint8_t * reply;
+    const kvm_result_t result = send_v1(h_transport, sizeof(request), request, &reply_size, &reply);
+    if (KVM_RESULT_OK != result)
+    {
+        return result;
+    }
+
+    /* Servers without HELLO reply KVM_REPLY_BAD_REQUEST, stay with v1 then. */
+    if (sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_hello_t) == reply_size &&
+        KVM_REPLY_STATUS_OK == ((kvm_reply_generic_t *) reply)->status)
+    {
+        kvm_reply_hello_t hello_reply;
+        memcpy(&hello_reply, reply + sizeof(kvm_reply_generic_t), sizeof(hello_reply));
+
+        if (KVM_PROTOCOL_V1 <= hello_reply.version && KVM_PROTOCOL_VERSION >= hello_reply.version)
+        {
+            h_transport->version = hello_reply.version;
+            h_transport->features = kvm_util_transport_to_host32(hello_reply.features) & KVM_FEATURES_SUPPORTED;
+        }
+    }
+
+    free(reply);
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t send_v1(kvm_transport_handle_t h_transport, uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply)
+{
+    uint32_t size = kvm_util_host_to_transport32(request_size);
+    kvm_result_t result = write_frame(h_transport, (const uint8_t *) &size, sizeof(size), request, request_size);
+    if (KVM_RESULT_OK != result)
+    {
+        return result;
+    }
+
+    result = read_all(h_transport, (uint8_t *) &size, sizeof(size));
+    if (KVM_RESULT_OK != result)
+    {
+        return result;
+    }
+    size = kvm_util_transport_to_host32(size);
+
+    if (0 == size || size > KVM_FRAME_MAX_SIZE)
+    {
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+
     uint8_t * buff = malloc(size);
     if (NULL == buff)
     {
         return KVM_RESULT_SYS_CALL_FAIL;
     }
 
-    read_len = read(h_transport->client_socket, buff, size);
-    if (read_len == -1)
+    result = read_all(h_transport, buff, size);
+    if (KVM_RESULT_OK != result)
     {
         free(buff);
-        return KVM_RESULT_SYS_CALL_FAIL;
+        return result;
     }
 
     *reply_size = size;
     *reply = buff;
 
     return KVM_RESULT_OK;
-}
\ No newline at end of file
+}
+
+static kvm_result_t send_v2(kvm_transport_handle_t h_transport, uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply)
+{
+    const kvm_request_id_t id = ((const kvm_request_generic_t *) request)->id;
+
+    /* A single pass into the kept buffer, or one sized by the bound. */
+    uint32_t capacity = KVM_PROTOCOL_V2_MAX_SIZE(request_size);
+    uint8_t * encoded = NULL;
+    if (capacity <= CONVERT_BUFFER_SIZE)
+    {
+        if (NULL == h_transport->encode_buffer)
+        {
+            h_transport->encode_buffer = (uint8_t *) malloc(CONVERT_BUFFER_SIZE);
+        }
+        capacity = CONVERT_BUFFER_SIZE;
+        encoded = h_transport->encode_buffer;
+    }
+    else
+    {
+        encoded = (uint8_t *) malloc(capacity);
+    }
+
+    if (NULL == encoded)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    uint32_t encoded_size;
+    kvm_result_t result = kvm_protocol_request_to_v2(request, request_size, encoded, capacity, &encoded_size);
+    if (KVM_RESULT_OK != result)
+    {
+        if (encoded != h_transport->encode_buffer)
+        {
+            free(encoded);
+        }
+        return result;
+    }
+
+    uint8_t header[KVM_FRAME_V2_HEADER_MAX_SIZE];
+    uint32_t header_size = kvm_varint_encode(encoded_size + 1, header);
+    header[header_size++] = KVM_FRAME_FLAGS_NONE;
+
+    result = write_frame(h_transport, header, header_size, encoded, encoded_size);
+    if (encoded != h_transport->encode_buffer)
+    {
+        free(encoded);
+    }
+    if (KVM_RESULT_OK != result)
+    {
+        return result;
+    }
+
+    /* Only one reply is outstanding, so reading ahead can not take bytes
+       of the next one. Small replies arrive with a single read. */
+    ssize_t received = 0;
+    uint32_t frame_size;
+    uint32_t varint_size;
+    uint8_t small[SMALL_FRAME_SIZE];
+    do
+    {
+        const ssize_t read_len = receive(h_transport, small + received, sizeof(small) - received);
+        if (read_len <= 0)
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+        received += read_len;
+
+        result = kvm_varint_decode(small, received, &frame_size, &varint_size);
+    } while (KVM_RESULT_CONNECTION_FAIL == result);
+
+    if (KVM_RESULT_OK != result || 0 == frame_size || frame_size > KVM_FRAME_MAX_SIZE)
+    {
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    const uint32_t buffered = received - varint_size;
+    if (buffered > frame_size)
+    {
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    uint8_t * frame = small + varint_size;
+    if (buffered < frame_size)
+    {
+        frame = (uint8_t *) malloc(frame_size);
+        if (NULL == frame)
+        {
+            return KVM_RESULT_SYS_CALL_FAIL;
+        }
+
+        memcpy(frame, small + varint_size, buffered);
+        result = read_all(h_transport, frame + buffered, frame_size - buffered);
+    }
+
+    if (KVM_RESULT_OK == result && KVM_FRAME_FLAGS_NONE != frame[0])
+    {
+        result = KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    if (KVM_RESULT_OK == result)
+    {
+        result = decode_reply(id, frame + 1, frame_size - 1, reply_size, reply);
+    }
+
+    if (frame != small + varint_size)
+    {
+        free(frame);
+    }
+
+    return result;
+}
+
+/* Converts a v2 reply in one pass, into a buffer with room for its fields
+   to widen. Only replies with many fields, like LIST, take a second one. */
+static kvm_result_t decode_reply(kvm_request_id_t id, const uint8_t * data, uint32_t size, uint32_t * reply_size, uint8_t ** reply)
+{
+    uint32_t capacity = size + KVM_PROTOCOL_V1_SLACK;
+    uint32_t decoded_size;
+    uint8_t * decoded = (uint8_t *) malloc(capacity);
+    kvm_result_t result = (NULL != decoded) ? kvm_protocol_reply_from_v2(id, data, size, decoded, capacity, &decoded_size) : KVM_RESULT_SYS_CALL_FAIL;
+    if (KVM_RESULT_OK == result && decoded_size > capacity)
+    {
+        free(decoded);
+        capacity = decoded_size;
+        decoded = (uint8_t *) malloc(capacity);
+        result = (NULL != decoded) ? kvm_protocol_reply_from_v2(id, data, size, decoded, capacity, &decoded_size) : KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    if (KVM_RESULT_OK != result)
+    {
+        free(decoded);
+        return result;
+    }
+
+    *reply_size = decoded_size;
+    *reply = decoded;
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t write_frame(kvm_transport_handle_t h_transport, const uint8_t * header, uint32_t header_size, const uint8_t * body, uint32_t body_size)
+{
+    if (NULL != h_transport->shm)
+    {
+        const kvm_result_t result = write_shm(h_transport, header, header_size);
+        return (KVM_RESULT_OK == result) ? write_shm(h_transport, body, body_size) : result;
+    }
+
+    const int client_socket = h_transport->client_socket;
+    struct iovec iov[2];
+    iov[0].iov_base = (void *) header;
+    iov[0].iov_len = header_size;
+    iov[1].iov_base = (void *) body;
+    iov[1].iov_len = body_size;
+
+    /* Header and body go in a single system call. */
+    struct iovec * current = iov;
+    int count = 2;
+    while (0 != count)
+    {
+        ssize_t written = writev(client_socket, current, count);
+        if (written <= 0)
+        {
+            return KVM_RESULT_SYS_CALL_FAIL;
+        }
+
+        while (0 != count && (size_t) written >= current->iov_len)
+        {
+            written -= current->iov_len;
+            current++;
+            count--;
+        }
+
+        if (0 != count)
+        {
+            current->iov_base = (uint8_t *) current->iov_base + written;
+            current->iov_len -= written;
+        }
+    }
+
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t write_shm(kvm_transport_handle_t h_transport, const uint8_t * data, uint32_t size)
+{
+    kvm_shm_ring_t * ring = &h_transport->shm->request;
+    while (0 != size)
+    {
+        uint32_t written;
+        if (KVM_RESULT_OK != kvm_shm_ring_write(ring, data, size, &written))
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+        data += written;
+        size -= written;
+
+        while (0 != size && KVM_RESULT_OK != kvm_shm_ring_wait_writable(ring, SHM_SPIN_NS, SHM_LIVENESS_PERIOD_MS))
+        {
+            if (!is_server_alive(h_transport->client_socket))
+            {
+                return KVM_RESULT_CONNECTION_FAIL;
+            }
+        }
+    }
+
+    return KVM_RESULT_OK;
+}
+
+/* Reads what is available, waits for at least one byte. */
+static ssize_t receive(kvm_transport_handle_t h_transport, uint8_t * buffer, uint32_t size)
+{
+    if (NULL == h_transport->shm)
+    {
+        return read(h_transport->client_socket, buffer, size);
+    }
+
+    kvm_shm_ring_t * ring = &h_transport->shm->reply;
+    while (1)
+    {
+        uint32_t read_len;
+        if (KVM_RESULT_OK != kvm_shm_ring_read(ring, buffer, size, &read_len))
+        {
+            return -1;
+        }
+        if (0 != read_len)
+        {
+            return read_len;
+        }
+
+        if (KVM_RESULT_OK != kvm_shm_ring_wait_readable(ring, SHM_SPIN_NS, SHM_LIVENESS_PERIOD_MS) &&
+            !is_server_alive(h_transport->client_socket))
+        {
+            return -1;
+        }
+    }
+}
+
+/* The server does not write to the socket of a shared memory client, so
+   a readable socket means it is closed. */
+static int is_server_alive(int client_socket)
+{
+    struct pollfd fd;
+    fd.fd = client_socket;
+    fd.events = POLLIN;
+    fd.revents = 0;
+    return 0 == poll(&fd, 1, 0);
+}
+
+static kvm_result_t read_all(kvm_transport_handle_t h_transport, uint8_t * buffer, uint32_t size)
+{
+    while (0 != size)
+    {
+        const ssize_t read_len = receive(h_transport, buffer, size);
+        if (read_len <= 0)
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+
+        buffer += read_len;
+        size -= read_len;
+    }
+
+    return KVM_RESULT_OK;
+}
@@ -8,6 +8,10 @@
 #ifndef __kvm_client_transport_internal_h__
 #define __kvm_client_transport_internal_h__
 
+#include <stdint.h>
+
+#include "kvm_shm.h"
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -17,8 +21,26 @@ extern "C"
 struct kvm_transprot_s
 {
     int client_socket;
+    uint8_t version;        /* KVM_PROTOCOL_VXXX negotiated with the server */
+    uint32_t features;      /* KVM_FEATURE_XXX negotiated with the server */
+    kvm_shm_t * shm;        /* Frames go through shared memory rings if not NULL */
+    uint8_t * encode_buffer;    /* v2 requests up to CONVERT_BUFFER_SIZE, allocated on first use */
 };
 
+/* Replies up to this size are received with a single read */
+#define SMALL_FRAME_SIZE 256
+
+/* v2 requests up to this size are encoded in a buffer kept by the
+   transport, larger ones in their own */
+#define CONVERT_BUFFER_SIZE (16 * 1024)
+
+/* Time to poll the reply ring before sleeping. Replies to small requests
+   arrive within it when the server polls its rings too. */
+#define SHM_SPIN_NS 50000
+
+/* Sleeps on the rings are cut to check that the server is still there */
+#define SHM_LIVENESS_PERIOD_MS 100
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
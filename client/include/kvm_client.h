@@ -9,6 +9,7 @@
 #define __kvm_client_h__
 
 #include "kvm_results.h"
+#include "kvm_stats.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -16,6 +17,7 @@ extern "C"
 #endif /* __cplusplus */
 
 typedef struct kvm_client_s * kvm_client_handle_t;
+typedef struct kvm_batch_s * kvm_batch_handle_t;
 
 typedef struct kvm_const_dlob_data_s
 {
@@ -28,14 +30,49 @@ typedef void (* kvm_data_callback_t)(
     void *                          context,
     const kvm_const_dlob_data_t *   data);
 
+/**< Slow log entry provider callback type */
+typedef void (* kvm_slowlog_callback_t)(
+    void *                          context,
+    const kvm_slowlog_entry_t *     entry);
+
+/**< Hot key provider callback type */
+typedef void (* kvm_hotkeys_callback_t)(
+    void *                          context,
+    const kvm_hotkey_t *            key);
+
+/**< Value chunk provider callback type */
+typedef void (* kvm_chunk_callback_t)(
+    void *                          context,
+    uint32_t                        value_size,
+    uint32_t                        offset,
+    const kvm_const_dlob_data_t *   chunk);
+
+/**< Batch operation result provider callback type */
+typedef void (* kvm_batch_callback_t)(
+    void *                          context,
+    uint32_t                        index,
+    kvm_result_t                    result,
+    const kvm_const_dlob_data_t *   value);
+
+/**< Scanned pair provider callback type, value is NULL if it was left out
+     of the page and has to be read by kvm_client_get_stream() */
+typedef void (* kvm_scan_callback_t)(
+    void *                          context,
+    const kvm_const_dlob_data_t *   key,
+    const kvm_const_dlob_data_t *   value,
+    uint32_t                        value_size,
+    uint32_t                        ttl);
 
 /*!
 *******************************************************************************
 ** Opens the client to work with Key/Value Management System.
 **
 ** @param[out]  h_client        Pinter where opened client handle will be stored.
-** @param[in]   server_ip       Zero terminated IP address of the server.
-** @param[in]   server_port     Server port.
+** @param[in]   server_ip       Zero terminated IP address of the server, or
+**                              "unix:<path>" for a Unix domain socket of a
+**                              server on the same host, or "shm:<path>" for
+**                              shared memory rings attached over it.
+** @param[in]   server_port     Server port, ignored for a Unix domain socket.
 **
 ** @return
 **      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
@@ -59,6 +96,24 @@ kvm_result_t
 kvm_client_close(
     kvm_client_handle_t h_client);
 
+/*!
+*******************************************************************************
+** Enables or disables receiving of compressed values. When enabled, values
+** compressed by the server are transferred as is and decompressed by the
+** client library. Disabled by default. Has no effect if the server does
+** not support it.
+**
+** @param[in]   h_client    Client handle.
+** @param[in]   enable      Non zero to enable, 0 to disable.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_set_compression(
+    kvm_client_handle_t h_client,
+    uint8_t             enable);
+
 /*!
 *******************************************************************************
 ** Sends key/value pair to Key/Value Management System to store.
@@ -77,6 +132,27 @@ kvm_client_put(
     kvm_const_dlob_data_t * key,
     kvm_const_dlob_data_t * value);
 
+/*!
+*******************************************************************************
+** Sends key/value pair to Key/Value Management System to store for limited time.
+** If key already exists, it will be overriden.
+**
+** @param[in]   h_client    Client handle.
+** @param[in]   key         Blob containig key.
+** @param[in]   value       Blob containig value.
+** @param[in]   ttl         Time to live in milliseconds. Must not be 0.
+**                          KVM_TTL_PERSIST stores the pair without expiration.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_put_ttl(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    kvm_const_dlob_data_t * value,
+    uint32_t                ttl);
+
 /*!
 *******************************************************************************
 ** Gets value by specified key from Key/Value Management System.
@@ -96,6 +172,96 @@ kvm_client_get(
     kvm_data_callback_t     callback,
     void *                  user_context);
 
+/*!
+*******************************************************************************
+** Starts storing a value too large to be sent at once. The value is sent by
+** kvm_client_put_stream_write() calls and stored by
+** kvm_client_put_stream_end(), replacing an existing key at once. The
+** server reserves the memory for the whole value up front and drops the
+** upload if the client disconnects.
+**
+** @param[in]   h_client    Client handle.
+** @param[in]   key         Blob containig key.
+** @param[in]   value_size  Total size of the value.
+** @param[in]   ttl         Time to live in milliseconds or KVM_TTL_PERSIST.
+**                          Must not be 0.
+** @param[out]  stream      Pointer where the upload id will be stored.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_put_stream_begin(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    uint32_t                value_size,
+    uint32_t                ttl,
+    uint32_t *              stream);
+
+/*!
+*******************************************************************************
+** Sends the next part of a value started by kvm_client_put_stream_begin().
+** Parts larger than KVM_STREAM_CHUNK_MAX are split.
+**
+** @param[in]   h_client    Client handle.
+** @param[in]   stream      Upload id.
+** @param[in]   chunk       Blob containig the part of the value.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_put_stream_write(
+    kvm_client_handle_t     h_client,
+    uint32_t                stream,
+    kvm_const_dlob_data_t * chunk);
+
+/*!
+*******************************************************************************
+** Stores or drops the value sent by kvm_client_put_stream_write(). The
+** upload id is invalid afterwards, whatever the result.
+**
+** @param[in]   h_client    Client handle.
+** @param[in]   stream      Upload id.
+** @param[in]   abort       Non zero to drop the value. Otherwise the whole
+**                          value must have been sent.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_put_stream_end(
+    kvm_client_handle_t     h_client,
+    uint32_t                stream,
+    uint8_t                 abort);
+
+/*!
+*******************************************************************************
+** Gets value by specified key from Key/Value Management System in chunks,
+** one request per chunk, so neither side holds more than a chunk of it.
+** Fails with KVM_RESULT_CONFLICT if the value is stored again while it is
+** being read.
+**
+** @param[in]   h_client        Client handle.
+** @param[in]   key             Blob containig key.
+** @param[in]   chunk_size      Maximum size of a chunk, capped at
+**                              KVM_STREAM_CHUNK_MAX. Must not be 0.
+** @param[in]   callback        Callback function to provide the chunks in
+**                              order, called once with an empty chunk for
+**                              an empty value.
+** @param[in]   user_context    User context which will be provided during callback call.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_get_stream(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    uint32_t                chunk_size,
+    kvm_chunk_callback_t    callback,
+    void *                  user_context);
+
 /*!
 *******************************************************************************
 ** Deletes key/value pair by specified key from Key/Value Management System.
@@ -111,6 +277,341 @@ kvm_client_delete(
     kvm_client_handle_t     h_client,
     kvm_const_dlob_data_t * key);
 
+/*!
+*******************************************************************************
+** Gets value by specified key together with its version. The version changes
+** whenever the key is stored again.
+**
+** @param[in]   h_client        Client handle.
+** @param[in]   key             Blob containig key.
+** @param[in]   callback        Callback function to provide the value.
+** @param[in]   user_context    User context which will be provided during callback call.
+** @param[out]  version         Pointer where version of the value will be stored.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_get_versioned(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    kvm_data_callback_t     callback,
+    void *                  user_context,
+    uint64_t *              version);
+
+/*!
+*******************************************************************************
+** Stores key/value pair only if the current value of the key matches the
+** condition, checked and stored atomically by the server.
+**
+** @param[in]   h_client        Client handle.
+** @param[in]   key             Blob containig key.
+** @param[in]   value           Blob containig value.
+** @param[in]   ttl             Time to live in milliseconds. Must not be 0.
+** @param[in]   condition       KVM_IF_VERSION - the key holds version,
+**                              KVM_IF_ABSENT - the key does not exist,
+**                              KVM_IF_PRESENT - the key exists.
+** @param[in]   version         Expected version for KVM_IF_VERSION.
+** @param[out]  stored_version  Pointer where version of the stored value
+**                              will be stored. May be NULL.
+**
+** @return
+**      - KVM_RESULT_OK, KVM_RESULT_CONFLICT if the condition does not hold or
+**        corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_put_if(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    kvm_const_dlob_data_t * value,
+    uint32_t                ttl,
+    kvm_condition_t         condition,
+    uint64_t                version,
+    uint64_t *              stored_version);
+
+/*!
+*******************************************************************************
+** Deletes key/value pair only if the current value of the key matches the
+** condition.
+**
+** @param[in]   h_client        Client handle.
+** @param[in]   key             Blob containig key.
+** @param[in]   condition       KVM_IF_VERSION or KVM_IF_PRESENT.
+** @param[in]   version         Expected version for KVM_IF_VERSION.
+**
+** @return
+**      - KVM_RESULT_OK, KVM_RESULT_CONFLICT if the condition does not hold or
+**        corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_delete_if(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    kvm_condition_t         condition,
+    uint64_t                version);
+
+/*!
+*******************************************************************************
+** Adds delta to the decimal integer value of the key on the server, in one
+** round trip. A missing key counts as 0 and is stored without expiration.
+**
+** @param[in]   h_client    Client handle.
+** @param[in]   key         Blob containig key.
+** @param[in]   delta       Value to add, negative to decrement.
+** @param[out]  value       Pointer where the value after the increment will
+**                          be stored. May be NULL.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure,
+**        including a value which is not an integer or overflows.
+*/
+kvm_result_t
+kvm_client_incr(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    int64_t                 delta,
+    int64_t *               value);
+
+/*!
+*******************************************************************************
+** Appends data to the value of the key on the server, only the appended
+** data is sent. A missing key is stored without expiration.
+**
+** @param[in]   h_client    Client handle.
+** @param[in]   key         Blob containig key.
+** @param[in]   data        Blob containig data to append.
+** @param[out]  value_size  Pointer where the size of the value after the
+**                          append will be stored. May be NULL.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_append(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    kvm_const_dlob_data_t * data,
+    uint32_t *              value_size);
+
+/*!
+*******************************************************************************
+** Stores key/value pair and gets the value it replaced, in one step.
+** An existing key keeps its TTL.
+**
+** @param[in]   h_client        Client handle.
+** @param[in]   key             Blob containig key.
+** @param[in]   value           Blob containig value.
+** @param[in]   callback        Callback function to provide the replaced
+**                              value, not called if the key did not exist.
+** @param[in]   user_context    User context which will be provided during callback call.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_getset(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    kvm_const_dlob_data_t * value,
+    kvm_data_callback_t     callback,
+    void *                  user_context);
+
+/*!
+*******************************************************************************
+** Creates an empty batch. Operations added to it are sent in one BATCH
+** request by kvm_client_batch_exec() and applied all or none.
+**
+** @param[out]  h_batch     Pointer where created batch handle will be stored.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_batch_create(
+    kvm_batch_handle_t *    h_batch);
+
+/*!
+*******************************************************************************
+** Destroys the batch created by kvm_client_batch_create().
+**
+** @param[in]   h_batch     Batch handle.
+*/
+void
+kvm_client_batch_destroy(
+    kvm_batch_handle_t      h_batch);
+
+/*!
+*******************************************************************************
+** Removes all operations from the batch, keeping its buffer for the next
+** ones.
+**
+** @param[in]   h_batch     Batch handle.
+*/
+void
+kvm_client_batch_reset(
+    kvm_batch_handle_t      h_batch);
+
+/*!
+*******************************************************************************
+** Adds storing of key/value pair to the batch, as kvm_client_put_ttl()
+** does.
+**
+** @param[in]   h_batch     Batch handle.
+** @param[in]   key         Blob containig key.
+** @param[in]   value       Blob containig value.
+** @param[in]   ttl         Time to live in milliseconds or KVM_TTL_PERSIST.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_batch_put(
+    kvm_batch_handle_t      h_batch,
+    kvm_const_dlob_data_t * key,
+    kvm_const_dlob_data_t * value,
+    uint32_t                ttl);
+
+/*!
+*******************************************************************************
+** Adds conditional storing of key/value pair to the batch, as
+** kvm_client_put_if() does. A condition which does not hold fails the batch.
+**
+** @param[in]   h_batch     Batch handle.
+** @param[in]   key         Blob containig key.
+** @param[in]   value       Blob containig value.
+** @param[in]   ttl         Time to live in milliseconds or KVM_TTL_PERSIST.
+** @param[in]   condition   KVM_IF_XXX.
+** @param[in]   version     Expected version for KVM_IF_VERSION.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_batch_put_if(
+    kvm_batch_handle_t      h_batch,
+    kvm_const_dlob_data_t * key,
+    kvm_const_dlob_data_t * value,
+    uint32_t                ttl,
+    kvm_condition_t         condition,
+    uint64_t                version);
+
+/*!
+*******************************************************************************
+** Adds reading of the value of the key to the batch. A missing key does not
+** fail the batch.
+**
+** @param[in]   h_batch     Batch handle.
+** @param[in]   key         Blob containig key.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_batch_get(
+    kvm_batch_handle_t      h_batch,
+    kvm_const_dlob_data_t * key);
+
+/*!
+*******************************************************************************
+** Adds deletion of key/value pair to the batch. A missing key does not fail
+** the batch, unlike kvm_client_batch_delete_if() with KVM_IF_PRESENT.
+**
+** @param[in]   h_batch     Batch handle.
+** @param[in]   key         Blob containig key.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_batch_delete(
+    kvm_batch_handle_t      h_batch,
+    kvm_const_dlob_data_t * key);
+
+/*!
+*******************************************************************************
+** Adds conditional deletion of key/value pair to the batch, as
+** kvm_client_delete_if() does. A condition which does not hold fails the
+** batch.
+**
+** @param[in]   h_batch     Batch handle.
+** @param[in]   key         Blob containig key.
+** @param[in]   condition   KVM_IF_VERSION or KVM_IF_PRESENT.
+** @param[in]   version     Expected version for KVM_IF_VERSION.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_batch_delete_if(
+    kvm_batch_handle_t      h_batch,
+    kvm_const_dlob_data_t * key,
+    kvm_condition_t         condition,
+    uint64_t                version);
+
+/*!
+*******************************************************************************
+** Executes the operations of the batch in order, with no other request of
+** any client in between. Either all writes are applied or, once one of
+** them fails, none. The batch is kept and may be executed again.
+**
+** @param[in]   h_client        Client handle.
+** @param[in]   h_batch         Batch handle.
+** @param[in]   callback        Callback function to provide the result of
+**                              each executed operation and the value of a
+**                              found GET, otherwise NULL. Not called for the
+**                              operations after a failed one. May be NULL.
+** @param[in]   user_context    User context which will be provided during callback call.
+**
+** @return
+**      - KVM_RESULT_OK if all operations were applied, otherwise the result
+**        of the failed operation (KVM_RESULT_CONFLICT, KVM_RESULT_NO_MEMORY,
+**        KVM_RESULT_CONNECTION_FAIL), KVM_RESULT_INVALID_PARAM if the
+**        replies would exceed half of KVM_FRAME_MAX_SIZE and nothing was
+**        applied, or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_batch_exec(
+    kvm_client_handle_t     h_client,
+    kvm_batch_handle_t      h_batch,
+    kvm_batch_callback_t    callback,
+    void *                  user_context);
+
+/*!
+*******************************************************************************
+** Sets time to live of the existing key in Key/Value Management System.
+**
+** @param[in]   h_client    Client handle.
+** @param[in]   key         Blob containig key.
+** @param[in]   ttl         Time to live in milliseconds. 0 deletes the key
+**                          immediately, KVM_TTL_PERSIST removes expiration.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_expire(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    uint32_t                ttl);
+
+/*!
+*******************************************************************************
+** Gets remaining time to live of the key from Key/Value Management System.
+**
+** @param[in]   h_client    Client handle.
+** @param[in]   key         Blob containig key.
+** @param[out]  ttl         Pointer where remaining time to live in milliseconds
+**                          will be stored. KVM_TTL_PERSIST if key never expires.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_ttl(
+    kvm_client_handle_t     h_client,
+    kvm_const_dlob_data_t * key,
+    uint32_t *              ttl);
+
 /*!
 *******************************************************************************
 ** Gets the list of all keys from Key/Value Management System.
@@ -145,6 +646,110 @@ kvm_client_count(
     kvm_client_handle_t h_client,
     uint32_t *          count);
 
+/*!
+*******************************************************************************
+** Gets statistics of Key/Value Management System server.
+**
+** @param[in]   h_client    Client handle.
+** @param[out]  stats       Pointer where statistics will be stored.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_stats(
+    kvm_client_handle_t h_client,
+    kvm_stats_t *       stats);
+
+/*!
+*******************************************************************************
+** Gets slow request log of Key/Value Management System server.
+**
+** @param[in]   h_client        Client handle.
+** @param[in]   reset           Non zero to clear the log after reading.
+** @param[in]   callback        Callback function to provide entries, newest
+**                              first. Call with entry equal to NULL
+**                              indicates the end of the log.
+** @param[in]   user_context    User context which will be provided during callback call.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_slowlog(
+    kvm_client_handle_t     h_client,
+    uint8_t                 reset,
+    kvm_slowlog_callback_t  callback,
+    void *                  user_context);
+
+/*!
+*******************************************************************************
+** Gets the hottest keys of Key/Value Management System server, estimated
+** from a sample of GET and PUT requests.
+**
+** @param[in]   h_client        Client handle.
+** @param[in]   count           Maximum number of keys, 0 - all tracked
+**                              (at most KVM_HOTKEYS_MAX).
+** @param[in]   callback        Callback function to provide keys, hottest
+**                              first. Call with key equal to NULL indicates
+**                              the end of the list.
+** @param[in]   user_context    User context which will be provided during callback call.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_hotkeys(
+    kvm_client_handle_t     h_client,
+    uint32_t                count,
+    kvm_hotkeys_callback_t  callback,
+    void *                  user_context);
+
+/*!
+*******************************************************************************
+** Gets the memory report of Key/Value Management System server: bytes
+** taken by keys, values, entry headers and slack, hash table, uploads,
+** rollback room, retired entries and connections, as counted by the
+** server, plus its resident set size and heap figures of its allocator.
+**
+** @param[in]   h_client    Client handle.
+** @param[out]  memory      Pointer where the report will be stored.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_memory(
+    kvm_client_handle_t     h_client,
+    kvm_memory_t *          memory);
+
+/*!
+*******************************************************************************
+** Gets the next page of all key/value pairs stored in Key/Value Management
+** System. Start with the cursor set to 0 and call again with the cursor
+** stored by the previous call until it is 0 again. Pairs stored for the
+** whole scan are provided once, others may be provided or not.
+**
+** @param[in]   h_client        Client handle.
+** @param[in,out] cursor        Position of the page, the next one on return.
+** @param[in]   max_bytes       Key and value data wanted in the page, up to
+**                              KVM_SCAN_MAX_BYTES. The page may hold more,
+**                              values larger than this are left out.
+** @param[in]   callback        Callback function to provide the pairs with
+**                              their remaining time to live.
+** @param[in]   user_context    User context which will be provided during callback call.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_client_scan(
+    kvm_client_handle_t     h_client,
+    uint32_t *              cursor,
+    uint32_t                max_bytes,
+    kvm_scan_callback_t     callback,
+    void *                  user_context);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
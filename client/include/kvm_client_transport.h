@@ -29,8 +29,11 @@ typedef void (* kvm_response_callback_t)(
 ** Opens the client to work with Key/Value management system.
 **
 ** @param[out]  h_transport     Pinter where opened transport handle will be stored.
-** @param[in]   server_ip       Zero terminated IP address of the server.
-** @param[in]   server_port     Server port.
+** @param[in]   server_ip       Zero terminated IP address of the server, or
+**                              "unix:<path>" for a Unix domain socket of a
+**                              server on the same host, or "shm:<path>" for
+**                              shared memory rings attached over it.
+** @param[in]   server_port     Server port, ignored for a Unix domain socket.
 **
 ** @return
 **      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
@@ -54,6 +57,19 @@ kvm_result_t
 kvm_transport_close(
     kvm_transport_handle_t h_transport);
 
+/*!
+*******************************************************************************
+** Gets the features negotiated with the server when the transport was opened.
+**
+** @param[in]  h_transport    Client handle.
+**
+** @return
+**      - KVM_FEATURE_XXX mask, 0 if the server does not support negotiation.
+*/
+uint32_t
+kvm_transport_get_features(
+    kvm_transport_handle_t h_transport);
+
 /*!
 *******************************************************************************
 ** Sends the request and recieves the reply.
@@ -0,0 +1,48 @@
+/**
+ * @file kvm_hash.h
+ *
+ * @brief Defines the hash function used by Key/Value Management system.
+ *
+ */
+
+#ifndef __kvm_hash_h__
+#define __kvm_hash_h__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/*!
+*******************************************************************************
+** Calculates seeded 64-bit hash of the data.
+**
+** Multiply-mix hash in the style of wyhash. Consumes 16 bytes per step
+** (48 bytes for long inputs) and never reads outside of the data.
+**
+** @param[in]   data    Data to hash.
+** @param[in]   size    Size of the data.
+** @param[in]   seed    Seed. Different seeds give unrelated hash values.
+**
+** @return
+**      - Hash value.
+*/
+uint64_t kvm_hash(const uint8_t * data, uint32_t size, uint64_t seed);
+
+/*!
+*******************************************************************************
+** Gets random seed for kvm_hash().
+**
+** @return
+**      - Seed from the system random source, or derived from the time
+**        and process id if the source is not available.
+*/
+uint64_t kvm_hash_random_seed(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __kvm_hash_h__ */
@@ -0,0 +1,63 @@
+/**
+ * @file kvm_lz4.h
+ *
+ * @brief Defines LZ4 block format compression functions used by Key/Value Management system.
+ *
+ */
+
+#ifndef __kvm_lz4_h__
+#define __kvm_lz4_h__
+
+#include <stdint.h>
+
+#include "kvm_results.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/*!
+*******************************************************************************
+** Gets the maximum compressed size for the input of specified size.
+**
+** @param[in]   size    Input size.
+**
+** @return
+**      - Maximum size of the compressed data.
+*/
+uint32_t kvm_lz4_compress_bound(uint32_t size);
+
+/*!
+*******************************************************************************
+** Compresses the data into LZ4 block.
+**
+** @param[in]   src             Data to compress.
+** @param[in]   src_size        Size of the data.
+** @param[out]  dst             Buffer for compressed data.
+** @param[in]   dst_capacity    Size of the buffer.
+**
+** @return
+**      - Size of the compressed data or 0 if it does not fit into the buffer.
+*/
+uint32_t kvm_lz4_compress(const uint8_t * src, uint32_t src_size, uint8_t * dst, uint32_t dst_capacity);
+
+/*!
+*******************************************************************************
+** Decompresses LZ4 block.
+**
+** @param[in]   src         Compressed data.
+** @param[in]   src_size    Size of the compressed data.
+** @param[out]  dst         Buffer for decompressed data.
+** @param[in]   dst_size    Exact size of the decompressed data.
+**
+** @return
+**      - KVM_RESULT_OK or KVM_RESULT_INVALID_PARAM if the block is malformed.
+*/
+kvm_result_t kvm_lz4_decompress(const uint8_t * src, uint32_t src_size, uint8_t * dst, uint32_t dst_size);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __kvm_lz4_h__ */
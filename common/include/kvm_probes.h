@@ -0,0 +1,48 @@
+/**
+ * @file kvm_probes.h
+ *
+ * @brief Defines USDT (static tracepoint) probes of Key/Value Management System.
+ *
+ * Probes are compiled in when KVM_USDT is defined, which the build does if
+ * sys/sdt.h is available. A disabled probe is a single nop instruction and
+ * its arguments are only read when perf or bpftrace attaches. Without
+ * KVM_USDT the macros expand to nothing and their arguments are not
+ * evaluated. All probes belong to the "kvm" provider.
+ *
+ * Server probes:
+ *      accept(fd)
+ *      frame_read(fd, frame_size, protocol_version)
+ *      request_start(op, key_size, value_size)
+ *      request_done(op, status, reply_size, duration_ns)
+ *      reply_write(fd, reply_size, result)
+ *      close(fd)
+ *
+ * Client transport probes:
+ *      client_connect(fd)
+ *      client_request_start(op, request_size)
+ *      client_request_done(op, result, reply_size)
+ *
+ */
+
+#ifndef __kvm_probes_h__
+#define __kvm_probes_h__
+
+#ifdef KVM_USDT
+
+#include <sys/sdt.h>
+
+#define KVM_PROBE1(name, a1)                    DTRACE_PROBE1(kvm, name, a1)
+#define KVM_PROBE2(name, a1, a2)                DTRACE_PROBE2(kvm, name, a1, a2)
+#define KVM_PROBE3(name, a1, a2, a3)            DTRACE_PROBE3(kvm, name, a1, a2, a3)
+#define KVM_PROBE4(name, a1, a2, a3, a4)        DTRACE_PROBE4(kvm, name, a1, a2, a3, a4)
+
+#else
+
+#define KVM_PROBE1(name, a1)                    ((void) 0)
+#define KVM_PROBE2(name, a1, a2)                ((void) 0)
+#define KVM_PROBE3(name, a1, a2, a3)            ((void) 0)
+#define KVM_PROBE4(name, a1, a2, a3, a4)        ((void) 0)
+
+#endif /* KVM_USDT */
+
+#endif /* __kvm_probes_h__ */
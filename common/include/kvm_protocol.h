@@ -0,0 +1,185 @@
+/**
+ * @file kvm_protocol.h
+ *
+ * @brief Defines wire protocol versions and v2 encoding used by Key/Value Management system.
+ *
+ * All multi-byte integers on the wire are little endian.
+ *
+ * Protocol v1 frame:
+ *      uint32_t size, followed by <size> bytes of request or reply.
+ *      Requests and replies use the fixed size structures from
+ *      kvm_requests.h and kvm_replies.h.
+ *
+ * Protocol v2 frame:
+ *      varint size, followed by uint8_t flags and <size - 1> bytes of
+ *      request or reply. Requests and replies have the same fields as in
+ *      v1, but every uint32_t field is encoded as varint.
+ *
+ * A connection starts with v1. The client switches it to v2 by sending
+ * KVM_REQUST_HELLO; both sides use the version from the HELLO reply
+ * for all following frames. v1 servers reply KVM_REPLY_BAD_REQUEST to
+ * HELLO, so v2 clients keep working with them using v1.
+ *
+ * Varint is LEB128: 7 bits per byte, least significant group first,
+ * high bit set on all bytes but the last one.
+ *
+ */
+
+#ifndef __kvm_protocol_h__
+#define __kvm_protocol_h__
+
+#include <stdint.h>
+
+#include "kvm_requests.h"
+#include "kvm_results.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* Protocol versions */
+#define KVM_PROTOCOL_V1         ((uint8_t) 1)
+#define KVM_PROTOCOL_V2         ((uint8_t) 2)
+#define KVM_PROTOCOL_VERSION    KVM_PROTOCOL_V2
+
+/* Features negotiated by HELLO */
+#define KVM_FEATURE_TTL             ((uint32_t) 0x00000001)  /* PUT_TTL, EXPIRE and TTL requests */
+#define KVM_FEATURE_ENCODED_VALUES  ((uint32_t) 0x00000002)  /* GET_ENCODED request */
+#define KVM_FEATURES_SUPPORTED      (KVM_FEATURE_TTL | KVM_FEATURE_ENCODED_VALUES)
+
+/* v2 frame flags. No flags are defined yet, frames with unknown flags are rejected. */
+#define KVM_FRAME_FLAGS_NONE    ((uint8_t) 0)
+
+/* Maximum size of varint encoded uint32_t */
+#define KVM_VARINT_MAX_SIZE     5
+
+/* Maximum v2 frame header size: varint size and flags */
+#define KVM_FRAME_V2_HEADER_MAX_SIZE (KVM_VARINT_MAX_SIZE + 1)
+
+/* Upper bound of the v2 size of a v1 request or reply: a uint32_t field
+   takes up to 5 bytes as varint, everything else keeps its size. */
+#define KVM_PROTOCOL_V2_MAX_SIZE(v1_size)   ((v1_size) + (v1_size) / 4)
+
+/* Room over the v2 size which holds the v1 encoding of requests and replies
+   with a few fields, each varint widens to 4 bytes. Not a bound: LIST and
+   BATCH may take more. */
+#define KVM_PROTOCOL_V1_SLACK   64
+
+/* Frames above this size are treated as protocol violation */
+#define KVM_FRAME_MAX_SIZE      ((uint32_t) 256 * 1024 * 1024)
+
+/* Server address prefix of a Unix domain socket path, e.g. "unix:/run/kvm.sock" */
+#define KVM_UNIX_ADDRESS_PREFIX     "unix:"
+
+/* Server address prefix of a Unix domain socket path to attach shared memory
+   rings over, e.g. "shm:/run/kvm.sock". See kvm_shm.h */
+#define KVM_SHM_ADDRESS_PREFIX      "shm:"
+
+/*!
+*******************************************************************************
+** Encodes the value as varint.
+**
+** @param[in]   value   Value to encode.
+** @param[out]  out     Buffer of at least KVM_VARINT_MAX_SIZE bytes.
+**
+** @return
+**      - Number of bytes written.
+*/
+uint32_t kvm_varint_encode(uint32_t value, uint8_t * out);
+
+/*!
+*******************************************************************************
+** Decodes varint.
+**
+** @param[in]   in      Encoded data.
+** @param[in]   size    Size of the encoded data.
+** @param[out]  value   Pointer where decoded value will be stored.
+** @param[out]  used    Pointer where number of consumed bytes will be stored.
+**
+** @return
+**      - KVM_RESULT_OK.
+**      - KVM_RESULT_CONNECTION_FAIL if more data is required.
+**      - KVM_RESULT_INVALID_PARAM if varint is malformed or does not fit uint32_t.
+*/
+kvm_result_t kvm_varint_decode(const uint8_t * in, uint32_t size, uint32_t * value, uint32_t * used);
+
+/*!
+*******************************************************************************
+** Converts v1 request to v2 encoding.
+**
+** @param[in]   request         v1 request.
+** @param[in]   request_size    Size of the v1 request.
+** @param[out]  out             Buffer for v2 request. May be NULL to get
+**                              the required size only.
+** @param[in]   out_capacity    Size of the out buffer. Nothing is written
+**                              past it, the conversion is complete only if
+**                              the size stored in out_size fits.
+** @param[out]  out_size        Pointer where size of v2 request will be stored.
+**
+** @return
+**      - KVM_RESULT_OK or KVM_RESULT_INVALID_PARAM if the request is malformed.
+*/
+kvm_result_t kvm_protocol_request_to_v2(const uint8_t * request, uint32_t request_size, uint8_t * out, uint32_t out_capacity, uint32_t * out_size);
+
+/*!
+*******************************************************************************
+** Converts v2 request to v1 encoding.
+**
+** @param[in]   request         v2 request.
+** @param[in]   request_size    Size of the v2 request.
+** @param[out]  out             Buffer for v1 request. May be NULL to get
+**                              the required size only.
+** @param[in]   out_capacity    Size of the out buffer. Nothing is written
+**                              past it, the conversion is complete only if
+**                              the size stored in out_size fits.
+** @param[out]  out_size        Pointer where size of v1 request will be stored.
+**
+** @return
+**      - KVM_RESULT_OK or KVM_RESULT_INVALID_PARAM if the request is malformed.
+*/
+kvm_result_t kvm_protocol_request_from_v2(const uint8_t * request, uint32_t request_size, uint8_t * out, uint32_t out_capacity, uint32_t * out_size);
+
+/*!
+*******************************************************************************
+** Converts v1 reply to v2 encoding.
+**
+** @param[in]   id              Id of the request the reply is for.
+** @param[in]   reply           v1 reply.
+** @param[in]   reply_size      Size of the v1 reply.
+** @param[out]  out             Buffer for v2 reply. May be NULL to get
+**                              the required size only.
+** @param[in]   out_capacity    Size of the out buffer. Nothing is written
+**                              past it, the conversion is complete only if
+**                              the size stored in out_size fits.
+** @param[out]  out_size        Pointer where size of v2 reply will be stored.
+**
+** @return
+**      - KVM_RESULT_OK or KVM_RESULT_INVALID_PARAM if the reply is malformed.
+*/
+kvm_result_t kvm_protocol_reply_to_v2(kvm_request_id_t id, const uint8_t * reply, uint32_t reply_size, uint8_t * out, uint32_t out_capacity, uint32_t * out_size);
+
+/*!
+*******************************************************************************
+** Converts v2 reply to v1 encoding.
+**
+** @param[in]   id              Id of the request the reply is for.
+** @param[in]   reply           v2 reply.
+** @param[in]   reply_size      Size of the v2 reply.
+** @param[out]  out             Buffer for v1 reply. May be NULL to get
+**                              the required size only.
+** @param[in]   out_capacity    Size of the out buffer. Nothing is written
+**                              past it, the conversion is complete only if
+**                              the size stored in out_size fits.
+** @param[out]  out_size        Pointer where size of v1 reply will be stored.
+**
+** @return
+**      - KVM_RESULT_OK or KVM_RESULT_INVALID_PARAM if the reply is malformed.
+*/
+kvm_result_t kvm_protocol_reply_from_v2(kvm_request_id_t id, const uint8_t * reply, uint32_t reply_size, uint8_t * out, uint32_t out_capacity, uint32_t * out_size);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __kvm_protocol_h__ */
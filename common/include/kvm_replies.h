@@ -21,6 +21,8 @@ typedef uint8_t kvm_reply_status_t;
 #define KVM_REPLY_STATUS_OK     ((kvm_reply_status_t) 0)
 #define KVM_REPLY_BAD_REQUEST   ((kvm_reply_status_t) 1)
 #define KVM_REPLY_SYS_FAIL      ((kvm_reply_status_t) 2)
+#define KVM_REPLY_NO_MEMORY     ((kvm_reply_status_t) 3)
+#define KVM_REPLY_CONFLICT      ((kvm_reply_status_t) 4)    /* Condition of a conditional request not met */
 
 #pragma pack(push, 1)
 typedef struct kvm_reply_generic_s
@@ -37,6 +39,22 @@ typedef struct kvm_reyply_value_s
 } kvm_reyply_value_t;
 #pragma pack(pop)
 
+typedef uint8_t kvm_codec_t;
+
+/* Value encodings */
+#define KVM_CODEC_NONE  ((kvm_codec_t) 0)
+#define KVM_CODEC_LZ4   ((kvm_codec_t) 1)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_get_encoded_s
+{
+    kvm_codec_t codec;
+    uint32_t raw_size;      /* Size of the value after decoding */
+    uint32_t value_size;
+    /* Followed by encoded value data */
+} kvm_reply_get_encoded_t;
+#pragma pack(pop)
+
 typedef kvm_reply_generic_t kvm_reply_put_t;
 typedef kvm_reyply_value_t  kvm_reply_get_t;
 typedef kvm_reply_generic_t kvm_reply_delete_t;
@@ -49,6 +67,223 @@ typedef struct kvm_reply_list_s
 } kvm_reply_list_t;
 #pragma pack(pop)
 
+#pragma pack(push, 1)
+typedef struct kvm_reply_ttl_s
+{
+    uint32_t ttl;           /* Remaining time to live in milliseconds or KVM_TTL_PERSIST */
+} kvm_reply_ttl_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_hello_s
+{
+    uint8_t  version;       /* Protocol version used for the rest of the connection */
+    uint32_t features;      /* KVM_FEATURE_XXX supported by both sides */
+} kvm_reply_hello_t;
+#pragma pack(pop)
+
+/* Fields of kvm_memory_t, see kvm_stats.h */
+#pragma pack(push, 1)
+typedef struct kvm_reply_memory_s
+{
+    uint64_t keys;
+    uint64_t values;
+    uint64_t entry_headers;
+    uint64_t entry_slack;
+    uint64_t buckets;
+    uint64_t uploads;
+    uint64_t undo_log;
+    uint64_t retired;
+    uint64_t connections;
+    uint64_t rss;
+    uint64_t heap_in_use;
+    uint64_t heap_free;
+    uint64_t heap_releasable;
+} kvm_reply_memory_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_stats_s
+{
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t connections_accepted;
+    uint64_t connections_closed;
+    uint64_t keys;
+    uint64_t used_memory;
+    uint64_t evicted_keys;
+    uint8_t  op_count;
+    /* Followed by <op_count> kvm_reply_stats_op_t, requests handled at least once only,
+       then by kvm_reply_stats_phases_t. Servers before phase statistics end here. */
+} kvm_reply_stats_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_stats_op_s
+{
+    uint8_t  id;            /* KVM_REQUST_XXX */
+    uint64_t requests;
+    uint64_t latency_sum;   /* Nanoseconds */
+    uint16_t bucket_count;
+    /* Followed by <bucket_count> kvm_reply_stats_bucket_t, non empty latency buckets only */
+} kvm_reply_stats_op_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_stats_phases_s
+{
+    uint8_t  phase_count;
+    /* Followed by <phase_count> kvm_reply_stats_op_t with KVM_STATS_PHASE_XXX as id and
+       number of measurements as requests, measured phases only */
+} kvm_reply_stats_phases_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_stats_bucket_s
+{
+    uint16_t index;         /* Latency histogram bucket, see kvm_stats.h */
+    uint64_t count;
+} kvm_reply_stats_bucket_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_slowlog_s
+{
+    uint32_t count;
+    /* Followed by <count> kvm_reply_slowlog_entry_t, newest first */
+} kvm_reply_slowlog_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_slowlog_entry_s
+{
+    uint64_t id;
+    uint64_t timestamp_ms;
+    uint64_t duration_ns;
+    uint8_t  kind;          /* KVM_SLOWLOG_XXX */
+    uint8_t  op;
+    int32_t  fd;
+    uint32_t key_size;
+    uint32_t request_size;
+    uint32_t reply_size;
+    uint8_t  prefix_size;
+    /* Followed by <prefix_size> bytes of key prefix */
+} kvm_reply_slowlog_entry_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_hotkeys_s
+{
+    uint32_t count;
+    /* Followed by <count> kvm_reply_hotkeys_entry_t, hottest first */
+} kvm_reply_hotkeys_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_hotkeys_entry_s
+{
+    uint64_t hits;
+    uint32_t rate;
+    uint32_t key_size;
+    uint8_t  prefix_size;
+    /* Followed by <prefix_size> bytes of key prefix */
+} kvm_reply_hotkeys_entry_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_put_begin_s
+{
+    uint32_t stream;        /* Id of the upload for PUT_CHUNK and PUT_END */
+} kvm_reply_put_begin_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_get_range_s
+{
+    uint32_t value_size;    /* Size of the whole decoded value */
+    uint32_t range_size;
+    uint64_t version;       /* Changes whenever the value is stored again */
+    /* Followed by <range_size> bytes of value data from the requested offset */
+} kvm_reply_get_range_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_get_versioned_s
+{
+    uint32_t value_size;
+    uint64_t version;
+    /* Followed by value data */
+} kvm_reply_get_versioned_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_put_if_s
+{
+    uint64_t version;       /* Version of the stored value */
+} kvm_reply_put_if_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_incr_s
+{
+    int64_t value;          /* Value after the increment */
+} kvm_reply_incr_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_append_s
+{
+    uint32_t value_size;    /* Size of the value after the append */
+} kvm_reply_append_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_getset_s
+{
+    uint8_t  found;         /* 0 if the key did not exist, the value is empty then */
+    uint32_t value_size;
+    /* Followed by the replaced value data */
+} kvm_reply_getset_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_batch_s
+{
+    uint8_t  committed;     /* 0 if the last reply failed and all were reverted */
+    uint32_t count;
+    /* Followed by <count> times reply size (uint32_t), reply data
+       (<reply size>) starting with its status, in the v1 encoding */
+} kvm_reply_batch_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_scan_s
+{
+    uint32_t cursor;        /* Cursor of the next page, 0 after the last one */
+    uint32_t count;
+    /* Followed by <count> times entry size (uint32_t) and entry data: a
+       kvm_reply_scan_entry_t, key data and value data if has_value */
+} kvm_reply_scan_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_reply_scan_entry_s
+{
+    uint32_t key_size;
+    uint32_t value_size;    /* Size of the decoded value */
+    uint32_t ttl;           /* Remaining time to live in milliseconds or KVM_TTL_PERSIST */
+    uint8_t  has_value;     /* 0 if the value did not fit the page, GET_RANGE reads it */
+} kvm_reply_scan_entry_t;
+#pragma pack(pop)
+
+typedef kvm_reply_generic_t kvm_reply_delete_if_t;
+typedef kvm_reply_generic_t kvm_reply_put_chunk_t;
+typedef kvm_reply_generic_t kvm_reply_put_end_t;
+typedef kvm_reply_generic_t kvm_reply_put_ttl_t;
+typedef kvm_reply_generic_t kvm_reply_expire_t;
+
 #pragma pack(push, 1)
 typedef struct kvm_reply_count_s
 {
@@ -23,6 +23,37 @@ typedef uint8_t kvm_request_id_t;
 #define KVM_REQUST_DELETE   ((kvm_request_id_t) 3)
 #define KVM_REQUST_LIST     ((kvm_request_id_t) 4)
 #define KVM_REQUST_COUNT    ((kvm_request_id_t) 5)
+#define KVM_REQUST_PUT_TTL  ((kvm_request_id_t) 6)
+#define KVM_REQUST_EXPIRE   ((kvm_request_id_t) 7)
+#define KVM_REQUST_TTL      ((kvm_request_id_t) 8)
+#define KVM_REQUST_GET_ENCODED ((kvm_request_id_t) 9)
+#define KVM_REQUST_HELLO    ((kvm_request_id_t) 10)
+#define KVM_REQUST_STATS    ((kvm_request_id_t) 11)
+#define KVM_REQUST_SLOWLOG  ((kvm_request_id_t) 12)
+#define KVM_REQUST_SHM_ATTACH ((kvm_request_id_t) 13)
+#define KVM_REQUST_HOTKEYS  ((kvm_request_id_t) 14)
+#define KVM_REQUST_PUT_BEGIN ((kvm_request_id_t) 15)
+#define KVM_REQUST_PUT_CHUNK ((kvm_request_id_t) 16)
+#define KVM_REQUST_PUT_END  ((kvm_request_id_t) 17)
+#define KVM_REQUST_GET_RANGE ((kvm_request_id_t) 18)
+#define KVM_REQUST_GET_VERSIONED ((kvm_request_id_t) 19)
+#define KVM_REQUST_PUT_IF   ((kvm_request_id_t) 20)
+#define KVM_REQUST_DELETE_IF ((kvm_request_id_t) 21)
+#define KVM_REQUST_INCR     ((kvm_request_id_t) 22)
+#define KVM_REQUST_APPEND   ((kvm_request_id_t) 23)
+#define KVM_REQUST_GETSET   ((kvm_request_id_t) 24)
+#define KVM_REQUST_BATCH    ((kvm_request_id_t) 25)
+#define KVM_REQUST_MEMORY   ((kvm_request_id_t) 26)
+#define KVM_REQUST_SCAN     ((kvm_request_id_t) 27)
+
+/* Most operations in a single BATCH request */
+#define KVM_BATCH_MAX_OPS       1024
+
+/* Largest value data carried by a single PUT_CHUNK or GET_RANGE frame */
+#define KVM_STREAM_CHUNK_MAX    ((uint32_t) 16 * 1024 * 1024)
+
+/* Largest page a single SCAN request may ask for */
+#define KVM_SCAN_MAX_BYTES      ((uint32_t) 16 * 1024 * 1024)
 
 #pragma pack(push, 1)
 typedef struct kvm_request_generic_s
@@ -48,11 +79,180 @@ typedef struct kvm_request_by_key_value_s
 } kvm_request_by_key_value_t;
 #pragma pack(pop)
 
+#pragma pack(push, 1)
+typedef struct kvm_request_put_ttl_s
+{
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t ttl;           /* Time to live in milliseconds */
+    /* Followed by key data + value data */
+} kvm_request_put_ttl_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_request_expire_s
+{
+    uint32_t key_size;
+    uint32_t ttl;           /* Time to live in milliseconds, KVM_TTL_PERSIST to remove expiration */
+    /* Followed by key data */
+} kvm_request_expire_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_request_hello_s
+{
+    uint8_t  version;       /* Highest protocol version supported by the client */
+    uint32_t features;      /* KVM_FEATURE_XXX requested by the client */
+} kvm_request_hello_t;
+#pragma pack(pop)
+
+/* Slow log request flags */
+#define KVM_SLOWLOG_FLAG_RESET  ((uint8_t) 0x01)    /* Clear the log after reading */
+
+#pragma pack(push, 1)
+typedef struct kvm_request_slowlog_s
+{
+    uint8_t flags;          /* KVM_SLOWLOG_FLAG_XXX */
+} kvm_request_slowlog_t;
+#pragma pack(pop)
+
+/* Sent over a Unix domain socket with SCM_RIGHTS carrying the memfd of
+   kvm_shm_create() and an eventfd waking the server. Frames after the
+   reply go through the rings, see kvm_shm.h. */
+#pragma pack(push, 1)
+typedef struct kvm_request_shm_attach_s
+{
+    uint32_t ring_size;     /* Data size of each ring */
+} kvm_request_shm_attach_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_request_hotkeys_s
+{
+    uint32_t count;         /* Maximum number of keys to return, 0 - all tracked */
+} kvm_request_hotkeys_t;
+#pragma pack(pop)
+
+/* Starts a chunked PUT of a value too large for a single frame. The value
+   is sent by PUT_CHUNK requests in order and stored by PUT_END, which
+   replaces an existing key at once. Uploads are bound to the connection
+   and dropped when it closes. */
+#pragma pack(push, 1)
+typedef struct kvm_request_put_begin_s
+{
+    uint32_t key_size;
+    uint32_t value_size;    /* Total size of all chunks */
+    uint32_t ttl;           /* Time to live in milliseconds or KVM_TTL_PERSIST */
+    /* Followed by key data */
+} kvm_request_put_begin_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_request_put_chunk_s
+{
+    uint32_t stream;        /* Id from kvm_reply_put_begin_t */
+    uint32_t chunk_size;    /* At most KVM_STREAM_CHUNK_MAX */
+    /* Followed by chunk data */
+} kvm_request_put_chunk_t;
+#pragma pack(pop)
+
+/* PUT_END flags */
+#define KVM_PUT_END_ABORT   ((uint8_t) 0x01)    /* Drop the upload instead of storing it */
+
+#pragma pack(push, 1)
+typedef struct kvm_request_put_end_s
+{
+    uint32_t stream;
+    uint8_t  flags;         /* KVM_PUT_END_XXX */
+} kvm_request_put_end_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_request_get_range_s
+{
+    uint32_t key_size;
+    uint32_t offset;        /* In the decoded value */
+    uint32_t max_size;      /* Capped at KVM_STREAM_CHUNK_MAX */
+    /* Followed by key data */
+} kvm_request_get_range_t;
+#pragma pack(pop)
+
+/* Conditional requests are applied only if the condition holds for the
+   stored key, checked and applied in one step. Versions come from
+   GET_VERSIONED, GET_RANGE and PUT_IF replies. */
+#pragma pack(push, 1)
+typedef struct kvm_request_put_if_s
+{
+    uint32_t        key_size;
+    uint32_t        value_size;
+    uint32_t        ttl;        /* Time to live in milliseconds or KVM_TTL_PERSIST */
+    kvm_condition_t condition;  /* KVM_IF_XXX */
+    uint64_t        version;    /* Compared for KVM_IF_VERSION only */
+    /* Followed by key data + value data */
+} kvm_request_put_if_t;
+#pragma pack(pop)
+
+#pragma pack(push, 1)
+typedef struct kvm_request_delete_if_s
+{
+    uint32_t        key_size;
+    kvm_condition_t condition;  /* KVM_IF_VERSION or KVM_IF_PRESENT */
+    uint64_t        version;
+    /* Followed by key data */
+} kvm_request_delete_if_t;
+#pragma pack(pop)
+
+/* Read-modify-write requests run on the server in one step. A missing key
+   counts as 0 for INCR and as empty for APPEND, and is stored without
+   expiration; an existing key keeps its time to live. */
+#pragma pack(push, 1)
+typedef struct kvm_request_incr_s
+{
+    uint32_t        key_size;
+    int64_t         delta;      /* Added to the decimal integer value, negative to decrement */
+    /* Followed by key data */
+} kvm_request_incr_t;
+#pragma pack(pop)
+
 typedef kvm_request_by_key_value_t kvm_request_put_t;
 typedef kvm_request_by_key_t kvm_request_get_t;
 typedef kvm_request_by_key_t kvm_request_delete_t;
 typedef kvm_request_generic_t kvm_request_list_t;
 typedef kvm_request_generic_t kvm_request_count_t;
+typedef kvm_request_by_key_t kvm_request_ttl_t;
+typedef kvm_request_by_key_t kvm_request_get_encoded_t;
+typedef kvm_request_by_key_t kvm_request_get_versioned_t;
+typedef kvm_request_generic_t kvm_request_stats_t;
+typedef kvm_request_generic_t kvm_request_memory_t;
+/* BATCH runs its operations in order and applies all of them or none:
+   the first failed PUT, PUT_TTL, DELETE, EXPIRE, PUT_IF, DELETE_IF, INCR,
+   APPEND or GETSET reverts the ones before it. GET, GET_VERSIONED, TTL and
+   COUNT may miss without failing the batch. Nothing else runs meanwhile.
+   A batch whose replies would take more than half of KVM_FRAME_MAX_SIZE is
+   reverted and answered with BAD_REQUEST. */
+#pragma pack(push, 1)
+typedef struct kvm_request_batch_s
+{
+    uint32_t count;         /* 1 to KVM_BATCH_MAX_OPS */
+    /* Followed by <count> times request size (uint32_t), request data
+       (<request size>) starting with its id, always in the v1 encoding */
+} kvm_request_batch_t;
+#pragma pack(pop)
+
+/* SCAN returns the pairs of whole hash table buckets from the cursor on,
+   until their key and value data reach max_bytes. Cursors advance in
+   reverse bit order of the bucket index, so a pair stored for the whole
+   scan is returned once, even if the table grows in between. */
+#pragma pack(push, 1)
+typedef struct kvm_request_scan_s
+{
+    uint32_t cursor;        /* 0 to start, then the cursor of the previous reply */
+    uint32_t max_bytes;     /* 1 to KVM_SCAN_MAX_BYTES */
+} kvm_request_scan_t;
+#pragma pack(pop)
+
+typedef kvm_request_by_key_value_t kvm_request_append_t;
+typedef kvm_request_by_key_value_t kvm_request_getset_t;
 
 #ifdef __cplusplus
 }
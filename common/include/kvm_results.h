@@ -22,6 +22,18 @@ typedef uint32_t kvm_result_t;
 #define KVM_RESULT_INVALID_PARAM    ((kvm_result_t) 1)
 #define KVM_RESULT_SYS_CALL_FAIL    ((kvm_result_t) 2)
 #define KVM_RESULT_CONNECTION_FAIL  ((kvm_result_t) 3)
+#define KVM_RESULT_NO_MEMORY        ((kvm_result_t) 4)
+#define KVM_RESULT_CONFLICT         ((kvm_result_t) 5)  /* Condition of a conditional request not met */
+
+/* Special TTL value meaning the key never expires */
+#define KVM_TTL_PERSIST             ((uint32_t) 0xFFFFFFFF)
+
+typedef uint8_t kvm_condition_t;
+
+/* Conditions of conditional PUT and DELETE */
+#define KVM_IF_VERSION              ((kvm_condition_t) 0)   /* Key exists with the given version */
+#define KVM_IF_ABSENT               ((kvm_condition_t) 1)   /* Key does not exist, PUT only */
+#define KVM_IF_PRESENT              ((kvm_condition_t) 2)   /* Key exists with any version */
 
 
 #ifdef __cplusplus
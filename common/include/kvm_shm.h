@@ -0,0 +1,221 @@
+/**
+ * @file kvm_shm.h
+ *
+ * @brief Defines shared memory transport rings of Key/Value Management System.
+ *
+ * A client on the same host creates a sealed memfd with a request ring and
+ * a reply ring and passes it to the server over the Unix domain socket
+ * (KVM_REQUST_SHM_ATTACH). Each ring has one producer and one consumer and
+ * carries the same byte stream as the socket would: v1 or v2 frames.
+ *
+ * Positions are free running uint32_t, the data size is a power of two.
+ * Each side keeps its own position locally and only reads the position of
+ * the other side from the shared memory, so a broken peer can not make it
+ * access memory outside the ring.
+ *
+ * A side which runs out of data or space sets the waiting flag and sleeps,
+ * the other side wakes it after moving its position. The server sleeps in
+ * select(), so the request ring producer signals an eventfd; other waits
+ * use futexes on the positions.
+ *
+ */
+
+#ifndef __kvm_shm_h__
+#define __kvm_shm_h__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "kvm_results.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+#define KVM_SHM_CACHE_LINE          64
+
+/* Size of the control page in front of the ring data */
+#define KVM_SHM_CONTROL_SIZE        4096
+
+#define KVM_SHM_RING_SIZE_MIN       ((uint32_t) 4096)
+#define KVM_SHM_RING_SIZE_MAX       ((uint32_t) 64 * 1024 * 1024)
+#define KVM_SHM_RING_SIZE_DEFAULT   ((uint32_t) 1024 * 1024)
+
+/* Shared state of a ring, positions are on their own cache lines */
+typedef struct kvm_shm_ring_control_s
+{
+    uint32_t head;                  /* Written by the producer */
+    uint8_t  pad_head[KVM_SHM_CACHE_LINE - sizeof(uint32_t)];
+    uint32_t tail;                  /* Written by the consumer */
+    uint8_t  pad_tail[KVM_SHM_CACHE_LINE - sizeof(uint32_t)];
+    uint32_t consumer_waiting;      /* Consumer sleeps until head moves */
+    uint32_t producer_waiting;      /* Producer sleeps until tail moves */
+    uint8_t  pad_waiting[KVM_SHM_CACHE_LINE - 2 * sizeof(uint32_t)];
+} kvm_shm_ring_control_t;
+
+/* Process local view of a ring */
+typedef struct kvm_shm_ring_s
+{
+    kvm_shm_ring_control_t *    control;
+    uint8_t *                   data;
+    uint32_t                    size;       /* Power of two */
+    uint32_t                    position;   /* Own head or tail */
+    int                         wake_fd;    /* eventfd the consumer sleeps on, -1 - futex */
+} kvm_shm_ring_t;
+
+/* Process local view of a shared region */
+typedef struct kvm_shm_s
+{
+    void *          region;
+    size_t          region_size;
+    kvm_shm_ring_t  request;    /* Client to server */
+    kvm_shm_ring_t  reply;      /* Server to client */
+} kvm_shm_t;
+
+/*!
+*******************************************************************************
+** Creates a sealed memfd with a request and a reply ring and maps it.
+**
+** @param[in]   ring_size   Data size of each ring, power of two between
+**                          KVM_SHM_RING_SIZE_MIN and KVM_SHM_RING_SIZE_MAX.
+** @param[out]  shm         Mapped region.
+** @param[out]  fd          memfd to pass to the server, it is up to caller
+**                          to close it.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t kvm_shm_create(uint32_t ring_size, kvm_shm_t * shm, int * fd);
+
+/*!
+*******************************************************************************
+** Maps a region created by kvm_shm_create() in another process. The memfd
+** must be sealed against shrinking, so the mapping can not be cut under
+** the reader.
+**
+** @param[in]   fd          memfd received from the client.
+** @param[in]   ring_size   Data size of each ring announced by the client.
+** @param[out]  shm         Mapped region.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t kvm_shm_map(int fd, uint32_t ring_size, kvm_shm_t * shm);
+
+/*!
+*******************************************************************************
+** Unmaps the region. Wake descriptors of the rings are not closed.
+**
+** @param[in]   shm     Mapped region.
+*/
+void kvm_shm_unmap(kvm_shm_t * shm);
+
+/*!
+*******************************************************************************
+** Copies as much data as fits into the ring and wakes the consumer if it
+** sleeps.
+**
+** @param[in]   ring        Ring of which the caller is the producer.
+** @param[in]   data        Data to write.
+** @param[in]   size        Size of the data.
+** @param[out]  written     Number of bytes written, 0 if the ring is full.
+**
+** @return
+**      - KVM_RESULT_OK or KVM_RESULT_CONNECTION_FAIL if the consumer
+**        position is invalid.
+*/
+kvm_result_t kvm_shm_ring_write(kvm_shm_ring_t * ring, const uint8_t * data, uint32_t size, uint32_t * written);
+
+/*!
+*******************************************************************************
+** Copies available data out of the ring and wakes the producer if it
+** sleeps.
+**
+** @param[in]   ring    Ring of which the caller is the consumer.
+** @param[out]  data    Buffer for the data.
+** @param[in]   size    Size of the buffer.
+** @param[out]  read    Number of bytes read, 0 if the ring is empty.
+**
+** @return
+**      - KVM_RESULT_OK or KVM_RESULT_CONNECTION_FAIL if the producer
+**        position is invalid.
+*/
+kvm_result_t kvm_shm_ring_read(kvm_shm_ring_t * ring, uint8_t * data, uint32_t size, uint32_t * read);
+
+/*!
+*******************************************************************************
+** Checks if the ring has data for the consumer.
+**
+** @param[in]   ring    Ring of which the caller is the consumer.
+**
+** @return
+**      - Non zero if there is data to read.
+*/
+int kvm_shm_ring_readable(const kvm_shm_ring_t * ring);
+
+/*!
+*******************************************************************************
+** Tells the producer that the consumer is going to sleep, so the next write
+** signals the wake descriptor. Used by a consumer which sleeps in select().
+**
+** @param[in]   ring    Ring of which the caller is the consumer.
+**
+** @return
+**      - Non zero if data arrived meanwhile and the consumer should not sleep.
+*/
+int kvm_shm_ring_prepare_wait(kvm_shm_ring_t * ring);
+
+/*!
+*******************************************************************************
+** Tells the producer that the consumer is awake again.
+**
+** @param[in]   ring    Ring of which the caller is the consumer.
+*/
+void kvm_shm_ring_cancel_wait(kvm_shm_ring_t * ring);
+
+/*!
+*******************************************************************************
+** Checks if polling the rings can help: on a single CPU the other side can
+** not run while this one spins.
+**
+** @return
+**      - Non zero if more than one CPU is online.
+*/
+int kvm_shm_can_spin(void);
+
+/*!
+*******************************************************************************
+** Waits for data in the ring: spins first, then sleeps on a futex. Spinning
+** is skipped if kvm_shm_can_spin() is 0.
+**
+** @param[in]   ring        Ring of which the caller is the consumer.
+** @param[in]   spin_ns     Time to poll the ring before sleeping.
+** @param[in]   timeout_ms  Time to sleep.
+**
+** @return
+**      - KVM_RESULT_OK if there is data to read or KVM_RESULT_CONNECTION_FAIL
+**        on timeout.
+*/
+kvm_result_t kvm_shm_ring_wait_readable(kvm_shm_ring_t * ring, uint64_t spin_ns, uint32_t timeout_ms);
+
+/*!
+*******************************************************************************
+** Waits for free space in the ring: spins first, then sleeps on a futex.
+** Spinning is skipped if kvm_shm_can_spin() is 0.
+**
+** @param[in]   ring        Ring of which the caller is the producer.
+** @param[in]   spin_ns     Time to poll the ring before sleeping.
+** @param[in]   timeout_ms  Time to sleep.
+**
+** @return
+**      - KVM_RESULT_OK if there is space to write or
+**        KVM_RESULT_CONNECTION_FAIL on timeout.
+*/
+kvm_result_t kvm_shm_ring_wait_writable(kvm_shm_ring_t * ring, uint64_t spin_ns, uint32_t timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __kvm_shm_h__ */
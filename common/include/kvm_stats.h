@@ -0,0 +1,196 @@
+/**
+ * @file kvm_stats.h
+ *
+ * @brief Defines server statistics and latency histograms used by Key/Value Management system.
+ *
+ * Latency histograms are HDR style: values below 2^KVM_HISTOGRAM_SUB_BITS
+ * have own buckets, above that every power of two range is split into
+ * 2^KVM_HISTOGRAM_SUB_BITS buckets. The relative error of a value taken
+ * from a histogram is below 1 / 2^KVM_HISTOGRAM_SUB_BITS.
+ *
+ */
+
+#ifndef __kvm_stats_h__
+#define __kvm_stats_h__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* Request ids below this value have own counters */
+#define KVM_STATS_MAX_OPS           32
+
+/* Histogram precision and range */
+#define KVM_HISTOGRAM_SUB_BITS      4
+#define KVM_HISTOGRAM_MAX_BITS      40      /* Larger values are counted in the last bucket */
+#define KVM_HISTOGRAM_BUCKETS       ((KVM_HISTOGRAM_MAX_BITS - KVM_HISTOGRAM_SUB_BITS + 1) << KVM_HISTOGRAM_SUB_BITS)
+
+/* Request processing phases. Queue and read are measured per read() of
+   a connection, which may carry several requests or a part of one; the
+   other phases per request. */
+#define KVM_STATS_PHASE_QUEUE       0       /* Socket reported readable to read start */
+#define KVM_STATS_PHASE_READ        1       /* read() system call */
+#define KVM_STATS_PHASE_DECODE      2       /* Frame header and v2 decoding */
+#define KVM_STATS_PHASE_EXECUTE     3       /* Request handler, including reply assembly */
+#define KVM_STATS_PHASE_REPLY       4       /* Reply framing and v2 encoding */
+#define KVM_STATS_PHASE_WRITE       5       /* writev() system calls of the reply */
+#define KVM_STATS_PHASES            6
+
+/* Server statistics. Large, better allocated on the heap. */
+typedef struct kvm_stats_s
+{
+    uint64_t requests[KVM_STATS_MAX_OPS];   /* Handled requests by request id, operations of a BATCH included */
+    uint64_t hits;                          /* GET requests which found the key */
+    uint64_t misses;                        /* GET requests which did not find the key */
+    uint64_t bytes_in;                      /* Received from clients, including framing */
+    uint64_t bytes_out;                     /* Sent to clients, including framing */
+    uint64_t connections_accepted;
+    uint64_t connections_closed;
+    uint64_t keys;                          /* Stored keys */
+    uint64_t used_memory;                   /* Bytes used by stored keys and values */
+    uint64_t evicted_keys;
+    uint64_t decompression_time_ns;         /* Spent decompressing values, readers included */
+
+    /* Nanoseconds spent in request handler by request id */
+    uint64_t latency_sum[KVM_STATS_MAX_OPS];
+    uint64_t latency[KVM_STATS_MAX_OPS][KVM_HISTOGRAM_BUCKETS];
+
+    /* Nanoseconds spent in request processing phases by KVM_STATS_PHASE_XXX */
+    uint64_t phase_sum[KVM_STATS_PHASES];
+    uint64_t phase[KVM_STATS_PHASES][KVM_HISTOGRAM_BUCKETS];
+} kvm_stats_t;
+
+/* Slow log entry kinds */
+#define KVM_SLOWLOG_EXECUTE         ((uint8_t) 0)   /* Time spent in request handler */
+#define KVM_SLOWLOG_END_TO_END      ((uint8_t) 1)   /* Time from reading the request to writing the reply */
+
+/* Number of key bytes kept in a slow log entry */
+#define KVM_SLOWLOG_KEY_PREFIX      32
+
+/* Slow log entry */
+typedef struct kvm_slowlog_entry_s
+{
+    uint64_t id;                /* Increasing, unique since server start */
+    uint64_t timestamp_ms;      /* Unix time the request finished */
+    uint64_t duration_ns;
+    uint8_t  kind;              /* KVM_SLOWLOG_XXX */
+    uint8_t  op;                /* KVM_REQUST_XXX */
+    int32_t  fd;                /* Client socket on the server, -1 if unknown */
+    uint32_t key_size;          /* 0 for requests without a key */
+    uint32_t request_size;
+    uint32_t reply_size;
+    uint32_t prefix_size;       /* Number of bytes in key_prefix */
+    uint8_t  key_prefix[KVM_SLOWLOG_KEY_PREFIX];
+} kvm_slowlog_entry_t;
+
+/* Maximum number of hot keys tracked and reported */
+#define KVM_HOTKEYS_MAX             32
+
+/* Number of key bytes kept for a hot key */
+#define KVM_HOTKEYS_KEY_PREFIX      64
+
+/* Hot key estimate */
+typedef struct kvm_hotkey_s
+{
+    uint64_t hits;              /* Estimated GET and PUT requests, decaying over time */
+    uint32_t rate;              /* Estimated requests per second */
+    uint32_t key_size;
+    uint32_t prefix_size;       /* Number of bytes in key_prefix */
+    uint8_t  key_prefix[KVM_HOTKEYS_KEY_PREFIX];
+} kvm_hotkey_t;
+
+/* Memory report in bytes. Storage and connection figures are counted by the
+   server itself, the process figures come from the kernel and the allocator. */
+typedef struct kvm_memory_s
+{
+    uint64_t keys;              /* Key data of stored pairs */
+    uint64_t values;            /* Value data of stored pairs, compressed as stored */
+    uint64_t entry_headers;     /* Per pair headers */
+    uint64_t entry_slack;       /* Allocated to pairs past their data: allocator rounding and APPEND room */
+    uint64_t buckets;           /* Hash table */
+    uint64_t uploads;           /* Chunked PUTs in progress */
+    uint64_t undo_log;          /* Room for BATCH rollback */
+    uint64_t retired;           /* Removed pairs and tables waiting for lock-free readers */
+    uint64_t connections;       /* Receive buffers and shared memory rings */
+    uint64_t rss;               /* Resident set size of the server process */
+    uint64_t heap_in_use;       /* Handed out by the allocator */
+    uint64_t heap_free;         /* Held by the allocator but free */
+    uint64_t heap_releasable;   /* Part of heap_free the allocator can return to the system at once */
+} kvm_memory_t;
+
+/*!
+*******************************************************************************
+** Gets printable name of the request.
+**
+** @param[in]   id      Request id.
+**
+** @return
+**      - Lower case name or NULL if the request is unknown.
+*/
+const char * kvm_stats_op_name(uint32_t id);
+
+/*!
+*******************************************************************************
+** Gets printable name of the request processing phase.
+**
+** @param[in]   phase   KVM_STATS_PHASE_XXX.
+**
+** @return
+**      - Lower case name or NULL if the phase is unknown.
+*/
+const char * kvm_stats_phase_name(uint32_t phase);
+
+/*!
+*******************************************************************************
+** Gets histogram bucket index for the value.
+**
+** @param[in]   value   Value to record.
+**
+** @return
+**      - Bucket index below KVM_HISTOGRAM_BUCKETS.
+*/
+uint32_t kvm_histogram_index(uint64_t value);
+
+/*!
+*******************************************************************************
+** Gets the highest value counted in the histogram bucket.
+**
+** @param[in]   index   Bucket index.
+**
+** @return
+**      - Highest value of the bucket.
+*/
+uint64_t kvm_histogram_bucket_limit(uint32_t index);
+
+/*!
+*******************************************************************************
+** Gets the value below or at which the specified share of recorded values is.
+**
+** @param[in]   buckets     Histogram of KVM_HISTOGRAM_BUCKETS buckets.
+** @param[in]   percentile  Percentile from 0 to 100.
+**
+** @return
+**      - Highest value of the bucket containing the percentile, 0 if the
+**        histogram is empty.
+*/
+uint64_t kvm_histogram_percentile(const uint64_t * buckets, double percentile);
+
+/*!
+*******************************************************************************
+** Gets the number of values recorded in the histogram.
+**
+** @param[in]   buckets     Histogram of KVM_HISTOGRAM_BUCKETS buckets.
+**
+** @return
+**      - Number of values.
+*/
+uint64_t kvm_histogram_count(const uint64_t * buckets);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __kvm_stats_h__ */
@@ -15,14 +15,20 @@ extern "C"
 {
 #endif /* __cplusplus */
 
+/* Byte order conversion between the host and the transport, which is little endian. */
+
 uint16_t kvm_util_host_to_transport16(uint16_t u16);
 
 uint32_t kvm_util_host_to_transport32(uint32_t u32);
 
+uint64_t kvm_util_host_to_transport64(uint64_t u64);
+
 uint16_t kvm_util_transport_to_host16(uint16_t u16);
 
 uint32_t kvm_util_transport_to_host32(uint32_t u32);
 
+uint64_t kvm_util_transport_to_host64(uint64_t u64);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
@@ -0,0 +1,116 @@
+#include <benchmark/benchmark.h>
+#include <string>
+#include "kvm_requests.h"
+#include "kvm_client.h"
+
+/* Requests go to client_transport_mock.cc, which replies without I/O */
+class client
+{
+public:
+    client(benchmark::State & state)
+        : h_client(nullptr), key(state.range(0), 'k'), value(state.range(1), 'v')
+    {
+        if (KVM_RESULT_OK != kvm_client_open(&h_client, "127.0.0.1", 55555))
+        {
+            state.SkipWithError("Failed to open client");
+        }
+        key_blob = {(uint32_t) key.size(), (const uint8_t *) key.data()};
+        value_blob = {(uint32_t) value.size(), (const uint8_t *) value.data()};
+    }
+
+    ~client()
+    {
+        if (nullptr != h_client)
+        {
+            kvm_client_close(h_client);
+        }
+    }
+
+    kvm_client_handle_t h_client;
+    const std::string key;
+    const std::string value;
+    kvm_const_dlob_data_t key_blob;
+    kvm_const_dlob_data_t value_blob;
+};
+
+static void consume(void * context, const kvm_const_dlob_data_t * data)
+{
+    benchmark::DoNotOptimize(data);
+}
+
+template <typename Call>
+static void run(benchmark::State & state, Call call)
+{
+    for (auto _ : state)
+    {
+        if (KVM_RESULT_OK != call())
+        {
+            state.SkipWithError("Request failed");
+            break;
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_client_put(benchmark::State & state)
+{
+    client c(state);
+    run(state, [&] { return kvm_client_put(c.h_client, &c.key_blob, &c.value_blob); });
+    state.SetBytesProcessed(state.iterations() * (c.key.size() + c.value.size()));
+}
+
+static void BM_client_put_ttl(benchmark::State & state)
+{
+    client c(state);
+    run(state, [&] { return kvm_client_put_ttl(c.h_client, &c.key_blob, &c.value_blob, 1000); });
+}
+
+static void BM_client_get(benchmark::State & state)
+{
+    client c(state);
+    run(state, [&] { return kvm_client_get(c.h_client, &c.key_blob, consume, nullptr); });
+}
+
+static void BM_client_get_encoded(benchmark::State & state)
+{
+    /* The mock replies with an LZ4 block, which the client decodes */
+    client c(state);
+    kvm_client_set_compression(c.h_client, 1);
+    run(state, [&] { return kvm_client_get(c.h_client, &c.key_blob, consume, nullptr); });
+}
+
+static void BM_client_delete(benchmark::State & state)
+{
+    client c(state);
+    run(state, [&] { return kvm_client_delete(c.h_client, &c.key_blob); });
+}
+
+static void BM_client_expire(benchmark::State & state)
+{
+    client c(state);
+    run(state, [&] { return kvm_client_expire(c.h_client, &c.key_blob, 1000); });
+}
+
+static void BM_client_ttl(benchmark::State & state)
+{
+    client c(state);
+    uint32_t ttl;
+    run(state, [&] { return kvm_client_ttl(c.h_client, &c.key_blob, &ttl); });
+}
+
+static void BM_client_count(benchmark::State & state)
+{
+    client c(state);
+    uint32_t count;
+    run(state, [&] { return kvm_client_count(c.h_client, &count); });
+}
+
+/* Arguments: key size, value size */
+BENCHMARK(BM_client_put)->ArgsProduct({{16, 128}, {16, 1024, 65536}})->ArgNames({"key", "value"});
+BENCHMARK(BM_client_put_ttl)->ArgsProduct({{16, 128}, {16, 1024}})->ArgNames({"key", "value"});
+BENCHMARK(BM_client_get)->Args({16, 0})->Args({128, 0})->ArgNames({"key", "value"});
+BENCHMARK(BM_client_get_encoded)->Args({16, 0})->ArgNames({"key", "value"});
+BENCHMARK(BM_client_delete)->Args({16, 0})->Args({128, 0})->ArgNames({"key", "value"});
+BENCHMARK(BM_client_expire)->Args({16, 0})->ArgNames({"key", "value"});
+BENCHMARK(BM_client_ttl)->Args({16, 0})->ArgNames({"key", "value"});
+BENCHMARK(BM_client_count)->Args({0, 0})->ArgNames({"key", "value"});
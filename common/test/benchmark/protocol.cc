@@ -0,0 +1,135 @@
+#include <benchmark/benchmark.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include "kvm_requests.h"
+#include "kvm_replies.h"
+#include "kvm_utils.h"
+#include "kvm_protocol.h"
+#include "kvm_server_internal.h"
+
+/* Conversions as done per request by the server and the client, with the
+   frame sizes of both encodings as counters. */
+
+static void append_u32(std::vector<uint8_t> & data, uint32_t value)
+{
+    const uint32_t transport = kvm_util_host_to_transport32(value);
+    const uint8_t * bytes = (const uint8_t *) &transport;
+    data.insert(data.end(), bytes, bytes + sizeof(transport));
+}
+
+static std::vector<uint8_t> make_put_request(uint32_t key_size, uint32_t value_size)
+{
+    std::vector<uint8_t> request(1, KVM_REQUST_PUT);
+    append_u32(request, key_size);
+    append_u32(request, value_size);
+    request.insert(request.end(), key_size + value_size, 'k');
+    return request;
+}
+
+static std::vector<uint8_t> make_get_reply(uint32_t value_size)
+{
+    std::vector<uint8_t> reply(1, KVM_REPLY_STATUS_OK);
+    append_u32(reply, value_size);
+    reply.insert(reply.end(), value_size, 'v');
+    return reply;
+}
+
+static std::vector<uint8_t> to_v2(const std::vector<uint8_t> & reply)
+{
+    std::vector<uint8_t> encoded(KVM_PROTOCOL_V2_MAX_SIZE(reply.size()));
+    uint32_t size;
+    kvm_protocol_reply_to_v2(KVM_REQUST_GET, reply.data(), reply.size(), encoded.data(), encoded.size(), &size);
+    encoded.resize(size);
+    return encoded;
+}
+
+static void set_counters(benchmark::State & state, size_t v1_size, size_t v2_size)
+{
+    state.counters["v1_bytes"] = v1_size;
+    state.counters["v2_bytes"] = v2_size;
+    state.SetItemsProcessed(state.iterations());
+}
+
+/* Server: into the buffer kept between frames, a second pass into an
+   allocated one if the request does not fit */
+static void BM_protocol_request_from_v2(benchmark::State & state)
+{
+    const std::vector<uint8_t> v1 = make_put_request(state.range(0), state.range(1));
+    std::vector<uint8_t> v2(KVM_PROTOCOL_V2_MAX_SIZE(v1.size()));
+    uint32_t v2_size;
+    kvm_protocol_request_to_v2(v1.data(), v1.size(), v2.data(), v2.size(), &v2_size);
+
+    std::vector<uint8_t> kept(CONVERT_BUFFER_SIZE);
+    for (auto _ : state)
+    {
+        uint8_t * decoded = kept.data();
+        uint32_t size;
+        kvm_protocol_request_from_v2(v2.data(), v2_size, decoded, kept.size(), &size);
+        if (size > kept.size())
+        {
+            decoded = (uint8_t *) malloc(size);
+            kvm_protocol_request_from_v2(v2.data(), v2_size, decoded, size, &size);
+        }
+        benchmark::DoNotOptimize(decoded);
+        benchmark::ClobberMemory();
+
+        if (decoded != kept.data())
+        {
+            free(decoded);
+        }
+    }
+    set_counters(state, v1.size(), v2_size);
+}
+
+/* Server: into the buffer kept between frames, or one sized by the bound */
+static void BM_protocol_reply_to_v2(benchmark::State & state)
+{
+    const std::vector<uint8_t> v1 = make_get_reply(state.range(1));
+    uint32_t size = 0;
+
+    std::vector<uint8_t> kept(CONVERT_BUFFER_SIZE);
+    for (auto _ : state)
+    {
+        uint32_t capacity = KVM_PROTOCOL_V2_MAX_SIZE(v1.size());
+        uint8_t * encoded = (capacity <= kept.size()) ? kept.data() : (uint8_t *) malloc(capacity);
+        if (encoded == kept.data())
+        {
+            capacity = kept.size();
+        }
+
+        kvm_protocol_reply_to_v2(KVM_REQUST_GET, v1.data(), v1.size(), encoded, capacity, &size);
+        benchmark::DoNotOptimize(encoded);
+        benchmark::ClobberMemory();
+
+        if (encoded != kept.data())
+        {
+            free(encoded);
+        }
+    }
+    set_counters(state, v1.size(), size);
+}
+
+/* Client: into the allocated reply handed to the caller */
+static void BM_protocol_reply_from_v2(benchmark::State & state)
+{
+    const std::vector<uint8_t> v1 = make_get_reply(state.range(1));
+    const std::vector<uint8_t> v2 = to_v2(v1);
+
+    for (auto _ : state)
+    {
+        const uint32_t capacity = v2.size() + KVM_PROTOCOL_V1_SLACK;
+        uint8_t * decoded = (uint8_t *) malloc(capacity);
+
+        uint32_t size;
+        kvm_protocol_reply_from_v2(KVM_REQUST_GET, v2.data(), v2.size(), decoded, capacity, &size);
+        benchmark::DoNotOptimize(decoded);
+        benchmark::ClobberMemory();
+        free(decoded);
+    }
+    set_counters(state, v1.size(), v2.size());
+}
+
+BENCHMARK(BM_protocol_request_from_v2)->ArgsProduct({{16}, {32, 1024, 4096, 65536}})->ArgNames({"key", "value"});
+BENCHMARK(BM_protocol_reply_to_v2)->ArgsProduct({{16}, {32, 1024, 4096, 65536}})->ArgNames({"key", "value"});
+BENCHMARK(BM_protocol_reply_from_v2)->ArgsProduct({{16}, {32, 1024, 4096, 65536}})->ArgNames({"key", "value"});
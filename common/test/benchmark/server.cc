@@ -0,0 +1,279 @@
+#include <benchmark/benchmark.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "kvm_results.h"
+#include "kvm_requests.h"
+#include "kvm_replies.h"
+#include "kvm_utils.h"
+#include "kvm_server.h"
+#include "kvm_server_internal.h"
+
+/* Tables larger than this are skipped for big values */
+static const int64_t max_table_bytes = (int64_t) 256 * 1024 * 1024;
+
+static std::string make_key(uint32_t index, uint32_t key_size)
+{
+    std::string digits = std::to_string(index);
+    return std::string(key_size - digits.size(), '0') + digits;
+}
+
+static std::string make_value(uint32_t value_size)
+{
+    /* Repetitive enough for LZ4 to matter when compression is on */
+    std::string value(value_size, '\0');
+    for (uint32_t i = 0; i < value_size; ++i)
+    {
+        value[i] = 'a' + (i * 7 + i / 13) % 26;
+    }
+    return value;
+}
+
+static void append_u32(std::vector<uint8_t> & request, uint32_t value)
+{
+    const uint32_t transport = kvm_util_host_to_transport32(value);
+    const uint8_t * bytes = (const uint8_t *) &transport;
+    request.insert(request.end(), bytes, bytes + sizeof(transport));
+}
+
+static std::vector<uint8_t> make_by_key_request(kvm_request_id_t id, const std::string & key)
+{
+    std::vector<uint8_t> request(1, id);
+    append_u32(request, key.size());
+    request.insert(request.end(), key.begin(), key.end());
+    return request;
+}
+
+static std::vector<uint8_t> make_put_request(const std::string & key, const std::string & value)
+{
+    std::vector<uint8_t> request(1, KVM_REQUST_PUT);
+    append_u32(request, key.size());
+    append_u32(request, value.size());
+    request.insert(request.end(), key.begin(), key.end());
+    request.insert(request.end(), value.begin(), value.end());
+    return request;
+}
+
+static std::vector<uint8_t> make_put_ttl_request(const std::string & key, const std::string & value, uint32_t ttl)
+{
+    std::vector<uint8_t> request(1, KVM_REQUST_PUT_TTL);
+    append_u32(request, key.size());
+    append_u32(request, value.size());
+    append_u32(request, ttl);
+    request.insert(request.end(), key.begin(), key.end());
+    request.insert(request.end(), value.begin(), value.end());
+    return request;
+}
+
+static std::vector<uint8_t> make_expire_request(const std::string & key, uint32_t ttl)
+{
+    std::vector<uint8_t> request(1, KVM_REQUST_EXPIRE);
+    append_u32(request, key.size());
+    append_u32(request, ttl);
+    request.insert(request.end(), key.begin(), key.end());
+    return request;
+}
+
+/* Storage filled with <table size> keys. Google Benchmark calls a benchmark
+   function several times, the table is kept while the same benchmark runs
+   with the same arguments. */
+class table
+{
+public:
+    static const table & prepare(benchmark::State & state, const char * name, uint32_t compression_threshold = 0)
+    {
+        static table * current = nullptr;
+
+        if (nullptr == current || current->name != name || current->key_size != state.range(0) ||
+            current->value_size != state.range(1) || current->size != state.range(2))
+        {
+            delete current;
+            current = new table(name, state.range(0), state.range(1), state.range(2), compression_threshold);
+        }
+        return *current;
+    }
+
+    /* Requests for a spread of existing keys, walked in a cache unfriendly order */
+    template <typename Make>
+    std::vector<std::vector<uint8_t>> requests(Make make) const
+    {
+        const uint32_t count = (size < 4096) ? size : 4096;
+        const uint32_t step = size / count;
+        std::vector<std::vector<uint8_t>> result;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            result.push_back(make(make_key((i * 2654435761u % count) * step, key_size)));
+        }
+        return result;
+    }
+
+    const std::string name;
+    const uint32_t key_size;
+    const uint32_t value_size;
+    const uint32_t size;
+    const std::string value;
+
+private:
+    table(const char * name, uint32_t key_size, uint32_t value_size, uint32_t size, uint32_t compression_threshold)
+        : name(name), key_size(key_size), value_size(value_size), size(size), value(make_value(value_size))
+    {
+        storage_uninit();
+        storage_init();
+
+        kvm_server_config_t config;
+        kvm_server_config_default(&config);
+        config.compression_threshold = compression_threshold;
+        storage_configure(&config);
+
+        for (uint32_t i = 0; i < size; ++i)
+        {
+            const std::string key = make_key(i, key_size);
+            storage_put((const uint8_t *) key.data(), key.size(), (const uint8_t *) value.data(), value.size(), KVM_TTL_PERSIST);
+        }
+    }
+};
+
+static void run(benchmark::State & state, const std::vector<std::vector<uint8_t>> & requests, kvm_reply_status_t expected)
+{
+    size_t next = 0;
+    for (auto _ : state)
+    {
+        const std::vector<uint8_t> & request = requests[next];
+        next = (next + 1 == requests.size()) ? 0 : next + 1;
+
+        uint32_t reply_size = 0;
+        uint8_t * reply = nullptr;
+        handle_request(request.size(), request.data(), &reply_size, &reply);
+        benchmark::DoNotOptimize(reply);
+
+        if (nullptr == reply || expected != reply[0])
+        {
+            state.SkipWithError("Unexpected reply");
+            free(reply);
+            break;
+        }
+        free(reply);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_handle_put(benchmark::State & state)
+{
+    const table & t = table::prepare(state, __func__);
+    run(state, t.requests([&](const std::string & key) { return make_put_request(key, t.value); }), KVM_REPLY_STATUS_OK);
+}
+
+static void BM_handle_put_ttl(benchmark::State & state)
+{
+    const table & t = table::prepare(state, __func__);
+    run(state, t.requests([&](const std::string & key) { return make_put_ttl_request(key, t.value, 100000); }), KVM_REPLY_STATUS_OK);
+}
+
+static void BM_handle_get(benchmark::State & state)
+{
+    const table & t = table::prepare(state, __func__);
+    run(state, t.requests([](const std::string & key) { return make_by_key_request(KVM_REQUST_GET, key); }), KVM_REPLY_STATUS_OK);
+}
+
+static void BM_handle_get_miss(benchmark::State & state)
+{
+    const table & t = table::prepare(state, __func__);
+    run(state, t.requests([](const std::string & key) { return make_by_key_request(KVM_REQUST_GET, "x" + key); }), KVM_REPLY_BAD_REQUEST);
+}
+
+static void BM_handle_get_encoded(benchmark::State & state)
+{
+    /* Every value is stored compressed */
+    const table & t = table::prepare(state, __func__, 1);
+    run(state, t.requests([](const std::string & key) { return make_by_key_request(KVM_REQUST_GET_ENCODED, key); }), KVM_REPLY_STATUS_OK);
+}
+
+static void BM_handle_get_compressed(benchmark::State & state)
+{
+    /* Values are decompressed for clients without compression support */
+    const table & t = table::prepare(state, __func__, 1);
+    run(state, t.requests([](const std::string & key) { return make_by_key_request(KVM_REQUST_GET, key); }), KVM_REPLY_STATUS_OK);
+}
+
+static void BM_handle_ttl(benchmark::State & state)
+{
+    const table & t = table::prepare(state, __func__);
+    run(state, t.requests([](const std::string & key) { return make_by_key_request(KVM_REQUST_TTL, key); }), KVM_REPLY_STATUS_OK);
+}
+
+static void BM_handle_expire(benchmark::State & state)
+{
+    const table & t = table::prepare(state, __func__);
+    run(state, t.requests([](const std::string & key) { return make_expire_request(key, 100000); }), KVM_REPLY_STATUS_OK);
+}
+
+static void BM_handle_delete_put(benchmark::State & state)
+{
+    /* DELETE of a missing key is a miss, so each key is deleted and stored again */
+    const table & t = table::prepare(state, __func__);
+    std::vector<std::vector<uint8_t>> requests;
+    for (const std::vector<uint8_t> & del : t.requests([](const std::string & key) { return make_by_key_request(KVM_REQUST_DELETE, key); }))
+    {
+        const std::string key((const char *) del.data() + sizeof(kvm_request_generic_t) + sizeof(kvm_request_delete_t), t.key_size);
+        requests.push_back(del);
+        requests.push_back(make_put_request(key, t.value));
+    }
+    run(state, requests, KVM_REPLY_STATUS_OK);
+}
+
+static void BM_handle_count(benchmark::State & state)
+{
+    table::prepare(state, __func__);
+    run(state, {std::vector<uint8_t>(1, KVM_REQUST_COUNT)}, KVM_REPLY_STATUS_OK);
+}
+
+static void BM_handle_list(benchmark::State & state)
+{
+    const table & t = table::prepare(state, __func__);
+    run(state, {std::vector<uint8_t>(1, KVM_REQUST_LIST)}, KVM_REPLY_STATUS_OK);
+    state.SetItemsProcessed(state.iterations() * t.size);
+}
+
+/* Arguments: key size, value size, table size */
+static void key_value_table_sizes(benchmark::internal::Benchmark * b)
+{
+    for (int64_t key_size : {16, 128})
+    {
+        for (int64_t value_size : {16, 1024, 65536})
+        {
+            for (int64_t table_size : {1 << 10, 1 << 16, 1 << 20})
+            {
+                if (table_size * (key_size + value_size) <= max_table_bytes)
+                {
+                    b->Args({key_size, value_size, table_size});
+                }
+            }
+        }
+    }
+    b->ArgNames({"key", "value", "table"});
+}
+
+static void key_table_sizes(benchmark::internal::Benchmark * b)
+{
+    for (int64_t key_size : {16, 128})
+    {
+        for (int64_t table_size : {1 << 10, 1 << 16, 1 << 20})
+        {
+            b->Args({key_size, 16, table_size});
+        }
+    }
+    b->ArgNames({"key", "value", "table"});
+}
+
+BENCHMARK(BM_handle_put)->Apply(key_value_table_sizes);
+BENCHMARK(BM_handle_put_ttl)->Apply(key_table_sizes);
+BENCHMARK(BM_handle_get)->Apply(key_value_table_sizes);
+BENCHMARK(BM_handle_get_miss)->Apply(key_table_sizes);
+BENCHMARK(BM_handle_get_encoded)->Args({16, 1024, 1 << 16})->Args({16, 65536, 1 << 10})->ArgNames({"key", "value", "table"});
+BENCHMARK(BM_handle_get_compressed)->Args({16, 1024, 1 << 16})->Args({16, 65536, 1 << 10})->ArgNames({"key", "value", "table"});
+BENCHMARK(BM_handle_ttl)->Apply(key_table_sizes);
+BENCHMARK(BM_handle_expire)->Apply(key_table_sizes);
+BENCHMARK(BM_handle_delete_put)->Apply(key_table_sizes);
+BENCHMARK(BM_handle_count)->Args({16, 16, 1 << 16})->ArgNames({"key", "value", "table"});
+BENCHMARK(BM_handle_list)->Args({16, 16, 1 << 10})->Args({16, 16, 1 << 16})->ArgNames({"key", "value", "table"});
@@ -0,0 +1,148 @@
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <string>
+#include "kvm_protocol.h"
+#include "kvm_requests.h"
+#include "bulk_reader.h"
+
+class bulk_reader : public ::testing::Test
+{
+protected:
+    virtual void TearDown()
+    {
+        bulk_reader_uninit(&reader);
+        if (nullptr != file)
+        {
+            fclose(file);
+        }
+    }
+
+    /* Opens the reader on the input, returns what bulk_reader_init() does. */
+    int open(const std::string & data, bulk_format_t format)
+    {
+        input = data;
+        file = fmemopen(&input[0], input.size(), "rb");
+        EXPECT_NE(nullptr, file);
+        return bulk_reader_init(&reader, file, format);
+    }
+
+    /* Reads a pair, expecting a record with the given content. */
+    void expect_record(const std::string & key, const std::string & value, uint32_t ttl = KVM_TTL_PERSIST)
+    {
+        kvm_const_dlob_data_t k;
+        kvm_const_dlob_data_t v;
+        uint32_t t = 0;
+        ASSERT_EQ(BULK_READ_RECORD, bulk_reader_read(&reader, &k, &v, &t));
+        EXPECT_EQ(key, std::string((const char *) k.data, k.size));
+        EXPECT_EQ(value, std::string((const char *) v.data, v.size));
+        EXPECT_EQ(ttl, t);
+    }
+
+    bulk_read_status_t read()
+    {
+        kvm_const_dlob_data_t k;
+        kvm_const_dlob_data_t v;
+        uint32_t t;
+        return bulk_reader_read(&reader, &k, &v, &t);
+    }
+
+    static std::string record(const std::string & key, const std::string & value, uint32_t ttl)
+    {
+        bulk_record_t header = {(uint32_t) key.size(), (uint32_t) value.size(), ttl};
+        return std::string((const char *) &header, sizeof(header)) + key + value;
+    }
+
+    static std::string magic()
+    {
+        return std::string(BULK_BINARY_MAGIC, BULK_BINARY_MAGIC_SIZE);
+    }
+
+    std::string input;
+    FILE * file = nullptr;
+    bulk_reader_t reader = {};
+};
+
+/********** Text **********/
+TEST_F(bulk_reader, text_splits_at_first_equal_sign)
+{
+    ASSERT_NE(0, open("key1=value1\nkey2=a=b\nkey3=\n", BULK_FORMAT_TEXT));
+
+    expect_record("key1", "value1");
+    expect_record("key2", "a=b");
+    expect_record("key3", "");
+    EXPECT_EQ(BULK_READ_END, read());
+    EXPECT_EQ(3u, reader.record);
+}
+
+TEST_F(bulk_reader, text_strips_line_ends_and_skips_blank_lines)
+{
+    ASSERT_NE(0, open("key1=value1\r\n\r\n\nkey2=value2", BULK_FORMAT_TEXT));
+
+    expect_record("key1", "value1");
+    expect_record("key2", "value2");
+    EXPECT_EQ(BULK_READ_END, read());
+}
+
+TEST_F(bulk_reader, text_line_without_key_is_skipped)
+{
+    ASSERT_NE(0, open("no delimiter\n=value\nkey1=value1\n", BULK_FORMAT_TEXT));
+
+    EXPECT_EQ(BULK_READ_INVALID, read());
+    EXPECT_EQ(BULK_READ_INVALID, read());
+    expect_record("key1", "value1");
+    EXPECT_EQ(3u, reader.record);
+    EXPECT_EQ(BULK_READ_END, read());
+}
+
+/********** Binary **********/
+TEST_F(bulk_reader, binary_reads_records_with_ttl)
+{
+    const std::string value("a\n=\r\0b", 6);
+    ASSERT_NE(0, open(magic() + record("key1", value, 500) + record("key2", "", KVM_TTL_PERSIST), BULK_FORMAT_BINARY));
+
+    expect_record("key1", value, 500);
+    expect_record("key2", "");
+    EXPECT_EQ(BULK_READ_END, read());
+}
+
+TEST_F(bulk_reader, binary_wrong_magic_is_rejected)
+{
+    EXPECT_EQ(0, open("KVMBULK2" + record("key1", "value1", KVM_TTL_PERSIST), BULK_FORMAT_BINARY));
+    bulk_reader_uninit(&reader);
+    fclose(file);
+
+    EXPECT_EQ(0, open("KVM", BULK_FORMAT_BINARY));
+}
+
+TEST_F(bulk_reader, binary_invalid_header_is_an_error)
+{
+    const std::string headers[] = {
+        record("", "value1", KVM_TTL_PERSIST),
+        record("key1", "value1", 0),
+        record("key1", "", KVM_TTL_PERSIST).replace(sizeof(uint32_t), sizeof(uint32_t), "\xFF\xFF\xFF\x7F")};
+
+    for (const std::string & header : headers)
+    {
+        ASSERT_NE(0, open(magic() + header, BULK_FORMAT_BINARY));
+        EXPECT_EQ(BULK_READ_ERROR, read());
+        bulk_reader_uninit(&reader);
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+TEST_F(bulk_reader, binary_truncated_record_is_an_error)
+{
+    const std::string full = record("key1", "value1", KVM_TTL_PERSIST);
+
+    /* Cut in the header, then in the data */
+    for (size_t size : {sizeof(bulk_record_t) - 1, full.size() - 1})
+    {
+        ASSERT_NE(0, open(magic() + full.substr(0, size), BULK_FORMAT_BINARY));
+        EXPECT_EQ(BULK_READ_ERROR, read());
+        EXPECT_EQ(1u, reader.record);
+        bulk_reader_uninit(&reader);
+        fclose(file);
+        file = nullptr;
+    }
+}
@@ -1,4 +1,8 @@
 #include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "kvm_requests.h"
 #include "kvm_client.h"
 
 const uint8_t key1[] = {'k', 'e', 'y', '1'};
@@ -109,6 +113,25 @@ TEST_F(client_request, client_get_null_callback_return_bad_param)
     ASSERT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_get(h_client, &key1_blob, NULL, NULL));
 }
 
+TEST_F(client_request, client_get_compressed_return_ok)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+    ASSERT_NE(nullptr, h_client);
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_set_compression(h_client, 1));
+
+    uint8_t cb_result = 0;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_get(h_client, &key1_blob, get_callback, &cb_result));
+    EXPECT_EQ(1, cb_result);
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+TEST_F(client_request, client_set_compression_null_client_handle_return_bad_param)
+{
+    ASSERT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_set_compression(NULL, 1));
+}
+
 /********** kvm_client_delete **********/
 TEST_F(client_request, client_delete_return_ok)
 {
@@ -201,4 +224,476 @@ TEST_F(client_request, client_count_null_client_handle_return_bad_param)
 TEST_F(client_request, client_count_null_count_return_bad_param)
 {
     ASSERT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_count(h_client, NULL));
-}
\ No newline at end of file
+}
+
+/********** kvm_client_stats **********/
+TEST_F(client_request, client_stats_return_ok)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+    ASSERT_NE(nullptr, h_client);
+
+    std::unique_ptr<kvm_stats_t> stats(new kvm_stats_t());
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_stats(h_client, stats.get()));
+    EXPECT_EQ(3, stats->hits);
+    EXPECT_EQ(1, stats->misses);
+    EXPECT_EQ(2, stats->keys);
+    EXPECT_EQ(4, stats->requests[KVM_REQUST_GET]);
+    EXPECT_EQ(0, stats->requests[KVM_REQUST_PUT]);
+    EXPECT_EQ(1000, stats->latency_sum[KVM_REQUST_GET]);
+    EXPECT_EQ(4, stats->latency[KVM_REQUST_GET][20]);
+    EXPECT_EQ(4, kvm_histogram_count(stats->latency[KVM_REQUST_GET]));
+    EXPECT_EQ(3000, stats->phase_sum[KVM_STATS_PHASE_READ]);
+    EXPECT_EQ(2, stats->phase[KVM_STATS_PHASE_READ][21]);
+    EXPECT_EQ(0, kvm_histogram_count(stats->phase[KVM_STATS_PHASE_WRITE]));
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+TEST_F(client_request, client_stats_null_client_handle_return_bad_param)
+{
+    std::unique_ptr<kvm_stats_t> stats(new kvm_stats_t());
+    ASSERT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_stats(NULL, stats.get()));
+}
+
+TEST_F(client_request, client_stats_null_stats_return_bad_param)
+{
+    ASSERT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_stats(h_client, NULL));
+}
+
+/********** kvm_client_slowlog **********/
+static std::vector<kvm_slowlog_entry_t> slowlog_entries;
+static int slowlog_end_seen;
+
+static void slowlog_callback(void * context, const kvm_slowlog_entry_t * entry)
+{
+    if (NULL == entry)
+    {
+        slowlog_end_seen = 1;
+    }
+    else
+    {
+        slowlog_entries.push_back(*entry);
+    }
+}
+
+TEST_F(client_request, client_slowlog_return_ok)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+    ASSERT_NE(nullptr, h_client);
+
+    slowlog_entries.clear();
+    slowlog_end_seen = 0;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_slowlog(h_client, 1, slowlog_callback, NULL));
+    EXPECT_EQ(1, slowlog_end_seen);
+    ASSERT_EQ(1, slowlog_entries.size());
+
+    const kvm_slowlog_entry_t & entry = slowlog_entries[0];
+    EXPECT_EQ(9, entry.id);
+    EXPECT_EQ(2000000, entry.duration_ns);
+    EXPECT_EQ(KVM_SLOWLOG_EXECUTE, entry.kind);
+    EXPECT_EQ(KVM_REQUST_GET, entry.op);
+    EXPECT_EQ(7, entry.fd);
+    EXPECT_EQ(4, entry.key_size);
+    EXPECT_EQ(9, entry.request_size);
+    EXPECT_EQ(11, entry.reply_size);
+    ASSERT_EQ(4, entry.prefix_size);
+    EXPECT_EQ(0, memcmp("key1", entry.key_prefix, 4));
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+TEST_F(client_request, client_slowlog_null_client_handle_return_bad_param)
+{
+    ASSERT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_slowlog(NULL, 0, slowlog_callback, NULL));
+}
+
+TEST_F(client_request, client_slowlog_null_callback_return_bad_param)
+{
+    ASSERT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_slowlog(h_client, 0, NULL, NULL));
+}
+
+/********** kvm_client_hotkeys **********/
+static std::vector<kvm_hotkey_t> hotkeys;
+static int hotkeys_end_seen;
+
+static void hotkeys_callback(void * context, const kvm_hotkey_t * key)
+{
+    if (NULL == key)
+    {
+        hotkeys_end_seen = 1;
+    }
+    else
+    {
+        hotkeys.push_back(*key);
+    }
+}
+
+TEST_F(client_request, client_hotkeys_return_ok)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+    ASSERT_NE(nullptr, h_client);
+
+    hotkeys.clear();
+    hotkeys_end_seen = 0;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_hotkeys(h_client, 0, hotkeys_callback, NULL));
+    EXPECT_EQ(1, hotkeys_end_seen);
+    ASSERT_EQ(1, hotkeys.size());
+
+    const kvm_hotkey_t & key = hotkeys[0];
+    EXPECT_EQ(1600, key.hits);
+    EXPECT_EQ(160, key.rate);
+    EXPECT_EQ(4, key.key_size);
+    ASSERT_EQ(4, key.prefix_size);
+    EXPECT_EQ(0, memcmp("key1", key.key_prefix, 4));
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+TEST_F(client_request, client_hotkeys_null_client_handle_return_bad_param)
+{
+    ASSERT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_hotkeys(NULL, 0, hotkeys_callback, NULL));
+}
+
+TEST_F(client_request, client_hotkeys_null_callback_return_bad_param)
+{
+    ASSERT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_hotkeys(h_client, 0, NULL, NULL));
+}
+
+/********** kvm_client_memory **********/
+TEST_F(client_request, client_memory_return_ok)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+
+    kvm_memory_t memory;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_memory(h_client, &memory));
+    EXPECT_EQ(1u, memory.keys);
+    EXPECT_EQ(5u, memory.buckets);
+    EXPECT_EQ(10u, memory.rss);
+    EXPECT_EQ(13u, memory.heap_releasable);
+
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_memory(h_client, NULL));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+/********** kvm_client_scan **********/
+static void scan_callback(void * context, const kvm_const_dlob_data_t * key, const kvm_const_dlob_data_t * value, uint32_t value_size, uint32_t ttl)
+{
+    std::vector<std::string> * pairs = (std::vector<std::string> *) context;
+    pairs->push_back(std::string((const char *) key->data, key->size) + "=" +
+        ((NULL != value) ? std::string((const char *) value->data, value->size) : "<" + std::to_string(value_size) + ">") +
+        ":" + std::to_string(ttl));
+}
+
+TEST_F(client_request, client_scan_return_pages_until_cursor_is_zero)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+
+    std::vector<std::string> pairs;
+    uint32_t cursor = 0;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_scan(h_client, &cursor, 1024, scan_callback, &pairs));
+    EXPECT_EQ(5u, cursor);
+    EXPECT_EQ(std::vector<std::string>({"key1=value1:4294967295", "big=<100000>:500"}), pairs);
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_scan(h_client, &cursor, 1024, scan_callback, &pairs));
+    EXPECT_EQ(0u, cursor);
+    EXPECT_EQ(2u, pairs.size());
+
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_scan(h_client, &cursor, 0, scan_callback, &pairs));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_scan(h_client, &cursor, KVM_SCAN_MAX_BYTES + 1, scan_callback, &pairs));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_scan(h_client, NULL, 1024, scan_callback, &pairs));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+/********** kvm_client_put_stream **********/
+TEST_F(client_request, client_put_stream_return_ok)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+    ASSERT_NE(nullptr, h_client);
+
+    uint32_t stream = 0;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_put_stream_begin(h_client, &key1_blob, sizeof(value1), KVM_TTL_PERSIST, &stream));
+    EXPECT_EQ(7, stream);
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_put_stream_write(h_client, stream, &value1_blob));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_put_stream_end(h_client, stream, 0));
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+TEST_F(client_request, client_put_stream_begin_zero_ttl_return_bad_param)
+{
+    uint32_t stream;
+    ASSERT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_put_stream_begin(NULL, &key1_blob, 1, KVM_TTL_PERSIST, &stream));
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_put_stream_begin(h_client, &key1_blob, 1, 0, &stream));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_put_stream_begin(h_client, &key1_blob, 1, KVM_TTL_PERSIST, NULL));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+/********** kvm_client_get_stream **********/
+static std::string streamed_value;
+static uint32_t streamed_chunks;
+
+static void chunk_callback(void * context, uint32_t value_size, uint32_t offset, const kvm_const_dlob_data_t * chunk)
+{
+    EXPECT_EQ(sizeof(value1), value_size);
+    EXPECT_EQ(streamed_value.size(), offset);
+    streamed_value.append((const char *) chunk->data, chunk->size);
+    streamed_chunks++;
+}
+
+TEST_F(client_request, client_get_stream_return_value_in_chunks)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+    ASSERT_NE(nullptr, h_client);
+
+    streamed_value.clear();
+    streamed_chunks = 0;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_get_stream(h_client, &key1_blob, 4, chunk_callback, NULL));
+    EXPECT_EQ("value1", streamed_value);
+    EXPECT_EQ(2, streamed_chunks);
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+TEST_F(client_request, client_get_stream_zero_chunk_size_return_bad_param)
+{
+    ASSERT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_get_stream(NULL, &key1_blob, 4, chunk_callback, NULL));
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_get_stream(h_client, &key1_blob, 0, chunk_callback, NULL));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_get_stream(h_client, &key1_blob, 4, NULL, NULL));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+/********** kvm_client_get_versioned **********/
+TEST_F(client_request, client_get_versioned_return_value_and_version)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+
+    uint8_t cb_result = 0;
+    uint64_t version = 0;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_get_versioned(h_client, &key1_blob, get_callback, &cb_result, &version));
+    EXPECT_EQ(1, cb_result);
+    EXPECT_EQ(5u, version);
+
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_get_versioned(h_client, &key1_blob, get_callback, &cb_result, NULL));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+/********** kvm_client_put_if **********/
+TEST_F(client_request, client_put_if_return_stored_version_or_conflict)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+
+    uint64_t version = 0;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_put_if(h_client, &key1_blob, &value1_blob, KVM_TTL_PERSIST, KVM_IF_VERSION, 5, &version));
+    EXPECT_EQ(6u, version);
+    EXPECT_EQ(KVM_RESULT_CONFLICT, kvm_client_put_if(h_client, &key1_blob, &value1_blob, KVM_TTL_PERSIST, KVM_IF_VERSION, 4, &version));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_put_if(h_client, &key1_blob, &value1_blob, KVM_TTL_PERSIST, KVM_IF_PRESENT, 0, NULL));
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+TEST_F(client_request, client_put_if_bad_condition_return_bad_param)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_put_if(h_client, &key1_blob, &value1_blob, 0, KVM_IF_ABSENT, 0, NULL));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_put_if(h_client, &key1_blob, &value1_blob, KVM_TTL_PERSIST, KVM_IF_PRESENT + 1, 0, NULL));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+/********** kvm_client_delete_if **********/
+TEST_F(client_request, client_delete_if_return_ok_or_conflict)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_delete_if(h_client, &key1_blob, KVM_IF_VERSION, 5));
+    EXPECT_EQ(KVM_RESULT_CONFLICT, kvm_client_delete_if(h_client, &key1_blob, KVM_IF_VERSION, 7));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_delete_if(h_client, &key1_blob, KVM_IF_ABSENT, 0));
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+/********** kvm_client_incr / append / getset **********/
+TEST_F(client_request, client_incr_return_value)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+
+    int64_t value = 0;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_incr(h_client, &key1_blob, 3, &value));
+    EXPECT_EQ(8, value);
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_incr(h_client, &key1_blob, -7, &value));
+    EXPECT_EQ(-2, value);
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_incr(h_client, &key1_blob, 1, NULL));
+
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_incr(h_client, NULL, 1, &value));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+TEST_F(client_request, client_append_return_value_size)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+
+    uint32_t value_size = 0;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_append(h_client, &key1_blob, &value1_blob, &value_size));
+    EXPECT_EQ(2 * sizeof(value1), value_size);
+
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_append(h_client, &key1_blob, NULL, &value_size));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+TEST_F(client_request, client_getset_return_old_value)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+
+    uint8_t cb_result = 0;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_getset(h_client, &key1_blob, &value1_blob, get_callback, &cb_result));
+    EXPECT_EQ(1, cb_result);
+
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_getset(h_client, &key1_blob, &value1_blob, NULL, NULL));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+/********** kvm_client_batch_xxx **********/
+struct batch_results
+{
+    std::vector<kvm_result_t> results;
+    std::vector<std::string> values;
+};
+
+static void batch_callback(void * context, uint32_t index, kvm_result_t result, const kvm_const_dlob_data_t * value)
+{
+    batch_results * r = (batch_results *) context;
+    EXPECT_EQ(r->results.size(), index);
+    r->results.push_back(result);
+    r->values.push_back((NULL != value) ? std::string((const char *) value->data, value->size) : "-");
+}
+
+TEST_F(client_request, client_batch_exec_return_results_in_order)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+
+    kvm_batch_handle_t h_batch = nullptr;
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_batch_create(&h_batch));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_batch_put(h_batch, &key1_blob, &value1_blob, KVM_TTL_PERSIST));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_batch_get(h_batch, &key1_blob));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_batch_delete_if(h_batch, &key1_blob, KVM_IF_VERSION, 5));
+
+    batch_results r;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_batch_exec(h_client, h_batch, batch_callback, &r));
+    EXPECT_EQ(std::vector<kvm_result_t>({KVM_RESULT_OK, KVM_RESULT_OK, KVM_RESULT_OK}), r.results);
+    EXPECT_EQ(std::vector<std::string>({"-", "value1", "-"}), r.values);
+
+    /* The batch is kept and can be executed again. */
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_batch_exec(h_client, h_batch, NULL, NULL));
+
+    kvm_client_batch_destroy(h_batch);
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+TEST_F(client_request, client_batch_exec_failed_op_return_its_result)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+
+    kvm_batch_handle_t h_batch = nullptr;
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_batch_create(&h_batch));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_batch_delete(h_batch, &key1_blob));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_batch_delete_if(h_batch, &key1_blob, KVM_IF_VERSION, 4));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_batch_get(h_batch, &key1_blob));
+
+    batch_results r;
+    EXPECT_EQ(KVM_RESULT_CONFLICT, kvm_client_batch_exec(h_client, h_batch, batch_callback, &r));
+    EXPECT_EQ(std::vector<kvm_result_t>({KVM_RESULT_OK, KVM_RESULT_CONFLICT}), r.results);
+
+    kvm_client_batch_destroy(h_batch);
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+TEST_F(client_request, client_batch_invalid_param_return_bad_param)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+
+    kvm_batch_handle_t h_batch = nullptr;
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_batch_create(NULL));
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_batch_create(&h_batch));
+
+    /* An empty batch is not sent. */
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_batch_exec(h_client, h_batch, NULL, NULL));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_batch_put(h_batch, &key1_blob, &value1_blob, 0));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_batch_delete_if(h_batch, &key1_blob, KVM_IF_ABSENT, 0));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_batch_get(NULL, &key1_blob));
+
+    for (uint32_t i = 0; i < KVM_BATCH_MAX_OPS; ++i)
+    {
+        ASSERT_EQ(KVM_RESULT_OK, kvm_client_batch_get(h_batch, &key1_blob));
+    }
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_batch_get(h_batch, &key1_blob));
+
+    /* A reset batch is empty again. */
+    kvm_client_batch_reset(h_batch);
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_batch_exec(h_client, h_batch, NULL, NULL));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_batch_get(h_batch, &key1_blob));
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_batch_exec(h_client, h_batch, NULL, NULL));
+
+    kvm_client_batch_destroy(h_batch);
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+/********** kvm_client_put_ttl **********/
+TEST_F(client_request, client_put_ttl_return_ok)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+    ASSERT_NE(nullptr, h_client);
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_put_ttl(h_client, &key1_blob, &value1_blob, 1000));
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+TEST_F(client_request, client_put_ttl_null_client_handle_return_bad_param)
+{
+    ASSERT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_put_ttl(NULL, &key1_blob, &value1_blob, 1000));
+}
+
+TEST_F(client_request, client_put_ttl_zero_ttl_return_bad_param)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+    ASSERT_NE(nullptr, h_client);
+
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_put_ttl(h_client, &key1_blob, &value1_blob, 0));
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+/********** kvm_client_expire **********/
+TEST_F(client_request, client_expire_return_ok)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+    ASSERT_NE(nullptr, h_client);
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_expire(h_client, &key1_blob, 1000));
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+TEST_F(client_request, client_expire_null_key_return_bad_param)
+{
+    ASSERT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_expire(h_client, NULL, 1000));
+}
+
+/********** kvm_client_ttl **********/
+TEST_F(client_request, client_ttl_return_ok)
+{
+    ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, ip, port));
+    ASSERT_NE(nullptr, h_client);
+
+    uint32_t ttl = 0;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_ttl(h_client, &key1_blob, &ttl));
+    EXPECT_EQ(1000, ttl);
+
+    EXPECT_EQ(KVM_RESULT_OK, kvm_client_close(h_client));
+}
+
+TEST_F(client_request, client_ttl_null_ttl_return_bad_param)
+{
+    ASSERT_EQ(KVM_RESULT_INVALID_PARAM, kvm_client_ttl(h_client, &key1_blob, NULL));
+}
@@ -3,16 +3,52 @@
 
 #include "kvm_requests.h"
 #include "kvm_replies.h"
+#include "kvm_protocol.h"
 #include "kvm_client.h"
 #include "kvm_client_transport.h"
+#include "kvm_server_internal.h"
 
 const uint32_t * dummy_ctx = ((uint32_t *) 0xABABABAB);
 const char * ip = "127.0.0.1";
 const uint16_t port = 55555;
 
+/* Requests sent on this port are handled by the server request handler. */
+const uint32_t * handler_ctx = ((uint32_t *) 0xCDCDCDCD);
+const uint16_t handler_port = 55556;
+
 const uint8_t get_reply_ok[] = {KVM_REPLY_STATUS_OK, 6, 0, 0, 0, 'v', 'a', 'l', 'u', 'e', '1'};
 const uint8_t list_reply_ok[] = {KVM_REPLY_STATUS_OK, 1, 0, 0, 0, 4, 0, 0, 0, 'k', 'e', 'y', '1'};
 const uint8_t count_reply_ok[] = {KVM_REPLY_STATUS_OK, 1, 0, 0, 0};
+const uint8_t get_encoded_reply_ok[] = {KVM_REPLY_STATUS_OK, KVM_CODEC_LZ4, 6, 0, 0, 0, 7, 0, 0, 0, 0x60, 'v', 'a', 'l', 'u', 'e', '1'};
+const uint8_t ttl_reply_ok[] = {KVM_REPLY_STATUS_OK, 0xE8, 0x03, 0, 0};
+/* 3 hits, 1 miss, 2 keys; 4 GET requests taking 1000 ns, all in latency bucket 20;
+   2 reads taking 3000 ns, both in bucket 21 */
+const uint8_t stats_reply_ok[] = {KVM_REPLY_STATUS_OK,
+    3, 0, 0, 0, 0, 0, 0, 0,     1, 0, 0, 0, 0, 0, 0, 0,     0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0,     0, 0, 0, 0, 0, 0, 0, 0,     0, 0, 0, 0, 0, 0, 0, 0,
+    2, 0, 0, 0, 0, 0, 0, 0,     0, 0, 0, 0, 0, 0, 0, 0,     0, 0, 0, 0, 0, 0, 0, 0,
+    1,
+    KVM_REQUST_GET, 4, 0, 0, 0, 0, 0, 0, 0, 0xE8, 0x03, 0, 0, 0, 0, 0, 0, 1, 0,
+    20, 0, 4, 0, 0, 0, 0, 0, 0, 0,
+    1,
+    KVM_STATS_PHASE_READ, 2, 0, 0, 0, 0, 0, 0, 0, 0xB8, 0x0B, 0, 0, 0, 0, 0, 0, 1, 0,
+    21, 0, 2, 0, 0, 0, 0, 0, 0, 0};
+/* One entry: GET key1 taking 2 ms on fd 7 */
+const uint8_t slowlog_reply_ok[] = {KVM_REPLY_STATUS_OK, 1, 0, 0, 0,
+    9, 0, 0, 0, 0, 0, 0, 0,     0, 0, 0, 0, 0, 0, 0, 0,     0x80, 0x84, 0x1E, 0, 0, 0, 0, 0,
+    KVM_SLOWLOG_EXECUTE, KVM_REQUST_GET, 7, 0, 0, 0, 4, 0, 0, 0, 9, 0, 0, 0, 11, 0, 0, 0, 4,
+    'k', 'e', 'y', '1'};
+
+/* One key: key1 with 1600 hits at 160 per second */
+const uint8_t hotkeys_reply_ok[] = {KVM_REPLY_STATUS_OK, 1, 0, 0, 0,
+    0x40, 0x06, 0, 0, 0, 0, 0, 0,   160, 0, 0, 0,   4, 0, 0, 0,   4,
+    'k', 'e', 'y', '1'};
+
+/* Upload id 7 */
+const uint8_t put_begin_reply_ok[] = {KVM_REPLY_STATUS_OK, 7, 0, 0, 0};
+
+/* Value of GET_RANGE requests, version 5 */
+const char range_value[] = "value1";
 
 uint8_t delete_called;
 
@@ -27,7 +63,7 @@ kvm_transport_open(
         return KVM_RESULT_INVALID_PARAM;
     }
 
-    if (port != server_port)
+    if (port != server_port && handler_port != server_port)
     {
         return KVM_RESULT_INVALID_PARAM;
     }
@@ -37,7 +73,7 @@ kvm_transport_open(
         return KVM_RESULT_INVALID_PARAM;
     }
 
-    *h_transport = (kvm_transport_handle_t) dummy_ctx;
+    *h_transport = (kvm_transport_handle_t) ((handler_port == server_port) ? handler_ctx : dummy_ctx);
     delete_called = 0;
 
     return KVM_RESULT_OK;
@@ -50,6 +86,13 @@ kvm_transport_close(
     return KVM_RESULT_OK;
 }
 
+uint32_t
+kvm_transport_get_features(
+    kvm_transport_handle_t h_transport)
+{
+    return KVM_FEATURES_SUPPORTED;
+}
+
 kvm_result_t
 kvm_transport_send(
     kvm_transport_handle_t  h_transport,
@@ -58,8 +101,13 @@ kvm_transport_send(
     uint32_t *              reply_size,
     uint8_t **              reply)
 {
+    if ((kvm_transport_handle_t) handler_ctx == h_transport)
+    {
+        return handle_request(request_size, request, reply_size, reply);
+    }
+
     kvm_request_id_t id = (kvm_request_id_t) *request;
-    uint8_t * r_buf = (uint8_t *) malloc(100);
+    uint8_t * r_buf = (uint8_t *) malloc(256);
     if (NULL == r_buf)
     {
         return KVM_RESULT_SYS_CALL_FAIL;
@@ -70,6 +118,10 @@ kvm_transport_send(
         case KVM_REQUST_DELETE:
             delete_called = 1;
         case KVM_REQUST_PUT:
+        case KVM_REQUST_PUT_TTL:
+        case KVM_REQUST_EXPIRE:
+        case KVM_REQUST_PUT_CHUNK:
+        case KVM_REQUST_PUT_END:
         {
             *reply_size = sizeof(kvm_reply_generic_t);
             ((kvm_reply_generic_t *) r_buf)->status = KVM_REPLY_STATUS_OK;
@@ -89,6 +141,12 @@ kvm_transport_send(
             }
             break;
         }        
+        case KVM_REQUST_GET_ENCODED:
+        {
+            *reply_size = sizeof(get_encoded_reply_ok);
+            mempcpy(r_buf, get_encoded_reply_ok, sizeof(get_encoded_reply_ok));
+            break;
+        }
         case KVM_REQUST_LIST:
         {
             *reply_size = sizeof(list_reply_ok);
@@ -101,6 +159,238 @@ kvm_transport_send(
             mempcpy(r_buf, count_reply_ok, sizeof(count_reply_ok));
             break;
         }
+        case KVM_REQUST_TTL:
+        {
+            *reply_size = sizeof(ttl_reply_ok);
+            mempcpy(r_buf, ttl_reply_ok, sizeof(ttl_reply_ok));
+            break;
+        }
+        case KVM_REQUST_PUT_BEGIN:
+        {
+            *reply_size = sizeof(put_begin_reply_ok);
+            mempcpy(r_buf, put_begin_reply_ok, sizeof(put_begin_reply_ok));
+            break;
+        }
+        case KVM_REQUST_GET_RANGE:
+        {
+            kvm_request_get_range_t range_req;
+            memcpy(&range_req, request + sizeof(kvm_request_generic_t), sizeof(range_req));
+
+            const uint32_t value_size = sizeof(range_value) - 1;
+            uint32_t size = value_size - range_req.offset;
+            size = (size < range_req.max_size) ? size : range_req.max_size;
+
+            kvm_reply_get_range_t range_reply;
+            range_reply.value_size = value_size;
+            range_reply.range_size = size;
+            range_reply.version = 5;
+
+            r_buf[0] = KVM_REPLY_STATUS_OK;
+            memcpy(r_buf + 1, &range_reply, sizeof(range_reply));
+            memcpy(r_buf + 1 + sizeof(range_reply), range_value + range_req.offset, size);
+            *reply_size = 1 + sizeof(range_reply) + size;
+            break;
+        }
+        case KVM_REQUST_GET_VERSIONED:
+        {
+            kvm_reply_get_versioned_t get_reply;
+            get_reply.value_size = sizeof(range_value) - 1;
+            get_reply.version = 5;
+
+            r_buf[0] = KVM_REPLY_STATUS_OK;
+            memcpy(r_buf + 1, &get_reply, sizeof(get_reply));
+            memcpy(r_buf + 1 + sizeof(get_reply), range_value, get_reply.value_size);
+            *reply_size = 1 + sizeof(get_reply) + get_reply.value_size;
+            break;
+        }
+        case KVM_REQUST_PUT_IF:
+        case KVM_REQUST_DELETE_IF:
+        {
+            /* Only version 5 of any key exists. */
+            kvm_request_delete_if_t cond_req;
+            kvm_request_put_if_t put_req;
+            uint64_t version;
+            if (KVM_REQUST_PUT_IF == id)
+            {
+                memcpy(&put_req, request + sizeof(kvm_request_generic_t), sizeof(put_req));
+                version = (KVM_IF_VERSION == put_req.condition) ? put_req.version : 5;
+            }
+            else
+            {
+                memcpy(&cond_req, request + sizeof(kvm_request_generic_t), sizeof(cond_req));
+                version = (KVM_IF_VERSION == cond_req.condition) ? cond_req.version : 5;
+            }
+
+            r_buf[0] = (5 == version) ? KVM_REPLY_STATUS_OK : KVM_REPLY_CONFLICT;
+            *reply_size = 1;
+            if (KVM_REQUST_PUT_IF == id && 5 == version)
+            {
+                kvm_reply_put_if_t put_reply;
+                put_reply.version = 6;
+                memcpy(r_buf + 1, &put_reply, sizeof(put_reply));
+                *reply_size += sizeof(put_reply);
+            }
+            break;
+        }
+        case KVM_REQUST_INCR:
+        {
+            /* Every key holds 5. */
+            kvm_request_incr_t incr_req;
+            memcpy(&incr_req, request + sizeof(kvm_request_generic_t), sizeof(incr_req));
+
+            kvm_reply_incr_t incr_reply;
+            incr_reply.value = 5 + incr_req.delta;
+
+            r_buf[0] = KVM_REPLY_STATUS_OK;
+            memcpy(r_buf + 1, &incr_reply, sizeof(incr_reply));
+            *reply_size = 1 + sizeof(incr_reply);
+            break;
+        }
+        case KVM_REQUST_APPEND:
+        {
+            /* Every key holds "value1". */
+            kvm_request_append_t append_req;
+            memcpy(&append_req, request + sizeof(kvm_request_generic_t), sizeof(append_req));
+
+            kvm_reply_append_t append_reply;
+            append_reply.value_size = sizeof(range_value) - 1 + append_req.value_size;
+
+            r_buf[0] = KVM_REPLY_STATUS_OK;
+            memcpy(r_buf + 1, &append_reply, sizeof(append_reply));
+            *reply_size = 1 + sizeof(append_reply);
+            break;
+        }
+        case KVM_REQUST_GETSET:
+        {
+            kvm_reply_getset_t getset_reply;
+            getset_reply.found = 1;
+            getset_reply.value_size = sizeof(range_value) - 1;
+
+            r_buf[0] = KVM_REPLY_STATUS_OK;
+            memcpy(r_buf + 1, &getset_reply, sizeof(getset_reply));
+            memcpy(r_buf + 1 + sizeof(getset_reply), range_value, getset_reply.value_size);
+            *reply_size = 1 + sizeof(getset_reply) + getset_reply.value_size;
+            break;
+        }
+        case KVM_REQUST_BATCH:
+        {
+            /* GETs find "value1", DELETE_IF conflicts unless version 5 is
+               expected and fails the batch, anything else succeeds. */
+            kvm_request_batch_t batch_req;
+            memcpy(&batch_req, request + sizeof(kvm_request_generic_t), sizeof(batch_req));
+
+            const uint8_t * op = request + sizeof(kvm_request_generic_t) + sizeof(batch_req);
+            kvm_reply_batch_t batch_reply;
+            batch_reply.committed = 1;
+            batch_reply.count = 0;
+            *reply_size = 1 + sizeof(batch_reply);
+
+            while (batch_reply.committed && batch_reply.count < batch_req.count)
+            {
+                uint32_t op_size;
+                memcpy(&op_size, op, sizeof(op_size));
+                const uint8_t * op_request = op + sizeof(op_size);
+                op += sizeof(op_size) + op_size;
+
+                uint32_t op_reply_size = sizeof(kvm_reply_generic_t);
+                uint8_t * op_reply = r_buf + *reply_size + sizeof(op_reply_size);
+                op_reply[0] = KVM_REPLY_STATUS_OK;
+                if (KVM_REQUST_GET == op_request[0])
+                {
+                    op_reply_size = sizeof(get_reply_ok);
+                    memcpy(op_reply, get_reply_ok, sizeof(get_reply_ok));
+                }
+                else if (KVM_REQUST_DELETE_IF == op_request[0])
+                {
+                    kvm_request_delete_if_t cond_req;
+                    memcpy(&cond_req, op_request + sizeof(kvm_request_generic_t), sizeof(cond_req));
+                    if (KVM_IF_VERSION == cond_req.condition && 5 != cond_req.version)
+                    {
+                        op_reply[0] = KVM_REPLY_CONFLICT;
+                        batch_reply.committed = 0;
+                    }
+                }
+
+                memcpy(r_buf + *reply_size, &op_reply_size, sizeof(op_reply_size));
+                *reply_size += sizeof(op_reply_size) + op_reply_size;
+                batch_reply.count++;
+            }
+
+            r_buf[0] = KVM_REPLY_STATUS_OK;
+            memcpy(r_buf + 1, &batch_reply, sizeof(batch_reply));
+            break;
+        }
+        case KVM_REQUST_MEMORY:
+        {
+            /* Every field holds its index plus one. */
+            r_buf[0] = KVM_REPLY_STATUS_OK;
+            for (uint64_t i = 0; i < sizeof(kvm_reply_memory_t) / sizeof(uint64_t); ++i)
+            {
+                const uint64_t field = i + 1;
+                memcpy(r_buf + 1 + i * sizeof(field), &field, sizeof(field));
+            }
+            *reply_size = 1 + sizeof(kvm_reply_memory_t);
+            break;
+        }
+        case KVM_REQUST_SCAN:
+        {
+            /* The first page holds "key1" with its value and "big" without,
+               the second one is empty and the last. */
+            kvm_request_scan_t scan_req;
+            memcpy(&scan_req, request + 1, sizeof(scan_req));
+
+            kvm_reply_scan_t scan_reply;
+            scan_reply.cursor = (0 == scan_req.cursor) ? 5 : 0;
+            scan_reply.count = 0;
+            *reply_size = 1 + sizeof(scan_reply);
+
+            if (0 == scan_req.cursor)
+            {
+                const char * keys[] = {"key1", "big"};
+                const char * values[] = {"value1", NULL};
+                for (int i = 0; i < 2; ++i)
+                {
+                    kvm_reply_scan_entry_t entry;
+                    entry.key_size = (uint32_t) strlen(keys[i]);
+                    entry.value_size = (NULL != values[i]) ? (uint32_t) strlen(values[i]) : 100000;
+                    entry.ttl = (NULL != values[i]) ? KVM_TTL_PERSIST : 500;
+                    entry.has_value = (NULL != values[i]);
+
+                    const uint32_t entry_size = sizeof(entry) + entry.key_size + (entry.has_value ? entry.value_size : 0);
+                    memcpy(r_buf + *reply_size, &entry_size, sizeof(entry_size));
+                    memcpy(r_buf + *reply_size + sizeof(entry_size), &entry, sizeof(entry));
+                    memcpy(r_buf + *reply_size + sizeof(entry_size) + sizeof(entry), keys[i], entry.key_size);
+                    if (entry.has_value)
+                    {
+                        memcpy(r_buf + *reply_size + sizeof(entry_size) + sizeof(entry) + entry.key_size, values[i], entry.value_size);
+                    }
+                    *reply_size += sizeof(entry_size) + entry_size;
+                    scan_reply.count++;
+                }
+            }
+
+            r_buf[0] = KVM_REPLY_STATUS_OK;
+            memcpy(r_buf + 1, &scan_reply, sizeof(scan_reply));
+            break;
+        }
+        case KVM_REQUST_HOTKEYS:
+        {
+            *reply_size = sizeof(hotkeys_reply_ok);
+            mempcpy(r_buf, hotkeys_reply_ok, sizeof(hotkeys_reply_ok));
+            break;
+        }
+        case KVM_REQUST_SLOWLOG:
+        {
+            *reply_size = sizeof(slowlog_reply_ok);
+            mempcpy(r_buf, slowlog_reply_ok, sizeof(slowlog_reply_ok));
+            break;
+        }
+        case KVM_REQUST_STATS:
+        {
+            *reply_size = sizeof(stats_reply_ok);
+            mempcpy(r_buf, stats_reply_ok, sizeof(stats_reply_ok));
+            break;
+        }
         default:
         {
             *reply_size = sizeof(kvm_reply_generic_t);
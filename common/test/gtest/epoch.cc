@@ -0,0 +1,222 @@
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "kvm_epoch.h"
+#include "kvm_storage.h"
+
+TEST(epoch, reclaim_without_readers_frees_retired)
+{
+    epoch_init();
+    epoch_retire(malloc(16));
+    epoch_retire(malloc(16));
+    EXPECT_EQ(2u, epoch_pending());
+
+    EXPECT_EQ(2u, epoch_reclaim());
+    EXPECT_EQ(0u, epoch_pending());
+    EXPECT_EQ(0u, epoch_reclaim());
+}
+
+TEST(epoch, reader_in_critical_section_holds_back_reclaim)
+{
+    epoch_init();
+
+    std::atomic<int> state(0);
+    std::thread reader([&]
+    {
+        epoch_enter();
+        state = 1;
+        while (2 != state)
+        {
+            std::this_thread::yield();
+        }
+        epoch_exit();
+        state = 3;
+    });
+
+    while (1 != state)
+    {
+        std::this_thread::yield();
+    }
+
+    epoch_retire(malloc(16));
+    EXPECT_EQ(0u, epoch_reclaim());
+    EXPECT_EQ(1u, epoch_pending());
+
+    state = 2;
+    while (3 != state)
+    {
+        std::this_thread::yield();
+    }
+
+    EXPECT_EQ(1u, epoch_reclaim());
+    EXPECT_EQ(0u, epoch_pending());
+    reader.join();
+}
+
+/* Readers look keys up while the writer replaces, removes and re-inserts
+   them and grows the table. Stable keys must never be missed. */
+TEST(epoch, storage_lookup_concurrent_with_writer)
+{
+    ASSERT_EQ(KVM_RESULT_OK, storage_init());
+
+    const int stable_count = 64;
+    for (int i = 0; i < stable_count; ++i)
+    {
+        const std::string key = "stable" + std::to_string(i);
+        ASSERT_EQ(KVM_RESULT_OK, storage_put((const uint8_t *) key.data(), key.size(), (const uint8_t *) key.data(), key.size(), KVM_TTL_PERSIST));
+    }
+
+    std::atomic<bool> done(false);
+    std::atomic<uint64_t> misses(0);
+    std::atomic<uint64_t> corrupted(0);
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 2; ++t)
+    {
+        readers.emplace_back([&]
+        {
+            std::vector<uint8_t> value;
+            while (!done)
+            {
+                for (int i = 0; i < stable_count; ++i)
+                {
+                    const std::string key = "stable" + std::to_string(i);
+
+                    epoch_enter();
+                    const kvm_entry_t * entry = storage_lookup((const uint8_t *) key.data(), key.size(), storage_now());
+                    if (NULL == entry)
+                    {
+                        misses++;
+                    }
+                    else
+                    {
+                        value.resize(storage_value_size(entry));
+                        storage_read_value(entry, value.data());
+                        if (value.size() < key.size() || 0 != memcmp(value.data(), key.data(), key.size()))
+                        {
+                            corrupted++;
+                        }
+                    }
+                    epoch_exit();
+                }
+            }
+        });
+    }
+
+    for (int round = 0; round < 20; ++round)
+    {
+        /* Replaced values keep the key as a prefix. */
+        for (int i = 0; i < stable_count; ++i)
+        {
+            const std::string key = "stable" + std::to_string(i);
+            const std::string value = key + std::to_string(round);
+            ASSERT_EQ(KVM_RESULT_OK, storage_put((const uint8_t *) key.data(), key.size(), (const uint8_t *) value.data(), value.size(), KVM_TTL_PERSIST));
+        }
+
+        /* Fill up to grow the table, then remove again. */
+        for (int i = 0; i < 2000; ++i)
+        {
+            const std::string key = "churn" + std::to_string(round) + "_" + std::to_string(i);
+            ASSERT_EQ(KVM_RESULT_OK, storage_put((const uint8_t *) key.data(), key.size(), (const uint8_t *) key.data(), key.size(), KVM_TTL_PERSIST));
+        }
+        for (int i = 0; i < 2000; ++i)
+        {
+            const std::string key = "churn" + std::to_string(round) + "_" + std::to_string(i);
+            kvm_entry_t * entry = storage_find((const uint8_t *) key.data(), key.size(), storage_now());
+            ASSERT_NE(nullptr, entry);
+            storage_remove(entry);
+        }
+
+        epoch_reclaim();
+    }
+
+    done = true;
+    for (std::thread & reader : readers)
+    {
+        reader.join();
+    }
+
+    EXPECT_EQ(0u, misses.load());
+    EXPECT_EQ(0u, corrupted.load());
+    EXPECT_EQ((uint32_t) stable_count, storage_count());
+
+    storage_uninit();
+    EXPECT_EQ(0u, epoch_pending());
+}
+
+/* Readers copy a value while the writer appends to it, in place or by
+   copying. Every read must be a prefix of the final value. */
+TEST(epoch, storage_append_concurrent_with_readers)
+{
+    ASSERT_EQ(KVM_RESULT_OK, storage_init());
+
+    const std::string key = "appended";
+    const int appends = 5000;
+
+    std::atomic<bool> done(false);
+    std::atomic<uint64_t> corrupted(0);
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 2; ++t)
+    {
+        readers.emplace_back([&]
+        {
+            std::vector<uint8_t> value;
+            while (!done)
+            {
+                epoch_enter();
+                const kvm_entry_t * entry = storage_lookup((const uint8_t *) key.data(), key.size(), storage_now());
+                if (NULL != entry)
+                {
+                    value.resize(storage_value_size(entry));
+                    storage_read_range(entry, 0, value.size(), value.data());
+                    for (size_t i = 0; i < value.size(); ++i)
+                    {
+                        if (value[i] != (uint8_t) ('a' + i % 26))
+                        {
+                            corrupted++;
+                            break;
+                        }
+                    }
+                }
+                epoch_exit();
+            }
+        });
+    }
+
+    uint32_t size = 0;
+    for (int i = 0; i < appends; ++i)
+    {
+        /* One to seven bytes continuing the pattern. */
+        uint8_t data[8];
+        const uint32_t count = 1 + i % 7;
+        for (uint32_t j = 0; j < count; ++j)
+        {
+            data[j] = (uint8_t) ('a' + (size + j) % 26);
+        }
+
+        uint32_t value_size;
+        ASSERT_EQ(KVM_RESULT_OK, storage_append((const uint8_t *) key.data(), key.size(), data, count, &value_size));
+        size += count;
+        ASSERT_EQ(size, value_size);
+
+        epoch_reclaim();
+    }
+
+    done = true;
+    for (std::thread & reader : readers)
+    {
+        reader.join();
+    }
+
+    EXPECT_EQ(0u, corrupted.load());
+
+    kvm_server_storage_stats_t stats;
+    storage_get_stats(&stats);
+    EXPECT_LT(appends / 2, (int) stats.appended_in_place);
+
+    storage_uninit();
+}
@@ -0,0 +1,170 @@
+#include <gtest/gtest.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <string>
+#include <vector>
+#include "kvm_protocol.h"
+#include "kvm_handoff.h"
+#include "kvm_storage.h"
+
+/* The running server in this process, the new one in a forked child which
+   reports by its exit code: 0 - everything arrived, 1 - a check failed. */
+class server_handoff : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        ASSERT_EQ(KVM_RESULT_OK, storage_init());
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, channel));
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, listener));
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, client));
+
+        memset(&state, 0, sizeof(state));
+        state.server_socket = listener[0];
+        state.unix_socket = -1;
+        state.connection_count = 1;
+        state.sockets[0] = client[0];
+        state.connections[0].version = KVM_PROTOCOL_V2;
+        state.connections[0].buffer = (uint8_t *) pending;
+        state.connections[0].size = sizeof(pending);
+    }
+
+    virtual void TearDown()
+    {
+        close(channel[0]);
+        close(listener[0]);
+        close(listener[1]);
+        close(client[0]);
+        close(client[1]);
+        storage_uninit();
+    }
+
+    void put(const std::string & key, const std::string & value, uint32_t ttl)
+    {
+        ASSERT_EQ(KVM_RESULT_OK, storage_put((const uint8_t *) key.data(), key.size(), (const uint8_t *) value.data(), value.size(), ttl));
+    }
+
+    static uint64_t version(const std::string & key)
+    {
+        const kvm_entry_t * entry = storage_find((const uint8_t *) key.data(), key.size(), storage_now());
+        return (NULL != entry) ? storage_version(entry) : 0;
+    }
+
+    static std::string value(const kvm_entry_t * entry)
+    {
+        std::string data(storage_value_size(entry), '\0');
+        storage_read_value(entry, (uint8_t *) &data[0]);
+        return data;
+    }
+
+    /* Runs the new process side, confirming the handoff if asked to. */
+    pid_t take_over(const std::vector<std::string> & keys, const std::vector<uint64_t> & versions, int confirm)
+    {
+        const pid_t pid = fork();
+        if (0 != pid)
+        {
+            close(channel[1]);
+            return pid;
+        }
+
+        close(channel[0]);
+        storage_uninit();
+        storage_init();
+
+        handoff_state_t received;
+        int ok = KVM_RESULT_OK == handoff_receive(channel[1], &received);
+        ok = ok && keys.size() == storage_count() && 1 == received.connection_count && -1 == received.unix_socket;
+        for (size_t i = 0; ok && i < keys.size(); ++i)
+        {
+            ok = versions[i] == version(keys[i]);
+        }
+
+        const kvm_entry_t * entry = ok ? storage_find((const uint8_t *) "large", 5, storage_now()) : NULL;
+        ok = ok && NULL != entry && std::string(300000, 'l') == value(entry);
+        entry = ok ? storage_find((const uint8_t *) "expiring", 8, storage_now()) : NULL;
+        ok = ok && NULL != entry && entry->timer.expire_at > storage_now() && entry->timer.expire_at <= storage_now() + 60000;
+
+        /* Received data of the connection and the sockets themselves. */
+        const kvm_connection_t * connection = &received.connections[0];
+        ok = ok && KVM_PROTOCOL_V2 == connection->version && sizeof(pending) == connection->size &&
+            0 == memcmp(pending, connection->buffer, connection->size);
+        ok = ok && 1 == write(received.sockets[0], "c", 1) && 1 == write(received.server_socket, "l", 1);
+
+        if (ok && confirm)
+        {
+            ok = KVM_RESULT_OK == handoff_confirm(channel[1]);
+        }
+        handoff_release(&received);
+        _exit(ok ? 0 : 1);
+    }
+
+    static int exit_code(pid_t pid)
+    {
+        int status;
+        return (pid == waitpid(pid, &status, 0) && WIFEXITED(status)) ? WEXITSTATUS(status) : -1;
+    }
+
+    const char pending[5] = {'\x20', '\x00', 'p', 'a', 'r'};
+    int channel[2];
+    int listener[2];
+    int client[2];
+    handoff_state_t state;
+};
+
+TEST_F(server_handoff, pass_sockets_connections_and_pairs)
+{
+    std::vector<std::string> keys;
+    for (int i = 0; i < 1000; ++i)
+    {
+        keys.push_back("key" + std::to_string(i));
+        put(keys.back(), "value" + std::to_string(i), KVM_TTL_PERSIST);
+    }
+    keys.push_back("large");
+    put(keys.back(), std::string(300000, 'l'), KVM_TTL_PERSIST);
+    keys.push_back("expiring");
+    put(keys.back(), "soon", 60000);
+
+    std::vector<uint64_t> versions;
+    for (const std::string & key : keys)
+    {
+        versions.push_back(version(key));
+    }
+
+    const pid_t pid = take_over(keys, versions, 1);
+    EXPECT_EQ(KVM_RESULT_OK, handoff_send(channel[0], &state));
+    EXPECT_EQ(0, exit_code(pid));
+
+    /* Written through the passed descriptors by the new process */
+    char data;
+    EXPECT_EQ(1, read(client[1], &data, 1));
+    EXPECT_EQ('c', data);
+    EXPECT_EQ(1, read(listener[1], &data, 1));
+    EXPECT_EQ('l', data);
+}
+
+TEST_F(server_handoff, unconfirmed_handoff_return_connection_fail)
+{
+    std::vector<std::string> keys;
+    keys.push_back("large");
+    put(keys.back(), std::string(300000, 'l'), KVM_TTL_PERSIST);
+    keys.push_back("expiring");
+    put(keys.back(), "soon", 60000);
+    const std::vector<uint64_t> versions = {version("large"), version("expiring")};
+
+    const pid_t pid = take_over(keys, versions, 0);
+    EXPECT_EQ(KVM_RESULT_CONNECTION_FAIL, handoff_send(channel[0], &state));
+    EXPECT_EQ(0, exit_code(pid));
+
+    /* Everything stays with this process. */
+    EXPECT_EQ(2u, storage_count());
+}
+
+TEST(handoff, connect_without_running_server_return_enoent)
+{
+    EXPECT_EQ(-1, handoff_connect("/tmp/kvm_test_no_such.handoff"));
+    EXPECT_EQ(ENOENT, errno);
+}
@@ -0,0 +1,67 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "kvm_hash.h"
+
+static uint64_t hash_string(const std::string & s, uint64_t seed)
+{
+    return kvm_hash((const uint8_t *) s.data(), s.size(), seed);
+}
+
+TEST(hash, same_seed_same_hash)
+{
+    for (uint32_t size = 0; size < 100; ++size)
+    {
+        const std::string s(size, 'k');
+        EXPECT_EQ(hash_string(s, 1), hash_string(s, 1)) << "size " << size;
+    }
+}
+
+TEST(hash, different_seed_different_hash)
+{
+    EXPECT_NE(hash_string("key1", 1), hash_string("key1", 2));
+    EXPECT_NE(hash_string(std::string(100, 'k'), 1), hash_string(std::string(100, 'k'), 2));
+}
+
+TEST(hash, every_byte_affects_hash)
+{
+    for (uint32_t size = 1; size < 100; ++size)
+    {
+        const std::string s(size, 'k');
+        const uint64_t hash = hash_string(s, 1);
+        for (uint32_t i = 0; i < size; ++i)
+        {
+            std::string t = s;
+            t[i] ^= 1;
+            EXPECT_NE(hash, hash_string(t, 1)) << "size " << size << " byte " << i;
+        }
+    }
+}
+
+TEST(hash, does_not_read_outside_data)
+{
+    /* Same bytes at the end of differently placed buffers must hash the same. */
+    std::vector<uint8_t> buffer(200, 0xAB);
+    for (uint32_t size = 0; size < 100; ++size)
+    {
+        EXPECT_EQ(kvm_hash(&buffer[0], size, 7), kvm_hash(&buffer[200 - size], size, 7)) << "size " << size;
+    }
+}
+
+TEST(hash, similar_keys_spread_over_buckets)
+{
+    const uint32_t buckets = 1024;
+    std::vector<uint32_t> chain(buckets);
+    for (uint32_t i = 0; i < buckets; ++i)
+    {
+        chain[hash_string("user:" + std::to_string(i), 42) & (buckets - 1)]++;
+    }
+
+    uint32_t longest = 0;
+    for (uint32_t length : chain)
+    {
+        longest = std::max(longest, length);
+    }
+    EXPECT_LE(longest, 8u);
+}
@@ -0,0 +1,69 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "kvm_lz4.h"
+
+static void check_round_trip(const std::vector<uint8_t> & input)
+{
+    std::vector<uint8_t> compressed(kvm_lz4_compress_bound(input.size()));
+    const uint32_t compressed_size = kvm_lz4_compress(input.data(), input.size(), compressed.data(), compressed.size());
+    ASSERT_NE(0u, compressed_size);
+
+    std::vector<uint8_t> output(input.size());
+    ASSERT_EQ(KVM_RESULT_OK, kvm_lz4_decompress(compressed.data(), compressed_size, output.data(), output.size()));
+    EXPECT_EQ(input, output);
+}
+
+TEST(lz4, round_trip_empty_input)
+{
+    check_round_trip(std::vector<uint8_t>());
+}
+
+TEST(lz4, round_trip_short_input)
+{
+    const std::string s = "value1";
+    check_round_trip(std::vector<uint8_t>(s.begin(), s.end()));
+}
+
+TEST(lz4, round_trip_random_input)
+{
+    std::vector<uint8_t> input(70000);
+    uint32_t state = 12345;
+    for (auto & b : input)
+    {
+        state = state * 1103515245 + 12345;
+        b = (uint8_t) (state >> 16);
+    }
+    check_round_trip(input);
+}
+
+TEST(lz4, repetitive_input_compresses)
+{
+    std::string s;
+    while (s.size() < 10000)
+    {
+        s += "{\"key\":\"value\",\"count\":42},";
+    }
+    const std::vector<uint8_t> input(s.begin(), s.end());
+
+    std::vector<uint8_t> compressed(kvm_lz4_compress_bound(input.size()));
+    const uint32_t compressed_size = kvm_lz4_compress(input.data(), input.size(), compressed.data(), compressed.size());
+    EXPECT_LT(compressed_size * 10, input.size());
+
+    check_round_trip(input);
+}
+
+TEST(lz4, compress_into_small_buffer_return_zero)
+{
+    std::vector<uint8_t> input(1000, 'a');
+    uint8_t compressed[4];
+    EXPECT_EQ(0u, kvm_lz4_compress(input.data(), input.size(), compressed, sizeof(compressed)));
+}
+
+TEST(lz4, decompress_malformed_input_return_invalid_param)
+{
+    /* Match offset points before the start of the output. */
+    const uint8_t block[] = {0x14, 'a', 0x10, 0x00, 0x50, 'a', 'a', 'a', 'a', 'a'};
+    uint8_t output[32];
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_lz4_decompress(block, sizeof(block), output, sizeof(output)));
+}
@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include "kvm_requests.h"
+#include "kvm_metrics.h"
+#include "kvm_server_stats.h"
+
+const uint16_t metrics_port = 45455;
+
+static std::string render(const kvm_stats_t * stats)
+{
+    char * text = nullptr;
+    uint32_t size = 0;
+    EXPECT_EQ(KVM_RESULT_OK, metrics_render(stats, &text, &size));
+    std::string result(text, size);
+    free(text);
+    return result;
+}
+
+static std::string scrape(const char * request)
+{
+    const int s = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(metrics_port);
+    EXPECT_EQ(0, connect(s, (struct sockaddr *) &addr, sizeof(addr)));
+    EXPECT_EQ((ssize_t) strlen(request), write(s, request, strlen(request)));
+
+    std::string response;
+    char buffer[4096];
+    ssize_t read_len;
+    while ((read_len = read(s, buffer, sizeof(buffer))) > 0)
+    {
+        response.append(buffer, read_len);
+    }
+    close(s);
+    return response;
+}
+
+TEST(metrics, render_counters_and_gauges)
+{
+    std::unique_ptr<kvm_stats_t> stats(new kvm_stats_t());
+    stats->requests[KVM_REQUST_GET] = 7;
+    stats->hits = 5;
+    stats->misses = 2;
+    stats->connections_accepted = 3;
+    stats->connections_closed = 1;
+    stats->keys = 42;
+
+    const std::string text = render(stats.get());
+    EXPECT_NE(std::string::npos, text.find("# TYPE kvm_requests_total counter\n"));
+    EXPECT_NE(std::string::npos, text.find("kvm_requests_total{op=\"get\"} 7\n"));
+    EXPECT_EQ(std::string::npos, text.find("kvm_requests_total{op=\"put\"}"));
+    EXPECT_NE(std::string::npos, text.find("kvm_keyspace_hits_total 5\n"));
+    EXPECT_NE(std::string::npos, text.find("kvm_keyspace_misses_total 2\n"));
+    EXPECT_NE(std::string::npos, text.find("kvm_connections 2\n"));
+    EXPECT_NE(std::string::npos, text.find("# TYPE kvm_keys gauge\nkvm_keys 42\n"));
+}
+
+TEST(metrics, render_latency_histogram_is_cumulative)
+{
+    std::unique_ptr<kvm_stats_t> stats(new kvm_stats_t());
+    stats->requests[KVM_REQUST_PUT] = 3;
+    stats->latency[KVM_REQUST_PUT][kvm_histogram_index(100)] = 1;       /* below the first bucket */
+    stats->latency[KVM_REQUST_PUT][kvm_histogram_index(1000)] = 1;      /* up to 1.024 us */
+    stats->latency[KVM_REQUST_PUT][kvm_histogram_index(1025)] = 1;      /* up to 2.048 us */
+    stats->latency_sum[KVM_REQUST_PUT] = 2125;
+
+    const std::string text = render(stats.get());
+    EXPECT_NE(std::string::npos, text.find("kvm_request_duration_seconds_bucket{op=\"put\",le=\"1.28e-07\"} 1\n"));
+    EXPECT_NE(std::string::npos, text.find("kvm_request_duration_seconds_bucket{op=\"put\",le=\"1.024e-06\"} 2\n"));
+    EXPECT_NE(std::string::npos, text.find("kvm_request_duration_seconds_bucket{op=\"put\",le=\"2.048e-06\"} 3\n"));
+    EXPECT_NE(std::string::npos, text.find("kvm_request_duration_seconds_bucket{op=\"put\",le=\"+Inf\"} 3\n"));
+    EXPECT_NE(std::string::npos, text.find("kvm_request_duration_seconds_sum{op=\"put\"} 2.125e-06\n"));
+    EXPECT_NE(std::string::npos, text.find("kvm_request_duration_seconds_count{op=\"put\"} 3\n"));
+}
+
+TEST(metrics, scrape_return_metrics)
+{
+    stats_reset();
+    stats_record_request(KVM_REQUST_COUNT, 500);
+
+    ASSERT_EQ(KVM_RESULT_OK, metrics_start(metrics_port));
+
+    const std::string response = scrape("GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    EXPECT_EQ(0, response.find("HTTP/1.0 200 OK\r\n"));
+    EXPECT_NE(std::string::npos, response.find("kvm_requests_total{op=\"count\"} 1\n"));
+
+    EXPECT_EQ(0, scrape("GET /other HTTP/1.1\r\n\r\n").find("HTTP/1.0 404 Not Found\r\n"));
+
+    metrics_stop();
+}
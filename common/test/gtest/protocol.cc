@@ -0,0 +1,150 @@
+#include <gtest/gtest.h>
+#include <string.h>
+#include <vector>
+#include "kvm_requests.h"
+#include "kvm_replies.h"
+#include "kvm_protocol.h"
+
+const uint8_t put_v1[] = {KVM_REQUST_PUT, 4, 0, 0, 0, 6, 0, 0, 0, 'k', 'e', 'y', '1', 'v', 'a', 'l', 'u', 'e', '1'};
+const uint8_t put_v2[] = {KVM_REQUST_PUT, 4, 6, 'k', 'e', 'y', '1', 'v', 'a', 'l', 'u', 'e', '1'};
+const uint8_t expire_persist_v1[] = {KVM_REQUST_EXPIRE, 4, 0, 0, 0, 0xFF, 0xFF, 0xFF, 0xFF, 'k', 'e', 'y', '1'};
+const uint8_t expire_persist_v2[] = {KVM_REQUST_EXPIRE, 4, 0xFF, 0xFF, 0xFF, 0xFF, 0x0F, 'k', 'e', 'y', '1'};
+const uint8_t list_reply_v1[] = {KVM_REPLY_STATUS_OK, 2, 0, 0, 0, 4, 0, 0, 0, 'k', 'e', 'y', '1', 2, 0, 0, 0, 'k', '2'};
+const uint8_t list_reply_v2[] = {KVM_REPLY_STATUS_OK, 2, 4, 'k', 'e', 'y', '1', 2, 'k', '2'};
+const uint8_t get_encoded_reply_v1[] = {KVM_REPLY_STATUS_OK, KVM_CODEC_LZ4, 0x2C, 0x01, 0, 0, 3, 0, 0, 0, 1, 2, 3};
+const uint8_t get_encoded_reply_v2[] = {KVM_REPLY_STATUS_OK, KVM_CODEC_LZ4, 0xAC, 0x02, 3, 1, 2, 3};
+const uint8_t bad_request_reply[] = {KVM_REPLY_BAD_REQUEST};
+
+typedef kvm_result_t (*convert_request_t)(const uint8_t *, uint32_t, uint8_t *, uint32_t, uint32_t *);
+typedef kvm_result_t (*convert_reply_t)(kvm_request_id_t, const uint8_t *, uint32_t, uint8_t *, uint32_t, uint32_t *);
+
+static std::vector<uint8_t> convert(convert_request_t f, const uint8_t * in, uint32_t size)
+{
+    uint32_t out_size;
+    EXPECT_EQ(KVM_RESULT_OK, f(in, size, NULL, 0, &out_size));
+    std::vector<uint8_t> out(out_size);
+    EXPECT_EQ(KVM_RESULT_OK, f(in, size, out.data(), out.size(), &out_size));
+    EXPECT_EQ(out.size(), out_size);
+    return out;
+}
+
+static std::vector<uint8_t> convert(convert_reply_t f, kvm_request_id_t id, const uint8_t * in, uint32_t size)
+{
+    uint32_t out_size;
+    EXPECT_EQ(KVM_RESULT_OK, f(id, in, size, NULL, 0, &out_size));
+    std::vector<uint8_t> out(out_size);
+    EXPECT_EQ(KVM_RESULT_OK, f(id, in, size, out.data(), out.size(), &out_size));
+    EXPECT_EQ(out.size(), out_size);
+    return out;
+}
+
+#define EXPECT_BYTES(expected, actual) \
+    EXPECT_EQ(std::vector<uint8_t>(expected, expected + sizeof(expected)), actual)
+
+TEST(protocol, varint_round_trip)
+{
+    const uint32_t values[] = {0, 1, 127, 128, 16383, 16384, 2097151, 2097152, 268435455, 268435456, UINT32_MAX};
+    const uint32_t sizes[] = {1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5};
+
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i)
+    {
+        uint8_t buffer[KVM_VARINT_MAX_SIZE];
+        EXPECT_EQ(sizes[i], kvm_varint_encode(values[i], buffer));
+
+        uint32_t value;
+        uint32_t used;
+        EXPECT_EQ(KVM_RESULT_OK, kvm_varint_decode(buffer, sizes[i], &value, &used));
+        EXPECT_EQ(values[i], value);
+        EXPECT_EQ(sizes[i], used);
+    }
+}
+
+TEST(protocol, varint_incomplete_return_connection_fail)
+{
+    const uint8_t data[] = {0x80, 0x80};
+    uint32_t value;
+    uint32_t used;
+    EXPECT_EQ(KVM_RESULT_CONNECTION_FAIL, kvm_varint_decode(data, sizeof(data), &value, &used));
+    EXPECT_EQ(KVM_RESULT_CONNECTION_FAIL, kvm_varint_decode(data, 0, &value, &used));
+}
+
+TEST(protocol, varint_over_32_bits_return_invalid_param)
+{
+    const uint8_t too_large[] = {0xFF, 0xFF, 0xFF, 0xFF, 0x1F};
+    const uint8_t too_long[] = {0x80, 0x80, 0x80, 0x80, 0x80, 0x00};
+    uint32_t value;
+    uint32_t used;
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_varint_decode(too_large, sizeof(too_large), &value, &used));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_varint_decode(too_long, sizeof(too_long), &value, &used));
+}
+
+TEST(protocol, request_round_trip)
+{
+    EXPECT_BYTES(put_v2, convert(kvm_protocol_request_to_v2, put_v1, sizeof(put_v1)));
+    EXPECT_BYTES(put_v1, convert(kvm_protocol_request_from_v2, put_v2, sizeof(put_v2)));
+
+    EXPECT_BYTES(expire_persist_v2, convert(kvm_protocol_request_to_v2, expire_persist_v1, sizeof(expire_persist_v1)));
+    EXPECT_BYTES(expire_persist_v1, convert(kvm_protocol_request_from_v2, expire_persist_v2, sizeof(expire_persist_v2)));
+}
+
+TEST(protocol, reply_round_trip)
+{
+    EXPECT_BYTES(list_reply_v2, convert(kvm_protocol_reply_to_v2, KVM_REQUST_LIST, list_reply_v1, sizeof(list_reply_v1)));
+    EXPECT_BYTES(list_reply_v1, convert(kvm_protocol_reply_from_v2, KVM_REQUST_LIST, list_reply_v2, sizeof(list_reply_v2)));
+
+    EXPECT_BYTES(get_encoded_reply_v2, convert(kvm_protocol_reply_to_v2, KVM_REQUST_GET_ENCODED, get_encoded_reply_v1, sizeof(get_encoded_reply_v1)));
+    EXPECT_BYTES(get_encoded_reply_v1, convert(kvm_protocol_reply_from_v2, KVM_REQUST_GET_ENCODED, get_encoded_reply_v2, sizeof(get_encoded_reply_v2)));
+}
+
+TEST(protocol, failed_reply_has_no_fields)
+{
+    EXPECT_BYTES(bad_request_reply, convert(kvm_protocol_reply_to_v2, KVM_REQUST_GET, bad_request_reply, sizeof(bad_request_reply)));
+    EXPECT_BYTES(bad_request_reply, convert(kvm_protocol_reply_from_v2, KVM_REQUST_GET, bad_request_reply, sizeof(bad_request_reply)));
+}
+
+TEST(protocol, unknown_request_passed_as_is)
+{
+    const uint8_t request[] = {0xF0, 1, 2, 3};
+    EXPECT_BYTES(request, convert(kvm_protocol_request_to_v2, request, sizeof(request)));
+    EXPECT_BYTES(request, convert(kvm_protocol_request_from_v2, request, sizeof(request)));
+}
+
+TEST(protocol, conversion_stops_at_capacity)
+{
+    /* The size is still reported in full, for a second pass. */
+    uint8_t out[sizeof(list_reply_v1) + 1];
+    for (uint32_t capacity = 0; capacity < sizeof(list_reply_v1); ++capacity)
+    {
+        memset(out, 0xAA, sizeof(out));
+        uint32_t size;
+        EXPECT_EQ(KVM_RESULT_OK, kvm_protocol_reply_from_v2(KVM_REQUST_LIST, list_reply_v2, sizeof(list_reply_v2), out, capacity, &size));
+        EXPECT_EQ(sizeof(list_reply_v1), size);
+        for (uint32_t i = capacity; i < sizeof(out); ++i)
+        {
+            EXPECT_EQ(0xAA, out[i]);
+        }
+    }
+
+    uint32_t size;
+    EXPECT_EQ(KVM_RESULT_OK, kvm_protocol_reply_from_v2(KVM_REQUST_LIST, list_reply_v2, sizeof(list_reply_v2), out, sizeof(list_reply_v1), &size));
+    EXPECT_EQ(0, memcmp(list_reply_v1, out, size));
+}
+
+TEST(protocol, v2_size_within_bound)
+{
+    EXPECT_LE(sizeof(expire_persist_v2), KVM_PROTOCOL_V2_MAX_SIZE(sizeof(expire_persist_v1)));
+    EXPECT_LE(sizeof(list_reply_v2), KVM_PROTOCOL_V2_MAX_SIZE(sizeof(list_reply_v1)));
+
+    /* Every field taking 5 bytes */
+    const uint8_t count_reply_v1[] = {KVM_REPLY_STATUS_OK, 0xFF, 0xFF, 0xFF, 0xFF};
+    EXPECT_EQ(6u, convert(kvm_protocol_reply_to_v2, KVM_REQUST_COUNT, count_reply_v1, sizeof(count_reply_v1)).size());
+    EXPECT_LE(6u, KVM_PROTOCOL_V2_MAX_SIZE(sizeof(count_reply_v1)));
+}
+
+TEST(protocol, truncated_request_return_invalid_param)
+{
+    uint32_t size;
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_protocol_request_to_v2(put_v1, 6, NULL, 0, &size));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_protocol_request_from_v2(expire_persist_v2, 4, NULL, 0, &size));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_protocol_reply_from_v2(KVM_REQUST_LIST, list_reply_v2, sizeof(list_reply_v2) - 1, NULL, 0, &size));
+}
@@ -1,8 +1,28 @@
 #include <gtest/gtest.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
 #include "kvm_results.h"
 #include "kvm_requests.h"
 #include "kvm_replies.h"
+#include "kvm_server.h"
 #include "kvm_server_internal.h"
+#include "kvm_lz4.h"
+#include "kvm_protocol.h"
+#include "kvm_server_stats.h"
+#include "kvm_epoch.h"
+#include "kvm_slowlog.h"
+#include "kvm_hotkeys.h"
+#include "kvm_stream.h"
+#include "kvm_shm.h"
+#include "bulk_load.h"
+#include "dump.h"
 
 /* PUT key1=value1 */
 const uint8_t put_key1_value1_request[] = {KVM_REQUST_PUT, 4, 0, 0, 0, 6, 0, 0, 0, 'k', 'e', 'y', '1', 'v', 'a', 'l', 'u', 'e', '1'};
@@ -22,6 +42,21 @@ const uint8_t delete_key1_request[] = {KVM_REQUST_DELETE, 4, 0, 0, 0, 'k', 'e',
 /* DELETE key2 */
 const uint8_t delete_key2_request[] = {KVM_REQUST_DELETE, 4, 0, 0, 0, 'k', 'e', 'y', '2'};
 
+/* PUT key1=value1 with 1 ms TTL */
+const uint8_t put_ttl_key1_value1_short_request[] = {KVM_REQUST_PUT_TTL, 4, 0, 0, 0, 6, 0, 0, 0, 1, 0, 0, 0, 'k', 'e', 'y', '1', 'v', 'a', 'l', 'u', 'e', '1'};
+
+/* PUT key1=value1 with 100 s TTL */
+const uint8_t put_ttl_key1_value1_long_request[] = {KVM_REQUST_PUT_TTL, 4, 0, 0, 0, 6, 0, 0, 0, 0xA0, 0x86, 0x01, 0, 'k', 'e', 'y', '1', 'v', 'a', 'l', 'u', 'e', '1'};
+
+/* EXPIRE key1 in 1 ms */
+const uint8_t expire_key1_short_request[] = {KVM_REQUST_EXPIRE, 4, 0, 0, 0, 1, 0, 0, 0, 'k', 'e', 'y', '1'};
+
+/* EXPIRE key1 never */
+const uint8_t expire_key1_persist_request[] = {KVM_REQUST_EXPIRE, 4, 0, 0, 0, 0xFF, 0xFF, 0xFF, 0xFF, 'k', 'e', 'y', '1'};
+
+/* TTL key1 */
+const uint8_t ttl_key1_request[] = {KVM_REQUST_TTL, 4, 0, 0, 0, 'k', 'e', 'y', '1'};
+
 /* LIST */
 const uint8_t list_request[] = {KVM_REQUST_LIST};
 
@@ -33,15 +68,43 @@ const uint8_t generic_reply_ok[] = {KVM_REPLY_STATUS_OK};
 const uint8_t generic_reply_bad_request[] = {KVM_REPLY_BAD_REQUEST};
 const uint8_t get_key1_reply_ok[] = {KVM_REPLY_STATUS_OK, 6, 0, 0, 0, 'v', 'a', 'l', 'u', 'e', '1'};
 const uint8_t list_reply_ok[] = {KVM_REPLY_STATUS_OK, 2, 0, 0, 0, 4, 0, 0, 0, 'k', 'e', 'y', '1', 4, 0, 0, 0, 'k', 'e', 'y', '2'};
+const uint8_t list_reply_reversed_ok[] = {KVM_REPLY_STATUS_OK, 2, 0, 0, 0, 4, 0, 0, 0, 'k', 'e', 'y', '2', 4, 0, 0, 0, 'k', 'e', 'y', '1'};
 const uint8_t list_count_empty_reply_ok[] = {KVM_REPLY_STATUS_OK, 0, 0, 0, 0};
 const uint8_t count_reply_ok[] = {KVM_REPLY_STATUS_OK, 2, 0, 0, 0};
+const uint8_t count_one_reply_ok[] = {KVM_REPLY_STATUS_OK, 1, 0, 0, 0};
+const uint8_t list_key2_reply_ok[] = {KVM_REPLY_STATUS_OK, 1, 0, 0, 0, 4, 0, 0, 0, 'k', 'e', 'y', '2'};
+const uint8_t ttl_persist_reply_ok[] = {KVM_REPLY_STATUS_OK, 0xFF, 0xFF, 0xFF, 0xFF};
+const uint8_t generic_reply_no_memory[] = {KVM_REPLY_NO_MEMORY};
+const uint8_t hello_v2_request[] = {KVM_REQUST_HELLO, KVM_PROTOCOL_V2, 0xFF, 0xFF, 0xFF, 0xFF};
+const uint8_t hello_v9_request[] = {KVM_REQUST_HELLO, 9, 0, 0, 0, 0};
+const uint8_t hello_v0_request[] = {KVM_REQUST_HELLO, 0, 0, 0, 0, 0};
+const uint8_t hello_v2_reply_ok[] = {KVM_REPLY_STATUS_OK, KVM_PROTOCOL_V2, KVM_FEATURES_SUPPORTED, 0, 0, 0};
+const uint8_t hello_v9_reply_ok[] = {KVM_REPLY_STATUS_OK, KVM_PROTOCOL_VERSION, 0, 0, 0, 0};
+const uint8_t stats_request[] = {KVM_REQUST_STATS};
+const uint8_t slowlog_request[] = {KVM_REQUST_SLOWLOG, 0};
+const uint8_t slowlog_reset_request[] = {KVM_REQUST_SLOWLOG, KVM_SLOWLOG_FLAG_RESET};
+
+/* HOTKEYS, all tracked keys */
+const uint8_t hotkeys_request[] = {KVM_REQUST_HOTKEYS, 0, 0, 0, 0};
+
+static std::vector<uint8_t> make_put_request(const std::string & key, const std::string & value)
+{
+    std::vector<uint8_t> request(sizeof(kvm_request_generic_t) + sizeof(kvm_request_put_t));
+    kvm_request_put_t put_req = {(uint32_t) key.size(), (uint32_t) value.size()};
+
+    request[0] = KVM_REQUST_PUT;
+    memcpy(&request[1], &put_req, sizeof(put_req));
+    request.insert(request.end(), key.begin(), key.end());
+    request.insert(request.end(), value.begin(), value.end());
+    return request;
+}
 
 class server_handle_request : public ::testing::Test
 {
 protected:
     virtual void SetUp()
     {
-        ASSERT_EQ(KVM_RESULT_OK, init_apr_hashtable());
+        ASSERT_EQ(KVM_RESULT_OK, storage_init());
         reply = nullptr;
         reply_size = 0;
     }
@@ -49,7 +112,22 @@ protected:
     virtual void TearDown()
     {
         reset_reply();
-        uninit_apr_hashtable();
+        stream_release_all();
+        stream_set_client(-1);
+        storage_uninit();
+        slowlog_configure(SLOWLOG_DISABLED);
+        hotkeys_configure(0);
+        stats_phase_configure(KVM_PHASE_CLOCK_NONE);
+    }
+
+    void configure(uint64_t max_memory, kvm_eviction_policy_t policy, uint32_t compression_threshold)
+    {
+        kvm_server_config_t config;
+        kvm_server_config_default(&config);
+        config.max_memory = max_memory;
+        config.eviction_policy = policy;
+        config.compression_threshold = compression_threshold;
+        storage_configure(&config);
     }
 
     void reset_reply()
@@ -82,6 +160,15 @@ TEST_F(server_handle_request, handle_request_put_invalid_request_size_return_bad
     EXPECT_EQ(0, memcmp(generic_reply_bad_request, reply, reply_size));
 }
 
+TEST_F(server_handle_request, handle_request_put_sizes_wrapping_return_bad_request)
+{
+    /* Key and value sizes add up to 0 in 32 bits. */
+    const uint8_t request[] = {KVM_REQUST_PUT, 0xFF, 0xFF, 0xFF, 0xFF, 1, 0, 0, 0, 'k'};
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(request), request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_bad_request), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_bad_request, reply, reply_size));
+}
+
 /********** GET **********/
 TEST_F(server_handle_request, handle_request_get_return_ok)
 {
@@ -186,8 +273,9 @@ TEST_F(server_handle_request, handle_request_list_return_ok)
     reset_reply();
 
     EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(list_request), list_request, &reply_size, &reply));
+    /* Keys are listed in hash table order, which depends on the hash seed. */
     EXPECT_EQ(sizeof(list_reply_ok), reply_size);
-    EXPECT_EQ(0, memcmp(list_reply_ok, reply, reply_size));
+    EXPECT_TRUE(0 == memcmp(list_reply_ok, reply, reply_size) || 0 == memcmp(list_reply_reversed_ok, reply, reply_size));
 }
 
 TEST_F(server_handle_request, handle_request_list_invalid_request_size_return_bad_request)
@@ -236,4 +324,1989 @@ TEST_F(server_handle_request, handle_request_count_empty_hash_table_return_ok)
     EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(count_request), count_request, &reply_size, &reply));
     EXPECT_EQ(sizeof(list_count_empty_reply_ok), reply_size);
     EXPECT_EQ(0, memcmp(list_count_empty_reply_ok, reply, reply_size));
-}
\ No newline at end of file
+}
+
+/********** PUT_TTL **********/
+TEST_F(server_handle_request, handle_request_put_ttl_get_before_expiration_return_ok)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_ttl_key1_value1_long_request), put_ttl_key1_value1_long_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_ok), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_ok, reply, reply_size));
+
+    reset_reply();
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(get_key1_request), get_key1_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(get_key1_reply_ok), reply_size);
+    EXPECT_EQ(0, memcmp(get_key1_reply_ok, reply, reply_size));
+}
+
+TEST_F(server_handle_request, handle_request_put_ttl_get_after_expiration_return_bad_request)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_ttl_key1_value1_short_request), put_ttl_key1_value1_short_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_ok), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_ok, reply, reply_size));
+
+    reset_reply();
+    usleep(5000);
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(get_key1_request), get_key1_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_bad_request), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_bad_request, reply, reply_size));
+}
+
+TEST_F(server_handle_request, handle_request_put_ttl_invalid_request_size_return_bad_request)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_ttl_key1_value1_long_request) - 1, put_ttl_key1_value1_long_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_bad_request), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_bad_request, reply, reply_size));
+}
+
+TEST_F(server_handle_request, handle_request_put_ttl_sizes_wrapping_return_bad_request)
+{
+    /* Key and value sizes add up to 0 in 32 bits. */
+    const uint8_t request[] = {KVM_REQUST_PUT_TTL, 0xFF, 0xFF, 0xFF, 0xFF, 1, 0, 0, 0, 1, 0, 0, 0, 'k'};
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(request), request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_bad_request), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_bad_request, reply, reply_size));
+}
+
+TEST_F(server_handle_request, handle_request_put_ttl_expired_keys_not_counted_nor_listed)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_ttl_key1_value1_short_request), put_ttl_key1_value1_short_request, &reply_size, &reply));
+    reset_reply();
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_key2_value2_request), put_key2_value2_request, &reply_size, &reply));
+    reset_reply();
+
+    usleep(5000);
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(list_request), list_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(list_key2_reply_ok), reply_size);
+    EXPECT_EQ(0, memcmp(list_key2_reply_ok, reply, reply_size));
+
+    reset_reply();
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(count_request), count_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(count_one_reply_ok), reply_size);
+    EXPECT_EQ(0, memcmp(count_one_reply_ok, reply, reply_size));
+
+    /* Skipped, not reaped, the expiration cycle does that. */
+    EXPECT_EQ(2u, storage_count());
+    EXPECT_EQ(1u, expire_entries(EXPIRE_CYCLE_BUDGET));
+}
+
+TEST_F(server_handle_request, handle_request_put_overrides_ttl)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_ttl_key1_value1_short_request), put_ttl_key1_value1_short_request, &reply_size, &reply));
+    reset_reply();
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_key1_value1_request), put_key1_value1_request, &reply_size, &reply));
+    reset_reply();
+
+    usleep(5000);
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(get_key1_request), get_key1_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(get_key1_reply_ok), reply_size);
+    EXPECT_EQ(0, memcmp(get_key1_reply_ok, reply, reply_size));
+}
+
+/********** EXPIRE **********/
+TEST_F(server_handle_request, handle_request_expire_return_ok)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_key1_value1_request), put_key1_value1_request, &reply_size, &reply));
+    reset_reply();
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(expire_key1_short_request), expire_key1_short_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_ok), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_ok, reply, reply_size));
+
+    reset_reply();
+    usleep(5000);
+
+    /* Reaped by the background expiration, not by lazy lookup. */
+    EXPECT_EQ(1, expire_entries(EXPIRE_CYCLE_BUDGET));
+    EXPECT_EQ(0, has_expiring_entries());
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(get_key1_request), get_key1_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_bad_request), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_bad_request, reply, reply_size));
+}
+
+TEST_F(server_handle_request, handle_request_expire_missing_key_return_bad_request)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(expire_key1_short_request), expire_key1_short_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_bad_request), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_bad_request, reply, reply_size));
+}
+
+TEST_F(server_handle_request, handle_request_expire_persist_removes_ttl)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_ttl_key1_value1_long_request), put_ttl_key1_value1_long_request, &reply_size, &reply));
+    reset_reply();
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(expire_key1_persist_request), expire_key1_persist_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_ok), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_ok, reply, reply_size));
+    EXPECT_EQ(0, has_expiring_entries());
+
+    reset_reply();
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(ttl_key1_request), ttl_key1_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(ttl_persist_reply_ok), reply_size);
+    EXPECT_EQ(0, memcmp(ttl_persist_reply_ok, reply, reply_size));
+}
+
+/********** TTL **********/
+TEST_F(server_handle_request, handle_request_ttl_return_ok)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_ttl_key1_value1_long_request), put_ttl_key1_value1_long_request, &reply_size, &reply));
+    reset_reply();
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(ttl_key1_request), ttl_key1_request, &reply_size, &reply));
+    ASSERT_EQ(sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_ttl_t), reply_size);
+    EXPECT_EQ(KVM_REPLY_STATUS_OK, reply[0]);
+
+    uint32_t ttl;
+    memcpy(&ttl, reply + sizeof(kvm_reply_generic_t), sizeof(ttl));
+    EXPECT_LE(ttl, 100000u);
+    EXPECT_GT(ttl, 90000u);
+}
+
+TEST_F(server_handle_request, handle_request_ttl_missing_key_return_bad_request)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(ttl_key1_request), ttl_key1_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_bad_request), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_bad_request, reply, reply_size));
+}
+
+/********** Eviction **********/
+TEST_F(server_handle_request, handle_request_put_over_memory_limit_evicts_keys)
+{
+    configure(4096, KVM_EVICTION_LRU, 0);
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        const std::vector<uint8_t> request = make_put_request("key" + std::to_string(i), "value");
+        EXPECT_EQ(KVM_RESULT_OK, handle_request(request.size(), request.data(), &reply_size, &reply));
+        EXPECT_EQ(sizeof(generic_reply_ok), reply_size);
+        EXPECT_EQ(0, memcmp(generic_reply_ok, reply, reply_size));
+        reset_reply();
+    }
+
+    kvm_server_storage_stats_t stats;
+    storage_get_stats(&stats);
+    EXPECT_LE(stats.used_memory, 4096u);
+    EXPECT_GT(stats.evicted_keys, 0u);
+    EXPECT_EQ(1000u, storage_count() + stats.evicted_keys);
+}
+
+TEST_F(server_handle_request, handle_request_put_over_memory_limit_lfu_keeps_hot_key)
+{
+    configure(4096, KVM_EVICTION_LFU, 0);
+
+    const std::vector<uint8_t> hot = make_put_request("hot", "value");
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(hot.size(), hot.data(), &reply_size, &reply));
+    reset_reply();
+
+    const uint8_t get_hot_request[] = {KVM_REQUST_GET, 3, 0, 0, 0, 'h', 'o', 't'};
+    for (int i = 0; i < 1000; ++i)
+    {
+        const std::vector<uint8_t> request = make_put_request("key" + std::to_string(i), "value");
+        EXPECT_EQ(KVM_RESULT_OK, handle_request(request.size(), request.data(), &reply_size, &reply));
+        reset_reply();
+
+        EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(get_hot_request), get_hot_request, &reply_size, &reply));
+        EXPECT_EQ(KVM_REPLY_STATUS_OK, reply[0]);
+        reset_reply();
+    }
+}
+
+TEST_F(server_handle_request, handle_request_put_over_memory_limit_no_eviction_return_no_memory)
+{
+    configure(1, KVM_EVICTION_NONE, 0);
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_key1_value1_request), put_key1_value1_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_no_memory), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_no_memory, reply, reply_size));
+
+    kvm_server_storage_stats_t stats;
+    storage_get_stats(&stats);
+    EXPECT_EQ(1u, stats.rejected_puts);
+    EXPECT_EQ(0u, storage_count());
+}
+
+TEST_F(server_handle_request, handle_request_put_over_memory_limit_keeps_replaced_value)
+{
+    const kvm_eviction_policy_t policies[] = {KVM_EVICTION_NONE, KVM_EVICTION_LRU};
+    for (const kvm_eviction_policy_t policy : policies)
+    {
+        storage_uninit();
+        ASSERT_EQ(KVM_RESULT_OK, storage_init());
+        configure(64 * 1024, policy, 0);
+
+        const std::vector<uint8_t> small = make_put_request("key1", std::string(100, 's'));
+        EXPECT_EQ(KVM_RESULT_OK, handle_request(small.size(), small.data(), &reply_size, &reply));
+        EXPECT_EQ(KVM_REPLY_STATUS_OK, reply[0]);
+        reset_reply();
+
+        const std::vector<uint8_t> large = make_put_request("key1", std::string(200 * 1024, 'l'));
+        EXPECT_EQ(KVM_RESULT_OK, handle_request(large.size(), large.data(), &reply_size, &reply));
+        EXPECT_EQ(sizeof(generic_reply_no_memory), reply_size);
+        EXPECT_EQ(0, memcmp(generic_reply_no_memory, reply, reply_size));
+        reset_reply();
+
+        const kvm_entry_t * entry = storage_find((const uint8_t *) "key1", 4, storage_now());
+        ASSERT_NE(nullptr, entry);
+        std::string value(storage_value_size(entry), '\0');
+        EXPECT_EQ(KVM_RESULT_OK, storage_read_value(entry, (uint8_t *) &value[0]));
+        EXPECT_EQ(std::string(100, 's'), value);
+    }
+}
+
+/********** Compression **********/
+static std::string make_json_value(size_t size)
+{
+    std::string value;
+    for (int i = 0; value.size() < size; ++i)
+    {
+        value += "{\"id\":" + std::to_string(i) + ",\"name\":\"item\",\"tags\":[\"a\",\"b\"]},";
+    }
+    value.resize(size);
+    return value;
+}
+
+TEST_F(server_handle_request, handle_request_put_large_value_stored_compressed)
+{
+    configure(0, KVM_EVICTION_NONE, 256);
+
+    const std::string value = make_json_value(4096);
+    const std::vector<uint8_t> put = make_put_request("key1", value);
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(put.size(), put.data(), &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_ok), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_ok, reply, reply_size));
+    reset_reply();
+
+    kvm_server_storage_stats_t stats;
+    storage_get_stats(&stats);
+    EXPECT_EQ(1u, stats.compressed_values);
+    EXPECT_EQ(4096u, stats.compression_input_bytes);
+    EXPECT_LT(stats.compression_output_bytes * 3, stats.compression_input_bytes);
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(get_key1_request), get_key1_request, &reply_size, &reply));
+    ASSERT_EQ(sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_get_t) + value.size(), reply_size);
+    EXPECT_EQ(KVM_REPLY_STATUS_OK, reply[0]);
+    EXPECT_EQ(0, memcmp(value.data(), reply + sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_get_t), value.size()));
+}
+
+TEST_F(server_handle_request, decompression_time_recorded_by_reader_thread)
+{
+    configure(0, KVM_EVICTION_NONE, 256);
+    stats_reset();
+
+    const std::string value = make_json_value(64 * 1024);
+    const std::vector<uint8_t> put = make_put_request("key1", value);
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(put.size(), put.data(), &reply_size, &reply));
+
+    kvm_server_storage_stats_t stats;
+    storage_get_stats(&stats);
+    EXPECT_EQ(0u, stats.decompression_time_ns);
+
+    std::string read(value.size(), '\0');
+    std::thread reader([&]
+    {
+        epoch_enter();
+        const kvm_entry_t * entry = storage_lookup((const uint8_t *) "key1", 4, storage_now());
+        EXPECT_EQ(KVM_RESULT_OK, (NULL != entry) ? storage_read_value(entry, (uint8_t *) &read[0]) : KVM_RESULT_INVALID_PARAM);
+        epoch_exit();
+    });
+    reader.join();
+    EXPECT_EQ(value, read);
+
+    /* Summed from the block of the reader */
+    std::unique_ptr<kvm_stats_t> aggregated(new kvm_stats_t());
+    stats_aggregate(aggregated.get());
+    storage_get_stats(&stats);
+    EXPECT_LT(0u, stats.decompression_time_ns);
+    EXPECT_EQ(stats.decompression_time_ns, aggregated->decompression_time_ns);
+}
+
+TEST_F(server_handle_request, handle_request_get_encoded_return_compressed_value)
+{
+    configure(0, KVM_EVICTION_NONE, 256);
+
+    const std::string value = make_json_value(4096);
+    const std::vector<uint8_t> put = make_put_request("key1", value);
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(put.size(), put.data(), &reply_size, &reply));
+    reset_reply();
+
+    const uint8_t get_encoded_key1_request[] = {KVM_REQUST_GET_ENCODED, 4, 0, 0, 0, 'k', 'e', 'y', '1'};
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(get_encoded_key1_request), get_encoded_key1_request, &reply_size, &reply));
+    ASSERT_GT(reply_size, sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_get_encoded_t));
+    EXPECT_EQ(KVM_REPLY_STATUS_OK, reply[0]);
+
+    kvm_reply_get_encoded_t header;
+    memcpy(&header, reply + sizeof(kvm_reply_generic_t), sizeof(header));
+    EXPECT_EQ(KVM_CODEC_LZ4, header.codec);
+    EXPECT_EQ(value.size(), header.raw_size);
+    ASSERT_EQ(reply_size, sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_get_encoded_t) + header.value_size);
+
+    std::vector<uint8_t> raw(header.raw_size);
+    EXPECT_EQ(KVM_RESULT_OK, kvm_lz4_decompress(reply + sizeof(kvm_reply_generic_t) + sizeof(header), header.value_size, raw.data(), raw.size()));
+    EXPECT_EQ(0, memcmp(value.data(), raw.data(), raw.size()));
+}
+
+TEST_F(server_handle_request, handle_request_put_small_value_stored_uncompressed)
+{
+    configure(0, KVM_EVICTION_NONE, 256);
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_key1_value1_request), put_key1_value1_request, &reply_size, &reply));
+    reset_reply();
+
+    kvm_server_storage_stats_t stats;
+    storage_get_stats(&stats);
+    EXPECT_EQ(0u, stats.compressed_values);
+    EXPECT_EQ(0u, stats.compression_input_bytes);
+}
+
+TEST_F(server_handle_request, handle_request_put_many_keys_all_found_after_table_growth)
+{
+    for (int i = 0; i < 1000; ++i)
+    {
+        const std::vector<uint8_t> request = make_put_request("key" + std::to_string(i), "value" + std::to_string(i));
+        EXPECT_EQ(KVM_RESULT_OK, handle_request(request.size(), request.data(), &reply_size, &reply));
+        reset_reply();
+    }
+
+    EXPECT_EQ(1000u, storage_count());
+
+    uint32_t listed = 0;
+    for (const kvm_entry_t * entry = storage_first(); NULL != entry; entry = storage_next(entry))
+    {
+        listed++;
+    }
+    EXPECT_EQ(1000u, listed);
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        const std::string key = "key" + std::to_string(i);
+        const std::string value = "value" + std::to_string(i);
+        const kvm_entry_t * entry = storage_find((const uint8_t *) key.data(), key.size(), storage_now());
+        ASSERT_NE(nullptr, entry) << key;
+        ASSERT_EQ(value.size(), entry->value_size);
+        EXPECT_EQ(0, memcmp(value.data(), ENTRY_VALUE(entry), value.size())) << key;
+    }
+}
+
+/********** HELLO **********/
+TEST_F(server_handle_request, handle_request_hello_return_ok)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(hello_v2_request), hello_v2_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(hello_v2_reply_ok), reply_size);
+    EXPECT_EQ(0, memcmp(hello_v2_reply_ok, reply, reply_size));
+}
+
+TEST_F(server_handle_request, handle_request_hello_newer_client_gets_server_version)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(hello_v9_request), hello_v9_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(hello_v9_reply_ok), reply_size);
+    EXPECT_EQ(0, memcmp(hello_v9_reply_ok, reply, reply_size));
+}
+
+TEST_F(server_handle_request, handle_request_hello_invalid_version_return_bad_request)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(hello_v0_request), hello_v0_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_bad_request), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_bad_request, reply, reply_size));
+}
+
+TEST_F(server_handle_request, handle_request_hello_invalid_request_size_return_bad_request)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(hello_v2_request) - 1, hello_v2_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_bad_request), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_bad_request, reply, reply_size));
+}
+
+/********** STATS **********/
+TEST_F(server_handle_request, handle_request_stats_return_ok)
+{
+    stats_reset();
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_key1_value1_request), put_key1_value1_request, &reply_size, &reply));
+    reset_reply();
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(get_key1_request), get_key1_request, &reply_size, &reply));
+    reset_reply();
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(get_key2_request), get_key2_request, &reply_size, &reply));
+    reset_reply();
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(stats_request), stats_request, &reply_size, &reply));
+    ASSERT_LE(sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_stats_t), reply_size);
+    EXPECT_EQ(KVM_REPLY_STATUS_OK, reply[0]);
+
+    kvm_reply_stats_t stats_reply;
+    memcpy(&stats_reply, reply + sizeof(kvm_reply_generic_t), sizeof(stats_reply));
+    EXPECT_EQ(1, stats_reply.hits);
+    EXPECT_EQ(1, stats_reply.misses);
+    EXPECT_EQ(1, stats_reply.keys);
+    EXPECT_LT(0, stats_reply.used_memory);
+    ASSERT_EQ(2, stats_reply.op_count);
+
+    /* PUT and GET, in request id order, with a latency recorded per request */
+    const uint8_t * ptr = reply + sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_stats_t);
+    const kvm_request_id_t ids[] = {KVM_REQUST_PUT, KVM_REQUST_GET};
+    const uint64_t requests[] = {1, 2};
+    for (int i = 0; i < 2; ++i)
+    {
+        kvm_reply_stats_op_t op;
+        memcpy(&op, ptr, sizeof(op));
+        ptr += sizeof(op);
+        EXPECT_EQ(ids[i], op.id);
+        EXPECT_EQ(requests[i], op.requests);
+
+        uint64_t recorded = 0;
+        for (uint16_t b = 0; b < op.bucket_count; ++b)
+        {
+            kvm_reply_stats_bucket_t bucket;
+            memcpy(&bucket, ptr, sizeof(bucket));
+            ptr += sizeof(bucket);
+            EXPECT_GT(KVM_HISTOGRAM_BUCKETS, bucket.index);
+            recorded += bucket.count;
+        }
+        EXPECT_EQ(requests[i], recorded);
+    }
+
+    /* Phases are not measured until a clock is configured. */
+    kvm_reply_stats_phases_t phases_reply;
+    memcpy(&phases_reply, ptr, sizeof(phases_reply));
+    ptr += sizeof(phases_reply);
+    EXPECT_EQ(0, phases_reply.phase_count);
+    EXPECT_EQ(reply + reply_size, ptr);
+}
+
+TEST_F(server_handle_request, handle_request_stats_phases_return_ok)
+{
+    stats_reset();
+    ASSERT_EQ(KVM_PHASE_CLOCK_COARSE, stats_phase_configure(KVM_PHASE_CLOCK_COARSE));
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_key1_value1_request), put_key1_value1_request, &reply_size, &reply));
+    reset_reply();
+    stats_record_phase(KVM_STATS_PHASE_READ, 1000, 3500);
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(stats_request), stats_request, &reply_size, &reply));
+    ASSERT_LE(sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_stats_t), reply_size);
+    EXPECT_EQ(KVM_REPLY_STATUS_OK, reply[0]);
+
+    kvm_reply_stats_t stats_reply;
+    memcpy(&stats_reply, reply + sizeof(kvm_reply_generic_t), sizeof(stats_reply));
+    ASSERT_EQ(1, stats_reply.op_count);
+
+    const uint8_t * ptr = reply + sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_stats_t);
+    kvm_reply_stats_op_t op;
+    memcpy(&op, ptr, sizeof(op));
+    ptr += sizeof(op) + op.bucket_count * sizeof(kvm_reply_stats_bucket_t);
+
+    /* Read as recorded, execute taken from the PUT handler time */
+    kvm_reply_stats_phases_t phases_reply;
+    memcpy(&phases_reply, ptr, sizeof(phases_reply));
+    ptr += sizeof(phases_reply);
+    ASSERT_EQ(2, phases_reply.phase_count);
+
+    const uint8_t ids[] = {KVM_STATS_PHASE_READ, KVM_STATS_PHASE_EXECUTE};
+    for (int i = 0; i < 2; ++i)
+    {
+        kvm_reply_stats_op_t phase;
+        memcpy(&phase, ptr, sizeof(phase));
+        ptr += sizeof(phase) + phase.bucket_count * sizeof(kvm_reply_stats_bucket_t);
+        EXPECT_EQ(ids[i], phase.id);
+        EXPECT_EQ(1, phase.requests);
+        EXPECT_EQ(1, phase.bucket_count);
+    }
+    EXPECT_EQ(reply + reply_size, ptr);
+
+    std::unique_ptr<kvm_stats_t> stats(new kvm_stats_t());
+    stats_aggregate(stats.get());
+    EXPECT_EQ(2500, stats->phase_sum[KVM_STATS_PHASE_READ]);
+    EXPECT_EQ(1, stats->phase[KVM_STATS_PHASE_READ][kvm_histogram_index(2500)]);
+}
+
+TEST_F(server_handle_request, stats_phase_clock_measures_nanoseconds)
+{
+    stats_reset();
+
+    /* The time stamp counter is calibrated, or coarse clock used if it is not invariant. */
+    const kvm_phase_clock_t clock = stats_phase_configure(KVM_PHASE_CLOCK_TSC);
+    EXPECT_TRUE(KVM_PHASE_CLOCK_TSC == clock || KVM_PHASE_CLOCK_COARSE == clock);
+
+    const uint64_t start = stats_phase_now();
+    usleep(20000);
+    stats_record_phase(KVM_STATS_PHASE_WRITE, start, stats_phase_now());
+
+    std::unique_ptr<kvm_stats_t> stats(new kvm_stats_t());
+    stats_aggregate(stats.get());
+    EXPECT_LE(15000000u, stats->phase_sum[KVM_STATS_PHASE_WRITE]);
+    EXPECT_GE(40000000u, stats->phase_sum[KVM_STATS_PHASE_WRITE]);
+
+    /* Nothing is recorded without a clock. */
+    EXPECT_EQ(KVM_PHASE_CLOCK_NONE, stats_phase_configure(KVM_PHASE_CLOCK_NONE));
+    EXPECT_EQ(0, stats_phase_now());
+    stats_record_phase(KVM_STATS_PHASE_WRITE, 0, 1000);
+    stats_aggregate(stats.get());
+    EXPECT_EQ(1, kvm_histogram_count(stats->phase[KVM_STATS_PHASE_WRITE]));
+}
+
+TEST_F(server_handle_request, handle_request_stats_counts_every_request)
+{
+    stats_reset();
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(count_request), count_request, &reply_size, &reply));
+    reset_reply();
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(stats_request), stats_request, &reply_size, &reply));
+    reset_reply();
+
+    std::unique_ptr<kvm_stats_t> stats(new kvm_stats_t());
+    stats_aggregate(stats.get());
+    EXPECT_EQ(1, stats->requests[KVM_REQUST_COUNT]);
+    EXPECT_EQ(1, stats->requests[KVM_REQUST_STATS]);
+    EXPECT_EQ(1, kvm_histogram_count(stats->latency[KVM_REQUST_COUNT]));
+    EXPECT_EQ(0, stats->hits + stats->misses);
+}
+
+TEST_F(server_handle_request, handle_request_stats_invalid_request_size_return_bad_request)
+{
+    const uint8_t request[] = {KVM_REQUST_STATS, 0};
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(request), request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_bad_request), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_bad_request, reply, reply_size));
+}
+
+/********** SLOWLOG **********/
+TEST_F(server_handle_request, handle_request_slowlog_disabled_records_nothing)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_key1_value1_request), put_key1_value1_request, &reply_size, &reply));
+    EXPECT_EQ(0, slowlog_count());
+}
+
+TEST_F(server_handle_request, handle_request_slowlog_return_ok)
+{
+    slowlog_configure(0);
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_key1_value1_request), put_key1_value1_request, &reply_size, &reply));
+    reset_reply();
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(slowlog_request), slowlog_request, &reply_size, &reply));
+    ASSERT_EQ(sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_slowlog_t) + sizeof(kvm_reply_slowlog_entry_t) + 4, reply_size);
+    EXPECT_EQ(KVM_REPLY_STATUS_OK, reply[0]);
+
+    kvm_reply_slowlog_t slowlog_reply;
+    memcpy(&slowlog_reply, reply + sizeof(kvm_reply_generic_t), sizeof(slowlog_reply));
+    EXPECT_EQ(1, slowlog_reply.count);
+
+    kvm_reply_slowlog_entry_t entry;
+    const uint8_t * ptr = reply + sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_slowlog_t);
+    memcpy(&entry, ptr, sizeof(entry));
+    EXPECT_EQ(KVM_SLOWLOG_EXECUTE, entry.kind);
+    EXPECT_EQ(KVM_REQUST_PUT, entry.op);
+    EXPECT_EQ(4, entry.key_size);
+    EXPECT_EQ(sizeof(put_key1_value1_request), entry.request_size);
+    EXPECT_EQ(sizeof(generic_reply_ok), entry.reply_size);
+    EXPECT_EQ(4, entry.prefix_size);
+    EXPECT_EQ(0, memcmp("key1", ptr + sizeof(entry), 4));
+
+    /* The SLOWLOG request itself is logged after its reply is built. */
+    EXPECT_EQ(2, slowlog_count());
+    EXPECT_EQ(KVM_REQUST_SLOWLOG, slowlog_get(0)->op);
+    EXPECT_EQ(KVM_REQUST_PUT, slowlog_get(1)->op);
+}
+
+TEST_F(server_handle_request, handle_request_slowlog_reset)
+{
+    slowlog_configure(0);
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(get_key1_request), get_key1_request, &reply_size, &reply));
+    reset_reply();
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(slowlog_reset_request), slowlog_reset_request, &reply_size, &reply));
+
+    ASSERT_EQ(1, slowlog_count());
+    EXPECT_EQ(KVM_REQUST_SLOWLOG, slowlog_get(0)->op);
+}
+
+TEST_F(server_handle_request, handle_request_slowlog_keeps_newest_entries)
+{
+    slowlog_configure(0);
+
+    for (int i = 0; i < SLOWLOG_SIZE + 5; ++i)
+    {
+        EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(get_key1_request), get_key1_request, &reply_size, &reply));
+        reset_reply();
+    }
+
+    ASSERT_EQ(SLOWLOG_SIZE, slowlog_count());
+    EXPECT_EQ(slowlog_get(0)->id - (SLOWLOG_SIZE - 1), slowlog_get(SLOWLOG_SIZE - 1)->id);
+    EXPECT_EQ(nullptr, slowlog_get(SLOWLOG_SIZE));
+}
+
+TEST_F(server_handle_request, handle_request_slowlog_truncates_key)
+{
+    slowlog_configure(0);
+
+    const std::string key(100, 'k');
+    const std::vector<uint8_t> request = make_put_request(key, "value");
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(request.size(), request.data(), &reply_size, &reply));
+
+    ASSERT_EQ(1, slowlog_count());
+    EXPECT_EQ(key.size(), slowlog_get(0)->key_size);
+    EXPECT_EQ(KVM_SLOWLOG_KEY_PREFIX, slowlog_get(0)->prefix_size);
+    EXPECT_EQ(0, memcmp(key.data(), slowlog_get(0)->key_prefix, KVM_SLOWLOG_KEY_PREFIX));
+}
+
+TEST_F(server_handle_request, handle_request_slowlog_invalid_request_size_return_bad_request)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(slowlog_request) - 1, slowlog_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_bad_request), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_bad_request, reply, reply_size));
+}
+
+/********** HOTKEYS **********/
+TEST_F(server_handle_request, handle_request_hotkeys_disabled_return_no_keys)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(get_key1_request), get_key1_request, &reply_size, &reply));
+    reset_reply();
+
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(hotkeys_request), hotkeys_request, &reply_size, &reply));
+    ASSERT_EQ(sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_hotkeys_t), reply_size);
+    EXPECT_EQ(KVM_REPLY_STATUS_OK, reply[0]);
+    EXPECT_EQ(0, reply[1]);
+}
+
+TEST_F(server_handle_request, handle_request_hotkeys_return_hottest_first)
+{
+    hotkeys_configure(1);
+
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(get_key1_request), get_key1_request, &reply_size, &reply));
+        reset_reply();
+    }
+    for (int i = 0; i < 10; ++i)
+    {
+        EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_key2_value2_request), put_key2_value2_request, &reply_size, &reply));
+        reset_reply();
+    }
+
+    const uint8_t hotkeys_one_request[] = {KVM_REQUST_HOTKEYS, 1, 0, 0, 0};
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(hotkeys_one_request), hotkeys_one_request, &reply_size, &reply));
+    ASSERT_EQ(sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_hotkeys_t) + sizeof(kvm_reply_hotkeys_entry_t) + 4, reply_size);
+    EXPECT_EQ(KVM_REPLY_STATUS_OK, reply[0]);
+
+    kvm_reply_hotkeys_t hotkeys_reply;
+    memcpy(&hotkeys_reply, reply + sizeof(kvm_reply_generic_t), sizeof(hotkeys_reply));
+    EXPECT_EQ(1, hotkeys_reply.count);
+
+    kvm_reply_hotkeys_entry_t entry;
+    const uint8_t * ptr = reply + sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_hotkeys_t);
+    memcpy(&entry, ptr, sizeof(entry));
+    EXPECT_EQ(100, entry.hits);
+    EXPECT_EQ(4, entry.key_size);
+    ASSERT_EQ(4, entry.prefix_size);
+    EXPECT_EQ(0, memcmp("key1", ptr + sizeof(entry), 4));
+
+    kvm_hotkey_t keys[KVM_HOTKEYS_MAX];
+    ASSERT_EQ(2, hotkeys_get(keys, KVM_HOTKEYS_MAX));
+    EXPECT_EQ(10, keys[1].hits);
+    EXPECT_EQ(0, memcmp("key2", keys[1].key_prefix, 4));
+}
+
+TEST_F(server_handle_request, hotkeys_sampled_by_other_thread_counted_by_owner)
+{
+    hotkeys_configure(1);
+
+    /* One more sample than the ring holds, the last one is dropped */
+    std::thread reader([]
+    {
+        for (int i = 0; i < HOTKEYS_RING_SIZE + 1; ++i)
+        {
+            hotkeys_sample((const uint8_t *) "key1", 4);
+        }
+    });
+    reader.join();
+
+    hotkeys_sample((const uint8_t *) "key2", 4);
+
+    kvm_hotkey_t keys[KVM_HOTKEYS_MAX];
+    ASSERT_EQ(2, hotkeys_get(keys, KVM_HOTKEYS_MAX));
+    EXPECT_EQ(HOTKEYS_RING_SIZE, keys[0].hits);
+    EXPECT_EQ(0, memcmp("key1", keys[0].key_prefix, 4));
+    EXPECT_EQ(1, keys[1].hits);
+}
+
+TEST_F(server_handle_request, handle_request_hotkeys_keeps_heavy_hitters)
+{
+    hotkeys_configure(1);
+
+    /* Many cold keys once each, hot keys interleaved */
+    for (int i = 0; i < 5000; ++i)
+    {
+        const std::vector<uint8_t> cold = make_put_request("cold" + std::to_string(i), "v");
+        EXPECT_EQ(KVM_RESULT_OK, handle_request(cold.size(), cold.data(), &reply_size, &reply));
+        reset_reply();
+
+        const std::vector<uint8_t> hot = make_put_request("hot" + std::to_string(i % 4), "v");
+        EXPECT_EQ(KVM_RESULT_OK, handle_request(hot.size(), hot.data(), &reply_size, &reply));
+        reset_reply();
+    }
+
+    kvm_hotkey_t keys[KVM_HOTKEYS_MAX];
+    ASSERT_EQ(KVM_HOTKEYS_MAX, hotkeys_get(keys, KVM_HOTKEYS_MAX));
+    for (int i = 0; i < 4; ++i)
+    {
+        EXPECT_EQ(0, memcmp("hot", keys[i].key_prefix, 3));
+        EXPECT_GE(keys[i].hits, 1250u);
+    }
+    EXPECT_LT(keys[4].hits, 100u);
+}
+
+TEST_F(server_handle_request, handle_request_hotkeys_wrong_size_return_bad_request)
+{
+    const uint8_t hotkeys_short_request[] = {KVM_REQUST_HOTKEYS, 0};
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(hotkeys_short_request), hotkeys_short_request, &reply_size, &reply));
+    EXPECT_EQ(sizeof(generic_reply_bad_request), reply_size);
+    EXPECT_EQ(0, memcmp(generic_reply_bad_request, reply, reply_size));
+}
+
+/********** Chunked PUT / GET **********/
+static std::vector<uint8_t> make_put_begin_request(const std::string & key, uint32_t value_size)
+{
+    std::vector<uint8_t> request(sizeof(kvm_request_generic_t) + sizeof(kvm_request_put_begin_t));
+    kvm_request_put_begin_t begin_req = {(uint32_t) key.size(), value_size, KVM_TTL_PERSIST};
+
+    request[0] = KVM_REQUST_PUT_BEGIN;
+    memcpy(&request[1], &begin_req, sizeof(begin_req));
+    request.insert(request.end(), key.begin(), key.end());
+    return request;
+}
+
+static std::vector<uint8_t> make_put_chunk_request(uint32_t stream, const std::string & chunk)
+{
+    std::vector<uint8_t> request(sizeof(kvm_request_generic_t) + sizeof(kvm_request_put_chunk_t));
+    kvm_request_put_chunk_t chunk_req = {stream, (uint32_t) chunk.size()};
+
+    request[0] = KVM_REQUST_PUT_CHUNK;
+    memcpy(&request[1], &chunk_req, sizeof(chunk_req));
+    request.insert(request.end(), chunk.begin(), chunk.end());
+    return request;
+}
+
+static std::vector<uint8_t> make_put_end_request(uint32_t stream, uint8_t flags)
+{
+    std::vector<uint8_t> request(sizeof(kvm_request_generic_t) + sizeof(kvm_request_put_end_t));
+    kvm_request_put_end_t end_req = {stream, flags};
+
+    request[0] = KVM_REQUST_PUT_END;
+    memcpy(&request[1], &end_req, sizeof(end_req));
+    return request;
+}
+
+static std::vector<uint8_t> make_get_range_request(const std::string & key, uint32_t offset, uint32_t max_size)
+{
+    std::vector<uint8_t> request(sizeof(kvm_request_generic_t) + sizeof(kvm_request_get_range_t));
+    kvm_request_get_range_t range_req = {(uint32_t) key.size(), offset, max_size};
+
+    request[0] = KVM_REQUST_GET_RANGE;
+    memcpy(&request[1], &range_req, sizeof(range_req));
+    request.insert(request.end(), key.begin(), key.end());
+    return request;
+}
+
+class server_stream_request : public server_handle_request
+{
+protected:
+    /* Sends a request and checks the status of its reply, the reply is kept. */
+    void send(const std::vector<uint8_t> & request, kvm_reply_status_t status)
+    {
+        reset_reply();
+        ASSERT_EQ(KVM_RESULT_OK, handle_request(request.size(), request.data(), &reply_size, &reply));
+        ASSERT_LE(sizeof(kvm_reply_generic_t), reply_size);
+        EXPECT_EQ(status, reply[0]);
+    }
+
+    uint32_t begin(const std::string & key, uint32_t value_size)
+    {
+        send(make_put_begin_request(key, value_size), KVM_REPLY_STATUS_OK);
+        EXPECT_EQ(sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_put_begin_t), reply_size);
+
+        kvm_reply_put_begin_t begin_reply = {0};
+        if (reply_size == sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_put_begin_t))
+        {
+            memcpy(&begin_reply, reply + sizeof(kvm_reply_generic_t), sizeof(begin_reply));
+        }
+        return begin_reply.stream;
+    }
+
+    /* Reads the value of the key in chunks of the given size. */
+    std::string read_range(const std::string & key, uint32_t chunk_size, uint64_t * version)
+    {
+        std::string value;
+        uint32_t value_size = 0;
+        do
+        {
+            send(make_get_range_request(key, value.size(), chunk_size), KVM_REPLY_STATUS_OK);
+
+            kvm_reply_get_range_t range_reply;
+            EXPECT_LE(sizeof(kvm_reply_generic_t) + sizeof(range_reply), reply_size);
+            memcpy(&range_reply, reply + sizeof(kvm_reply_generic_t), sizeof(range_reply));
+            EXPECT_EQ(sizeof(kvm_reply_generic_t) + sizeof(range_reply) + range_reply.range_size, reply_size);
+            EXPECT_LE(range_reply.range_size, chunk_size);
+
+            value.append((const char *) reply + sizeof(kvm_reply_generic_t) + sizeof(range_reply), range_reply.range_size);
+            value_size = range_reply.value_size;
+            *version = range_reply.version;
+            if (0 == range_reply.range_size)
+            {
+                break;
+            }
+        } while (value.size() < value_size);
+
+        return value;
+    }
+};
+
+TEST_F(server_stream_request, handle_request_put_in_chunks_then_get_in_chunks)
+{
+    const std::string value = make_json_value(10000);
+
+    const uint32_t stream = begin("key1", value.size());
+    ASSERT_NE(0u, stream);
+    for (size_t offset = 0; offset < value.size(); offset += 3000)
+    {
+        send(make_put_chunk_request(stream, value.substr(offset, 3000)), KVM_REPLY_STATUS_OK);
+    }
+
+    /* Not visible before the end. */
+    send(std::vector<uint8_t>(get_key1_request, get_key1_request + sizeof(get_key1_request)), KVM_REPLY_BAD_REQUEST);
+
+    send(make_put_end_request(stream, 0), KVM_REPLY_STATUS_OK);
+    EXPECT_EQ(1u, storage_count());
+
+    send(std::vector<uint8_t>(get_key1_request, get_key1_request + sizeof(get_key1_request)), KVM_REPLY_STATUS_OK);
+    ASSERT_EQ(sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_get_t) + value.size(), reply_size);
+    EXPECT_EQ(0, memcmp(value.data(), reply + sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_get_t), value.size()));
+
+    uint64_t version = 0;
+    EXPECT_EQ(value, read_range("key1", 4096, &version));
+    EXPECT_NE(0u, version);
+
+    /* The upload is gone after the end. */
+    send(make_put_end_request(stream, 0), KVM_REPLY_BAD_REQUEST);
+}
+
+TEST_F(server_stream_request, handle_request_get_range_of_compressed_value)
+{
+    configure(0, KVM_EVICTION_NONE, 256);
+
+    const std::string value = make_json_value(4096);
+    send(make_put_request("key1", value), KVM_REPLY_STATUS_OK);
+
+    kvm_server_storage_stats_t stats;
+    storage_get_stats(&stats);
+    ASSERT_EQ(1u, stats.compressed_values);
+
+    uint64_t version = 0;
+    EXPECT_EQ(value, read_range("key1", 1000, &version));
+}
+
+TEST_F(server_stream_request, handle_request_get_range_version_changes_on_put)
+{
+    uint64_t first = 0;
+    uint64_t second = 0;
+    send(make_put_request("key1", "value1"), KVM_REPLY_STATUS_OK);
+    EXPECT_EQ("value1", read_range("key1", 100, &first));
+    send(make_put_request("key1", "value2"), KVM_REPLY_STATUS_OK);
+    EXPECT_EQ("value2", read_range("key1", 100, &second));
+    EXPECT_NE(first, second);
+
+    send(make_get_range_request("key1", 7, 100), KVM_REPLY_BAD_REQUEST);
+    send(make_get_range_request("key2", 0, 100), KVM_REPLY_BAD_REQUEST);
+}
+
+TEST_F(server_stream_request, handle_request_put_end_incomplete_or_overflow_return_bad_request)
+{
+    uint32_t stream = begin("key1", 6);
+    send(make_put_chunk_request(stream, "value"), KVM_REPLY_STATUS_OK);
+    send(make_put_chunk_request(stream, "11"), KVM_REPLY_BAD_REQUEST);
+    send(make_put_end_request(stream, 0), KVM_REPLY_BAD_REQUEST);
+    EXPECT_EQ(0u, storage_count());
+
+    stream = begin("key1", 6);
+    send(make_put_chunk_request(stream, "value1"), KVM_REPLY_STATUS_OK);
+    send(make_put_end_request(stream, KVM_PUT_END_ABORT), KVM_REPLY_STATUS_OK);
+    EXPECT_EQ(0u, storage_count());
+}
+
+TEST_F(server_stream_request, handle_request_put_chunk_of_other_client_return_bad_request)
+{
+    stream_set_client(5);
+    const uint32_t stream = begin("key1", 6);
+
+    stream_set_client(6);
+    send(make_put_chunk_request(stream, "value1"), KVM_REPLY_BAD_REQUEST);
+
+    /* Dropped with the connection. */
+    stream_release_client(5);
+    stream_set_client(5);
+    send(make_put_chunk_request(stream, "value1"), KVM_REPLY_BAD_REQUEST);
+}
+
+TEST_F(server_stream_request, handle_request_put_begin_limits_uploads_per_client)
+{
+    for (uint32_t i = 0; i < STREAM_MAX_CLIENT_UPLOADS; ++i)
+    {
+        EXPECT_NE(0u, begin("key" + std::to_string(i), 1));
+    }
+    send(make_put_begin_request("key", 1), KVM_REPLY_BAD_REQUEST);
+}
+
+TEST_F(server_stream_request, handle_request_put_begin_over_memory_limit_return_no_memory)
+{
+    configure(4096, KVM_EVICTION_NONE, 0);
+
+    send(make_put_begin_request("key1", 1024 * 1024), KVM_REPLY_NO_MEMORY);
+
+    /* Reserved memory counts against the limit until the end. */
+    const uint32_t stream = begin("key1", 3000);
+    send(make_put_request("key2", std::string(2000, 'v')), KVM_REPLY_NO_MEMORY);
+    send(make_put_end_request(stream, KVM_PUT_END_ABORT), KVM_REPLY_STATUS_OK);
+    send(make_put_request("key2", std::string(2000, 'v')), KVM_REPLY_STATUS_OK);
+}
+
+/********** Conditional PUT / DELETE **********/
+static std::vector<uint8_t> make_get_versioned_request(const std::string & key)
+{
+    std::vector<uint8_t> request(sizeof(kvm_request_generic_t) + sizeof(kvm_request_get_versioned_t));
+    kvm_request_get_versioned_t get_req = {(uint32_t) key.size()};
+
+    request[0] = KVM_REQUST_GET_VERSIONED;
+    memcpy(&request[1], &get_req, sizeof(get_req));
+    request.insert(request.end(), key.begin(), key.end());
+    return request;
+}
+
+static std::vector<uint8_t> make_put_if_request(const std::string & key, const std::string & value, uint32_t ttl, kvm_condition_t condition, uint64_t version)
+{
+    std::vector<uint8_t> request(sizeof(kvm_request_generic_t) + sizeof(kvm_request_put_if_t));
+    kvm_request_put_if_t put_req = {(uint32_t) key.size(), (uint32_t) value.size(), ttl, condition, version};
+
+    request[0] = KVM_REQUST_PUT_IF;
+    memcpy(&request[1], &put_req, sizeof(put_req));
+    request.insert(request.end(), key.begin(), key.end());
+    request.insert(request.end(), value.begin(), value.end());
+    return request;
+}
+
+static std::vector<uint8_t> make_delete_if_request(const std::string & key, kvm_condition_t condition, uint64_t version)
+{
+    std::vector<uint8_t> request(sizeof(kvm_request_generic_t) + sizeof(kvm_request_delete_if_t));
+    kvm_request_delete_if_t delete_req = {(uint32_t) key.size(), condition, version};
+
+    request[0] = KVM_REQUST_DELETE_IF;
+    memcpy(&request[1], &delete_req, sizeof(delete_req));
+    request.insert(request.end(), key.begin(), key.end());
+    return request;
+}
+
+class server_conditional_request : public server_stream_request
+{
+protected:
+    /* Gets the version of the key, checking its value. */
+    uint64_t get_versioned(const std::string & key, const std::string & value)
+    {
+        send(make_get_versioned_request(key), KVM_REPLY_STATUS_OK);
+        EXPECT_EQ(sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_get_versioned_t) + value.size(), reply_size);
+
+        kvm_reply_get_versioned_t get_reply = {0, 0};
+        if (reply_size == sizeof(kvm_reply_generic_t) + sizeof(get_reply) + value.size())
+        {
+            memcpy(&get_reply, reply + sizeof(kvm_reply_generic_t), sizeof(get_reply));
+            EXPECT_EQ(0, memcmp(value.data(), reply + sizeof(kvm_reply_generic_t) + sizeof(get_reply), value.size()));
+        }
+        return get_reply.version;
+    }
+
+    uint64_t put_if(const std::string & key, const std::string & value, kvm_condition_t condition, uint64_t version)
+    {
+        send(make_put_if_request(key, value, KVM_TTL_PERSIST, condition, version), KVM_REPLY_STATUS_OK);
+        EXPECT_EQ(sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_put_if_t), reply_size);
+
+        kvm_reply_put_if_t put_reply = {0};
+        if (reply_size == sizeof(kvm_reply_generic_t) + sizeof(put_reply))
+        {
+            memcpy(&put_reply, reply + sizeof(kvm_reply_generic_t), sizeof(put_reply));
+        }
+        return put_reply.version;
+    }
+};
+
+TEST_F(server_conditional_request, handle_request_put_if_version_match_and_mismatch)
+{
+    send(make_put_request("key1", "value1"), KVM_REPLY_STATUS_OK);
+    const uint64_t version = get_versioned("key1", "value1");
+    ASSERT_NE(0u, version);
+
+    const uint64_t stored = put_if("key1", "value2", KVM_IF_VERSION, version);
+    EXPECT_NE(version, stored);
+    EXPECT_EQ(stored, get_versioned("key1", "value2"));
+
+    /* The old version lost the race. */
+    send(make_put_if_request("key1", "value3", KVM_TTL_PERSIST, KVM_IF_VERSION, version), KVM_REPLY_CONFLICT);
+    EXPECT_EQ(stored, get_versioned("key1", "value2"));
+}
+
+TEST_F(server_conditional_request, handle_request_put_if_absent_and_present)
+{
+    send(make_put_if_request("key1", "value1", KVM_TTL_PERSIST, KVM_IF_PRESENT, 0), KVM_REPLY_CONFLICT);
+    EXPECT_EQ(0u, storage_count());
+
+    const uint64_t version = put_if("key1", "value1", KVM_IF_ABSENT, 0);
+    EXPECT_EQ(version, get_versioned("key1", "value1"));
+    send(make_put_if_request("key1", "value2", KVM_TTL_PERSIST, KVM_IF_ABSENT, 0), KVM_REPLY_CONFLICT);
+
+    EXPECT_NE(version, put_if("key1", "value2", KVM_IF_PRESENT, 0));
+    get_versioned("key1", "value2");
+}
+
+TEST_F(server_conditional_request, handle_request_put_if_expired_key_is_absent)
+{
+    send(make_put_if_request("key1", "value1", 1, KVM_IF_ABSENT, 0), KVM_REPLY_STATUS_OK);
+    usleep(5000);
+
+    put_if("key1", "value2", KVM_IF_ABSENT, 0);
+    get_versioned("key1", "value2");
+}
+
+TEST_F(server_conditional_request, handle_request_delete_if_version)
+{
+    send(make_put_request("key1", "value1"), KVM_REPLY_STATUS_OK);
+    const uint64_t version = get_versioned("key1", "value1");
+
+    send(make_delete_if_request("key1", KVM_IF_VERSION, version + 1), KVM_REPLY_CONFLICT);
+    EXPECT_EQ(1u, storage_count());
+
+    send(make_delete_if_request("key1", KVM_IF_VERSION, version), KVM_REPLY_STATUS_OK);
+    EXPECT_EQ(0u, storage_count());
+
+    send(make_delete_if_request("key1", KVM_IF_PRESENT, 0), KVM_REPLY_CONFLICT);
+    send(make_get_versioned_request("key1"), KVM_REPLY_BAD_REQUEST);
+}
+
+TEST_F(server_conditional_request, handle_request_conditional_invalid_request_return_bad_request)
+{
+    send(make_put_if_request("key1", "value1", KVM_TTL_PERSIST, KVM_IF_PRESENT + 1, 0), KVM_REPLY_BAD_REQUEST);
+    send(make_put_if_request("key1", "value1", 0, KVM_IF_ABSENT, 0), KVM_REPLY_BAD_REQUEST);
+    send(make_delete_if_request("key1", KVM_IF_ABSENT, 0), KVM_REPLY_BAD_REQUEST);
+
+    std::vector<uint8_t> request = make_put_if_request("key1", "value1", KVM_TTL_PERSIST, KVM_IF_ABSENT, 0);
+    request.pop_back();
+    send(request, KVM_REPLY_BAD_REQUEST);
+
+    /* Key and value sizes adding up to 0 in 32 bits. */
+    request = make_put_if_request("k", "v", KVM_TTL_PERSIST, KVM_IF_ABSENT, 0);
+    memset(&request[1 + offsetof(kvm_request_put_if_t, key_size)], 0xFF, sizeof(uint32_t));
+    send(request, KVM_REPLY_BAD_REQUEST);
+    EXPECT_EQ(0u, storage_count());
+}
+
+/********** INCR / APPEND / GETSET **********/
+static std::vector<uint8_t> make_incr_request(const std::string & key, int64_t delta)
+{
+    std::vector<uint8_t> request(sizeof(kvm_request_generic_t) + sizeof(kvm_request_incr_t));
+    kvm_request_incr_t incr_req = {(uint32_t) key.size(), delta};
+
+    request[0] = KVM_REQUST_INCR;
+    memcpy(&request[1], &incr_req, sizeof(incr_req));
+    request.insert(request.end(), key.begin(), key.end());
+    return request;
+}
+
+/* APPEND and GETSET share the PUT layout. */
+static std::vector<uint8_t> make_key_value_request(kvm_request_id_t id, const std::string & key, const std::string & value)
+{
+    std::vector<uint8_t> request = make_put_request(key, value);
+    request[0] = id;
+    return request;
+}
+
+class server_update_request : public server_conditional_request
+{
+protected:
+    int64_t incr(const std::string & key, int64_t delta)
+    {
+        send(make_incr_request(key, delta), KVM_REPLY_STATUS_OK);
+        EXPECT_EQ(sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_incr_t), reply_size);
+
+        kvm_reply_incr_t incr_reply = {0};
+        if (reply_size == sizeof(kvm_reply_generic_t) + sizeof(incr_reply))
+        {
+            memcpy(&incr_reply, reply + sizeof(kvm_reply_generic_t), sizeof(incr_reply));
+        }
+        return incr_reply.value;
+    }
+
+    uint32_t append(const std::string & key, const std::string & data)
+    {
+        send(make_key_value_request(KVM_REQUST_APPEND, key, data), KVM_REPLY_STATUS_OK);
+        EXPECT_EQ(sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_append_t), reply_size);
+
+        kvm_reply_append_t append_reply = {0};
+        if (reply_size == sizeof(kvm_reply_generic_t) + sizeof(append_reply))
+        {
+            memcpy(&append_reply, reply + sizeof(kvm_reply_generic_t), sizeof(append_reply));
+        }
+        return append_reply.value_size;
+    }
+
+    /* Stores the value, returns the replaced one or "<none>". */
+    std::string getset(const std::string & key, const std::string & value)
+    {
+        send(make_key_value_request(KVM_REQUST_GETSET, key, value), KVM_REPLY_STATUS_OK);
+
+        kvm_reply_getset_t getset_reply;
+        EXPECT_LE(sizeof(kvm_reply_generic_t) + sizeof(getset_reply), reply_size);
+        memcpy(&getset_reply, reply + sizeof(kvm_reply_generic_t), sizeof(getset_reply));
+        EXPECT_EQ(sizeof(kvm_reply_generic_t) + sizeof(getset_reply) + getset_reply.value_size, reply_size);
+
+        if (!getset_reply.found)
+        {
+            return "<none>";
+        }
+        return std::string((const char *) reply + sizeof(kvm_reply_generic_t) + sizeof(getset_reply), getset_reply.value_size);
+    }
+};
+
+TEST_F(server_update_request, handle_request_incr_counts_from_zero)
+{
+    EXPECT_EQ(1, incr("key1", 1));
+    EXPECT_EQ(42, incr("key1", 41));
+    EXPECT_EQ(-8, incr("key1", -50));
+    get_versioned("key1", "-8");
+
+    send(make_put_request("key2", "100"), KVM_REPLY_STATUS_OK);
+    EXPECT_EQ(99, incr("key2", -1));
+}
+
+TEST_F(server_update_request, handle_request_incr_not_integer_or_overflow_return_bad_request)
+{
+    send(make_put_request("key1", "12a"), KVM_REPLY_STATUS_OK);
+    send(make_incr_request("key1", 1), KVM_REPLY_BAD_REQUEST);
+    send(make_put_request("key1", " 12"), KVM_REPLY_STATUS_OK);
+    send(make_incr_request("key1", 1), KVM_REPLY_BAD_REQUEST);
+    send(make_put_request("key1", ""), KVM_REPLY_STATUS_OK);
+    send(make_incr_request("key1", 1), KVM_REPLY_BAD_REQUEST);
+
+    send(make_put_request("key1", "9223372036854775807"), KVM_REPLY_STATUS_OK);
+    send(make_incr_request("key1", 1), KVM_REPLY_BAD_REQUEST);
+    get_versioned("key1", "9223372036854775807");
+
+    send(make_put_request("key1", "-9223372036854775808"), KVM_REPLY_STATUS_OK);
+    send(make_incr_request("key1", -1), KVM_REPLY_BAD_REQUEST);
+    EXPECT_EQ(INT64_MIN + 1, incr("key1", 1));
+}
+
+TEST_F(server_update_request, handle_request_incr_append_and_getset_keep_ttl)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_ttl_key1_value1_long_request), put_ttl_key1_value1_long_request, &reply_size, &reply));
+    append("key1", "2");
+
+    const kvm_entry_t * entry = storage_find((const uint8_t *) "key1", 4, storage_now());
+    ASSERT_NE(nullptr, entry);
+    EXPECT_NE(0u, entry->timer.expire_at);
+
+    send(make_put_if_request("key2", "7", 100000, KVM_IF_ABSENT, 0), KVM_REPLY_STATUS_OK);
+    EXPECT_EQ(8, incr("key2", 1));
+
+    entry = storage_find((const uint8_t *) "key2", 4, storage_now());
+    ASSERT_NE(nullptr, entry);
+    EXPECT_NE(0u, entry->timer.expire_at);
+
+    send(make_put_if_request("key3", "old", 100000, KVM_IF_ABSENT, 0), KVM_REPLY_STATUS_OK);
+    EXPECT_EQ("old", getset("key3", "new"));
+
+    entry = storage_find((const uint8_t *) "key3", 4, storage_now());
+    ASSERT_NE(nullptr, entry);
+    EXPECT_NE(0u, entry->timer.expire_at);
+    EXPECT_LE(entry->timer.expire_at, storage_now() + 100000);
+}
+
+TEST_F(server_update_request, handle_request_append_grows_value_in_place)
+{
+    const std::string second(100, 's');
+    EXPECT_EQ(5u, append("key1", "first"));
+    EXPECT_EQ(105u, append("key1", second));
+
+    /* Too large for the slack of the first allocation, the copy left room
+       for the following appends. */
+    const kvm_entry_t * entry = storage_find((const uint8_t *) "key1", 4, storage_now());
+    const uint64_t version = storage_version(entry);
+
+    kvm_server_storage_stats_t stats;
+    storage_get_stats(&stats);
+    const uint64_t in_place = stats.appended_in_place;
+    const uint64_t used_memory = stats.used_memory;
+
+    EXPECT_EQ(107u, append("key1", "d!"));
+    EXPECT_EQ(entry, storage_find((const uint8_t *) "key1", 4, storage_now()));
+    EXPECT_NE(version, storage_version(entry));
+
+    storage_get_stats(&stats);
+    EXPECT_EQ(in_place + 1, stats.appended_in_place);
+    EXPECT_EQ(used_memory + 2, stats.used_memory);
+
+    get_versioned("key1", "first" + second + "d!");
+}
+
+TEST_F(server_update_request, handle_request_append_under_memory_limit_leaves_no_room)
+{
+    configure(1024 * 1024, KVM_EVICTION_NONE, 0);
+
+    const std::string second(100, 's');
+    const std::string third(50, 't');
+    EXPECT_EQ(5u, append("key1", "first"));
+    EXPECT_EQ(105u, append("key1", second));
+
+    kvm_server_storage_stats_t stats;
+    storage_get_stats(&stats);
+    const uint64_t in_place = stats.appended_in_place;
+
+    /* Copied again, the first copy was sized to the value. */
+    EXPECT_EQ(155u, append("key1", third));
+    storage_get_stats(&stats);
+    EXPECT_EQ(in_place, stats.appended_in_place);
+
+    get_versioned("key1", "first" + second + third);
+}
+
+TEST_F(server_update_request, handle_request_append_to_compressed_value)
+{
+    configure(0, KVM_EVICTION_NONE, 64);
+
+    const std::string value = make_json_value(4096);
+    send(make_put_request("key1", value), KVM_REPLY_STATUS_OK);
+
+    kvm_server_storage_stats_t stats;
+    storage_get_stats(&stats);
+    ASSERT_EQ(1u, stats.compressed_values);
+
+    EXPECT_EQ(value.size() + 1, append("key1", "!"));
+    get_versioned("key1", value + "!");
+}
+
+TEST_F(server_update_request, handle_request_getset_return_replaced_value)
+{
+    EXPECT_EQ("<none>", getset("key1", "value1"));
+    EXPECT_EQ("value1", getset("key1", "value2"));
+    get_versioned("key1", "value2");
+
+    send(make_key_value_request(KVM_REQUST_GETSET, "key1", "value3"), KVM_REPLY_STATUS_OK);
+    std::vector<uint8_t> request = make_key_value_request(KVM_REQUST_GETSET, "key1", "value4");
+    request.pop_back();
+    send(request, KVM_REPLY_BAD_REQUEST);
+    get_versioned("key1", "value3");
+}
+
+TEST_F(server_update_request, handle_request_append_and_getset_sizes_wrapping_return_bad_request)
+{
+    /* Key and value sizes add up to 0 in 32 bits. */
+    for (kvm_request_id_t id : {KVM_REQUST_APPEND, KVM_REQUST_GETSET})
+    {
+        std::vector<uint8_t> request = make_key_value_request(id, "k", "v");
+        memset(&request[1], 0xFF, sizeof(uint32_t));
+        send(request, KVM_REPLY_BAD_REQUEST);
+    }
+    EXPECT_EQ(0u, storage_count());
+}
+
+/********** BATCH **********/
+/* GET and DELETE carry the key only. */
+static std::vector<uint8_t> make_key_request(kvm_request_id_t id, const std::string & key)
+{
+    std::vector<uint8_t> request(sizeof(kvm_request_generic_t) + sizeof(uint32_t));
+    const uint32_t key_size = key.size();
+
+    request[0] = id;
+    memcpy(&request[1], &key_size, sizeof(key_size));
+    request.insert(request.end(), key.begin(), key.end());
+    return request;
+}
+
+static std::vector<uint8_t> make_batch_request(const std::vector<std::vector<uint8_t>> & ops)
+{
+    std::vector<uint8_t> request(sizeof(kvm_request_generic_t) + sizeof(kvm_request_batch_t));
+    kvm_request_batch_t batch_req = {(uint32_t) ops.size()};
+
+    request[0] = KVM_REQUST_BATCH;
+    memcpy(&request[1], &batch_req, sizeof(batch_req));
+    for (const std::vector<uint8_t> & op : ops)
+    {
+        const uint32_t op_size = op.size();
+        request.insert(request.end(), (const uint8_t *) &op_size, (const uint8_t *) &op_size + sizeof(op_size));
+        request.insert(request.end(), op.begin(), op.end());
+    }
+    return request;
+}
+
+class server_batch_request : public server_update_request
+{
+protected:
+    /* Runs the batch, checks whether it committed and returns the replies. */
+    std::vector<std::vector<uint8_t>> batch(const std::vector<std::vector<uint8_t>> & ops, bool committed)
+    {
+        std::vector<std::vector<uint8_t>> replies;
+        send(make_batch_request(ops), KVM_REPLY_STATUS_OK);
+
+        kvm_reply_batch_t batch_reply;
+        EXPECT_LE(sizeof(kvm_reply_generic_t) + sizeof(batch_reply), reply_size);
+        memcpy(&batch_reply, reply + sizeof(kvm_reply_generic_t), sizeof(batch_reply));
+        EXPECT_EQ(committed, (bool) batch_reply.committed);
+
+        const uint8_t * ptr = reply + sizeof(kvm_reply_generic_t) + sizeof(batch_reply);
+        for (uint32_t i = 0; i < batch_reply.count; ++i)
+        {
+            uint32_t op_reply_size;
+            memcpy(&op_reply_size, ptr, sizeof(op_reply_size));
+            ptr += sizeof(op_reply_size);
+            replies.emplace_back(ptr, ptr + op_reply_size);
+            ptr += op_reply_size;
+        }
+        EXPECT_EQ(reply + reply_size, ptr);
+        return replies;
+    }
+};
+
+TEST_F(server_batch_request, handle_request_batch_commits_all_in_order)
+{
+    send(make_put_request("key3", "value3"), KVM_REPLY_STATUS_OK);
+
+    const std::vector<std::vector<uint8_t>> replies = batch({
+        make_put_request("key1", "value1"),
+        make_key_request(KVM_REQUST_GET, "key1"),
+        make_incr_request("key2", 5),
+        make_key_request(KVM_REQUST_DELETE, "key3"),
+        make_key_request(KVM_REQUST_GET, "key3")}, true);
+
+    ASSERT_EQ(5u, replies.size());
+    EXPECT_EQ(std::vector<uint8_t>({KVM_REPLY_STATUS_OK}), replies[0]);
+    EXPECT_EQ(std::vector<uint8_t>({KVM_REPLY_STATUS_OK, 6, 0, 0, 0, 'v', 'a', 'l', 'u', 'e', '1'}), replies[1]);
+    EXPECT_EQ(std::vector<uint8_t>({KVM_REPLY_STATUS_OK, 5, 0, 0, 0, 0, 0, 0, 0}), replies[2]);
+    EXPECT_EQ(std::vector<uint8_t>({KVM_REPLY_STATUS_OK}), replies[3]);
+
+    /* A read which misses does not fail the batch. */
+    EXPECT_EQ(std::vector<uint8_t>({KVM_REPLY_BAD_REQUEST}), replies[4]);
+
+    get_versioned("key1", "value1");
+    get_versioned("key2", "5");
+    EXPECT_EQ(2u, storage_count());
+}
+
+TEST_F(server_batch_request, handle_request_batch_failed_write_reverts_the_others)
+{
+    EXPECT_EQ(KVM_RESULT_OK, handle_request(sizeof(put_ttl_key1_value1_long_request), put_ttl_key1_value1_long_request, &reply_size, &reply));
+    send(make_put_request("key2", "value2"), KVM_REPLY_STATUS_OK);
+    const uint64_t version1 = get_versioned("key1", "value1");
+    const uint64_t version2 = get_versioned("key2", "value2");
+
+    kvm_server_storage_stats_t stats;
+    storage_get_stats(&stats);
+    const uint64_t used_memory = stats.used_memory;
+
+    const std::vector<std::vector<uint8_t>> replies = batch({
+        make_put_request("key1", "changed"),
+        make_key_request(KVM_REQUST_DELETE, "key2"),
+        make_put_request("key3", "value3"),
+        make_incr_request("key4", 1),
+        make_key_value_request(KVM_REQUST_APPEND, "key3", "!"),
+        make_put_if_request("key2", "value2", KVM_TTL_PERSIST, KVM_IF_PRESENT, 0),
+        make_put_request("key5", "value5")}, false);
+
+    /* Replies end with the failed operation. */
+    ASSERT_EQ(6u, replies.size());
+    EXPECT_EQ(std::vector<uint8_t>({KVM_REPLY_CONFLICT}), replies[5]);
+
+    EXPECT_EQ(version1, get_versioned("key1", "value1"));
+    EXPECT_EQ(version2, get_versioned("key2", "value2"));
+    EXPECT_EQ(2u, storage_count());
+
+    const kvm_entry_t * entry = storage_find((const uint8_t *) "key1", 4, storage_now());
+    ASSERT_NE(nullptr, entry);
+    EXPECT_NE(0u, entry->timer.expire_at);
+
+    storage_get_stats(&stats);
+    EXPECT_EQ(used_memory, stats.used_memory);
+}
+
+TEST_F(server_batch_request, handle_request_batch_reverts_append_in_place_and_ttl)
+{
+    append("key1", "first");
+    append("key1", std::string(100, 's'));
+    const uint64_t version = get_versioned("key1", "first" + std::string(100, 's'));
+
+    kvm_server_storage_stats_t stats;
+    storage_get_stats(&stats);
+    const uint64_t in_place = stats.appended_in_place;
+
+    batch({
+        make_key_value_request(KVM_REQUST_APPEND, "key1", "d!"),
+        make_delete_if_request("key1", KVM_IF_VERSION, version)}, false);
+
+    storage_get_stats(&stats);
+    EXPECT_EQ(in_place + 1, stats.appended_in_place);
+    EXPECT_EQ(version, get_versioned("key1", "first" + std::string(100, 's')));
+
+    std::vector<uint8_t> expire(sizeof(kvm_request_generic_t) + sizeof(kvm_request_expire_t));
+    kvm_request_expire_t expire_req = {4, 100000};
+    expire[0] = KVM_REQUST_EXPIRE;
+    memcpy(&expire[1], &expire_req, sizeof(expire_req));
+    expire.insert(expire.end(), {'k', 'e', 'y', '1'});
+
+    batch({expire, make_delete_if_request("key2", KVM_IF_PRESENT, 0)}, false);
+
+    const kvm_entry_t * entry = storage_find((const uint8_t *) "key1", 4, storage_now());
+    ASSERT_NE(nullptr, entry);
+    EXPECT_EQ(0u, entry->timer.expire_at);
+}
+
+TEST_F(server_batch_request, handle_request_batch_restores_evicted_keys)
+{
+    configure(4096, KVM_EVICTION_LRU, 0);
+    for (int i = 0; i < 8; ++i)
+    {
+        send(make_put_request("old" + std::to_string(i), std::string(200, 'o')), KVM_REPLY_STATUS_OK);
+    }
+
+    /* The new values push the old ones out before the batch fails. */
+    std::vector<std::vector<uint8_t>> ops;
+    for (int i = 0; i < 8; ++i)
+    {
+        ops.push_back(make_put_request("new" + std::to_string(i), std::string(400, 'n')));
+    }
+    ops.push_back(make_delete_if_request("old0", KVM_IF_VERSION, 0));
+    batch(ops, false);
+
+    EXPECT_EQ(8u, storage_count());
+    for (int i = 0; i < 8; ++i)
+    {
+        get_versioned("old" + std::to_string(i), std::string(200, 'o'));
+    }
+}
+
+TEST_F(server_batch_request, handle_request_batch_count_skips_many_expired_keys)
+{
+    /* Far more expired keys than an operation reserves undo records for */
+    for (int i = 0; i < 200; ++i)
+    {
+        send(make_put_if_request("key" + std::to_string(i), "value", 1, KVM_IF_ABSENT, 0), KVM_REPLY_STATUS_OK);
+    }
+    send(make_put_request("kept", "value"), KVM_REPLY_STATUS_OK);
+    usleep(5000);
+
+    const std::vector<std::vector<uint8_t>> replies = batch({
+        make_put_request("new", "value"),
+        std::vector<uint8_t>(count_request, count_request + sizeof(count_request)),
+        make_delete_if_request("kept", KVM_IF_VERSION, 0)}, false);
+
+    ASSERT_EQ(3u, replies.size());
+    EXPECT_EQ(std::vector<uint8_t>({KVM_REPLY_STATUS_OK, 2, 0, 0, 0}), replies[1]);
+
+    /* Nothing was reaped, the expired keys go on the next cycle. */
+    EXPECT_EQ(201u, storage_count());
+    EXPECT_EQ(200u, expire_entries(UINT32_MAX));
+    EXPECT_EQ(1u, storage_count());
+    get_versioned("kept", "value");
+}
+
+TEST_F(server_batch_request, handle_request_invalid_batch_return_bad_request)
+{
+    const std::vector<uint8_t> put = make_put_request("key1", "value1");
+
+    send(make_batch_request({}), KVM_REPLY_BAD_REQUEST);
+    send(make_batch_request({put, make_batch_request({put})}), KVM_REPLY_BAD_REQUEST);
+    send(make_batch_request({put, std::vector<uint8_t>(hotkeys_request, hotkeys_request + sizeof(hotkeys_request))}), KVM_REPLY_BAD_REQUEST);
+    send(make_batch_request({put, std::vector<uint8_t>()}), KVM_REPLY_BAD_REQUEST);
+
+    std::vector<uint8_t> request = make_batch_request({put, put});
+    request.push_back(0);
+    send(request, KVM_REPLY_BAD_REQUEST);
+    request.resize(request.size() - 2);
+    send(request, KVM_REPLY_BAD_REQUEST);
+
+    /* Nothing ran. */
+    EXPECT_EQ(0u, storage_count());
+}
+
+TEST_F(server_batch_request, handle_request_batch_too_large_reply_return_bad_request)
+{
+    send(make_put_request("key1", std::string(200 * 1024, 'v')), KVM_REPLY_STATUS_OK);
+    send(make_put_request("key2", "value2"), KVM_REPLY_STATUS_OK);
+    const uint64_t version2 = get_versioned("key2", "value2");
+
+    /* Replies of the GETs would take more than half the frame limit. */
+    std::vector<std::vector<uint8_t>> ops(1, make_put_request("key2", "changed"));
+    ops.resize(700, make_key_request(KVM_REQUST_GET, "key1"));
+    send(make_batch_request(ops), KVM_REPLY_BAD_REQUEST);
+
+    EXPECT_EQ(version2, get_versioned("key2", "value2"));
+    EXPECT_EQ(2u, storage_count());
+}
+
+TEST_F(server_batch_request, handle_request_batch_counts_each_operation)
+{
+    stats_reset();
+    slowlog_configure(0);
+
+    batch({
+        make_put_request("key1", "value1"),
+        make_put_request("key2", "value2"),
+        make_key_request(KVM_REQUST_GET, "key1"),
+        make_key_request(KVM_REQUST_GET, "key3")}, true);
+
+    std::unique_ptr<kvm_stats_t> stats(new kvm_stats_t());
+    stats_aggregate(stats.get());
+    EXPECT_EQ(2u, stats->requests[KVM_REQUST_PUT]);
+    EXPECT_EQ(2u, stats->requests[KVM_REQUST_GET]);
+    EXPECT_EQ(1u, stats->requests[KVM_REQUST_BATCH]);
+    EXPECT_EQ(2u, kvm_histogram_count(stats->latency[KVM_REQUST_PUT]));
+    EXPECT_EQ(1u, stats->hits);
+    EXPECT_EQ(1u, stats->misses);
+
+    /* The operations are logged as they finish, the BATCH after them. */
+    ASSERT_EQ(5u, slowlog_count());
+    EXPECT_EQ(KVM_REQUST_BATCH, slowlog_get(0)->op);
+    EXPECT_EQ(KVM_REQUST_GET, slowlog_get(1)->op);
+    EXPECT_EQ(KVM_REQUST_PUT, slowlog_get(4)->op);
+}
+
+/********** MEMORY **********/
+class server_memory_request : public server_update_request
+{
+protected:
+    kvm_memory_t memory()
+    {
+        const uint8_t memory_request[] = {KVM_REQUST_MEMORY};
+        send(std::vector<uint8_t>(memory_request, memory_request + sizeof(memory_request)), KVM_REPLY_STATUS_OK);
+        EXPECT_EQ(sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_memory_t), reply_size);
+
+        kvm_memory_t memory;
+        memset(&memory, 0, sizeof(memory));
+        if (reply_size == sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_memory_t))
+        {
+            memcpy(&memory, reply + sizeof(kvm_reply_generic_t), sizeof(memory));
+        }
+        return memory;
+    }
+};
+
+TEST_F(server_memory_request, handle_request_memory_counts_storage_categories)
+{
+    kvm_memory_t m = memory();
+    EXPECT_EQ(0u, m.keys);
+    EXPECT_EQ(0u, m.values);
+    EXPECT_EQ(0u, m.entry_headers);
+    EXPECT_EQ(0u, m.entry_slack);
+    EXPECT_EQ(STORAGE_INITIAL_BUCKETS * sizeof(kvm_entry_t *), m.buckets);
+    EXPECT_LT(0u, m.rss);
+    EXPECT_LT(0u, m.heap_in_use);
+
+    send(make_put_request("key1", "value1"), KVM_REPLY_STATUS_OK);
+    send(make_put_request("key22", std::string(1000, 'v')), KVM_REPLY_STATUS_OK);
+    m = memory();
+    EXPECT_EQ(9u, m.keys);
+    EXPECT_EQ(1006u, m.values);
+    EXPECT_EQ(2 * sizeof(kvm_entry_t), m.entry_headers);
+
+    kvm_server_storage_stats_t stats;
+    storage_get_stats(&stats);
+    EXPECT_EQ(stats.used_memory, m.keys + m.values + m.entry_headers + m.buckets);
+
+    /* A copied value leaves room for further appends. */
+    const uint64_t slack = m.entry_slack;
+    append("key22", std::string(1000, 'a'));
+    m = memory();
+    EXPECT_EQ(2006u, m.values);
+    EXPECT_LE(slack + 1000, m.entry_slack);
+
+    send(make_key_request(KVM_REQUST_DELETE, "key1"), KVM_REPLY_STATUS_OK);
+    send(make_key_request(KVM_REQUST_DELETE, "key22"), KVM_REPLY_STATUS_OK);
+    m = memory();
+    EXPECT_EQ(0u, m.keys);
+    EXPECT_EQ(0u, m.values);
+    EXPECT_EQ(0u, m.entry_headers);
+    EXPECT_EQ(0u, m.entry_slack);
+    EXPECT_LT(2000u, m.retired);
+}
+
+TEST_F(server_memory_request, handle_request_memory_counts_uploads_and_undo_log)
+{
+    begin("key1", 5000);
+    send(make_batch_request({make_put_request("key2", "value2")}), KVM_REPLY_STATUS_OK);
+    const kvm_memory_t m = memory();
+    EXPECT_EQ(sizeof(kvm_entry_t) + 4 + 5000, m.uploads);
+    EXPECT_LT(0u, m.undo_log);
+}
+
+TEST_F(server_memory_request, handle_request_memory_wrong_size_return_bad_request)
+{
+    const uint8_t memory_request[] = {KVM_REQUST_MEMORY, 0};
+    send(std::vector<uint8_t>(memory_request, memory_request + sizeof(memory_request)), KVM_REPLY_BAD_REQUEST);
+}
+
+/********** SCAN **********/
+class server_scan_request : public server_update_request
+{
+protected:
+    struct scanned
+    {
+        std::string key;
+        std::string value;
+        uint32_t    value_size;
+        uint32_t    ttl;
+        bool        has_value;
+    };
+
+    /* Gets a page, returns the next cursor. */
+    uint32_t scan(uint32_t cursor, uint32_t max_bytes, std::vector<scanned> & pairs)
+    {
+        kvm_request_scan_t scan_req = {cursor, max_bytes};
+        std::vector<uint8_t> request(1, KVM_REQUST_SCAN);
+        request.insert(request.end(), (const uint8_t *) &scan_req, (const uint8_t *) (&scan_req + 1));
+        send(request, KVM_REPLY_STATUS_OK);
+
+        kvm_reply_scan_t scan_reply;
+        EXPECT_LE(sizeof(kvm_reply_generic_t) + sizeof(scan_reply), reply_size);
+        memcpy(&scan_reply, reply + sizeof(kvm_reply_generic_t), sizeof(scan_reply));
+
+        const uint8_t * ptr = reply + sizeof(kvm_reply_generic_t) + sizeof(scan_reply);
+        for (uint32_t i = 0; i < scan_reply.count; ++i)
+        {
+            uint32_t entry_size;
+            kvm_reply_scan_entry_t entry;
+            memcpy(&entry_size, ptr, sizeof(entry_size));
+            memcpy(&entry, ptr + sizeof(entry_size), sizeof(entry));
+
+            const char * data = (const char *) ptr + sizeof(entry_size) + sizeof(entry);
+            scanned pair;
+            pair.key.assign(data, entry.key_size);
+            pair.value.assign(data + entry.key_size, entry.has_value ? entry.value_size : 0);
+            pair.value_size = entry.value_size;
+            pair.ttl = entry.ttl;
+            pair.has_value = entry.has_value;
+            pairs.push_back(pair);
+
+            EXPECT_EQ(sizeof(entry) + entry.key_size + (entry.has_value ? entry.value_size : 0), entry_size);
+            ptr += sizeof(entry_size) + entry_size;
+        }
+        EXPECT_EQ(reply + reply_size, ptr);
+        return scan_reply.cursor;
+    }
+};
+
+TEST_F(server_scan_request, handle_request_scan_returns_every_pair_once_while_table_grows)
+{
+    const int count = 200;
+    for (int i = 0; i < count; ++i)
+    {
+        send(make_put_request("key" + std::to_string(i), "value" + std::to_string(i)), KVM_REPLY_STATUS_OK);
+    }
+
+    std::vector<scanned> pairs;
+    uint32_t cursor = scan(0, 64, pairs);
+    ASSERT_NE(0u, cursor);
+
+    /* Grow the table a few times between pages. */
+    for (int i = 0; i < 2000; ++i)
+    {
+        send(make_put_request("new" + std::to_string(i), "v"), KVM_REPLY_STATUS_OK);
+    }
+
+    uint32_t pages = 1;
+    while (0 != cursor)
+    {
+        cursor = scan(cursor, 64, pairs);
+        pages++;
+    }
+    EXPECT_LT(10u, pages);
+
+    std::vector<int> seen(count, 0);
+    for (const scanned & pair : pairs)
+    {
+        if (0 == pair.key.compare(0, 3, "key"))
+        {
+            const int i = std::stoi(pair.key.substr(3));
+            seen[i]++;
+            EXPECT_EQ("value" + std::to_string(i), pair.value);
+            EXPECT_EQ(KVM_TTL_PERSIST, pair.ttl);
+        }
+    }
+    EXPECT_EQ(std::vector<int>(count, 1), seen);
+}
+
+TEST_F(server_scan_request, handle_request_scan_leaves_out_large_values_and_expired_pairs)
+{
+    send(make_put_request("large", std::string(5000, 'v')), KVM_REPLY_STATUS_OK);
+    send(std::vector<uint8_t>(put_ttl_key1_value1_long_request, put_ttl_key1_value1_long_request + sizeof(put_ttl_key1_value1_long_request)), KVM_REPLY_STATUS_OK);
+
+    std::vector<scanned> pairs;
+    uint32_t cursor = 0;
+    do
+    {
+        cursor = scan(cursor, 1000, pairs);
+    } while (0 != cursor);
+
+    ASSERT_EQ(2u, pairs.size());
+    const scanned & large = ("large" == pairs[0].key) ? pairs[0] : pairs[1];
+    const scanned & key1 = ("key1" == pairs[0].key) ? pairs[0] : pairs[1];
+    EXPECT_FALSE(large.has_value);
+    EXPECT_EQ(5000u, large.value_size);
+    EXPECT_TRUE(key1.has_value);
+    EXPECT_EQ("value1", key1.value);
+    EXPECT_LT(0u, key1.ttl);
+    EXPECT_GE(100000u, key1.ttl);
+
+    send(std::vector<uint8_t>(put_ttl_key1_value1_short_request, put_ttl_key1_value1_short_request + sizeof(put_ttl_key1_value1_short_request)), KVM_REPLY_STATUS_OK);
+    usleep(5000);
+
+    pairs.clear();
+    do
+    {
+        cursor = scan(cursor, KVM_SCAN_MAX_BYTES, pairs);
+    } while (0 != cursor);
+    ASSERT_EQ(1u, pairs.size());
+    EXPECT_EQ("large", pairs[0].key);
+    EXPECT_TRUE(pairs[0].has_value);
+}
+
+TEST_F(server_scan_request, handle_request_invalid_scan_return_bad_request)
+{
+    const uint8_t short_request[] = {KVM_REQUST_SCAN, 0, 0, 0, 0};
+    send(std::vector<uint8_t>(short_request, short_request + sizeof(short_request)), KVM_REPLY_BAD_REQUEST);
+
+    const uint8_t empty_page_request[] = {KVM_REQUST_SCAN, 0, 0, 0, 0, 0, 0, 0, 0};
+    send(std::vector<uint8_t>(empty_page_request, empty_page_request + sizeof(empty_page_request)), KVM_REPLY_BAD_REQUEST);
+
+    std::vector<scanned> pairs;
+    EXPECT_EQ(0u, scan(0, 1, pairs));
+    EXPECT_TRUE(pairs.empty());
+}
+
+/********** Dump and bulk load **********/
+/* The mock transport hands requests on this port to handle_request(). */
+const uint16_t handler_port = 55556;
+
+class server_dump_load : public server_scan_request
+{
+protected:
+    typedef std::map<std::string, std::pair<std::string, uint32_t>> keyspace;
+
+    /* Every pair with its value and TTL. */
+    keyspace read_all()
+    {
+        std::vector<scanned> pairs;
+        uint32_t cursor = 0;
+        do
+        {
+            cursor = scan(cursor, 64 * 1024, pairs);
+        } while (0 != cursor);
+
+        keyspace result;
+        for (const scanned & pair : pairs)
+        {
+            uint64_t version;
+            const std::string value = pair.has_value ? pair.value : read_range(pair.key, 64 * 1024, &version);
+            result[pair.key] = std::make_pair(value, pair.ttl);
+        }
+        return result;
+    }
+
+    /* Dumps the storage to a file, empties it and loads the file back. */
+    void round_trip(bulk_format_t format)
+    {
+        const std::string path = "/tmp/kvm_test_" + std::to_string(getpid()) + ".dump";
+
+        kvm_client_handle_t h_client;
+        ASSERT_EQ(KVM_RESULT_OK, kvm_client_open(&h_client, "127.0.0.1", handler_port));
+        const dump_options_t dump_options = {path.c_str(), format, 4096};
+        EXPECT_EQ(0, dump(h_client, &dump_options));
+        kvm_client_close(h_client);
+
+        storage_uninit();
+        ASSERT_EQ(KVM_RESULT_OK, storage_init());
+
+        /* One connection, as the handler serves one thread at a time. */
+        const bulk_load_options_t load_options = {path.c_str(), format, 1, 2, 1024 * 1024, 2};
+        EXPECT_EQ(0, bulk_load("127.0.0.1", handler_port, &load_options));
+        unlink(path.c_str());
+    }
+};
+
+TEST_F(server_dump_load, binary_dump_loads_back_every_pair_with_ttl)
+{
+    send(make_put_request("key1", "value1"), KVM_REPLY_STATUS_OK);
+    send(make_put_request(std::string("key\n=2", 6), std::string("a\r\n=\0b", 6)), KVM_REPLY_STATUS_OK);
+    send(make_put_if_request("key3", "value3", 100000, KVM_IF_ABSENT, 0), KVM_REPLY_STATUS_OK);
+    /* Read in chunks by the dump */
+    send(make_put_request("big", std::string(300000, 'b')), KVM_REPLY_STATUS_OK);
+    send(make_put_if_request("key4", "value4", 1, KVM_IF_ABSENT, 0), KVM_REPLY_STATUS_OK);
+    usleep(5000);
+
+    const keyspace before = read_all();
+    ASSERT_EQ(4u, before.size());
+    round_trip(BULK_FORMAT_BINARY);
+    const keyspace after = read_all();
+
+    ASSERT_EQ(before.size(), after.size());
+    for (const auto & pair : before)
+    {
+        const auto found = after.find(pair.first);
+        ASSERT_NE(after.end(), found) << pair.first;
+        EXPECT_EQ(pair.second.first, found->second.first) << pair.first;
+        if (KVM_TTL_PERSIST == pair.second.second)
+        {
+            EXPECT_EQ(KVM_TTL_PERSIST, found->second.second) << pair.first;
+        }
+        else
+        {
+            EXPECT_LE(found->second.second, pair.second.second) << pair.first;
+            EXPECT_GE(found->second.second + 1000, pair.second.second) << pair.first;
+        }
+    }
+}
+
+TEST_F(server_dump_load, text_dump_loads_back_the_pairs_it_can_hold)
+{
+    send(make_put_request("key1", "value1"), KVM_REPLY_STATUS_OK);
+    send(make_put_request("key2", "a=b"), KVM_REPLY_STATUS_OK);
+    send(make_put_request("key3", ""), KVM_REPLY_STATUS_OK);
+    /* No line can hold these */
+    send(make_put_request("key=4", "value4"), KVM_REPLY_STATUS_OK);
+    send(make_put_request("key5", "a\nb"), KVM_REPLY_STATUS_OK);
+
+    round_trip(BULK_FORMAT_TEXT);
+
+    EXPECT_EQ(3u, storage_count());
+    get_versioned("key1", "value1");
+    get_versioned("key2", "a=b");
+    get_versioned("key3", "");
+}
+
+/********** Unix domain socket **********/
+
+TEST(server_unix_socket, serves_requests_and_removes_socket_file)
+{
+    const std::string path = "/tmp/kvm_test_" + std::to_string(getpid()) + ".sock";
+
+    kvm_server_config_t config;
+    kvm_server_config_default(&config);
+    config.port = 0;
+    config.unix_path = path.c_str();
+    ASSERT_EQ(KVM_RESULT_OK, kvm_server_init(&config));
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+
+    const int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_NE(-1, s);
+    ASSERT_EQ(0, connect(s, (struct sockaddr *) &addr, sizeof(addr)));
+
+    const uint8_t count_frame[] = {1, 0, 0, 0, KVM_REQUST_COUNT};
+    ASSERT_EQ((ssize_t) sizeof(count_frame), write(s, count_frame, sizeof(count_frame)));
+
+    /* Returns once the accepted connection has the request */
+    ASSERT_EQ(KVM_RESULT_OK, kvm_server_wait_client_request());
+    EXPECT_EQ(KVM_RESULT_OK, kvm_server_handle_request());
+
+    const uint8_t count_frame_reply[] = {5, 0, 0, 0, KVM_REPLY_STATUS_OK, 0, 0, 0, 0};
+    uint8_t received[sizeof(count_frame_reply)];
+    ASSERT_EQ((ssize_t) sizeof(received), read(s, received, sizeof(received)));
+    EXPECT_EQ(0, memcmp(count_frame_reply, received, sizeof(received)));
+
+    close(s);
+    EXPECT_EQ(KVM_RESULT_OK, kvm_server_uninit());
+    EXPECT_NE(0, access(path.c_str(), F_OK));
+}
+
+TEST(server_unix_socket, shm_attach_serves_requests_through_rings)
+{
+    const std::string path = "/tmp/kvm_test_shm_" + std::to_string(getpid()) + ".sock";
+
+    kvm_server_config_t config;
+    kvm_server_config_default(&config);
+    config.port = 0;
+    config.unix_path = path.c_str();
+    ASSERT_EQ(KVM_RESULT_OK, kvm_server_init(&config));
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path.c_str());
+
+    const int s = socket(AF_UNIX, SOCK_STREAM, 0);
+    ASSERT_NE(-1, s);
+    ASSERT_EQ(0, connect(s, (struct sockaddr *) &addr, sizeof(addr)));
+
+    kvm_shm_t shm;
+    int fds[2];
+    ASSERT_EQ(KVM_RESULT_OK, kvm_shm_create(KVM_SHM_RING_SIZE_MIN, &shm, &fds[0]));
+    fds[1] = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    ASSERT_NE(-1, fds[1]);
+    shm.request.wake_fd = fds[1];
+
+    const uint32_t ring_size = KVM_SHM_RING_SIZE_MIN;
+    uint8_t attach_frame[] = {5, 0, 0, 0, KVM_REQUST_SHM_ATTACH, 0, 0, 0, 0};
+    memcpy(attach_frame + 5, &ring_size, sizeof(ring_size));
+
+    struct iovec iov = {attach_frame, sizeof(attach_frame)};
+    union
+    {
+        struct cmsghdr  header;
+        uint8_t         data[CMSG_SPACE(sizeof(fds))];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    ASSERT_EQ((ssize_t) sizeof(attach_frame), sendmsg(s, &msg, 0));
+
+    ASSERT_EQ(KVM_RESULT_OK, kvm_server_wait_client_request());
+    EXPECT_EQ(KVM_RESULT_OK, kvm_server_handle_request());
+
+    /* Attach is confirmed on the socket */
+    const uint8_t attach_frame_reply[] = {1, 0, 0, 0, KVM_REPLY_STATUS_OK};
+    uint8_t received[16];
+    ASSERT_EQ((ssize_t) sizeof(attach_frame_reply), read(s, received, sizeof(attach_frame_reply)));
+    EXPECT_EQ(0, memcmp(attach_frame_reply, received, sizeof(attach_frame_reply)));
+
+    /* Then requests and replies go through the rings */
+    const uint8_t count_frame[] = {1, 0, 0, 0, KVM_REQUST_COUNT};
+    uint32_t size;
+    ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_write(&shm.request, count_frame, sizeof(count_frame), &size));
+    ASSERT_EQ(sizeof(count_frame), size);
+
+    ASSERT_EQ(KVM_RESULT_OK, kvm_server_wait_client_request());
+    EXPECT_EQ(KVM_RESULT_OK, kvm_server_handle_request());
+
+    const uint8_t count_frame_reply[] = {5, 0, 0, 0, KVM_REPLY_STATUS_OK, 0, 0, 0, 0};
+    ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_wait_readable(&shm.reply, 0, 1000));
+    ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_read(&shm.reply, received, sizeof(received), &size));
+    ASSERT_EQ(sizeof(count_frame_reply), size);
+    EXPECT_EQ(0, memcmp(count_frame_reply, received, size));
+
+    close(s);
+    EXPECT_EQ(KVM_RESULT_OK, kvm_server_uninit());
+    kvm_shm_unmap(&shm);
+    close(fds[0]);
+    close(fds[1]);
+}
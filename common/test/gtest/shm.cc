@@ -0,0 +1,209 @@
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+#include "kvm_shm.h"
+
+/* Client and server views of the same region, as two processes would have */
+class shm_ring : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        ASSERT_EQ(KVM_RESULT_OK, kvm_shm_create(KVM_SHM_RING_SIZE_MIN, &client, &fd));
+        ASSERT_EQ(KVM_RESULT_OK, kvm_shm_map(fd, KVM_SHM_RING_SIZE_MIN, &server));
+    }
+
+    virtual void TearDown()
+    {
+        kvm_shm_unmap(&server);
+        kvm_shm_unmap(&client);
+        close(fd);
+    }
+
+    kvm_shm_t client;
+    kvm_shm_t server;
+    int fd;
+};
+
+TEST_F(shm_ring, write_read_return_ok)
+{
+    const uint8_t request[] = {1, 2, 3, 4, 5};
+    uint32_t size;
+
+    EXPECT_FALSE(kvm_shm_ring_readable(&server.request));
+    ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_write(&client.request, request, sizeof(request), &size));
+    EXPECT_EQ(sizeof(request), size);
+    EXPECT_TRUE(kvm_shm_ring_readable(&server.request));
+
+    uint8_t received[16];
+    ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_read(&server.request, received, sizeof(received), &size));
+    ASSERT_EQ(sizeof(request), size);
+    EXPECT_EQ(0, memcmp(request, received, size));
+    EXPECT_FALSE(kvm_shm_ring_readable(&server.request));
+
+    /* Directions are independent */
+    EXPECT_FALSE(kvm_shm_ring_readable(&client.reply));
+}
+
+TEST_F(shm_ring, write_full_ring_writes_free_space_only)
+{
+    std::vector<uint8_t> data(KVM_SHM_RING_SIZE_MIN + 100, 'x');
+    uint32_t size;
+
+    ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_write(&server.reply, data.data(), data.size(), &size));
+    EXPECT_EQ(KVM_SHM_RING_SIZE_MIN, size);
+    ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_write(&server.reply, data.data(), data.size(), &size));
+    EXPECT_EQ(0u, size);
+}
+
+TEST_F(shm_ring, read_write_wrap_around_return_ok)
+{
+    std::vector<uint8_t> data(KVM_SHM_RING_SIZE_MIN - 10);
+    std::vector<uint8_t> received(data.size());
+    uint32_t size;
+
+    /* Every round starts at a different offset and most of them wrap. */
+    for (int round = 0; round < 5; ++round)
+    {
+        for (size_t i = 0; i < data.size(); ++i)
+        {
+            data[i] = (uint8_t) (i * 7 + round);
+        }
+
+        ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_write(&server.reply, data.data(), data.size(), &size));
+        ASSERT_EQ(data.size(), size);
+        ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_read(&client.reply, received.data(), received.size(), &size));
+        ASSERT_EQ(data.size(), size);
+        EXPECT_EQ(data, received);
+    }
+}
+
+TEST_F(shm_ring, read_invalid_producer_position_return_connection_fail)
+{
+    uint8_t received[16];
+    uint32_t size;
+
+    client.request.control->head = server.request.position + KVM_SHM_RING_SIZE_MIN + 1;
+    EXPECT_EQ(KVM_RESULT_CONNECTION_FAIL, kvm_shm_ring_read(&server.request, received, sizeof(received), &size));
+}
+
+TEST_F(shm_ring, write_invalid_consumer_position_return_connection_fail)
+{
+    const uint8_t reply[] = {0};
+    uint32_t size;
+
+    server.reply.control->tail = server.reply.position + 1;
+    EXPECT_EQ(KVM_RESULT_CONNECTION_FAIL, kvm_shm_ring_write(&server.reply, reply, sizeof(reply), &size));
+}
+
+TEST_F(shm_ring, wait_readable_empty_ring_return_connection_fail)
+{
+    EXPECT_EQ(KVM_RESULT_CONNECTION_FAIL, kvm_shm_ring_wait_readable(&client.reply, 1000, 1));
+    EXPECT_EQ(0u, client.reply.control->consumer_waiting);
+}
+
+TEST_F(shm_ring, prepare_wait_signals_wake_descriptor)
+{
+    int wake[2];
+    ASSERT_EQ(0, pipe(wake));
+    client.request.wake_fd = wake[1];
+
+    const uint8_t request[] = {1};
+    uint32_t size;
+
+    /* The consumer is awake, the producer does not signal */
+    ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_write(&client.request, request, sizeof(request), &size));
+    EXPECT_NE(0, kvm_shm_ring_prepare_wait(&server.request));
+    EXPECT_EQ(0u, server.request.control->consumer_waiting);
+
+    uint8_t received[8];
+    ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_read(&server.request, received, sizeof(received), &size));
+    EXPECT_EQ(0, kvm_shm_ring_prepare_wait(&server.request));
+
+    ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_write(&client.request, request, sizeof(request), &size));
+    EXPECT_EQ(0u, server.request.control->consumer_waiting);
+
+    uint64_t wakeups = 0;
+    fcntl(wake[0], F_SETFL, O_NONBLOCK);
+    EXPECT_EQ((ssize_t) sizeof(wakeups), read(wake[0], &wakeups, sizeof(wakeups)));
+    EXPECT_EQ(1u, wakeups);
+
+    close(wake[0]);
+    close(wake[1]);
+}
+
+TEST_F(shm_ring, stream_larger_than_ring_between_threads)
+{
+    std::vector<uint8_t> data(KVM_SHM_RING_SIZE_MIN * 64 + 123);
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = (uint8_t) (i * 31 + i / 251);
+    }
+
+    std::thread producer([&]
+    {
+        size_t offset = 0;
+        while (offset < data.size())
+        {
+            uint32_t size;
+            const uint32_t chunk = (data.size() - offset < 1000) ? data.size() - offset : 1000;
+            ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_write(&server.reply, data.data() + offset, chunk, &size));
+            offset += size;
+            if (0 == size)
+            {
+                ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_wait_writable(&server.reply, 1000, 5000));
+            }
+        }
+    });
+
+    std::vector<uint8_t> received(data.size());
+    size_t offset = 0;
+    while (offset < received.size())
+    {
+        ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_wait_readable(&client.reply, 1000, 5000));
+
+        uint32_t size;
+        ASSERT_EQ(KVM_RESULT_OK, kvm_shm_ring_read(&client.reply, received.data() + offset, received.size() - offset, &size));
+        offset += size;
+    }
+
+    producer.join();
+    EXPECT_EQ(data, received);
+}
+
+TEST(shm, map_wrong_ring_size_return_invalid_param)
+{
+    kvm_shm_t client;
+    kvm_shm_t server;
+    int fd;
+
+    ASSERT_EQ(KVM_RESULT_OK, kvm_shm_create(KVM_SHM_RING_SIZE_MIN, &client, &fd));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_shm_map(fd, KVM_SHM_RING_SIZE_MIN * 2, &server));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_shm_map(fd, KVM_SHM_RING_SIZE_MIN + 1, &server));
+
+    kvm_shm_unmap(&client);
+    close(fd);
+}
+
+TEST(shm, map_unsealed_memfd_return_invalid_param)
+{
+    const int fd = memfd_create("kvm_test", MFD_CLOEXEC);
+    ASSERT_NE(-1, fd);
+    ASSERT_EQ(0, ftruncate(fd, KVM_SHM_CONTROL_SIZE + 2 * KVM_SHM_RING_SIZE_MIN));
+
+    kvm_shm_t server;
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_shm_map(fd, KVM_SHM_RING_SIZE_MIN, &server));
+    close(fd);
+}
+
+TEST(shm, create_invalid_ring_size_return_invalid_param)
+{
+    kvm_shm_t client;
+    int fd;
+
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_shm_create(KVM_SHM_RING_SIZE_MIN - 1, &client, &fd));
+    EXPECT_EQ(KVM_RESULT_INVALID_PARAM, kvm_shm_create(KVM_SHM_RING_SIZE_MAX * 2, &client, &fd));
+}
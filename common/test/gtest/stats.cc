@@ -0,0 +1,54 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "kvm_stats.h"
+
+TEST(stats, histogram_small_values_are_exact)
+{
+    for (uint64_t value = 0; value < 2 << KVM_HISTOGRAM_SUB_BITS; ++value)
+    {
+        EXPECT_EQ(value, kvm_histogram_bucket_limit(kvm_histogram_index(value)));
+    }
+}
+
+TEST(stats, histogram_relative_error_is_bounded)
+{
+    uint32_t previous = 0;
+    for (uint64_t value = 1; value < ((uint64_t) 1) << KVM_HISTOGRAM_MAX_BITS; value += value / 7 + 1)
+    {
+        const uint32_t index = kvm_histogram_index(value);
+        ASSERT_GT(KVM_HISTOGRAM_BUCKETS, index);
+        EXPECT_LE(previous, index);
+        previous = index;
+
+        const uint64_t limit = kvm_histogram_bucket_limit(index);
+        EXPECT_LE(value, limit);
+        EXPECT_GE(value + (value >> KVM_HISTOGRAM_SUB_BITS), limit) << "value " << value;
+        if (0 != index)
+        {
+            EXPECT_GT(value, kvm_histogram_bucket_limit(index - 1));
+        }
+    }
+}
+
+TEST(stats, histogram_large_values_go_to_last_bucket)
+{
+    EXPECT_EQ(KVM_HISTOGRAM_BUCKETS - 1, kvm_histogram_index(((uint64_t) 1) << KVM_HISTOGRAM_MAX_BITS));
+    EXPECT_EQ(KVM_HISTOGRAM_BUCKETS - 1, kvm_histogram_index(UINT64_MAX));
+}
+
+TEST(stats, histogram_percentile)
+{
+    std::vector<uint64_t> buckets(KVM_HISTOGRAM_BUCKETS);
+    EXPECT_EQ(0, kvm_histogram_percentile(buckets.data(), 50));
+
+    for (uint64_t value = 1; value <= 1000; ++value)
+    {
+        buckets[kvm_histogram_index(value * 1000)]++;
+    }
+
+    EXPECT_EQ(1000, kvm_histogram_count(buckets.data()));
+    EXPECT_NEAR(500000, kvm_histogram_percentile(buckets.data(), 50), 500000 / 16);
+    EXPECT_NEAR(990000, kvm_histogram_percentile(buckets.data(), 99), 990000 / 16);
+    EXPECT_EQ(kvm_histogram_bucket_limit(kvm_histogram_index(1000000)), kvm_histogram_percentile(buckets.data(), 100));
+    EXPECT_EQ(kvm_histogram_bucket_limit(kvm_histogram_index(1000)), kvm_histogram_percentile(buckets.data(), 0));
+}
@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "kvm_timer_wheel.h"
+
+static void record_callback(void * context, kvm_timer_t * timer)
+{
+    ((std::vector<kvm_timer_t *> *) context)->push_back(timer);
+}
+
+class timer_wheel : public ::testing::Test
+{
+protected:
+    virtual void SetUp()
+    {
+        kvm_timer_wheel_init(&wheel, start);
+        fired.clear();
+    }
+
+    uint32_t advance(uint64_t now, uint32_t max_count = UINT32_MAX)
+    {
+        return kvm_timer_wheel_advance(&wheel, now, max_count, record_callback, &fired);
+    }
+
+    const uint64_t start = 1000;
+    kvm_timer_wheel_t wheel;
+    std::vector<kvm_timer_t *> fired;
+};
+
+TEST_F(timer_wheel, timer_fires_at_expiration_time)
+{
+    kvm_timer_t timer;
+    kvm_timer_wheel_add(&wheel, &timer, start + 10);
+
+    EXPECT_EQ(0, advance(start + 9));
+    EXPECT_EQ(1, advance(start + 10));
+    ASSERT_EQ(1, fired.size());
+    EXPECT_EQ(&timer, fired[0]);
+    EXPECT_EQ(0, wheel.count);
+}
+
+TEST_F(timer_wheel, timers_on_all_levels_fire_in_time)
+{
+    const uint64_t delays[] = {0, 1, 63, 64, 65, 4095, 4096, 100000, 262143, 262144, 5000000, 20000000};
+    const size_t count = sizeof(delays) / sizeof(delays[0]);
+    kvm_timer_t timers[count];
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        kvm_timer_wheel_add(&wheel, &timers[i], start + delays[i]);
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (0 != delays[i])
+        {
+            EXPECT_EQ(0, advance(start + delays[i] - 1)) << "delay " << delays[i];
+        }
+        EXPECT_EQ(1, advance(start + delays[i])) << "delay " << delays[i];
+        ASSERT_EQ(i + 1, fired.size());
+        EXPECT_EQ(&timers[i], fired[i]);
+    }
+}
+
+TEST_F(timer_wheel, advance_respects_budget)
+{
+    kvm_timer_t timers[10];
+    for (int i = 0; i < 10; ++i)
+    {
+        kvm_timer_wheel_add(&wheel, &timers[i], start + 5);
+    }
+
+    EXPECT_EQ(4, advance(start + 100, 4));
+    EXPECT_EQ(4, advance(start + 100, 4));
+    EXPECT_EQ(2, advance(start + 100, 4));
+    EXPECT_EQ(10, fired.size());
+}
+
+TEST_F(timer_wheel, removed_timer_does_not_fire)
+{
+    kvm_timer_t timer1;
+    kvm_timer_t timer2;
+    kvm_timer_wheel_add(&wheel, &timer1, start + 100);
+    kvm_timer_wheel_add(&wheel, &timer2, start + 100);
+    kvm_timer_wheel_remove(&wheel, &timer1);
+
+    EXPECT_EQ(1, advance(start + 100));
+    ASSERT_EQ(1, fired.size());
+    EXPECT_EQ(&timer2, fired[0]);
+}
+
+TEST_F(timer_wheel, past_timer_fires_on_next_advance)
+{
+    advance(start + 50);
+
+    kvm_timer_t timer;
+    kvm_timer_wheel_add(&wheel, &timer, start);
+
+    EXPECT_EQ(1, advance(start + 50));
+}
+
+TEST_F(timer_wheel, due_timers_counted_on_all_levels)
+{
+    const uint64_t delays[] = {0, 1, 63, 64, 65, 4095, 4096, 100000, 262143, 262144, 5000000, 20000000};
+    const size_t count = sizeof(delays) / sizeof(delays[0]);
+    kvm_timer_t timers[count];
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        kvm_timer_wheel_add(&wheel, &timers[i], start + delays[i]);
+    }
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        if (0 != delays[i])
+        {
+            EXPECT_EQ(i, kvm_timer_wheel_count_due(&wheel, start + delays[i] - 1)) << "delay " << delays[i];
+        }
+        EXPECT_EQ(i + 1, kvm_timer_wheel_count_due(&wheel, start + delays[i])) << "delay " << delays[i];
+    }
+
+    /* Counting fires nothing. */
+    EXPECT_EQ(count, wheel.count);
+    EXPECT_EQ(0, fired.size());
+}
+
+TEST_F(timer_wheel, due_timers_counted_after_advance_and_remove)
+{
+    kvm_timer_t timers[1000];
+    for (int i = 0; i < 1000; ++i)
+    {
+        kvm_timer_wheel_add(&wheel, &timers[i], start + 100000 + i % 2);
+    }
+
+    EXPECT_EQ(0, kvm_timer_wheel_count_due(&wheel, start + 99999));
+    EXPECT_EQ(500, kvm_timer_wheel_count_due(&wheel, start + 100000));
+    EXPECT_EQ(1000, kvm_timer_wheel_count_due(&wheel, start + 200000));
+
+    for (int i = 0; i < 100; ++i)
+    {
+        kvm_timer_wheel_remove(&wheel, &timers[i]);
+    }
+    EXPECT_EQ(900, kvm_timer_wheel_count_due(&wheel, start + 200000));
+
+    /* Cascaded down to level 0, partly fired. */
+    EXPECT_EQ(300, advance(start + 100001, 300));
+    EXPECT_EQ(600, kvm_timer_wheel_count_due(&wheel, start + 100001));
+    EXPECT_EQ(600, advance(start + 100001));
+    EXPECT_EQ(0, kvm_timer_wheel_count_due(&wheel, start + 200000));
+}
+
+TEST_F(timer_wheel, overflow_timer_counted_and_fired)
+{
+    const uint64_t delay = 40ull << 24;
+    kvm_timer_t timer;
+    kvm_timer_wheel_add(&wheel, &timer, start + delay);
+
+    EXPECT_EQ(0, kvm_timer_wheel_count_due(&wheel, start + delay - 1));
+    EXPECT_EQ(1, kvm_timer_wheel_count_due(&wheel, start + delay));
+
+    kvm_timer_t near;
+    kvm_timer_wheel_add(&wheel, &near, start + 10);
+    EXPECT_EQ(1, advance(start + 10));
+    EXPECT_EQ(1, kvm_timer_wheel_count_due(&wheel, start + delay));
+}
@@ -0,0 +1,133 @@
+/**
+* @file kvm_hash.c
+*
+* @brief The module contains the hash function implementation.
+*
+*/
+
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/random.h>
+
+#include "kvm_hash.h"
+
+static const uint64_t secret[4] =
+{
+    0xA0761D6478BD642FULL,
+    0xE7037ED1A0B428DBULL,
+    0x8EBC6AF09C88C6E3ULL,
+    0x589965CC75374CC3ULL
+};
+
+static uint64_t read64(const uint8_t * p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t read32(const uint8_t * p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t read_small(const uint8_t * p, uint32_t size)
+{
+    /* 1 to 3 bytes: first, middle and last one. */
+    return (((uint64_t) p[0]) << 16) | (((uint64_t) p[size >> 1]) << 8) | p[size - 1];
+}
+
+static void multiply(uint64_t * a, uint64_t * b)
+{
+    const __uint128_t r = (__uint128_t) *a * *b;
+    *a = (uint64_t) r;
+    *b = (uint64_t) (r >> 64);
+}
+
+static uint64_t mix(uint64_t a, uint64_t b)
+{
+    multiply(&a, &b);
+    return a ^ b;
+}
+
+uint64_t kvm_hash(const uint8_t * data, uint32_t size, uint64_t seed)
+{
+    const uint8_t * p = data;
+    uint64_t a;
+    uint64_t b;
+
+    seed ^= mix(seed ^ secret[0], secret[1]);
+
+    if (size <= 16)
+    {
+        if (size >= 4)
+        {
+            /* Two overlapping 4 byte reads from each end cover 4 to 16 bytes. */
+            const uint32_t shift = (size >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + shift);
+            b = (read32(p + size - 4) << 32) | read32(p + size - 4 - shift);
+        }
+        else if (size > 0)
+        {
+            a = read_small(p, size);
+            b = 0;
+        }
+        else
+        {
+            a = 0;
+            b = 0;
+        }
+    }
+    else
+    {
+        uint32_t left = size;
+        if (left > 48)
+        {
+            /* Three independent lanes keep the multipliers busy. */
+            uint64_t seed1 = seed;
+            uint64_t seed2 = seed;
+            do
+            {
+                seed = mix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+                seed1 = mix(read64(p + 16) ^ secret[2], read64(p + 24) ^ seed1);
+                seed2 = mix(read64(p + 32) ^ secret[3], read64(p + 40) ^ seed2);
+                p += 48;
+                left -= 48;
+            } while (left > 48);
+            seed ^= seed1 ^ seed2;
+        }
+
+        while (left > 16)
+        {
+            seed = mix(read64(p) ^ secret[1], read64(p + 8) ^ seed);
+            p += 16;
+            left -= 16;
+        }
+
+        /* Last 16 bytes, possibly overlapping already hashed ones. */
+        a = read64(p + left - 16);
+        b = read64(p + left - 8);
+    }
+
+    a ^= secret[1];
+    b ^= seed;
+    multiply(&a, &b);
+
+    return mix(a ^ secret[0] ^ size, b ^ secret[1]);
+}
+
+uint64_t kvm_hash_random_seed(void)
+{
+    uint64_t seed;
+    if (sizeof(seed) == getrandom(&seed, sizeof(seed), GRND_NONBLOCK))
+    {
+        return seed;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return mix(((uint64_t) ts.tv_sec << 32) ^ ts.tv_nsec ^ secret[2], (uint64_t) getpid() ^ secret[3]);
+}
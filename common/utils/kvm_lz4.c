@@ -0,0 +1,239 @@
+/**
+* @file kvm_lz4.c
+*
+* @brief The module contains LZ4 block format compressor and decompressor.
+*
+* Greedy single-pass compressor with 4K entry hash table. The output is
+* a standard LZ4 block and can be decoded by any LZ4 implementation.
+*
+*/
+
+#include <string.h>
+
+#include "kvm_lz4.h"
+
+#define MIN_MATCH       4
+#define LAST_LITERALS   5
+#define MF_LIMIT        12
+#define HASH_BITS       12
+#define MAX_OFFSET      65535
+#define SKIP_TRIGGER    6
+
+static uint32_t read32(const uint8_t * p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t hash32(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static uint8_t * write_length(uint8_t * op, uint32_t length)
+{
+    while (length >= 255)
+    {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8_t) length;
+    return op;
+}
+
+static uint8_t * write_sequence(uint8_t * op, const uint8_t * literals, uint32_t literal_length, uint32_t offset, uint32_t match_length)
+{
+    uint8_t * token = op++;
+
+    *token = (uint8_t) (((literal_length >= 15) ? 15 : literal_length) << 4);
+    if (literal_length >= 15)
+    {
+        op = write_length(op, literal_length - 15);
+    }
+
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+
+    if (0 == offset)
+    {
+        /* Last sequence contains literals only. */
+        return op;
+    }
+
+    *op++ = (uint8_t) offset;
+    *op++ = (uint8_t) (offset >> 8);
+
+    *token |= (uint8_t) ((match_length >= 15) ? 15 : match_length);
+    if (match_length >= 15)
+    {
+        op = write_length(op, match_length - 15);
+    }
+
+    return op;
+}
+
+static uint32_t sequence_bound(uint32_t literal_length, uint32_t match_length)
+{
+    return 1 + literal_length + literal_length / 255 + 1 + 2 + match_length / 255 + 1;
+}
+
+uint32_t kvm_lz4_compress_bound(uint32_t size)
+{
+    return size + size / 255 + 16;
+}
+
+uint32_t kvm_lz4_compress(const uint8_t * src, uint32_t src_size, uint8_t * dst, uint32_t dst_capacity)
+{
+    uint32_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    const uint8_t * ip = src;
+    const uint8_t * anchor = src;
+    const uint8_t * const end = src + src_size;
+    uint8_t * op = dst;
+    uint8_t * const op_end = dst + dst_capacity;
+
+    if (src_size > MF_LIMIT)
+    {
+        const uint8_t * const match_start_limit = end - MF_LIMIT;
+        const uint8_t * const match_end_limit = end - LAST_LITERALS;
+        uint32_t misses = 0;
+
+        ip++;
+        while (ip < match_start_limit)
+        {
+            const uint32_t sequence = read32(ip);
+            const uint32_t h = hash32(sequence);
+            const uint8_t * ref = src + table[h];
+            table[h] = (uint32_t) (ip - src);
+
+            if (ref >= ip || (uint32_t) (ip - ref) > MAX_OFFSET || read32(ref) != sequence)
+            {
+                /* Move faster through incompressible data. */
+                ip += 1 + (misses++ >> SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+
+            const uint8_t * match_end = ip + MIN_MATCH;
+            const uint8_t * ref_end = ref + MIN_MATCH;
+            while (match_end < match_end_limit && *match_end == *ref_end)
+            {
+                match_end++;
+                ref_end++;
+            }
+
+            const uint32_t literal_length = (uint32_t) (ip - anchor);
+            const uint32_t match_length = (uint32_t) (match_end - ip) - MIN_MATCH;
+            if (sequence_bound(literal_length, match_length) > (uint32_t) (op_end - op))
+            {
+                return 0;
+            }
+
+            op = write_sequence(op, anchor, literal_length, (uint32_t) (ip - ref), match_length);
+
+            ip = match_end;
+            anchor = ip;
+
+            if (ip < match_start_limit)
+            {
+                table[hash32(read32(ip - 2))] = (uint32_t) (ip - 2 - src);
+            }
+        }
+    }
+
+    const uint32_t literal_length = (uint32_t) (end - anchor);
+    if (sequence_bound(literal_length, 0) > (uint32_t) (op_end - op))
+    {
+        return 0;
+    }
+
+    op = write_sequence(op, anchor, literal_length, 0, 0);
+
+    return (uint32_t) (op - dst);
+}
+
+kvm_result_t kvm_lz4_decompress(const uint8_t * src, uint32_t src_size, uint8_t * dst, uint32_t dst_size)
+{
+    const uint8_t * ip = src;
+    const uint8_t * const ip_end = src + src_size;
+    uint8_t * op = dst;
+    uint8_t * const op_end = dst + dst_size;
+
+    while (ip < ip_end)
+    {
+        const uint8_t token = *ip++;
+
+        uint32_t literal_length = token >> 4;
+        if (15 == literal_length)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip >= ip_end)
+                {
+                    return KVM_RESULT_INVALID_PARAM;
+                }
+                b = *ip++;
+                literal_length += b;
+            } while (255 == b);
+        }
+
+        if (literal_length > (uint32_t) (ip_end - ip) || literal_length > (uint32_t) (op_end - op))
+        {
+            return KVM_RESULT_INVALID_PARAM;
+        }
+
+        memcpy(op, ip, literal_length);
+        ip += literal_length;
+        op += literal_length;
+
+        if (ip == ip_end)
+        {
+            break;
+        }
+
+        if (ip_end - ip < 2)
+        {
+            return KVM_RESULT_INVALID_PARAM;
+        }
+
+        const uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (0 == offset || offset > (uint32_t) (op - dst))
+        {
+            return KVM_RESULT_INVALID_PARAM;
+        }
+
+        uint32_t match_length = token & 0x0F;
+        if (15 == match_length)
+        {
+            uint8_t b;
+            do
+            {
+                if (ip >= ip_end)
+                {
+                    return KVM_RESULT_INVALID_PARAM;
+                }
+                b = *ip++;
+                match_length += b;
+            } while (255 == b);
+        }
+        match_length += MIN_MATCH;
+
+        if (match_length > (uint32_t) (op_end - op))
+        {
+            return KVM_RESULT_INVALID_PARAM;
+        }
+
+        /* Byte by byte copy, as the match may overlap the output. */
+        const uint8_t * match = op - offset;
+        while (match_length--)
+        {
+            *op++ = *match++;
+        }
+    }
+
+    return (op == op_end) ? KVM_RESULT_OK : KVM_RESULT_INVALID_PARAM;
+}
@@ -0,0 +1,302 @@
+/**
+* @file kvm_protocol.c
+*
+* @brief The module contains conversion between v1 and v2 wire encodings.
+*
+* Both encodings have the same fields, so the conversion is driven by
+* per request layouts describing the fields after the request id or the
+* reply status:
+*      'b' - uint8_t, same in both encodings.
+*      'u' - uint32_t in v1, varint in v2.
+*      'l' - 'u' count, followed by <count> times 'u' size and <size> bytes.
+* Anything after the described fields (key and value data) is copied as is.
+*
+*/
+
+#include <string.h>
+
+#include "kvm_replies.h"
+#include "kvm_utils.h"
+#include "kvm_protocol.h"
+
+typedef struct layout_s
+{
+    const char * request;
+    const char * reply;     /* Replies with status other than OK have no fields */
+} layout_t;
+
+static const layout_t layouts[] =
+{
+    {"",    ""},    //KVM_REQUST_NOOP
+    {"uu",  ""},    //KVM_REQUST_PUT
+    {"u",   "u"},   //KVM_REQUST_GET
+    {"u",   ""},    //KVM_REQUST_DELETE
+    {"",    "l"},   //KVM_REQUST_LIST
+    {"",    "u"},   //KVM_REQUST_COUNT
+    {"uuu", ""},    //KVM_REQUST_PUT_TTL
+    {"uu",  ""},    //KVM_REQUST_EXPIRE
+    {"u",   "u"},   //KVM_REQUST_TTL
+    {"u",   "buu"}, //KVM_REQUST_GET_ENCODED
+    {"bu",  "bu"},  //KVM_REQUST_HELLO
+    {"",    ""},    //KVM_REQUST_STATS, fixed size 64-bit counters are copied as is
+    {"b",   "u"},   //KVM_REQUST_SLOWLOG, entries are copied as is
+    {"u",   ""},    //KVM_REQUST_SHM_ATTACH
+    {"u",   "u"},   //KVM_REQUST_HOTKEYS, entries are copied as is
+    {"uuu", "u"},   //KVM_REQUST_PUT_BEGIN
+    {"uu",  ""},    //KVM_REQUST_PUT_CHUNK
+    {"ub",  ""},    //KVM_REQUST_PUT_END
+    {"uuu", "uu"},  //KVM_REQUST_GET_RANGE, the version is copied as is
+    {"u",   "u"},   //KVM_REQUST_GET_VERSIONED, the version is copied as is
+    {"uuub", ""},   //KVM_REQUST_PUT_IF, versions are copied as is
+    {"ub",  ""},    //KVM_REQUST_DELETE_IF, the version is copied as is
+    {"u",   ""},    //KVM_REQUST_INCR, 64-bit delta and value are copied as is
+    {"uu",  "u"},   //KVM_REQUST_APPEND
+    {"uu",  "bu"},  //KVM_REQUST_GETSET
+    {"l",   "bl"},  //KVM_REQUST_BATCH, operations and their replies stay v1
+    {"",    ""},    //KVM_REQUST_MEMORY, fixed size 64-bit counters are copied as is
+    {"uu",  "ul"},  //KVM_REQUST_SCAN, entries are copied as is
+};
+
+typedef struct cursor_s
+{
+    const uint8_t * in;
+    uint32_t        in_size;
+    uint8_t *       out;        /* NULL when only measuring */
+    uint32_t        out_capacity;
+    uint32_t        out_size;
+    int             to_v2;
+} cursor_t;
+
+static const layout_t * find_layout(kvm_request_id_t id)
+{
+    return (id < sizeof(layouts) / sizeof(layouts[0])) ? &layouts[id] : NULL;
+}
+
+static void put_bytes(cursor_t * c, const uint8_t * data, uint32_t size)
+{
+    if (NULL != c->out && size <= c->out_capacity - c->out_size)
+    {
+        memcpy(c->out + c->out_size, data, size);
+    }
+    else
+    {
+        /* Out of room, the rest is measured only. */
+        c->out = NULL;
+    }
+    c->out_size += size;
+}
+
+static kvm_result_t copy_bytes(cursor_t * c, uint32_t size)
+{
+    if (c->in_size < size)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    put_bytes(c, c->in, size);
+    c->in += size;
+    c->in_size -= size;
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t convert_u32(cursor_t * c, uint32_t * value)
+{
+    if (c->to_v2)
+    {
+        if (c->in_size < sizeof(uint32_t))
+        {
+            return KVM_RESULT_INVALID_PARAM;
+        }
+
+        memcpy(value, c->in, sizeof(uint32_t));
+        *value = kvm_util_transport_to_host32(*value);
+        c->in += sizeof(uint32_t);
+        c->in_size -= sizeof(uint32_t);
+
+        uint8_t varint[KVM_VARINT_MAX_SIZE];
+        put_bytes(c, varint, kvm_varint_encode(*value, varint));
+        return KVM_RESULT_OK;
+    }
+
+    uint32_t used;
+    if (KVM_RESULT_OK != kvm_varint_decode(c->in, c->in_size, value, &used))
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+    c->in += used;
+    c->in_size -= used;
+
+    const uint32_t transport = kvm_util_host_to_transport32(*value);
+    put_bytes(c, (const uint8_t *) &transport, sizeof(transport));
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t convert(const char * layout, cursor_t * c)
+{
+    for (; '\0' != *layout; ++layout)
+    {
+        uint32_t value;
+        kvm_result_t result;
+
+        switch (*layout)
+        {
+            case 'b':
+            {
+                result = copy_bytes(c, 1);
+                break;
+            }
+            case 'u':
+            {
+                result = convert_u32(c, &value);
+                break;
+            }
+            case 'l':
+            {
+                uint32_t count;
+                result = convert_u32(c, &count);
+                for (uint32_t i = 0; i < count && KVM_RESULT_OK == result; ++i)
+                {
+                    result = convert_u32(c, &value);
+                    if (KVM_RESULT_OK == result)
+                    {
+                        result = copy_bytes(c, value);
+                    }
+                }
+                break;
+            }
+            default:
+            {
+                result = KVM_RESULT_INVALID_PARAM;
+                break;
+            }
+        }
+
+        if (KVM_RESULT_OK != result)
+        {
+            return result;
+        }
+    }
+
+    /* Key and value data */
+    return copy_bytes(c, c->in_size);
+}
+
+static kvm_result_t
+convert_request(
+    int             to_v2,
+    const uint8_t * request,
+    uint32_t        request_size,
+    uint8_t *       out,
+    uint32_t        out_capacity,
+    uint32_t *      out_size)
+{
+    if (NULL == request || NULL == out_size || 0 == request_size)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    cursor_t c = {request, request_size, out, out_capacity, 0, to_v2};
+
+    /* Unknown requests are passed as is, the server rejects them. */
+    const layout_t * layout = find_layout(((const kvm_request_generic_t *) request)->id);
+
+    kvm_result_t result = copy_bytes(&c, sizeof(kvm_request_generic_t));
+    if (KVM_RESULT_OK == result)
+    {
+        result = convert((NULL != layout) ? layout->request : "", &c);
+    }
+    *out_size = c.out_size;
+
+    return result;
+}
+
+static kvm_result_t
+convert_reply(
+    int                 to_v2,
+    kvm_request_id_t    id,
+    const uint8_t *     reply,
+    uint32_t            reply_size,
+    uint8_t *           out,
+    uint32_t            out_capacity,
+    uint32_t *          out_size)
+{
+    if (NULL == reply || NULL == out_size || reply_size < sizeof(kvm_reply_generic_t))
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    cursor_t c = {reply, reply_size, out, out_capacity, 0, to_v2};
+
+    const layout_t * layout = find_layout(id);
+    const int has_fields = (NULL != layout) && (KVM_REPLY_STATUS_OK == ((const kvm_reply_generic_t *) reply)->status);
+
+    kvm_result_t result = copy_bytes(&c, sizeof(kvm_reply_generic_t));
+    if (KVM_RESULT_OK == result)
+    {
+        result = convert(has_fields ? layout->reply : "", &c);
+    }
+    *out_size = c.out_size;
+
+    return result;
+}
+
+uint32_t kvm_varint_encode(uint32_t value, uint8_t * out)
+{
+    uint32_t size = 0;
+    while (value >= 0x80)
+    {
+        out[size++] = (uint8_t) (value | 0x80);
+        value >>= 7;
+    }
+    out[size++] = (uint8_t) value;
+    return size;
+}
+
+kvm_result_t kvm_varint_decode(const uint8_t * in, uint32_t size, uint32_t * value, uint32_t * used)
+{
+    uint32_t result = 0;
+    for (uint32_t i = 0; i < KVM_VARINT_MAX_SIZE; ++i)
+    {
+        if (i == size)
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+
+        const uint8_t b = in[i];
+        if (KVM_VARINT_MAX_SIZE - 1 == i && b > 0x0F)
+        {
+            /* More than 32 bits */
+            return KVM_RESULT_INVALID_PARAM;
+        }
+
+        result |= ((uint32_t) (b & 0x7F)) << (7 * i);
+        if (0 == (b & 0x80))
+        {
+            *value = result;
+            *used = i + 1;
+            return KVM_RESULT_OK;
+        }
+    }
+
+    return KVM_RESULT_INVALID_PARAM;
+}
+
+kvm_result_t kvm_protocol_request_to_v2(const uint8_t * request, uint32_t request_size, uint8_t * out, uint32_t out_capacity, uint32_t * out_size)
+{
+    return convert_request(1, request, request_size, out, out_capacity, out_size);
+}
+
+kvm_result_t kvm_protocol_request_from_v2(const uint8_t * request, uint32_t request_size, uint8_t * out, uint32_t out_capacity, uint32_t * out_size)
+{
+    return convert_request(0, request, request_size, out, out_capacity, out_size);
+}
+
+kvm_result_t kvm_protocol_reply_to_v2(kvm_request_id_t id, const uint8_t * reply, uint32_t reply_size, uint8_t * out, uint32_t out_capacity, uint32_t * out_size)
+{
+    return convert_reply(1, id, reply, reply_size, out, out_capacity, out_size);
+}
+
+kvm_result_t kvm_protocol_reply_from_v2(kvm_request_id_t id, const uint8_t * reply, uint32_t reply_size, uint8_t * out, uint32_t out_capacity, uint32_t * out_size)
+{
+    return convert_reply(0, id, reply, reply_size, out, out_capacity, out_size);
+}
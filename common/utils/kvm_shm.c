@@ -0,0 +1,355 @@
+/**
+* @file kvm_shm.c
+*
+* @brief The module contains shared memory transport rings.
+*
+*/
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "kvm_shm.h"
+
+#define SHM_MAGIC           ((uint32_t) 0x4B564D53)     /* "KVMS" */
+#define SHM_SEALS           (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL)
+
+/* Clock is checked once per this many polls while spinning */
+#define SPIN_CLOCK_PERIOD   64
+
+typedef struct shm_header_s
+{
+    uint32_t                magic;
+    uint32_t                ring_size;
+    uint8_t                 pad[KVM_SHM_CACHE_LINE - 2 * sizeof(uint32_t)];
+    kvm_shm_ring_control_t  request;
+    kvm_shm_ring_control_t  reply;
+} shm_header_t;
+
+_Static_assert(sizeof(shm_header_t) <= KVM_SHM_CONTROL_SIZE, "Control page overflow");
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static void futex_wait(uint32_t * address, uint32_t expected, uint64_t timeout_ns)
+{
+    struct timespec timeout;
+    timeout.tv_sec = timeout_ns / 1000000000ull;
+    timeout.tv_nsec = timeout_ns % 1000000000ull;
+
+    /* The region is shared between processes, so the futex is not private. */
+    syscall(SYS_futex, address, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+static void futex_wake(uint32_t * address)
+{
+    syscall(SYS_futex, address, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+static int is_valid_ring_size(uint32_t ring_size)
+{
+    return ring_size >= KVM_SHM_RING_SIZE_MIN && ring_size <= KVM_SHM_RING_SIZE_MAX &&
+        0 == (ring_size & (ring_size - 1));
+}
+
+static void init_ring(kvm_shm_ring_t * ring, kvm_shm_ring_control_t * control, uint8_t * data, uint32_t size)
+{
+    ring->control = control;
+    ring->data = data;
+    ring->size = size;
+    ring->position = 0;
+    ring->wake_fd = -1;
+}
+
+static void init_view(kvm_shm_t * shm, void * region, size_t region_size, uint32_t ring_size)
+{
+    shm_header_t * header = (shm_header_t *) region;
+    uint8_t * data = (uint8_t *) region + KVM_SHM_CONTROL_SIZE;
+
+    shm->region = region;
+    shm->region_size = region_size;
+    init_ring(&shm->request, &header->request, data, ring_size);
+    init_ring(&shm->reply, &header->reply, data + ring_size, ring_size);
+}
+
+kvm_result_t kvm_shm_create(uint32_t ring_size, kvm_shm_t * shm, int * fd)
+{
+    if (NULL == shm || NULL == fd || !is_valid_ring_size(ring_size))
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const size_t region_size = KVM_SHM_CONTROL_SIZE + 2 * (size_t) ring_size;
+
+    const int memfd = memfd_create("kvm_shm", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (-1 == memfd)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    if (-1 == ftruncate(memfd, region_size) || -1 == fcntl(memfd, F_ADD_SEALS, SHM_SEALS))
+    {
+        close(memfd);
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    void * region = mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+    if (MAP_FAILED == region)
+    {
+        close(memfd);
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    /* A new memfd is zero filled, positions and flags start at 0. */
+    shm_header_t * header = (shm_header_t *) region;
+    header->magic = SHM_MAGIC;
+    header->ring_size = ring_size;
+
+    init_view(shm, region, region_size, ring_size);
+    *fd = memfd;
+    return KVM_RESULT_OK;
+}
+
+kvm_result_t kvm_shm_map(int fd, uint32_t ring_size, kvm_shm_t * shm)
+{
+    if (NULL == shm || !is_valid_ring_size(ring_size))
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const size_t region_size = KVM_SHM_CONTROL_SIZE + 2 * (size_t) ring_size;
+
+    struct stat st;
+    const int seals = fcntl(fd, F_GET_SEALS);
+    if (-1 == fstat(fd, &st) || (size_t) st.st_size != region_size ||
+        -1 == seals || SHM_SEALS != (seals & SHM_SEALS))
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    void * region = mmap(NULL, region_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (MAP_FAILED == region)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    const shm_header_t * header = (const shm_header_t * ) region;
+    if (SHM_MAGIC != header->magic || ring_size != header->ring_size)
+    {
+        munmap(region, region_size);
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    init_view(shm, region, region_size, ring_size);
+
+    /* Attaching side takes over the positions the creator left. */
+    shm->request.position = __atomic_load_n(&shm->request.control->tail, __ATOMIC_ACQUIRE);
+    shm->reply.position = __atomic_load_n(&shm->reply.control->head, __ATOMIC_ACQUIRE);
+    return KVM_RESULT_OK;
+}
+
+void kvm_shm_unmap(kvm_shm_t * shm)
+{
+    if (NULL != shm && NULL != shm->region)
+    {
+        munmap(shm->region, shm->region_size);
+        shm->region = NULL;
+    }
+}
+
+kvm_result_t kvm_shm_ring_write(kvm_shm_ring_t * ring, const uint8_t * data, uint32_t size, uint32_t * written)
+{
+    kvm_shm_ring_control_t * control = ring->control;
+    const uint32_t used = ring->position - __atomic_load_n(&control->tail, __ATOMIC_ACQUIRE);
+    if (used > ring->size)
+    {
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    const uint32_t free_size = ring->size - used;
+    const uint32_t count = (size < free_size) ? size : free_size;
+    *written = count;
+    if (0 == count)
+    {
+        return KVM_RESULT_OK;
+    }
+
+    const uint32_t offset = ring->position & (ring->size - 1);
+    const uint32_t first = (count < ring->size - offset) ? count : ring->size - offset;
+    memcpy(ring->data + offset, data, first);
+    memcpy(ring->data, data + first, count - first);
+
+    ring->position += count;
+    __atomic_store_n(&control->head, ring->position, __ATOMIC_RELEASE);
+
+    /* Pairs with the fence of the consumer between setting the flag and
+       checking the head: either it sees the new head or we see the flag. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (0 != __atomic_load_n(&control->consumer_waiting, __ATOMIC_RELAXED) &&
+        0 != __atomic_exchange_n(&control->consumer_waiting, 0, __ATOMIC_ACQ_REL))
+    {
+        if (-1 != ring->wake_fd)
+        {
+            const uint64_t one = 1;
+            ssize_t result = write(ring->wake_fd, &one, sizeof(one));
+            (void) result;
+        }
+        else
+        {
+            futex_wake(&control->head);
+        }
+    }
+
+    return KVM_RESULT_OK;
+}
+
+kvm_result_t kvm_shm_ring_read(kvm_shm_ring_t * ring, uint8_t * data, uint32_t size, uint32_t * read)
+{
+    kvm_shm_ring_control_t * control = ring->control;
+    const uint32_t available = __atomic_load_n(&control->head, __ATOMIC_ACQUIRE) - ring->position;
+    if (available > ring->size)
+    {
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    const uint32_t count = (size < available) ? size : available;
+    *read = count;
+    if (0 == count)
+    {
+        return KVM_RESULT_OK;
+    }
+
+    const uint32_t offset = ring->position & (ring->size - 1);
+    const uint32_t first = (count < ring->size - offset) ? count : ring->size - offset;
+    memcpy(data, ring->data + offset, first);
+    memcpy(data + first, ring->data, count - first);
+
+    ring->position += count;
+    __atomic_store_n(&control->tail, ring->position, __ATOMIC_RELEASE);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (0 != __atomic_load_n(&control->producer_waiting, __ATOMIC_RELAXED) &&
+        0 != __atomic_exchange_n(&control->producer_waiting, 0, __ATOMIC_ACQ_REL))
+    {
+        futex_wake(&control->tail);
+    }
+
+    return KVM_RESULT_OK;
+}
+
+int kvm_shm_ring_readable(const kvm_shm_ring_t * ring)
+{
+    return __atomic_load_n(&ring->control->head, __ATOMIC_ACQUIRE) != ring->position;
+}
+
+static int is_writable(const kvm_shm_ring_t * ring)
+{
+    return ring->position - __atomic_load_n(&ring->control->tail, __ATOMIC_ACQUIRE) != ring->size;
+}
+
+int kvm_shm_ring_prepare_wait(kvm_shm_ring_t * ring)
+{
+    __atomic_store_n(&ring->control->consumer_waiting, 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (kvm_shm_ring_readable(ring))
+    {
+        kvm_shm_ring_cancel_wait(ring);
+        return 1;
+    }
+    return 0;
+}
+
+void kvm_shm_ring_cancel_wait(kvm_shm_ring_t * ring)
+{
+    __atomic_store_n(&ring->control->consumer_waiting, 0, __ATOMIC_RELAXED);
+}
+
+int kvm_shm_can_spin(void)
+{
+    static int can_spin = -1;
+    if (-1 == can_spin)
+    {
+        can_spin = (sysconf(_SC_NPROCESSORS_ONLN) > 1);
+    }
+    return can_spin;
+}
+
+/* Polls then sleeps on the position written by the other side until
+   ready() or the timeout. */
+static kvm_result_t wait_for(kvm_shm_ring_t * ring, int (* ready)(const kvm_shm_ring_t *), uint32_t * waiting,
+    uint32_t * position, uint64_t spin_ns, uint32_t timeout_ms)
+{
+    if (ready(ring))
+    {
+        return KVM_RESULT_OK;
+    }
+
+    const uint64_t start = now_ns();
+    for (uint32_t i = 1; kvm_shm_can_spin(); ++i)
+    {
+        if (ready(ring))
+        {
+            return KVM_RESULT_OK;
+        }
+        if (0 == i % SPIN_CLOCK_PERIOD && now_ns() - start >= spin_ns)
+        {
+            break;
+        }
+        cpu_relax();
+    }
+
+    const uint64_t deadline = now_ns() + (uint64_t) timeout_ms * 1000000;
+    while (1)
+    {
+        __atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        const uint32_t observed = __atomic_load_n(position, __ATOMIC_ACQUIRE);
+        if (ready(ring))
+        {
+            __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+            return KVM_RESULT_OK;
+        }
+
+        const uint64_t now = now_ns();
+        if (now >= deadline)
+        {
+            __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+
+        /* Returns at once if the position moved after it was observed. */
+        futex_wait(position, observed, deadline - now);
+    }
+}
+
+kvm_result_t kvm_shm_ring_wait_readable(kvm_shm_ring_t * ring, uint64_t spin_ns, uint32_t timeout_ms)
+{
+    return wait_for(ring, kvm_shm_ring_readable, &ring->control->consumer_waiting, &ring->control->head, spin_ns, timeout_ms);
+}
+
+kvm_result_t kvm_shm_ring_wait_writable(kvm_shm_ring_t * ring, uint64_t spin_ns, uint32_t timeout_ms)
+{
+    return wait_for(ring, is_writable, &ring->control->producer_waiting, &ring->control->tail, spin_ns, timeout_ms);
+}
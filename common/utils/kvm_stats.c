@@ -0,0 +1,131 @@
+/**
+* @file kvm_stats.c
+*
+* @brief The module contains latency histogram helpers.
+*
+*/
+
+#include <stddef.h>
+
+#include "kvm_stats.h"
+
+#define SUB_BUCKETS         (1u << KVM_HISTOGRAM_SUB_BITS)
+#define MAX_VALUE           ((((uint64_t) 1) << KVM_HISTOGRAM_MAX_BITS) - 1)
+
+static const char * op_names[] =
+{
+    "noop",         //KVM_REQUST_NOOP
+    "put",          //KVM_REQUST_PUT
+    "get",          //KVM_REQUST_GET
+    "delete",       //KVM_REQUST_DELETE
+    "list",         //KVM_REQUST_LIST
+    "count",        //KVM_REQUST_COUNT
+    "put_ttl",      //KVM_REQUST_PUT_TTL
+    "expire",       //KVM_REQUST_EXPIRE
+    "ttl",          //KVM_REQUST_TTL
+    "get_encoded",  //KVM_REQUST_GET_ENCODED
+    "hello",        //KVM_REQUST_HELLO
+    "stats",        //KVM_REQUST_STATS
+    "slowlog",      //KVM_REQUST_SLOWLOG
+    "shm_attach",   //KVM_REQUST_SHM_ATTACH
+    "hotkeys",      //KVM_REQUST_HOTKEYS
+    "put_begin",    //KVM_REQUST_PUT_BEGIN
+    "put_chunk",    //KVM_REQUST_PUT_CHUNK
+    "put_end",      //KVM_REQUST_PUT_END
+    "get_range",    //KVM_REQUST_GET_RANGE
+    "get_versioned", //KVM_REQUST_GET_VERSIONED
+    "put_if",       //KVM_REQUST_PUT_IF
+    "delete_if",    //KVM_REQUST_DELETE_IF
+    "incr",         //KVM_REQUST_INCR
+    "append",       //KVM_REQUST_APPEND
+    "getset",       //KVM_REQUST_GETSET
+    "batch",        //KVM_REQUST_BATCH
+    "memory",       //KVM_REQUST_MEMORY
+    "scan",         //KVM_REQUST_SCAN
+};
+
+static const char * phase_names[KVM_STATS_PHASES] =
+{
+    "queue",        //KVM_STATS_PHASE_QUEUE
+    "read",         //KVM_STATS_PHASE_READ
+    "decode",       //KVM_STATS_PHASE_DECODE
+    "execute",      //KVM_STATS_PHASE_EXECUTE
+    "reply",        //KVM_STATS_PHASE_REPLY
+    "write",        //KVM_STATS_PHASE_WRITE
+};
+
+const char * kvm_stats_op_name(uint32_t id)
+{
+    return (id < sizeof(op_names) / sizeof(op_names[0])) ? op_names[id] : NULL;
+}
+
+const char * kvm_stats_phase_name(uint32_t phase)
+{
+    return (phase < KVM_STATS_PHASES) ? phase_names[phase] : NULL;
+}
+
+uint32_t kvm_histogram_index(uint64_t value)
+{
+    if (value < SUB_BUCKETS)
+    {
+        return (uint32_t) value;
+    }
+
+    if (value > MAX_VALUE)
+    {
+        value = MAX_VALUE;
+    }
+
+    /* Keep KVM_HISTOGRAM_SUB_BITS bits below the most significant one. */
+    const uint32_t shift = 63 - __builtin_clzll(value) - KVM_HISTOGRAM_SUB_BITS;
+    return (shift + 1) * SUB_BUCKETS + (uint32_t) ((value >> shift) - SUB_BUCKETS);
+}
+
+uint64_t kvm_histogram_bucket_limit(uint32_t index)
+{
+    if (index < 2 * SUB_BUCKETS)
+    {
+        return index;
+    }
+
+    const uint32_t shift = index / SUB_BUCKETS - 1;
+    const uint64_t lowest = ((uint64_t) (SUB_BUCKETS + index % SUB_BUCKETS)) << shift;
+    return lowest + (((uint64_t) 1) << shift) - 1;
+}
+
+uint64_t kvm_histogram_percentile(const uint64_t * buckets, double percentile)
+{
+    const uint64_t count = kvm_histogram_count(buckets);
+    if (0 == count)
+    {
+        return 0;
+    }
+
+    uint64_t rank = (uint64_t) (percentile * count / 100.0 + 0.5);
+    if (0 == rank)
+    {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < KVM_HISTOGRAM_BUCKETS; ++i)
+    {
+        seen += buckets[i];
+        if (seen >= rank)
+        {
+            return kvm_histogram_bucket_limit(i);
+        }
+    }
+
+    return kvm_histogram_bucket_limit(KVM_HISTOGRAM_BUCKETS - 1);
+}
+
+uint64_t kvm_histogram_count(const uint64_t * buckets)
+{
+    uint64_t count = 0;
+    for (uint32_t i = 0; i < KVM_HISTOGRAM_BUCKETS; ++i)
+    {
+        count += buckets[i];
+    }
+    return count;
+}
@@ -7,22 +7,43 @@
 
 #include "kvm_utils.h"
 
+/* Transport byte order is little endian. */
+#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define TRANSPORT16(u16) __builtin_bswap16(u16)
+#define TRANSPORT32(u32) __builtin_bswap32(u32)
+#define TRANSPORT64(u64) __builtin_bswap64(u64)
+#else
+#define TRANSPORT16(u16) (u16)
+#define TRANSPORT32(u32) (u32)
+#define TRANSPORT64(u64) (u64)
+#endif
+
 uint16_t kvm_util_host_to_transport16(uint16_t u16)
 {
-    return u16;
+    return TRANSPORT16(u16);
 }
 
 uint32_t kvm_util_host_to_transport32(uint32_t u32)
 {
-    return u32;
+    return TRANSPORT32(u32);
+}
+
+uint64_t kvm_util_host_to_transport64(uint64_t u64)
+{
+    return TRANSPORT64(u64);
 }
 
 uint16_t kvm_util_transport_to_host16(uint16_t u16)
 {
-    return u16;
+    return TRANSPORT16(u16);
 }
 
 uint32_t kvm_util_transport_to_host32(uint32_t u32)
 {
-    return u32;
-}
\ No newline at end of file
+    return TRANSPORT32(u32);
+}
+
+uint64_t kvm_util_transport_to_host64(uint64_t u64)
+{
+    return TRANSPORT64(u64);
+}
@@ -5,12 +5,14 @@
 #include <signal.h>
 #include <syslog.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include "kvm_server.h"
 
 volatile sig_atomic_t stop_running = 0;
+volatile sig_atomic_t dump_stats = 0;
 
 static void daemonize(void)
 {
@@ -42,10 +44,17 @@ static void daemonize(void)
         exit(EXIT_FAILURE);
     }
 
-    // Close standard file descriptors
+    // Close standard file descriptors. They are pointed to /dev/null, so
+    // sockets never get descriptor 0, which marks a free client slot.
     close(STDIN_FILENO);
     close(STDOUT_FILENO);
     close(STDERR_FILENO);
+    const int null_fd = open("/dev/null", O_RDWR);
+    if (STDIN_FILENO == null_fd)
+    {
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+    }
 }
 
 static void signal_handler(int signal)
@@ -54,6 +63,7 @@ static void signal_handler(int signal)
     {
         case SIGHUP:
         {
+            dump_stats = 1;
             break;
         }
         case SIGTERM:
@@ -69,46 +79,186 @@ static void signal_handler(int signal)
     }
 }
 
-static uint16_t get_port_from_config(void)
+static uint64_t parse_size(const char * str)
+{
+    char * end = NULL;
+    uint64_t size = strtoull(str, &end, 10);
+    switch (*end)
+    {
+        case 'k': case 'K': size <<= 10; break;
+        case 'm': case 'M': size <<= 20; break;
+        case 'g': case 'G': size <<= 30; break;
+        default: break;
+    }
+    return size;
+}
+
+static kvm_eviction_policy_t parse_eviction_policy(const char * str)
+{
+    if (0 == strcmp(str, "lru"))
+    {
+        return KVM_EVICTION_LRU;
+    }
+    if (0 == strcmp(str, "lfu"))
+    {
+        return KVM_EVICTION_LFU;
+    }
+    if (0 == strcmp(str, "ttl"))
+    {
+        return KVM_EVICTION_TTL;
+    }
+    return KVM_EVICTION_NONE;
+}
+
+static kvm_phase_clock_t parse_phase_clock(const char * str)
 {
-    const uint16_t default_port = 55555;
+    if (0 == strcmp(str, "tsc"))
+    {
+        return KVM_PHASE_CLOCK_TSC;
+    }
+    if (0 == strcmp(str, "coarse"))
+    {
+        return KVM_PHASE_CLOCK_COARSE;
+    }
+    return KVM_PHASE_CLOCK_NONE;
+}
+
+/* The config consists of "<name> <value>" lines. A line with a single number
+   is treated as the port, for compatibility with the original format. */
+static void load_config(kvm_server_config_t * config)
+{
+    static char unix_path[192];
+    static char handoff_path[192];
+
+    kvm_server_config_default(config);
+
     FILE * f = fopen("server.config", "r");
     if (NULL == f)
     {
-        return default_port;
+        return;
     }
 
-    uint16_t port = 0;
-    if (1 != fscanf(f, "%u", &port))
+    char line[256];
+    while (NULL != fgets(line, sizeof(line), f))
     {
-        fclose(f);
-        return default_port;
+        char name[64];
+        char value[192];
+        unsigned int port;
+
+        if ('#' == line[0])
+        {
+            continue;
+        }
+
+        const int fields = sscanf(line, "%63s %191s", name, value);
+        if (1 == fields && 1 == sscanf(name, "%u", &port))
+        {
+            config->port = (uint16_t) port;
+        }
+        else if (2 != fields)
+        {
+            continue;
+        }
+        else if (0 == strcmp(name, "port"))
+        {
+            config->port = (uint16_t) strtoul(value, NULL, 10);
+        }
+        else if (0 == strcmp(name, "unix-socket"))
+        {
+            strcpy(unix_path, value);
+            config->unix_path = unix_path;
+        }
+        else if (0 == strcmp(name, "handoff-socket"))
+        {
+            strcpy(handoff_path, value);
+            config->handoff_path = handoff_path;
+        }
+        else if (0 == strcmp(name, "maxmemory"))
+        {
+            config->max_memory = parse_size(value);
+        }
+        else if (0 == strcmp(name, "maxmemory-policy"))
+        {
+            config->eviction_policy = parse_eviction_policy(value);
+        }
+        else if (0 == strcmp(name, "compression-threshold"))
+        {
+            config->compression_threshold = (uint32_t) parse_size(value);
+        }
+        else if (0 == strcmp(name, "slowlog-threshold"))
+        {
+            config->slowlog_threshold_us = (uint32_t) strtoul(value, NULL, 10);
+        }
+        else if (0 == strcmp(name, "hotkeys-sample"))
+        {
+            config->hotkeys_sample = (uint32_t) strtoul(value, NULL, 10);
+        }
+        else if (0 == strcmp(name, "metrics-port"))
+        {
+            config->metrics_port = (uint16_t) strtoul(value, NULL, 10);
+        }
+        else if (0 == strcmp(name, "shm-poll-us"))
+        {
+            config->shm_poll_us = (uint32_t) strtoul(value, NULL, 10);
+        }
+        else if (0 == strcmp(name, "phase-clock"))
+        {
+            config->phase_clock = parse_phase_clock(value);
+        }
     }
 
     fclose(f);
-    return port;
+}
+
+static void log_stats(void)
+{
+    kvm_server_storage_stats_t stats;
+    if (KVM_RESULT_OK == kvm_server_get_storage_stats(&stats))
+    {
+        syslog(LOG_INFO, "used_memory=%llu evicted_keys=%llu rejected_puts=%llu appended_in_place=%llu",
+            (unsigned long long) stats.used_memory,
+            (unsigned long long) stats.evicted_keys,
+            (unsigned long long) stats.rejected_puts,
+            (unsigned long long) stats.appended_in_place);
+
+        const double ratio = (0 != stats.compression_output_bytes)
+            ? (double) stats.compression_input_bytes / stats.compression_output_bytes : 1.0;
+        syslog(LOG_INFO, "compressed_values=%llu compression_ratio=%.2f compression_time_us=%llu decompression_time_us=%llu",
+            (unsigned long long) stats.compressed_values,
+            ratio,
+            (unsigned long long) (stats.compression_time_ns / 1000),
+            (unsigned long long) (stats.decompression_time_ns / 1000));
+    }
 }
 
 void main()
 {
-    uint16_t port = get_port_from_config();
+    kvm_server_config_t config;
+    load_config(&config);
 
     daemonize();
 
     openlog(NULL, LOG_PID, LOG_DAEMON);
-    syslog(LOG_INFO, "Key/Value Management System server started on %u port", port);
+    syslog(LOG_INFO, "Key/Value Management System server started on %u port", config.port);
 
     signal(SIGHUP, signal_handler);
     signal(SIGTERM, signal_handler);
 
-    kvm_result_t result = kvm_server_init(port);
+    kvm_result_t result = kvm_server_init(&config);
     if (KVM_RESULT_OK != result)
     {
         syslog(LOG_ERR, "kvm_server_init() failed: %s", strerror(errno));
+        exit(EXIT_FAILURE);
     }
 
     while (!stop_running)
     {
+        if (dump_stats)
+        {
+            dump_stats = 0;
+            log_stats();
+        }
+
         kvm_result_t result = kvm_server_wait_client_request();
         if (KVM_RESULT_OK != result)
         {
@@ -121,6 +271,13 @@ void main()
             exit(EXIT_FAILURE);
         }
 
+        if (kvm_server_handed_off())
+        {
+            /* The new process serves the connections and the data now. */
+            syslog(LOG_INFO, "Key/Value Management System server handed over to a new process");
+            break;
+        }
+
         result = kvm_server_handle_request();
         if (KVM_RESULT_OK != result)
         {
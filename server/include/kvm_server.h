@@ -9,24 +9,80 @@
 #define __kvm_server_h__
 
 #include "kvm_results.h"
+#include "kvm_stats.h"
 
 #ifdef __cplusplus
 extern "C"
 {
 #endif /* __cplusplus */
 
+typedef enum kvm_eviction_policy_e
+{
+    KVM_EVICTION_NONE = 0,  /**< Reject PUT requests when memory limit is reached */
+    KVM_EVICTION_LRU,       /**< Evict approximately least recently used keys */
+    KVM_EVICTION_LFU,       /**< Evict approximately least frequently used keys */
+    KVM_EVICTION_TTL,       /**< Evict keys closest to expiration first, then LRU */
+} kvm_eviction_policy_t;
+
+typedef enum kvm_phase_clock_e
+{
+    KVM_PHASE_CLOCK_NONE = 0,   /**< Request phases are not measured */
+    KVM_PHASE_CLOCK_TSC,        /**< CPU time stamp counter, KVM_PHASE_CLOCK_COARSE if it is not invariant */
+    KVM_PHASE_CLOCK_COARSE,     /**< CLOCK_MONOTONIC_COARSE, cheaper than CLOCK_MONOTONIC but only of scheduler tick resolution */
+} kvm_phase_clock_t;
+
+/* Server configuration */
+typedef struct kvm_server_config_s
+{
+    uint16_t                port;
+    const char *            unix_path;          /**< Path of Unix domain socket to listen on as well, NULL - disabled */
+    uint64_t                max_memory;         /**< Memory limit for stored data in bytes, 0 - unlimited */
+    kvm_eviction_policy_t   eviction_policy;
+    uint32_t                compression_threshold;  /**< Values of this size and above are compressed, 0 - disabled */
+    uint16_t                metrics_port;       /**< Loopback port of Prometheus metrics endpoint, 0 - disabled */
+    uint32_t                slowlog_threshold_us;   /**< Requests taking longer are kept in the slow log, 0 - disabled */
+    kvm_phase_clock_t       phase_clock;        /**< Clock of request phase latency statistics */
+    uint32_t                shm_poll_us;        /**< Time to poll shared memory rings before sleeping, 0 - sleep at once */
+    uint32_t                hotkeys_sample;     /**< One in N GET/PUT requests updates hot key detection, 0 - disabled */
+    const char *            handoff_path;       /**< Unix domain socket path of hot restart, NULL - disabled */
+} kvm_server_config_t;
+
+/* Storage statistics */
+typedef struct kvm_server_storage_stats_s
+{
+    uint64_t used_memory;               /**< Memory used by stored data in bytes */
+    uint64_t evicted_keys;              /**< Number of keys evicted since start */
+    uint64_t rejected_puts;             /**< Number of PUT requests rejected due to memory limit */
+    uint64_t appended_in_place;         /**< Number of APPEND requests which grew the value without a copy */
+    uint64_t compressed_values;         /**< Number of values stored compressed */
+    uint64_t compression_input_bytes;   /**< Total size of values passed to compressor */
+    uint64_t compression_output_bytes;  /**< Total size of values after compression */
+    uint64_t compression_time_ns;       /**< CPU time spent compressing */
+    uint64_t decompression_time_ns;     /**< CPU time spent decompressing */
+} kvm_server_storage_stats_t;
+
+/*!
+*******************************************************************************
+** Fills the configuration with default values.
+**
+** @param[out]  config  Configuration to fill.
+*/
+void
+kvm_server_config_default(
+    kvm_server_config_t * config);
+
 /*!
 *******************************************************************************
 ** Initializes Key/Value Management System server.
 **
-** @param[in]   port    Server port.
+** @param[in]   config  Server configuration.
 **
 ** @return
 **      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
 */
 kvm_result_t
 kvm_server_init(
-    uint16_t port);
+    const kvm_server_config_t * config);
 
 /*!
 *******************************************************************************
@@ -61,6 +117,61 @@ kvm_result_t
 kvm_server_handle_request(
     void);
 
+/*!
+*******************************************************************************
+** Tells whether the server was handed over to a new process by a hot
+** restart. Nothing is left to serve then, the event loop should end.
+**
+** @return
+**      - Non zero after a hot restart, 0 otherwise.
+*/
+int
+kvm_server_handed_off(
+    void);
+
+/*!
+*******************************************************************************
+** Gets storage statistics of the server.
+**
+** @param[out]  stats   Pointer where statistics will be stored.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_server_get_storage_stats(
+    kvm_server_storage_stats_t * stats);
+
+/*!
+*******************************************************************************
+** Gets the memory report of the server: storage and connection memory by
+** category, resident set size and allocator figures. Called by the thread
+** running the event loop.
+**
+** @param[out]  memory  Pointer where the report will be stored.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_server_get_memory(
+    kvm_memory_t * memory);
+
+/*!
+*******************************************************************************
+** Gets request, traffic and connection statistics of the server, summed
+** over all threads. May be called from any thread; storage figures are
+** as of the last event loop iteration.
+**
+** @param[out]  stats   Pointer where statistics will be stored.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t
+kvm_server_get_stats(
+    kvm_stats_t * stats);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
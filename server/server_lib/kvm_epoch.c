@@ -0,0 +1,242 @@
+/**
+* @file kvm_epoch.c
+*
+* @brief The module contains epoch based reclamation implementation.
+*
+* A pointer retired in epoch E was unlinked before the epoch advanced past
+* E. A reader which observed an epoch above E entered after that, so it
+* can not reach the pointer; the pointer is freed once no reader is in a
+* critical section entered in epoch E or before.
+*
+*/
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
+
+#include "kvm_epoch.h"
+
+typedef struct epoch_retired_s
+{
+    void *      pointer;
+    uint64_t    epoch;
+} epoch_retired_t;
+
+uint64_t epoch_global = 1;
+
+int epoch_reader_fence = 0;
+
+__thread epoch_reader_t * epoch_thread_reader = NULL;
+
+/* Records are never freed, a finished thread leaves an idle one behind. */
+static epoch_reader_t * readers = NULL;
+static uint32_t reader_count = 0;
+static pthread_mutex_t readers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Readers which failed to allocate a record. Any of them in a critical
+   section holds back all retired memory. */
+static uint32_t unregistered_readers = 0;
+
+static int membarrier_ready = 0;
+
+/* Retired pointers in the order of retirement, so epochs never decrease. */
+static epoch_retired_t *    retired = NULL;
+static uint32_t             retired_count = 0;
+static uint32_t             retired_capacity = 0;
+
+static int publish_barrier(void);
+static uint64_t oldest_reader_epoch(uint64_t epoch);
+static void synchronize(void);
+static uint32_t free_retired(uint64_t before);
+
+void epoch_init(void)
+{
+    if (membarrier_ready || epoch_reader_fence)
+    {
+        return;
+    }
+
+    const long commands = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0, 0);
+    if (-1 != commands && 0 != (commands & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+        0 == syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0, 0))
+    {
+        membarrier_ready = 1;
+    }
+    else
+    {
+        epoch_reader_fence = 1;
+    }
+}
+
+epoch_reader_t * epoch_register_thread(void)
+{
+    epoch_reader_t * reader = NULL;
+    if (0 != posix_memalign((void **) &reader, sizeof(epoch_reader_t), sizeof(epoch_reader_t)))
+    {
+        return NULL;
+    }
+    memset(reader, 0, sizeof(epoch_reader_t));
+
+    pthread_mutex_lock(&readers_lock);
+    reader->next = readers;
+    __atomic_store_n(&readers, reader, __ATOMIC_RELEASE);
+    reader_count++;
+    pthread_mutex_unlock(&readers_lock);
+
+    epoch_thread_reader = reader;
+    return reader;
+}
+
+void epoch_enter_unregistered(void)
+{
+    __atomic_add_fetch(&unregistered_readers, 1, __ATOMIC_SEQ_CST);
+}
+
+void epoch_exit_unregistered(void)
+{
+    __atomic_sub_fetch(&unregistered_readers, 1, __ATOMIC_RELEASE);
+}
+
+void epoch_retire(void * pointer)
+{
+    if (retired_count == retired_capacity)
+    {
+        const uint32_t capacity = (0 != retired_capacity) ? retired_capacity * 2 : EPOCH_RECLAIM_BATCH;
+        epoch_retired_t * grown = (epoch_retired_t *) realloc(retired, capacity * sizeof(epoch_retired_t));
+        if (NULL == grown)
+        {
+            /* No room to defer, wait for the readers instead. */
+            synchronize();
+            free(pointer);
+            return;
+        }
+
+        retired = grown;
+        retired_capacity = capacity;
+    }
+
+    retired[retired_count].pointer = pointer;
+    retired[retired_count].epoch = epoch_global;
+    retired_count++;
+
+    if (retired_count >= EPOCH_RECLAIM_BATCH)
+    {
+        epoch_reclaim();
+    }
+}
+
+uint32_t epoch_reclaim(void)
+{
+    if (0 == retired_count)
+    {
+        return 0;
+    }
+
+    const uint64_t epoch = __atomic_add_fetch(&epoch_global, 1, __ATOMIC_SEQ_CST);
+    if (!publish_barrier())
+    {
+        return 0;
+    }
+
+    return free_retired(oldest_reader_epoch(epoch));
+}
+
+void epoch_reclaim_all(void)
+{
+    free_retired(UINT64_MAX);
+    free(retired);
+    retired = NULL;
+    retired_capacity = 0;
+}
+
+uint32_t epoch_pending(void)
+{
+    return retired_count;
+}
+
+uint64_t epoch_pending_bytes(void)
+{
+    uint64_t bytes = 0;
+    for (uint32_t i = 0; i < retired_count; ++i)
+    {
+        bytes += malloc_usable_size(retired[i].pointer);
+    }
+
+    return bytes + (uint64_t) retired_capacity * sizeof(epoch_retired_t);
+}
+
+static int publish_barrier(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    if (epoch_reader_fence)
+    {
+        return 1;
+    }
+
+    /* The writer's own critical sections are ordered by program order.
+       Reading the count under the lock makes a reader registered after
+       it observe the advanced epoch. */
+    pthread_mutex_lock(&readers_lock);
+    const uint32_t others = reader_count - ((NULL != epoch_thread_reader) ? 1 : 0);
+    pthread_mutex_unlock(&readers_lock);
+    if (0 == others)
+    {
+        return 1;
+    }
+
+    /* Orders the epoch stores of running readers before the scan, as if
+       each of them had executed a full fence. */
+    return membarrier_ready && 0 == syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0, 0);
+}
+
+static uint64_t oldest_reader_epoch(uint64_t epoch)
+{
+    if (0 != __atomic_load_n(&unregistered_readers, __ATOMIC_ACQUIRE))
+    {
+        return 0;
+    }
+
+    uint64_t oldest = epoch;
+    for (const epoch_reader_t * reader = __atomic_load_n(&readers, __ATOMIC_ACQUIRE); NULL != reader; reader = reader->next)
+    {
+        const uint64_t observed = __atomic_load_n(&reader->epoch, __ATOMIC_ACQUIRE);
+        if (0 != observed && observed < oldest)
+        {
+            oldest = observed;
+        }
+    }
+
+    return oldest;
+}
+
+static void synchronize(void)
+{
+    const uint64_t epoch = __atomic_add_fetch(&epoch_global, 1, __ATOMIC_SEQ_CST);
+    while (!publish_barrier() || oldest_reader_epoch(epoch) < epoch)
+    {
+        sched_yield();
+    }
+}
+
+static uint32_t free_retired(uint64_t before)
+{
+    uint32_t count = 0;
+    while (count < retired_count && retired[count].epoch < before)
+    {
+        free(retired[count].pointer);
+        count++;
+    }
+
+    if (0 != count)
+    {
+        retired_count -= count;
+        memmove(retired, retired + count, retired_count * sizeof(epoch_retired_t));
+    }
+    return count;
+}
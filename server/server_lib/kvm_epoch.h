@@ -0,0 +1,148 @@
+/**
+ * @file kvm_epoch.h
+ *
+ * @brief Defines epoch based reclamation of storage memory.
+ *
+ * The storage has a single writer, the event loop. Readers on any thread
+ * look entries up without locks between epoch_enter() and epoch_exit(),
+ * which only store to the reader record of the calling thread. The writer
+ * unlinks entries with release stores and passes them to epoch_retire()
+ * instead of freeing them; epoch_reclaim() frees them once every reader
+ * which could have seen them has left its critical section.
+ *
+ * Readers need a full fence between publishing their epoch and loading
+ * storage pointers. The writer issues it on their behalf with
+ * membarrier(MEMBARRIER_CMD_PRIVATE_EXPEDITED), which is only needed when
+ * a reader thread other than the writer is registered. Without membarrier
+ * the readers fence themselves.
+ *
+ */
+
+#ifndef __kvm_epoch_h__
+#define __kvm_epoch_h__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* Number of retired pointers which triggers reclamation from epoch_retire() */
+#define EPOCH_RECLAIM_BATCH 1024
+
+/* Reader record, on its own cache line so readers never share one */
+typedef struct epoch_reader_s
+{
+    uint64_t                epoch;  /* Epoch observed at epoch_enter(), 0 - outside critical section */
+    struct epoch_reader_s * next;
+} __attribute__((aligned(64))) epoch_reader_t;
+
+/* Current epoch, starts at 1 and is advanced by the writer only */
+extern uint64_t epoch_global;
+
+/* Non zero if readers have to fence themselves */
+extern int epoch_reader_fence;
+
+/* Record of the current thread, NULL until the thread reads anything */
+extern __thread epoch_reader_t * epoch_thread_reader;
+
+/* Returns NULL if the record can not be allocated. */
+epoch_reader_t * epoch_register_thread(void);
+
+/* Critical sections of threads without a record, see kvm_epoch.c */
+void epoch_enter_unregistered(void);
+void epoch_exit_unregistered(void);
+
+/* Starts a read side critical section. Pointers loaded from the storage
+   stay valid until epoch_exit(). Critical sections do not nest. */
+static inline void epoch_enter(void)
+{
+    epoch_reader_t * reader = epoch_thread_reader;
+    if (NULL == reader && NULL == (reader = epoch_register_thread()))
+    {
+        epoch_enter_unregistered();
+        return;
+    }
+
+    __atomic_store_n(&reader->epoch, __atomic_load_n(&epoch_global, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    if (epoch_reader_fence)
+    {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    else
+    {
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    }
+}
+
+/* Ends a read side critical section. */
+static inline void epoch_exit(void)
+{
+    epoch_reader_t * reader = epoch_thread_reader;
+    if (NULL == reader)
+    {
+        epoch_exit_unregistered();
+        return;
+    }
+
+    __atomic_store_n(&reader->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*!
+*******************************************************************************
+** Registers the process for expedited memory barriers. Called before any
+** reader thread starts.
+*/
+void epoch_init(void);
+
+/*!
+*******************************************************************************
+** Passes memory unlinked from the storage to be freed when no reader can
+** reference it anymore. Called by the writer only.
+**
+** @param[in]   pointer     Memory allocated by malloc().
+*/
+void epoch_retire(void * pointer);
+
+/*!
+*******************************************************************************
+** Advances the epoch and frees retired memory no reader can reference.
+** Never waits for readers. Called by the writer only.
+**
+** @return
+**      - Number of pointers freed.
+*/
+uint32_t epoch_reclaim(void);
+
+/*!
+*******************************************************************************
+** Frees all retired memory. Called by the writer when no reader is in a
+** critical section, e.g. on shutdown.
+*/
+void epoch_reclaim_all(void);
+
+/*!
+*******************************************************************************
+** Gets the number of retired pointers waiting to be freed.
+**
+** @return
+**      - Number of pointers.
+*/
+uint32_t epoch_pending(void);
+
+/*!
+*******************************************************************************
+** Gets the memory held by retired pointers and their list. Called by the
+** writer only.
+**
+** @return
+**      - Size in bytes, as allocated.
+*/
+uint64_t epoch_pending_bytes(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __kvm_epoch_h__ */
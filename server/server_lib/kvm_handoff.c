@@ -0,0 +1,637 @@
+/**
+* @file kvm_handoff.c
+*
+* @brief The module contains hot restart implementation.
+*
+* The descriptors go with the header in a single message, then received
+* data of the connections and the pairs follow as a plain stream. Both
+* processes run on the same host, fields are in host byte order. Pairs are
+* sent as found by storage_scan(), uncompressed values straight from the
+* entry, and stored by storage_restore() with their remaining TTL and
+* version, so conditional requests of the clients keep working.
+*
+*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "kvm_replies.h"
+#include "kvm_protocol.h"
+#include "kvm_storage.h"
+#include "kvm_handoff.h"
+
+/* key_size of the record ending the pairs */
+#define HANDOFF_END_OF_PAIRS    0xFFFFFFFF
+
+/* Sent back by the new process once it has taken over */
+#define HANDOFF_CONFIRMED       1
+
+typedef struct handoff_header_s
+{
+    uint32_t    magic;
+    uint32_t    connection_count;
+    uint32_t    has_unix;
+    char        unix_path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+} handoff_header_t;
+
+/* Followed by size bytes of received data */
+typedef struct handoff_connection_s
+{
+    uint32_t    size;
+    uint8_t     version;
+    uint8_t     is_unix;
+    uint8_t     reserved[2];
+} handoff_connection_t;
+
+/* Followed by the key and the value */
+typedef struct handoff_record_s
+{
+    uint64_t    version;
+    uint32_t    key_size;
+    uint32_t    value_size;
+    uint32_t    ttl;
+    uint32_t    reserved;
+} handoff_record_t;
+
+typedef struct handoff_writer_s
+{
+    int         channel;
+    uint8_t *   buffer;
+    uint32_t    size;
+    uint8_t *   value;          /* Decompressed value of the pair being sent */
+    uint32_t    value_capacity;
+    int         failed;
+} handoff_writer_t;
+
+typedef struct handoff_reader_s
+{
+    int         channel;
+    uint8_t *   buffer;
+    uint32_t    offset;
+    uint32_t    size;
+} handoff_reader_t;
+
+static void set_timeout(int channel);
+static kvm_result_t send_all(int channel, const void * data, size_t size);
+static ssize_t receive_some(int channel, void * data, size_t size);
+static kvm_result_t receive_all(int channel, void * data, size_t size);
+static kvm_result_t send_sockets(int channel, const handoff_state_t * state);
+static kvm_result_t receive_sockets(int channel, handoff_state_t * state);
+static void write_data(handoff_writer_t * writer, const void * data, size_t size);
+static void flush(handoff_writer_t * writer);
+static void write_pair(void * context, const kvm_entry_t * entry, uint32_t ttl);
+static kvm_result_t read_data(handoff_reader_t * reader, void * data, size_t size);
+static kvm_result_t read_connections(handoff_reader_t * reader, handoff_state_t * state);
+static kvm_result_t read_pairs(handoff_reader_t * reader);
+
+int handoff_connect(const char * path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    const int channel = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (-1 == channel)
+    {
+        return -1;
+    }
+
+    if (-1 == connect(channel, (struct sockaddr *) &addr, sizeof(addr)))
+    {
+        const int error = errno;
+        close(channel);
+        errno = error;
+        return -1;
+    }
+
+    set_timeout(channel);
+    return channel;
+}
+
+kvm_result_t handoff_send(int channel, const handoff_state_t * state)
+{
+    set_timeout(channel);
+
+    kvm_result_t result = send_sockets(channel, state);
+    if (KVM_RESULT_OK != result)
+    {
+        return result;
+    }
+
+    handoff_writer_t writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.channel = channel;
+    writer.buffer = (uint8_t *) malloc(HANDOFF_BUFFER_SIZE);
+    if (NULL == writer.buffer)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    const uint64_t now = storage_now();
+    uint32_t cursor = 0;
+    do
+    {
+        cursor = storage_scan(cursor, now, write_pair, &writer);
+    } while (0 != cursor && !writer.failed);
+
+    handoff_record_t end;
+    memset(&end, 0, sizeof(end));
+    end.key_size = HANDOFF_END_OF_PAIRS;
+    write_data(&writer, &end, sizeof(end));
+    flush(&writer);
+
+    free(writer.buffer);
+    free(writer.value);
+    if (writer.failed)
+    {
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    /* Nothing but the confirmation hands the sockets over. */
+    uint8_t confirmation = 0;
+    if (KVM_RESULT_OK != receive_all(channel, &confirmation, sizeof(confirmation)) || HANDOFF_CONFIRMED != confirmation)
+    {
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    return KVM_RESULT_OK;
+}
+
+kvm_result_t handoff_receive(int channel, handoff_state_t * state)
+{
+    memset(state, 0, sizeof(*state));
+    state->server_socket = -1;
+    state->unix_socket = -1;
+
+    kvm_result_t result = receive_sockets(channel, state);
+    if (KVM_RESULT_OK != result)
+    {
+        return result;
+    }
+
+    handoff_reader_t reader;
+    memset(&reader, 0, sizeof(reader));
+    reader.channel = channel;
+    reader.buffer = (uint8_t *) malloc(HANDOFF_BUFFER_SIZE);
+
+    if (NULL == reader.buffer)
+    {
+        result = KVM_RESULT_SYS_CALL_FAIL;
+    }
+    else
+    {
+        result = read_connections(&reader, state);
+        if (KVM_RESULT_OK == result)
+        {
+            result = read_pairs(&reader);
+        }
+    }
+
+    free(reader.buffer);
+    if (KVM_RESULT_OK != result)
+    {
+        handoff_release(state);
+    }
+    return result;
+}
+
+kvm_result_t handoff_confirm(int channel)
+{
+    const uint8_t confirmation = HANDOFF_CONFIRMED;
+    return send_all(channel, &confirmation, sizeof(confirmation));
+}
+
+void handoff_release(handoff_state_t * state)
+{
+    if (-1 != state->server_socket)
+    {
+        close(state->server_socket);
+    }
+    if (-1 != state->unix_socket)
+    {
+        close(state->unix_socket);
+    }
+
+    for (uint32_t i = 0; i < state->connection_count; ++i)
+    {
+        close(state->sockets[i]);
+        free(state->connections[i].buffer);
+    }
+
+    memset(state, 0, sizeof(*state));
+    state->server_socket = -1;
+    state->unix_socket = -1;
+}
+
+/* A stalled peer fails the handoff instead of blocking the event loop. */
+static void set_timeout(int channel)
+{
+    struct timeval timeout;
+    timeout.tv_sec = HANDOFF_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (HANDOFF_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(channel, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(channel, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static kvm_result_t send_all(int channel, const void * data, size_t size)
+{
+    const uint8_t * p = (const uint8_t *) data;
+    while (0 != size)
+    {
+        const ssize_t sent = send(channel, p, size, MSG_NOSIGNAL);
+        if (-1 == sent && EINTR == errno)
+        {
+            continue;
+        }
+        if (sent <= 0)
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+        p += sent;
+        size -= sent;
+    }
+    return KVM_RESULT_OK;
+}
+
+static ssize_t receive_some(int channel, void * data, size_t size)
+{
+    ssize_t received;
+    do
+    {
+        received = read(channel, data, size);
+    } while (-1 == received && EINTR == errno);
+    return received;
+}
+
+static kvm_result_t receive_all(int channel, void * data, size_t size)
+{
+    uint8_t * p = (uint8_t *) data;
+    while (0 != size)
+    {
+        const ssize_t received = receive_some(channel, p, size);
+        if (received <= 0)
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+        p += received;
+        size -= received;
+    }
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t send_sockets(int channel, const handoff_state_t * state)
+{
+    handoff_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.magic = HANDOFF_MAGIC;
+    header.connection_count = state->connection_count;
+    header.has_unix = (-1 != state->unix_socket);
+    strcpy(header.unix_path, state->unix_path);
+
+    int fds[HANDOFF_MAX_FDS];
+    uint32_t fd_count = 0;
+    fds[fd_count++] = state->server_socket;
+    if (header.has_unix)
+    {
+        fds[fd_count++] = state->unix_socket;
+    }
+    memcpy(fds + fd_count, state->sockets, state->connection_count * sizeof(int));
+    fd_count += state->connection_count;
+
+    union
+    {
+        struct cmsghdr  header;
+        uint8_t         data[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    } control;
+    memset(&control, 0, sizeof(control));
+
+    struct iovec iov;
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fd_count);
+
+    struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fd_count);
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fd_count);
+
+    /* The descriptors arrive with the first byte, the rest of the header may follow. */
+    ssize_t sent;
+    do
+    {
+        sent = sendmsg(channel, &msg, MSG_NOSIGNAL);
+    } while (-1 == sent && EINTR == errno);
+
+    if (sent <= 0 || KVM_RESULT_OK != send_all(channel, (const uint8_t *) &header + sent, sizeof(header) - sent))
+    {
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    for (uint32_t i = 0; i < state->connection_count; ++i)
+    {
+        const kvm_connection_t * connection = &state->connections[i];
+
+        handoff_connection_t c;
+        memset(&c, 0, sizeof(c));
+        c.size = connection->size;
+        c.version = connection->version;
+        c.is_unix = connection->is_unix;
+
+        if (KVM_RESULT_OK != send_all(channel, &c, sizeof(c)) ||
+            KVM_RESULT_OK != send_all(channel, connection->buffer, connection->size))
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+    }
+
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t receive_sockets(int channel, handoff_state_t * state)
+{
+    handoff_header_t header;
+
+    union
+    {
+        struct cmsghdr  header;
+        uint8_t         data[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    } control;
+
+    struct iovec iov;
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+
+    ssize_t received;
+    do
+    {
+        received = recvmsg(channel, &msg, MSG_CMSG_CLOEXEC);
+    } while (-1 == received && EINTR == errno);
+
+    int fds[HANDOFF_MAX_FDS];
+    uint32_t fd_count = 0;
+    for (struct cmsghdr * cmsg = (received > 0) ? CMSG_FIRSTHDR(&msg) : NULL; NULL != cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type)
+        {
+            continue;
+        }
+
+        const uint32_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+            if (fd_count < HANDOFF_MAX_FDS)
+            {
+                fds[fd_count++] = fd;
+            }
+            else
+            {
+                close(fd);
+            }
+        }
+    }
+
+    const int valid = received > 0 &&
+        KVM_RESULT_OK == receive_all(channel, (uint8_t *) &header + received, sizeof(header) - received) &&
+        HANDOFF_MAGIC == header.magic &&
+        header.connection_count <= MAX_CLIENT_COUNT &&
+        1 + (0 != header.has_unix) + header.connection_count == fd_count;
+
+    if (!valid)
+    {
+        for (uint32_t i = 0; i < fd_count; ++i)
+        {
+            close(fds[i]);
+        }
+        return KVM_RESULT_CONNECTION_FAIL;
+    }
+
+    uint32_t next = 0;
+    state->server_socket = fds[next++];
+    if (header.has_unix)
+    {
+        header.unix_path[sizeof(header.unix_path) - 1] = '\0';
+        strcpy(state->unix_path, header.unix_path);
+        state->unix_socket = fds[next++];
+    }
+
+    state->connection_count = header.connection_count;
+    for (uint32_t i = 0; i < state->connection_count; ++i)
+    {
+        state->sockets[i] = fds[next++];
+    }
+
+    return KVM_RESULT_OK;
+}
+
+static void write_data(handoff_writer_t * writer, const void * data, size_t size)
+{
+    if (writer->size + size > HANDOFF_BUFFER_SIZE)
+    {
+        flush(writer);
+        if (size > HANDOFF_BUFFER_SIZE)
+        {
+            /* Large values are not copied through the buffer. */
+            if (!writer->failed && KVM_RESULT_OK != send_all(writer->channel, data, size))
+            {
+                writer->failed = 1;
+            }
+            return;
+        }
+    }
+
+    memcpy(writer->buffer + writer->size, data, size);
+    writer->size += size;
+}
+
+static void flush(handoff_writer_t * writer)
+{
+    if (!writer->failed && 0 != writer->size && KVM_RESULT_OK != send_all(writer->channel, writer->buffer, writer->size))
+    {
+        writer->failed = 1;
+    }
+    writer->size = 0;
+}
+
+static void write_pair(void * context, const kvm_entry_t * entry, uint32_t ttl)
+{
+    handoff_writer_t * writer = (handoff_writer_t *) context;
+    if (writer->failed)
+    {
+        return;
+    }
+
+    const uint32_t value_size = storage_value_size(entry);
+    const uint8_t * value = ENTRY_VALUE(entry);
+
+    if (KVM_CODEC_NONE != (entry->flags & ENTRY_FLAG_CODEC_MASK))
+    {
+        /* The new process compresses by its own configuration. */
+        if (value_size > writer->value_capacity)
+        {
+            uint8_t * grown = (uint8_t *) realloc(writer->value, value_size);
+            if (NULL == grown)
+            {
+                writer->failed = 1;
+                return;
+            }
+            writer->value = grown;
+            writer->value_capacity = value_size;
+        }
+
+        if (KVM_RESULT_OK != storage_read_value(entry, writer->value))
+        {
+            writer->failed = 1;
+            return;
+        }
+        value = writer->value;
+    }
+
+    handoff_record_t record;
+    memset(&record, 0, sizeof(record));
+    record.version = storage_version(entry);
+    record.key_size = entry->key_size;
+    record.value_size = value_size;
+    record.ttl = ttl;
+
+    write_data(writer, &record, sizeof(record));
+    write_data(writer, ENTRY_KEY(entry), entry->key_size);
+    write_data(writer, value, value_size);
+}
+
+static kvm_result_t read_data(handoff_reader_t * reader, void * data, size_t size)
+{
+    uint8_t * p = (uint8_t *) data;
+    while (0 != size)
+    {
+        if (reader->offset == reader->size)
+        {
+            if (size >= HANDOFF_BUFFER_SIZE)
+            {
+                /* Large values are not copied through the buffer. */
+                return receive_all(reader->channel, p, size);
+            }
+
+            const ssize_t received = receive_some(reader->channel, reader->buffer, HANDOFF_BUFFER_SIZE);
+            if (received <= 0)
+            {
+                return KVM_RESULT_CONNECTION_FAIL;
+            }
+            reader->offset = 0;
+            reader->size = received;
+        }
+
+        const uint32_t available = reader->size - reader->offset;
+        const uint32_t count = (size < available) ? (uint32_t) size : available;
+        memcpy(p, reader->buffer + reader->offset, count);
+        reader->offset += count;
+        p += count;
+        size -= count;
+    }
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t read_connections(handoff_reader_t * reader, handoff_state_t * state)
+{
+    for (uint32_t i = 0; i < state->connection_count; ++i)
+    {
+        kvm_connection_t * connection = &state->connections[i];
+
+        handoff_connection_t c;
+        if (KVM_RESULT_OK != read_data(reader, &c, sizeof(c)) ||
+            c.size > KVM_FRAME_MAX_SIZE + KVM_FRAME_V2_HEADER_MAX_SIZE)
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+
+        connection->version = c.version;
+        connection->is_unix = c.is_unix;
+        if (0 == c.size)
+        {
+            continue;
+        }
+
+        connection->buffer = (uint8_t *) malloc(c.size);
+        if (NULL == connection->buffer)
+        {
+            return KVM_RESULT_SYS_CALL_FAIL;
+        }
+        connection->capacity = c.size;
+        connection->size = c.size;
+
+        if (KVM_RESULT_OK != read_data(reader, connection->buffer, c.size))
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+    }
+
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t read_pairs(handoff_reader_t * reader)
+{
+    uint8_t * data = NULL;
+    uint64_t capacity = 0;
+    kvm_result_t result = KVM_RESULT_OK;
+
+    while (KVM_RESULT_OK == result)
+    {
+        handoff_record_t record;
+        result = read_data(reader, &record, sizeof(record));
+        if (KVM_RESULT_OK != result || HANDOFF_END_OF_PAIRS == record.key_size)
+        {
+            break;
+        }
+
+        const uint64_t size = (uint64_t) record.key_size + record.value_size;
+        if (size > capacity)
+        {
+            uint8_t * grown = (uint8_t *) realloc(data, size);
+            if (NULL == grown)
+            {
+                result = KVM_RESULT_SYS_CALL_FAIL;
+                break;
+            }
+            data = grown;
+            capacity = size;
+        }
+
+        result = read_data(reader, data, size);
+        if (KVM_RESULT_OK == result)
+        {
+            /* Pairs over a lower memory limit of the new process are dropped. */
+            const kvm_result_t restored = storage_restore(data, record.key_size, data + record.key_size, record.value_size, record.ttl, record.version);
+            result = (KVM_RESULT_NO_MEMORY == restored) ? KVM_RESULT_OK : restored;
+        }
+    }
+
+    free(data);
+    return result;
+}
@@ -0,0 +1,118 @@
+/**
+ * @file kvm_handoff.h
+ *
+ * @brief Defines hot restart: handing the running server over to a new process.
+ *
+ * The new process connects to the handoff socket of the running one. The
+ * running process passes its listening sockets and client connections as
+ * descriptors (SCM_RIGHTS), then streams every stored pair over the same
+ * channel and waits for the new process to confirm it has taken over.
+ * Requests are not served meanwhile, so the new process starts from the
+ * state the clients last saw. Until the confirmation the running process
+ * keeps everything, a failed handoff leaves it serving as before.
+ *
+ */
+
+#ifndef __kvm_handoff_h__
+#define __kvm_handoff_h__
+
+#include <stdint.h>
+
+#include "kvm_results.h"
+#include "kvm_server_internal.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* First field of the handoff header */
+#define HANDOFF_MAGIC           0x484D564B
+
+/* A channel idle for this long fails the handoff */
+#define HANDOFF_TIMEOUT_MS      10000
+
+/* Pairs are sent through a buffer of this size, larger values on their own */
+#define HANDOFF_BUFFER_SIZE     (64 * 1024)
+
+/* The TCP and Unix domain listeners, then the connections */
+#define HANDOFF_MAX_FDS         (2 + MAX_CLIENT_COUNT)
+
+/* Listening sockets and client connections handed over */
+typedef struct handoff_state_s
+{
+    int                 server_socket;
+    int                 unix_socket;        /* -1 if there is no Unix domain listener */
+    char                unix_path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    uint32_t            connection_count;
+    int                 sockets[MAX_CLIENT_COUNT];
+    kvm_connection_t    connections[MAX_CLIENT_COUNT];  /* Version, listener and received data not processed yet */
+} handoff_state_t;
+
+/*!
+*******************************************************************************
+** Connects to the handoff socket of a running server.
+**
+** @param[in]   path    Path of the handoff socket.
+**
+** @return
+**      - Channel socket, or -1 with errno set. ENOENT and ECONNREFUSED
+**        mean no server is running.
+*/
+int handoff_connect(const char * path);
+
+/*!
+*******************************************************************************
+** Passes the sockets and all stored pairs to the new process and waits for
+** its confirmation. Called by the thread running the event loop.
+**
+** @param[in]   channel Accepted connection of the new process.
+** @param[in]   state   Sockets and connections to pass. Received data of the
+**                      connections is copied, the descriptors stay open.
+**
+** @return
+**      - KVM_RESULT_OK once the new process has taken over, the caller
+**        closes its descriptors without shutting the sockets down.
+**        Any other result if the handoff failed, the caller keeps serving.
+*/
+kvm_result_t handoff_send(int channel, const handoff_state_t * state);
+
+/*!
+*******************************************************************************
+** Receives the sockets and loads all pairs into the storage, which must be
+** initialized and configured. Pairs over the memory limit are dropped.
+**
+** @param[in]   channel Channel returned by handoff_connect().
+** @param[out]  state   Received sockets and connections.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure,
+**        nothing is left to release then.
+*/
+kvm_result_t handoff_receive(int channel, handoff_state_t * state);
+
+/*!
+*******************************************************************************
+** Tells the running process the new one has taken over.
+**
+** @param[in]   channel Channel returned by handoff_connect().
+**
+** @return
+**      - KVM_RESULT_OK or KVM_RESULT_CONNECTION_FAIL.
+*/
+kvm_result_t handoff_confirm(int channel);
+
+/*!
+*******************************************************************************
+** Closes the sockets and frees the connection data of a received state
+** which is not taken over.
+**
+** @param[in]   state   State filled by handoff_receive().
+*/
+void handoff_release(handoff_state_t * state);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __kvm_handoff_h__ */
@@ -0,0 +1,397 @@
+/**
+* @file kvm_hotkeys.c
+*
+* @brief The module contains hot key detection implementation.
+*
+* The sketch uses conservative update: only the counters equal to the
+* minimum are incremented, which keeps the overestimate of cold keys
+* sharing counters with hot ones low. Rows are indexed by double hashing
+* of a single 64-bit key hash.
+*
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "kvm_hash.h"
+#include "kvm_hotkeys.h"
+
+typedef struct hotkey_slot_s
+{
+    uint64_t hash;
+    uint32_t count;
+    uint32_t key_size;
+    uint32_t prefix_size;
+    uint8_t  key_prefix[KVM_HOTKEYS_KEY_PREFIX];
+} hotkey_slot_t;
+
+/* Samples of a thread other than the owner. Only that thread writes head,
+   only the owner tail. */
+typedef struct hotkeys_ring_s
+{
+    hotkey_slot_t           slots[HOTKEYS_RING_SIZE];
+    uint32_t                head;
+    uint32_t                tail;
+    struct hotkeys_ring_s * next;
+} hotkeys_ring_t;
+
+uint32_t hotkeys_period = 0;
+
+__thread uint32_t hotkeys_countdown = 0;
+
+static uint32_t sketch[HOTKEYS_SKETCH_DEPTH][HOTKEYS_SKETCH_WIDTH];
+
+/* Min-heap on count, the coldest tracked key at the root */
+static hotkey_slot_t heap[KVM_HOTKEYS_MAX];
+static uint32_t heap_size = 0;
+
+static uint64_t hash_seed = 0;
+
+/* Per thread, seeded on first use */
+static __thread uint64_t random_state = 0;
+
+/* Set on the thread which configured detection */
+static __thread int owner = 0;
+
+/* Rings are never freed, a finished thread leaves an empty one behind. */
+static __thread hotkeys_ring_t * thread_ring = NULL;
+static hotkeys_ring_t * rings = NULL;
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Counts cover the time since decayed_at, plus a halved period before it
+   once the first decay happened. */
+static uint64_t decayed_at = 0;
+static int      decayed = 0;
+
+static uint64_t now_ms(void);
+static void count_sample(const hotkey_slot_t * sample);
+static void hand_over(const hotkey_slot_t * sample);
+static void drain(void);
+static void decay(uint64_t now);
+static void swap_slots(uint32_t a, uint32_t b);
+static void sift_down(uint32_t index);
+static void sift_up(uint32_t index);
+static void heapify(void);
+static uint32_t next_countdown(uint32_t period);
+
+void hotkeys_configure(uint32_t period)
+{
+    memset(sketch, 0, sizeof(sketch));
+    heap_size = 0;
+
+    hash_seed = kvm_hash_random_seed();
+    decayed_at = now_ms();
+    decayed = 0;
+    owner = 1;
+
+    /* Samples taken before are dropped. */
+    pthread_mutex_lock(&rings_lock);
+    for (hotkeys_ring_t * ring = rings; NULL != ring; ring = ring->next)
+    {
+        __atomic_store_n(&ring->tail, __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    hotkeys_countdown = next_countdown(period) - 1;
+    __atomic_store_n(&hotkeys_period, period, __ATOMIC_RELAXED);
+}
+
+void hotkeys_record(const uint8_t * key, uint32_t key_size)
+{
+    hotkeys_countdown = next_countdown(hotkeys_period) - 1;
+
+    hotkey_slot_t sample;
+    sample.hash = kvm_hash(key, key_size, hash_seed);
+    sample.count = 0;
+    sample.key_size = key_size;
+    sample.prefix_size = (key_size < KVM_HOTKEYS_KEY_PREFIX) ? key_size : KVM_HOTKEYS_KEY_PREFIX;
+    memcpy(sample.key_prefix, key, sample.prefix_size);
+
+    if (!owner)
+    {
+        hand_over(&sample);
+        return;
+    }
+
+    decay(now_ms());
+    drain();
+    count_sample(&sample);
+}
+
+uint32_t hotkeys_get(kvm_hotkey_t * keys, uint32_t max)
+{
+    const uint64_t now = now_ms();
+    decay(now);
+    drain();
+
+    /* In steady state a key seen r times per ms has r * (window) counts:
+       the time since the last decay plus the halved periods before it. */
+    const uint64_t elapsed = now - decayed_at;
+    const uint64_t window = decayed ? HOTKEYS_DECAY_MS + elapsed : elapsed;
+
+    hotkey_slot_t sorted[KVM_HOTKEYS_MAX];
+    memcpy(sorted, heap, heap_size * sizeof(hotkey_slot_t));
+
+    /* Insertion sort, hottest first */
+    for (uint32_t i = 1; i < heap_size; ++i)
+    {
+        const hotkey_slot_t slot = sorted[i];
+        uint32_t j = i;
+        for (; 0 != j && sorted[j - 1].count < slot.count; --j)
+        {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = slot;
+    }
+
+    const uint32_t count = (heap_size < max) ? heap_size : max;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const uint64_t hits = (uint64_t) sorted[i].count * hotkeys_period;
+        const uint64_t rate = hits * 1000 / ((0 != window) ? window : 1);
+
+        keys[i].hits = hits;
+        keys[i].rate = (rate < UINT32_MAX) ? (uint32_t) rate : UINT32_MAX;
+        keys[i].key_size = sorted[i].key_size;
+        keys[i].prefix_size = sorted[i].prefix_size;
+        memcpy(keys[i].key_prefix, sorted[i].key_prefix, sorted[i].prefix_size);
+    }
+
+    return count;
+}
+
+static uint64_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void count_sample(const hotkey_slot_t * sample)
+{
+    const uint64_t hash = sample->hash;
+    const uint32_t h1 = (uint32_t) hash;
+    const uint32_t h2 = (uint32_t) (hash >> 32) | 1;
+
+    uint32_t index[HOTKEYS_SKETCH_DEPTH];
+    uint32_t count = UINT32_MAX;
+    for (uint32_t d = 0; d < HOTKEYS_SKETCH_DEPTH; ++d)
+    {
+        index[d] = (h1 + d * h2) & (HOTKEYS_SKETCH_WIDTH - 1);
+        if (sketch[d][index[d]] < count)
+        {
+            count = sketch[d][index[d]];
+        }
+    }
+
+    if (UINT32_MAX != count)
+    {
+        count++;
+    }
+
+    for (uint32_t d = 0; d < HOTKEYS_SKETCH_DEPTH; ++d)
+    {
+        if (sketch[d][index[d]] < count)
+        {
+            sketch[d][index[d]] = count;
+        }
+    }
+
+    for (uint32_t i = 0; i < heap_size; ++i)
+    {
+        if (heap[i].hash == hash)
+        {
+            heap[i].count = count;
+            sift_down(i);
+            return;
+        }
+    }
+
+    uint32_t i;
+    if (heap_size < KVM_HOTKEYS_MAX)
+    {
+        i = heap_size++;
+    }
+    else if (count > heap[0].count)
+    {
+        i = 0;
+    }
+    else
+    {
+        return;
+    }
+
+    heap[i] = *sample;
+    heap[i].count = count;
+
+    if (0 == i)
+    {
+        sift_down(0);
+    }
+    else
+    {
+        sift_up(i);
+    }
+}
+
+static void hand_over(const hotkey_slot_t * sample)
+{
+    hotkeys_ring_t * ring = thread_ring;
+    if (NULL == ring)
+    {
+        ring = (hotkeys_ring_t *) calloc(1, sizeof(hotkeys_ring_t));
+        if (NULL == ring)
+        {
+            return;
+        }
+
+        pthread_mutex_lock(&rings_lock);
+        ring->next = rings;
+        __atomic_store_n(&rings, ring, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&rings_lock);
+        thread_ring = ring;
+    }
+
+    /* A full ring drops the sample, the owner is not counting. */
+    const uint32_t head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) < HOTKEYS_RING_SIZE)
+    {
+        ring->slots[head & (HOTKEYS_RING_SIZE - 1)] = *sample;
+        __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void drain(void)
+{
+    if (NULL == __atomic_load_n(&rings, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&rings_lock);
+    for (hotkeys_ring_t * ring = rings; NULL != ring; ring = ring->next)
+    {
+        const uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint32_t tail = ring->tail;
+        for (; tail != head; ++tail)
+        {
+            count_sample(&ring->slots[tail & (HOTKEYS_RING_SIZE - 1)]);
+        }
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&rings_lock);
+}
+
+static void decay(uint64_t now)
+{
+    const uint64_t periods = (now - decayed_at) / HOTKEYS_DECAY_MS;
+    if (0 == periods)
+    {
+        return;
+    }
+
+    decayed_at += periods * HOTKEYS_DECAY_MS;
+    decayed = 1;
+
+    const uint32_t shift = (periods < 32) ? (uint32_t) periods : 32;
+    for (uint32_t d = 0; d < HOTKEYS_SKETCH_DEPTH; ++d)
+    {
+        for (uint32_t i = 0; i < HOTKEYS_SKETCH_WIDTH; ++i)
+        {
+            sketch[d][i] = (shift < 32) ? sketch[d][i] >> shift : 0;
+        }
+    }
+
+    /* Keys which decayed to nothing leave room for new ones. */
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < heap_size; ++i)
+    {
+        heap[i].count = (shift < 32) ? heap[i].count >> shift : 0;
+        if (0 != heap[i].count)
+        {
+            heap[kept++] = heap[i];
+        }
+    }
+    heap_size = kept;
+    heapify();
+}
+
+static void swap_slots(uint32_t a, uint32_t b)
+{
+    const hotkey_slot_t slot = heap[a];
+    heap[a] = heap[b];
+    heap[b] = slot;
+}
+
+static void sift_down(uint32_t index)
+{
+    for (;;)
+    {
+        const uint32_t left = 2 * index + 1;
+        const uint32_t right = left + 1;
+        uint32_t smallest = index;
+
+        if (left < heap_size && heap[left].count < heap[smallest].count)
+        {
+            smallest = left;
+        }
+        if (right < heap_size && heap[right].count < heap[smallest].count)
+        {
+            smallest = right;
+        }
+        if (smallest == index)
+        {
+            return;
+        }
+
+        swap_slots(index, smallest);
+        index = smallest;
+    }
+}
+
+static void sift_up(uint32_t index)
+{
+    while (0 != index)
+    {
+        const uint32_t parent = (index - 1) / 2;
+        if (heap[parent].count <= heap[index].count)
+        {
+            return;
+        }
+
+        swap_slots(index, parent);
+        index = parent;
+    }
+}
+
+static void heapify(void)
+{
+    for (uint32_t i = heap_size / 2; 0 != i--; )
+    {
+        sift_down(i);
+    }
+}
+
+static uint32_t next_countdown(uint32_t period)
+{
+    if (period <= 1)
+    {
+        return 1;
+    }
+
+    if (0 == random_state)
+    {
+        random_state = (hash_seed ^ (uint64_t) (uintptr_t) &random_state) | 1;
+    }
+
+    /* Uniform in [1, 2 * period - 1], so requests in a fixed rhythm can not
+       hide from the sample. xorshift64* */
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    const uint64_t random = random_state * 0x2545F4914F6CDD1DULL;
+
+    return 1 + (uint32_t) ((random >> 32) % (2 * (uint64_t) period - 1));
+}
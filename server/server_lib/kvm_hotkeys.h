@@ -0,0 +1,93 @@
+/**
+ * @file kvm_hotkeys.h
+ *
+ * @brief Defines hot key detection.
+ *
+ * A sample of GET and PUT keys updates a count-min sketch, which estimates
+ * the count of any key in fixed memory. Keys whose estimate beats the
+ * coldest tracked one enter a min-heap of KVM_HOTKEYS_MAX heavy hitters.
+ * All counts are halved every HOTKEYS_DECAY_MS, so the report follows
+ * shifts in traffic. The sketch and the heap belong to the thread which
+ * configured detection, the request loop. Other threads sample on their
+ * own and hand sampled keys over through a ring per thread, which the
+ * owner drains on its next sample and on hotkeys_get(); a sample finding
+ * the ring full is dropped.
+ *
+ */
+
+#ifndef __kvm_hotkeys_h__
+#define __kvm_hotkeys_h__
+
+#include <stdint.h>
+
+#include "kvm_stats.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* Count-min sketch dimensions, width must be a power of two */
+#define HOTKEYS_SKETCH_DEPTH    4
+#define HOTKEYS_SKETCH_WIDTH    4096
+
+/* Period of halving all counts */
+#define HOTKEYS_DECAY_MS        10000
+
+/* Samples of a thread not yet counted by the owner, a power of two */
+#define HOTKEYS_RING_SIZE       256
+
+/* Sampling period, 0 - detection disabled. Written by hotkeys_configure() only. */
+extern uint32_t hotkeys_period;
+
+/* Requests of the calling thread skipped before its next sampled one */
+extern __thread uint32_t hotkeys_countdown;
+
+/*!
+*******************************************************************************
+** Records a sampled key. Called by hotkeys_sample() only.
+**
+** @param[in]   key         Key data.
+** @param[in]   key_size    Size of the key.
+*/
+void hotkeys_record(const uint8_t * key, uint32_t key_size);
+
+/* Counts the key of a GET or PUT request, one in the sampling period on
+   average. Any thread may call it, only its own state is written unless
+   the request is sampled. */
+static inline void hotkeys_sample(const uint8_t * key, uint32_t key_size)
+{
+    if (0 != __atomic_load_n(&hotkeys_period, __ATOMIC_RELAXED) && 0 == hotkeys_countdown--)
+    {
+        hotkeys_record(key, key_size);
+    }
+}
+
+/*!
+*******************************************************************************
+** Sets the sampling period and clears all counts. The calling thread
+** becomes the owner of the counts.
+**
+** @param[in]   sample_period   One in sample_period requests is counted on
+**                              average, 0 disables detection.
+*/
+void hotkeys_configure(uint32_t sample_period);
+
+/*!
+*******************************************************************************
+** Gets the hottest keys with counts scaled by the sampling period. Called
+** by the owner of the counts.
+**
+** @param[out]  keys    Array for the keys, hottest first.
+** @param[in]   max     Size of the array.
+**
+** @return
+**      - Number of keys stored, at most KVM_HOTKEYS_MAX.
+*/
+uint32_t hotkeys_get(kvm_hotkey_t * keys, uint32_t max);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __kvm_hotkeys_h__ */
@@ -0,0 +1,361 @@
+/**
+* @file kvm_metrics.c
+*
+* @brief The module contains Prometheus metrics endpoint implementation.
+*
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "kvm_metrics.h"
+#include "kvm_server_stats.h"
+
+/* Exported latency buckets are powers of two nanoseconds, which are
+   exact bucket boundaries of the histogram: 128 ns to 68.7 s. */
+#define LATENCY_MIN_BITS 7
+#define LATENCY_MAX_BITS 36
+
+typedef struct text_s
+{
+    char *      data;
+    uint32_t    size;
+    uint32_t    capacity;
+    int         failed;
+} text_t;
+
+static int metrics_socket = -1;
+static pthread_t metrics_thread;
+
+static void append(text_t * t, const char * format, ...)
+{
+    while (!t->failed)
+    {
+        va_list args;
+        va_start(args, format);
+        const int written = vsnprintf(t->data + t->size, t->capacity - t->size, format, args);
+        va_end(args);
+
+        if (written < 0)
+        {
+            t->failed = 1;
+            break;
+        }
+
+        if ((uint32_t) written < t->capacity - t->size)
+        {
+            t->size += written;
+            break;
+        }
+
+        const uint32_t capacity = t->capacity * 2 + written;
+        char * data = (char *) realloc(t->data, capacity);
+        if (NULL == data)
+        {
+            t->failed = 1;
+            break;
+        }
+        t->data = data;
+        t->capacity = capacity;
+    }
+}
+
+static void append_counter(text_t * t, const char * name, const char * type, const char * help, uint64_t value)
+{
+    append(t, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name, (unsigned long long) value);
+}
+
+static void append_op_label(text_t * t, uint32_t id)
+{
+    const char * name = kvm_stats_op_name(id);
+    if (NULL != name)
+    {
+        append(t, "op=\"%s\"", name);
+    }
+    else
+    {
+        append(t, "op=\"%u\"", id);
+    }
+}
+
+static void append_phase_label(text_t * t, uint32_t phase)
+{
+    append(t, "phase=\"%s\"", kvm_stats_phase_name(phase));
+}
+
+static void append_histogram(text_t * t, const char * name, void (* append_label)(text_t *, uint32_t), uint32_t id,
+    const uint64_t * latency, uint64_t latency_sum)
+{
+    uint64_t count = 0;
+    uint32_t index = 0;
+    for (uint32_t bits = LATENCY_MIN_BITS; bits <= LATENCY_MAX_BITS; ++bits)
+    {
+        const uint32_t last = kvm_histogram_index((((uint64_t) 1) << bits) - 1);
+        for (; index <= last; ++index)
+        {
+            count += latency[index];
+        }
+
+        append(t, "%s_bucket{", name);
+        append_label(t, id);
+        append(t, ",le=\"%.12g\"} %llu\n", (double) (((uint64_t) 1) << bits) / 1e9, (unsigned long long) count);
+    }
+
+    append(t, "%s_bucket{", name);
+    append_label(t, id);
+    append(t, ",le=\"+Inf\"} %llu\n", (unsigned long long) kvm_histogram_count(latency));
+
+    append(t, "%s_sum{", name);
+    append_label(t, id);
+    append(t, "} %.9g\n", (double) latency_sum / 1e9);
+
+    append(t, "%s_count{", name);
+    append_label(t, id);
+    append(t, "} %llu\n", (unsigned long long) kvm_histogram_count(latency));
+}
+
+kvm_result_t metrics_render(const kvm_stats_t * stats, char ** text, uint32_t * size)
+{
+    if (NULL == stats || NULL == text || NULL == size)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    text_t t = {(char *) malloc(4096), 0, 4096, 0};
+    if (NULL == t.data)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    append(&t, "# HELP kvm_requests_total Requests handled.\n# TYPE kvm_requests_total counter\n");
+    for (uint32_t id = 0; id < KVM_STATS_MAX_OPS; ++id)
+    {
+        if (0 != stats->requests[id])
+        {
+            append(&t, "kvm_requests_total{");
+            append_op_label(&t, id);
+            append(&t, "} %llu\n", (unsigned long long) stats->requests[id]);
+        }
+    }
+
+    append_counter(&t, "kvm_keyspace_hits_total", "counter", "GET requests which found the key.", stats->hits);
+    append_counter(&t, "kvm_keyspace_misses_total", "counter", "GET requests which did not find the key.", stats->misses);
+    append_counter(&t, "kvm_received_bytes_total", "counter", "Bytes received from clients.", stats->bytes_in);
+    append_counter(&t, "kvm_sent_bytes_total", "counter", "Bytes sent to clients.", stats->bytes_out);
+    append_counter(&t, "kvm_connections_accepted_total", "counter", "Accepted client connections.", stats->connections_accepted);
+    append_counter(&t, "kvm_connections", "gauge", "Open client connections.", stats->connections_accepted - stats->connections_closed);
+    append_counter(&t, "kvm_keys", "gauge", "Stored keys.", stats->keys);
+    append_counter(&t, "kvm_used_memory_bytes", "gauge", "Memory used by stored keys and values.", stats->used_memory);
+    append_counter(&t, "kvm_evicted_keys_total", "counter", "Keys evicted due to memory limit.", stats->evicted_keys);
+
+    append(&t, "# HELP kvm_request_duration_seconds Time spent in request handler.\n# TYPE kvm_request_duration_seconds histogram\n");
+    for (uint32_t id = 0; id < KVM_STATS_MAX_OPS; ++id)
+    {
+        if (0 != stats->requests[id])
+        {
+            append_histogram(&t, "kvm_request_duration_seconds", append_op_label, id, stats->latency[id], stats->latency_sum[id]);
+        }
+    }
+
+    append(&t, "# HELP kvm_request_phase_seconds Time spent in request processing phases.\n# TYPE kvm_request_phase_seconds histogram\n");
+    for (uint32_t phase = 0; phase < KVM_STATS_PHASES; ++phase)
+    {
+        if (0 != kvm_histogram_count(stats->phase[phase]))
+        {
+            append_histogram(&t, "kvm_request_phase_seconds", append_phase_label, phase, stats->phase[phase], stats->phase_sum[phase]);
+        }
+    }
+
+    if (t.failed)
+    {
+        free(t.data);
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    *text = t.data;
+    *size = t.size;
+    return KVM_RESULT_OK;
+}
+
+static int send_all(int client_socket, const char * data, uint32_t size)
+{
+    while (0 != size)
+    {
+        const ssize_t written = send(client_socket, data, size, MSG_NOSIGNAL);
+        if (written <= 0)
+        {
+            return 0;
+        }
+        data += written;
+        size -= written;
+    }
+    return 1;
+}
+
+static void send_response(int client_socket, const char * status, const char * body, uint32_t body_size)
+{
+    char head[256];
+    const int head_size = snprintf(head, sizeof(head),
+        "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %u\r\nConnection: close\r\n\r\n",
+        status, body_size);
+
+    if (send_all(client_socket, head, head_size))
+    {
+        send_all(client_socket, body, body_size);
+    }
+}
+
+static void serve_scrape(int client_socket)
+{
+    struct timeval timeout;
+    timeout.tv_sec = METRICS_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (METRICS_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(client_socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(client_socket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+    /* Only the request line matters, the rest of the head is read to
+       keep scrapers from seeing a reset before the response. */
+    char request[METRICS_REQUEST_SIZE + 1];
+    uint32_t size = 0;
+    while (size < METRICS_REQUEST_SIZE)
+    {
+        const ssize_t read_len = recv(client_socket, request + size, METRICS_REQUEST_SIZE - size, 0);
+        if (read_len <= 0)
+        {
+            return;
+        }
+        size += read_len;
+        request[size] = '\0';
+
+        if (NULL != strstr(request, "\r\n\r\n") || NULL != strstr(request, "\n\n"))
+        {
+            break;
+        }
+    }
+
+    if (0 != strncmp(request, "GET /metrics ", strlen("GET /metrics ")) &&
+        0 != strncmp(request, "GET / ", strlen("GET / ")))
+    {
+        static const char not_found[] = "Not found, use /metrics\n";
+        send_response(client_socket, "404 Not Found", not_found, sizeof(not_found) - 1);
+        return;
+    }
+
+    kvm_stats_t * stats = (kvm_stats_t *) malloc(sizeof(kvm_stats_t));
+    char * text = NULL;
+    uint32_t text_size = 0;
+    if (NULL != stats)
+    {
+        stats_aggregate(stats);
+        metrics_render(stats, &text, &text_size);
+        free(stats);
+    }
+
+    if (NULL == text)
+    {
+        static const char failed[] = "Out of memory\n";
+        send_response(client_socket, "500 Internal Server Error", failed, sizeof(failed) - 1);
+        return;
+    }
+
+    send_response(client_socket, "200 OK", text, text_size);
+    free(text);
+}
+
+static void * serve(void * arg)
+{
+    (void) arg;
+
+    while (1)
+    {
+        const int client_socket = accept(metrics_socket, NULL, NULL);
+        if (-1 == client_socket)
+        {
+            if (EINTR == errno || ECONNABORTED == errno)
+            {
+                continue;
+            }
+
+            /* The listener was shut down. */
+            break;
+        }
+
+        serve_scrape(client_socket);
+        close(client_socket);
+    }
+
+    return NULL;
+}
+
+kvm_result_t metrics_start(uint16_t port)
+{
+    if (-1 != metrics_socket)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const int s = socket(AF_INET, SOCK_STREAM, 0);
+    if (-1 == s)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    const int reuse = 1;
+    setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (-1 == bind(s, (struct sockaddr *) &addr, sizeof(addr)) || -1 == listen(s, 5))
+    {
+        close(s);
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+    metrics_socket = s;
+
+    /* Signals stay with the request loop, which relies on them interrupting select(). */
+    sigset_t all;
+    sigset_t previous;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &previous);
+    const int created = pthread_create(&metrics_thread, NULL, serve, NULL);
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    if (0 != created)
+    {
+        close(metrics_socket);
+        metrics_socket = -1;
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    return KVM_RESULT_OK;
+}
+
+void metrics_stop(void)
+{
+    if (-1 == metrics_socket)
+    {
+        return;
+    }
+
+    /* Wakes up accept() in the listener thread. */
+    shutdown(metrics_socket, SHUT_RDWR);
+    pthread_join(metrics_thread, NULL);
+
+    close(metrics_socket);
+    metrics_socket = -1;
+}
@@ -0,0 +1,65 @@
+/**
+ * @file kvm_metrics.h
+ *
+ * @brief Defines Prometheus metrics endpoint of the server.
+ *
+ * The endpoint runs in its own thread and serves every scrape from
+ * stats_aggregate(), so the request loop is never blocked by it.
+ *
+ */
+
+#ifndef __kvm_metrics_h__
+#define __kvm_metrics_h__
+
+#include <stdint.h>
+
+#include "kvm_results.h"
+#include "kvm_stats.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* Maximum size of HTTP request head read from a scraper */
+#define METRICS_REQUEST_SIZE 1024
+
+/* Scrapers not sending the request in time are disconnected */
+#define METRICS_TIMEOUT_MS 1000
+
+/*!
+*******************************************************************************
+** Starts the metrics HTTP listener on the loopback interface.
+**
+** @param[in]   port    Port to listen on.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t metrics_start(uint16_t port);
+
+/*!
+*******************************************************************************
+** Stops the metrics HTTP listener if it is running.
+*/
+void metrics_stop(void);
+
+/*!
+*******************************************************************************
+** Formats statistics in Prometheus text exposition format.
+**
+** @param[in]   stats   Statistics to format.
+** @param[out]  text    Pointer where allocated text will be stored.
+**                      Should be freed by the caller.
+** @param[out]  size    Pointer where text size will be stored.
+**
+** @return
+**      - KVM_RESULT_OK or corresponding KVM_RESULT_XXX in case of failure.
+*/
+kvm_result_t metrics_render(const kvm_stats_t * stats, char ** text, uint32_t * size);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __kvm_metrics_h__ */
@@ -6,20 +6,23 @@
 */
 
 #include<stdlib.h>
+#include<string.h>
 
 #include <sys/socket.h>
 
 #include "kvm_requests.h"
 #include "kvm_replies.h"
 #include "kvm_utils.h"
+#include "kvm_protocol.h"
 
 #include "kvm_server_internal.h"
-
-#include "apr_general.h"
-#include "apr_pools.h"
-#include "apr_hash.h"
-
-apr_hash_t * ht = NULL;
+#include "kvm_storage.h"
+#include "kvm_epoch.h"
+#include "kvm_server_stats.h"
+#include "kvm_slowlog.h"
+#include "kvm_hotkeys.h"
+#include "kvm_stream.h"
+#include "kvm_probes.h"
 
 typedef kvm_result_t (*request_handler_t) (uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
 
@@ -28,10 +31,36 @@ static kvm_result_t handle_get_request(uint32_t request_size, const uint8_t * re
 static kvm_result_t handle_delete_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
 static kvm_result_t handle_list_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
 static kvm_result_t handle_count_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_put_ttl_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_expire_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_ttl_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_get_encoded_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_hello_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_stats_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_slowlog_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_hotkeys_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_put_begin_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_put_chunk_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_put_end_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_get_range_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_get_versioned_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_put_if_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_delete_if_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_incr_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_append_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_getset_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_batch_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_memory_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t handle_scan_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
 
 static uint8_t * prepare_reply(uint32_t size, uint32_t * reply_size, uint8_t ** reply);
 static kvm_result_t prepare_generic_reply(kvm_reply_status_t status, uint32_t * reply_size, uint8_t ** reply);
-
+static kvm_result_t prepare_store_reply(kvm_result_t result, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t prepare_get_reply(const kvm_entry_t * entry, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t prepare_get_encoded_reply(const kvm_entry_t * entry, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t prepare_ttl_reply(const kvm_entry_t * entry, uint64_t now, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t prepare_get_range_reply(const kvm_entry_t * entry, uint32_t offset, uint32_t max_size, uint32_t * reply_size, uint8_t ** reply);
+static kvm_result_t prepare_get_versioned_reply(const kvm_entry_t * entry, uint32_t * reply_size, uint8_t ** reply);
 
 request_handler_t handlers[] =
 {
@@ -41,95 +70,134 @@ request_handler_t handlers[] =
     handle_delete_request,  //KVM_REQUST_DELETE
     handle_list_request,    //KVM_REQUST_LIST
     handle_count_request,   //KVM_REQUST_COUNT
+    handle_put_ttl_request, //KVM_REQUST_PUT_TTL
+    handle_expire_request,  //KVM_REQUST_EXPIRE
+    handle_ttl_request,     //KVM_REQUST_TTL
+    handle_get_encoded_request, //KVM_REQUST_GET_ENCODED
+    handle_hello_request,   //KVM_REQUST_HELLO
+    handle_stats_request,   //KVM_REQUST_STATS
+    handle_slowlog_request, //KVM_REQUST_SLOWLOG
+    NULL,                   //KVM_REQUST_SHM_ATTACH, handled by the connection
+    handle_hotkeys_request, //KVM_REQUST_HOTKEYS
+    handle_put_begin_request, //KVM_REQUST_PUT_BEGIN
+    handle_put_chunk_request, //KVM_REQUST_PUT_CHUNK
+    handle_put_end_request, //KVM_REQUST_PUT_END
+    handle_get_range_request, //KVM_REQUST_GET_RANGE
+    handle_get_versioned_request, //KVM_REQUST_GET_VERSIONED
+    handle_put_if_request,  //KVM_REQUST_PUT_IF
+    handle_delete_if_request, //KVM_REQUST_DELETE_IF
+    handle_incr_request,    //KVM_REQUST_INCR
+    handle_append_request,  //KVM_REQUST_APPEND
+    handle_getset_request,  //KVM_REQUST_GETSET
+    handle_batch_request,   //KVM_REQUST_BATCH
+    handle_memory_request,  //KVM_REQUST_MEMORY
+    handle_scan_request,    //KVM_REQUST_SCAN
 };
 
-kvm_result_t init_apr_hashtable(void)
+static uint8_t * prepare_reply(uint32_t size, uint32_t * reply_size, uint8_t ** reply)
 {
-    if (NULL != ht)
+    size += sizeof(kvm_reply_generic_t);
+    uint8_t * r = malloc(size);
+    if (NULL == r)
     {
-        return KVM_RESULT_OK;
+        return NULL;
     }
 
-    apr_pool_t * pool = NULL;
+    ((kvm_reply_generic_t *) r)->status = KVM_REPLY_STATUS_OK;
+    *reply_size = size;
+    *reply = r;
+
+    return r + sizeof(kvm_reply_generic_t);
+}
 
-    apr_status_t status = apr_initialize();
-    if (APR_SUCCESS != status)
+static kvm_result_t prepare_store_reply(kvm_result_t result, uint32_t * reply_size, uint8_t ** reply)
+{
+    if (KVM_RESULT_NO_MEMORY == result)
     {
-        return KVM_RESULT_SYS_CALL_FAIL;
+        return prepare_generic_reply(KVM_REPLY_NO_MEMORY, reply_size, reply);
     }
 
-    status = apr_pool_create(&pool, NULL);
-    if (APR_SUCCESS != status)
+    if (KVM_RESULT_CONFLICT == result)
     {
-        apr_terminate();
-        return KVM_RESULT_SYS_CALL_FAIL;
+        return prepare_generic_reply(KVM_REPLY_CONFLICT, reply_size, reply);
     }
 
-    ht = apr_hash_make(pool);
-    if (NULL == ht)
+    if (KVM_RESULT_OK != result)
     {
-        apr_pool_destroy(pool);
-        apr_terminate();
-        return KVM_RESULT_SYS_CALL_FAIL;
+        return result;
     }
 
-    return KVM_RESULT_OK;
+    return prepare_generic_reply(KVM_REPLY_STATUS_OK, reply_size, reply);
 }
 
-void uninit_apr_hashtable(void)
+static kvm_result_t prepare_generic_reply(kvm_reply_status_t status, uint32_t * reply_size, uint8_t ** reply)
 {
-    if (NULL != ht)
+    uint8_t * r = (uint8_t *) malloc(sizeof(kvm_reply_generic_t));
+    if (NULL == r)
     {
-        void * key = NULL;
-        void * val = NULL;
-        for (apr_hash_index_t * hi = apr_hash_first(NULL, ht); hi; hi = apr_hash_next(hi))
-        {
-            apr_hash_this(hi, (const void **) &key, NULL, &val);
-            free(key);
-            free(val);
-        }
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
 
-        apr_pool_t * pool = apr_hash_pool_get(ht);
-        if (NULL != pool)
-        {
-            apr_pool_destroy(pool);
-        }
+    ((kvm_reply_generic_t *) r)->status = status;
+    *reply_size = sizeof(kvm_reply_generic_t);
+    *reply = r;
 
-        apr_terminate();
+    return KVM_RESULT_OK;
+}
 
-        ht = NULL;
+/* Reads uint32_t field of the request after the id, 0 if the request is too short.
+   Only called from probe arguments, which are not evaluated unless probes are built in. */
+static inline uint32_t probe_field(uint32_t request_size, const uint8_t * request, uint32_t index)
+{
+    const uint32_t offset = sizeof(kvm_request_generic_t) + index * sizeof(uint32_t);
+    uint32_t value = 0;
+    if (request_size >= offset + sizeof(value))
+    {
+        memcpy(&value, request + offset, sizeof(value));
     }
+    return kvm_util_transport_to_host32(value);
 }
 
-static uint8_t * prepare_reply(uint32_t size, uint32_t * reply_size, uint8_t ** reply)
+static inline uint32_t probe_key_size(uint32_t request_size, const uint8_t * request)
 {
-    size += sizeof(kvm_reply_generic_t);
-    uint8_t * r = malloc(size);
-    if (NULL == r)
+    switch (request[0])
     {
-        return NULL;
+        case KVM_REQUST_PUT:
+        case KVM_REQUST_GET:
+        case KVM_REQUST_DELETE:
+        case KVM_REQUST_PUT_TTL:
+        case KVM_REQUST_EXPIRE:
+        case KVM_REQUST_TTL:
+        case KVM_REQUST_GET_ENCODED:
+        case KVM_REQUST_PUT_BEGIN:
+        case KVM_REQUST_GET_RANGE:
+        case KVM_REQUST_GET_VERSIONED:
+        case KVM_REQUST_PUT_IF:
+        case KVM_REQUST_DELETE_IF:
+        case KVM_REQUST_INCR:
+        case KVM_REQUST_APPEND:
+        case KVM_REQUST_GETSET:
+            return probe_field(request_size, request, 0);
+        default:
+            return 0;
     }
-
-    ((kvm_reply_generic_t *) r)->status = KVM_REPLY_STATUS_OK;
-    *reply_size = size;
-    *reply = r;
-
-    return r + sizeof(kvm_reply_generic_t);
 }
 
-static kvm_result_t prepare_generic_reply(kvm_reply_status_t status, uint32_t * reply_size, uint8_t ** reply)
+static inline uint32_t probe_value_size(uint32_t request_size, const uint8_t * request)
 {
-    uint8_t * r = (uint8_t *) malloc(sizeof(kvm_reply_generic_t));
-    if (NULL == r)
+    switch (request[0])
     {
-        return KVM_RESULT_SYS_CALL_FAIL;
+        case KVM_REQUST_PUT:
+        case KVM_REQUST_PUT_TTL:
+        case KVM_REQUST_PUT_BEGIN:
+        case KVM_REQUST_PUT_CHUNK:
+        case KVM_REQUST_PUT_IF:
+        case KVM_REQUST_APPEND:
+        case KVM_REQUST_GETSET:
+            return probe_field(request_size, request, 1);
+        default:
+            return 0;
     }
-
-    ((kvm_reply_generic_t *) r)->status = status;
-    *reply_size = sizeof(kvm_reply_generic_t);
-    *reply = r;
-
-    return KVM_RESULT_OK;
 }
 
 kvm_result_t handle_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply)
@@ -141,12 +209,29 @@ kvm_result_t handle_request(uint32_t request_size, const uint8_t * request, uint
         handler = handlers[id];
     }
 
+    KVM_PROBE3(request_start, id, probe_key_size(request_size, request), probe_value_size(request_size, request));
+    const uint64_t start = stats_clock_ns();
+
+    kvm_result_t result;
     if (NULL != handler)
     {
-        return handler(request_size - sizeof(kvm_request_generic_t), request + sizeof(kvm_request_generic_t), reply_size, reply);
+        result = handler(request_size - sizeof(kvm_request_generic_t), request + sizeof(kvm_request_generic_t), reply_size, reply);
+    }
+    else
+    {
+        result = prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
     }
 
-    return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    const uint64_t duration = stats_clock_ns() - start;
+    KVM_PROBE4(request_done, id, (KVM_RESULT_OK == result) ? (*reply)[0] : KVM_REPLY_SYS_FAIL,
+        (KVM_RESULT_OK == result) ? *reply_size : 0, duration);
+    stats_record_request(id, duration);
+    if (slowlog_is_slow(duration))
+    {
+        slowlog_record(KVM_SLOWLOG_EXECUTE, request, request_size, (KVM_RESULT_OK == result) ? *reply_size : 0, duration);
+    }
+
+    return result;
 }
 
 static kvm_result_t
@@ -172,29 +257,15 @@ handle_put_request(
     value_size = kvm_util_transport_to_host32(value_size);
     request += sizeof(value_size);
 
-    if (request_size < key_size + value_size)
+    if ((uint64_t) key_size + value_size > request_size)
     {
         return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
     }
 
-    uint8_t * key = (uint8_t *) malloc(key_size);
-    if (NULL == key)
-    {
-        return KVM_RESULT_SYS_CALL_FAIL;
-    }
-    memcpy(key, request, key_size);
-
-    uint8_t * value = (uint8_t *) malloc(value_size + sizeof(value_size));
-    if (NULL == value)
-    {
-        return KVM_RESULT_SYS_CALL_FAIL;
-    }
-    memcpy(value, &value_size, sizeof(value_size));
-    memcpy(value + sizeof(value_size), request + key_size, value_size);
-
-    apr_hash_set(ht, key, key_size, value);
+    hotkeys_sample(request, key_size);
 
-    return prepare_generic_reply(KVM_REPLY_STATUS_OK, reply_size, reply);
+    const kvm_result_t result = storage_put(request, key_size, request + key_size, value_size, KVM_TTL_PERSIST);
+    return prepare_store_reply(result, reply_size, reply);
 }
 
 static kvm_result_t
@@ -221,22 +292,39 @@ handle_get_request(
     }
 
     const uint8_t * key = request + sizeof(key_size);
+    hotkeys_sample(key, key_size);
 
-    uint8_t * value = apr_hash_get(ht, key, key_size);
-    if (NULL == value)
+    /* The value is copied out before leaving the critical section, the
+       entry may be freed right after. */
+    epoch_enter();
+    const kvm_result_t result = prepare_get_reply(storage_lookup(key, key_size, storage_now()), reply_size, reply);
+    epoch_exit();
+
+    return result;
+}
+
+static kvm_result_t prepare_get_reply(const kvm_entry_t * entry, uint32_t * reply_size, uint8_t ** reply)
+{
+    if (NULL == entry)
     {
+        stats_add(&stats_local()->misses, 1);
         return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
     }
+    stats_add(&stats_local()->hits, 1);
 
-    const uint32_t r_size = *((uint32_t *) value);
+    const uint32_t r_size = storage_value_size(entry);
     kvm_reply_get_t * r = (kvm_reply_get_t *) prepare_reply(r_size + sizeof(kvm_reply_get_t), reply_size, reply);
     if (NULL == r)
     {
         return KVM_RESULT_SYS_CALL_FAIL;
     }
 
-    r->value_size = r_size;
-    memcpy(r + 1, value + sizeof(uint32_t), r_size);
+    r->value_size = kvm_util_host_to_transport32(r_size);
+    if (KVM_RESULT_OK != storage_read_range(entry, 0, r_size, (uint8_t *) (r + 1)))
+    {
+        free(*reply);
+        return prepare_generic_reply(KVM_REPLY_SYS_FAIL, reply_size, reply);
+    }
 
     return KVM_RESULT_OK;
 }
@@ -266,14 +354,12 @@ handle_delete_request(
 
     const uint8_t * key = request + sizeof(key_size);
 
-    uint8_t * value = apr_hash_get(ht, key, key_size);
-    if (NULL != value)
+    kvm_entry_t * entry = storage_find(key, key_size, storage_now());
+    if (NULL != entry)
     {
-        free(value);
+        storage_remove(entry);
     }
 
-    apr_hash_set(ht, key, key_size, NULL);
-
     return prepare_generic_reply(KVM_REPLY_STATUS_OK, reply_size, reply);
 }
 
@@ -289,16 +375,20 @@ handle_list_request(
         return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
     }
 
+    /* Expired entries waiting for the expiration cycle are skipped. */
+    const uint64_t now = storage_now();
+
+    uint32_t count = 0;
     uint32_t size = 0;
-    for (apr_hash_index_t * hi = apr_hash_first(NULL, ht); hi; hi = apr_hash_next(hi))
+    for (const kvm_entry_t * entry = storage_first(); NULL != entry; entry = storage_next(entry))
     {
-        size += apr_hash_this_key_len(hi);
+        if (0 == entry->timer.expire_at || entry->timer.expire_at > now)
+        {
+            count++;
+            size += sizeof(uint32_t) + entry->key_size;
+        }
     }
 
-    const uint32_t count = apr_hash_count(ht);
-
-    size += count * sizeof(uint32_t);
-
     uint8_t * r = prepare_reply(size + sizeof(kvm_reply_list_t), reply_size, reply);
     if (NULL == r)
     {
@@ -308,16 +398,18 @@ handle_list_request(
     ((kvm_reply_list_t *)r)->count = kvm_util_host_to_transport32(count);
     r += sizeof(kvm_reply_list_t);
 
-    for (apr_hash_index_t * hi = apr_hash_first(NULL, ht); hi; hi = apr_hash_next(hi))
+    for (const kvm_entry_t * entry = storage_first(); NULL != entry; entry = storage_next(entry))
     {
-        const uint8_t * key = apr_hash_this_key(hi); 
-        const uint32_t key_len = (uint32_t) apr_hash_this_key_len(hi);
+        if (0 != entry->timer.expire_at && entry->timer.expire_at <= now)
+        {
+            continue;
+        }
 
-        uint32_t tmp = kvm_util_host_to_transport32(key_len);
-        memcpy(r, &tmp, sizeof(key_len));
-        r += sizeof(key_len);
-        memcpy(r, key, key_len);
-        r += key_len;
+        uint32_t tmp = kvm_util_host_to_transport32(entry->key_size);
+        memcpy(r, &tmp, sizeof(tmp));
+        r += sizeof(tmp);
+        memcpy(r, ENTRY_KEY(entry), entry->key_size);
+        r += entry->key_size;
     }
 
     return KVM_RESULT_OK;
@@ -341,6 +433,1309 @@ handle_count_request(
         return KVM_RESULT_SYS_CALL_FAIL;
     }
 
-    r->count = kvm_util_host_to_transport32(apr_hash_count(ht));
+    /* Expired entries waiting for the expiration cycle are not counted. */
+    r->count = kvm_util_host_to_transport32(storage_live_count(storage_now()));
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t
+handle_put_ttl_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_put_ttl_t put_req;
+
+    if (request_size < sizeof(put_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    request_size -= sizeof(put_req);
+
+    memcpy(&put_req, request, sizeof(put_req));
+    const uint32_t key_size = kvm_util_transport_to_host32(put_req.key_size);
+    const uint32_t value_size = kvm_util_transport_to_host32(put_req.value_size);
+    const uint32_t ttl = kvm_util_transport_to_host32(put_req.ttl);
+    request += sizeof(put_req);
+
+    if ((uint64_t) key_size + value_size > request_size || 0 == ttl)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    hotkeys_sample(request, key_size);
+
+    const kvm_result_t result = storage_put(request, key_size, request + key_size, value_size, ttl);
+    return prepare_store_reply(result, reply_size, reply);
+}
+
+static kvm_result_t
+handle_expire_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_expire_t expire_req;
+
+    if (request_size < sizeof(expire_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    request_size -= sizeof(expire_req);
+
+    memcpy(&expire_req, request, sizeof(expire_req));
+    const uint32_t key_size = kvm_util_transport_to_host32(expire_req.key_size);
+    const uint32_t ttl = kvm_util_transport_to_host32(expire_req.ttl);
+
+    if (request_size < key_size)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    const uint64_t now = storage_now();
+    kvm_entry_t * entry = storage_find(request + sizeof(expire_req), key_size, now);
+    if (NULL == entry)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    if (0 == ttl)
+    {
+        storage_remove(entry);
+    }
+    else
+    {
+        storage_set_ttl(entry, ttl, now);
+    }
+
+    return prepare_generic_reply(KVM_REPLY_STATUS_OK, reply_size, reply);
+}
+
+static kvm_result_t
+handle_ttl_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    uint32_t key_size;
+
+    if (request_size < sizeof(key_size))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    request_size -= sizeof(key_size);
+
+    memcpy(&key_size, request, sizeof(key_size));
+    key_size = kvm_util_transport_to_host32(key_size);
+
+    if (request_size < key_size)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    const uint64_t now = storage_now();
+
+    epoch_enter();
+    const kvm_result_t result = prepare_ttl_reply(storage_lookup(request + sizeof(key_size), key_size, now), now, reply_size, reply);
+    epoch_exit();
+
+    return result;
+}
+
+static kvm_result_t prepare_ttl_reply(const kvm_entry_t * entry, uint64_t now, uint32_t * reply_size, uint8_t ** reply)
+{
+    if (NULL == entry)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    kvm_reply_ttl_t * r = (kvm_reply_ttl_t *) prepare_reply(sizeof(kvm_reply_ttl_t), reply_size, reply);
+    if (NULL == r)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    uint32_t ttl = KVM_TTL_PERSIST;
+    const uint64_t expire_at = __atomic_load_n(&entry->timer.expire_at, __ATOMIC_RELAXED);
+    if (0 != expire_at)
+    {
+        ttl = (uint32_t) (expire_at - now);
+    }
+
+    r->ttl = kvm_util_host_to_transport32(ttl);
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t
+handle_get_encoded_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    uint32_t key_size;
+
+    if (request_size < sizeof(key_size))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    request_size -= sizeof(key_size);
+
+    memcpy(&key_size, request, sizeof(key_size));
+    key_size = kvm_util_transport_to_host32(key_size);
+
+    if (request_size < key_size)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    hotkeys_sample(request + sizeof(key_size), key_size);
+
+    epoch_enter();
+    const kvm_result_t result = prepare_get_encoded_reply(storage_lookup(request + sizeof(key_size), key_size, storage_now()), reply_size, reply);
+    epoch_exit();
+
+    return result;
+}
+
+static kvm_result_t prepare_get_encoded_reply(const kvm_entry_t * entry, uint32_t * reply_size, uint8_t ** reply)
+{
+    if (NULL == entry)
+    {
+        stats_add(&stats_local()->misses, 1);
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    stats_add(&stats_local()->hits, 1);
+
+    /* Value is forwarded as stored, the client decodes it. */
+    const kvm_codec_t codec = entry->flags & ENTRY_FLAG_CODEC_MASK;
+    const uint8_t * data = ENTRY_VALUE(entry);
+    const uint32_t raw_size = storage_value_size(entry);
+    uint32_t data_size = raw_size;
+    if (KVM_CODEC_NONE != codec)
+    {
+        data += sizeof(uint32_t);
+        data_size = entry->value_size - sizeof(uint32_t);
+    }
+
+    kvm_reply_get_encoded_t * r = (kvm_reply_get_encoded_t *) prepare_reply(data_size + sizeof(kvm_reply_get_encoded_t), reply_size, reply);
+    if (NULL == r)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    r->codec = codec;
+    r->raw_size = kvm_util_host_to_transport32(raw_size);
+    r->value_size = kvm_util_host_to_transport32(data_size);
+    memcpy(r + 1, data, data_size);
+
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t
+handle_hello_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_hello_t hello_req;
+
+    if (request_size != sizeof(hello_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    memcpy(&hello_req, request, sizeof(hello_req));
+    if (hello_req.version < KVM_PROTOCOL_V1)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    kvm_reply_hello_t * r = (kvm_reply_hello_t *) prepare_reply(sizeof(kvm_reply_hello_t), reply_size, reply);
+    if (NULL == r)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    /* The connection switches to the version once the reply is sent. */
+    r->version = (hello_req.version < KVM_PROTOCOL_VERSION) ? hello_req.version : KVM_PROTOCOL_VERSION;
+    r->features = kvm_util_host_to_transport32(kvm_util_transport_to_host32(hello_req.features) & KVM_FEATURES_SUPPORTED);
+
     return KVM_RESULT_OK;
-}
\ No newline at end of file
+}
+
+/* Size of a histogram in STATS reply, only used buckets are sent */
+static uint32_t stats_histogram_size(const uint64_t * buckets)
+{
+    uint32_t size = sizeof(kvm_reply_stats_op_t);
+    for (uint32_t i = 0; i < KVM_HISTOGRAM_BUCKETS; ++i)
+    {
+        size += (0 != buckets[i]) ? sizeof(kvm_reply_stats_bucket_t) : 0;
+    }
+    return size;
+}
+
+static uint8_t * write_stats_histogram(uint8_t * r, uint8_t id, uint64_t count, uint64_t sum, const uint64_t * buckets)
+{
+    kvm_reply_stats_op_t op;
+    op.id = id;
+    op.requests = kvm_util_host_to_transport64(count);
+    op.latency_sum = kvm_util_host_to_transport64(sum);
+    op.bucket_count = 0;
+    uint8_t * op_ptr = r;
+    r += sizeof(op);
+
+    for (uint32_t i = 0; i < KVM_HISTOGRAM_BUCKETS; ++i)
+    {
+        if (0 != buckets[i])
+        {
+            kvm_reply_stats_bucket_t bucket;
+            bucket.index = kvm_util_host_to_transport16((uint16_t) i);
+            bucket.count = kvm_util_host_to_transport64(buckets[i]);
+            memcpy(r, &bucket, sizeof(bucket));
+            r += sizeof(bucket);
+            op.bucket_count++;
+        }
+    }
+
+    op.bucket_count = kvm_util_host_to_transport16(op.bucket_count);
+    memcpy(op_ptr, &op, sizeof(op));
+    return r;
+}
+
+static kvm_result_t
+handle_stats_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    if (request_size != 0)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    kvm_stats_t * stats = (kvm_stats_t *) malloc(sizeof(kvm_stats_t));
+    if (NULL == stats)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+    stats_publish_storage();
+    stats_aggregate(stats);
+
+    /* Histograms are sent sparse: only requests and phases seen and buckets used. */
+    uint32_t size = sizeof(kvm_reply_stats_t) + sizeof(kvm_reply_stats_phases_t);
+    uint8_t op_count = 0;
+    for (uint32_t id = 0; id < KVM_STATS_MAX_OPS; ++id)
+    {
+        if (0 != stats->requests[id])
+        {
+            op_count++;
+            size += stats_histogram_size(stats->latency[id]);
+        }
+    }
+
+    uint64_t phase_counts[KVM_STATS_PHASES];
+    uint8_t phase_count = 0;
+    for (uint32_t phase = 0; phase < KVM_STATS_PHASES; ++phase)
+    {
+        phase_counts[phase] = kvm_histogram_count(stats->phase[phase]);
+        if (0 != phase_counts[phase])
+        {
+            phase_count++;
+            size += stats_histogram_size(stats->phase[phase]);
+        }
+    }
+
+    uint8_t * r = prepare_reply(size, reply_size, reply);
+    if (NULL == r)
+    {
+        free(stats);
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    kvm_reply_stats_t stats_reply;
+    stats_reply.hits = kvm_util_host_to_transport64(stats->hits);
+    stats_reply.misses = kvm_util_host_to_transport64(stats->misses);
+    stats_reply.bytes_in = kvm_util_host_to_transport64(stats->bytes_in);
+    stats_reply.bytes_out = kvm_util_host_to_transport64(stats->bytes_out);
+    stats_reply.connections_accepted = kvm_util_host_to_transport64(stats->connections_accepted);
+    stats_reply.connections_closed = kvm_util_host_to_transport64(stats->connections_closed);
+    stats_reply.keys = kvm_util_host_to_transport64(stats->keys);
+    stats_reply.used_memory = kvm_util_host_to_transport64(stats->used_memory);
+    stats_reply.evicted_keys = kvm_util_host_to_transport64(stats->evicted_keys);
+    stats_reply.op_count = op_count;
+    memcpy(r, &stats_reply, sizeof(stats_reply));
+    r += sizeof(stats_reply);
+
+    for (uint32_t id = 0; id < KVM_STATS_MAX_OPS; ++id)
+    {
+        if (0 != stats->requests[id])
+        {
+            r = write_stats_histogram(r, (uint8_t) id, stats->requests[id], stats->latency_sum[id], stats->latency[id]);
+        }
+    }
+
+    kvm_reply_stats_phases_t phases_reply;
+    phases_reply.phase_count = phase_count;
+    memcpy(r, &phases_reply, sizeof(phases_reply));
+    r += sizeof(phases_reply);
+
+    for (uint32_t phase = 0; phase < KVM_STATS_PHASES; ++phase)
+    {
+        if (0 != phase_counts[phase])
+        {
+            r = write_stats_histogram(r, (uint8_t) phase, phase_counts[phase], stats->phase_sum[phase], stats->phase[phase]);
+        }
+    }
+
+    free(stats);
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t
+handle_slowlog_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_slowlog_t slowlog_req;
+
+    if (request_size != sizeof(slowlog_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    memcpy(&slowlog_req, request, sizeof(slowlog_req));
+
+    const uint32_t count = slowlog_count();
+    uint32_t size = sizeof(kvm_reply_slowlog_t);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        size += sizeof(kvm_reply_slowlog_entry_t) + slowlog_get(i)->prefix_size;
+    }
+
+    uint8_t * r = prepare_reply(size, reply_size, reply);
+    if (NULL == r)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    ((kvm_reply_slowlog_t *) r)->count = kvm_util_host_to_transport32(count);
+    r += sizeof(kvm_reply_slowlog_t);
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        const kvm_slowlog_entry_t * entry = slowlog_get(i);
+
+        kvm_reply_slowlog_entry_t e;
+        e.id = kvm_util_host_to_transport64(entry->id);
+        e.timestamp_ms = kvm_util_host_to_transport64(entry->timestamp_ms);
+        e.duration_ns = kvm_util_host_to_transport64(entry->duration_ns);
+        e.kind = entry->kind;
+        e.op = entry->op;
+        e.fd = (int32_t) kvm_util_host_to_transport32((uint32_t) entry->fd);
+        e.key_size = kvm_util_host_to_transport32(entry->key_size);
+        e.request_size = kvm_util_host_to_transport32(entry->request_size);
+        e.reply_size = kvm_util_host_to_transport32(entry->reply_size);
+        e.prefix_size = (uint8_t) entry->prefix_size;
+
+        memcpy(r, &e, sizeof(e));
+        r += sizeof(e);
+        memcpy(r, entry->key_prefix, entry->prefix_size);
+        r += entry->prefix_size;
+    }
+
+    if (0 != (slowlog_req.flags & KVM_SLOWLOG_FLAG_RESET))
+    {
+        slowlog_reset();
+    }
+
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t
+handle_hotkeys_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_hotkeys_t hotkeys_req;
+
+    if (request_size != sizeof(hotkeys_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    memcpy(&hotkeys_req, request, sizeof(hotkeys_req));
+
+    uint32_t max = kvm_util_transport_to_host32(hotkeys_req.count);
+    if (0 == max || max > KVM_HOTKEYS_MAX)
+    {
+        max = KVM_HOTKEYS_MAX;
+    }
+
+    kvm_hotkey_t keys[KVM_HOTKEYS_MAX];
+    const uint32_t count = hotkeys_get(keys, max);
+
+    uint32_t size = sizeof(kvm_reply_hotkeys_t);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        size += sizeof(kvm_reply_hotkeys_entry_t) + keys[i].prefix_size;
+    }
+
+    uint8_t * r = prepare_reply(size, reply_size, reply);
+    if (NULL == r)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    ((kvm_reply_hotkeys_t *) r)->count = kvm_util_host_to_transport32(count);
+    r += sizeof(kvm_reply_hotkeys_t);
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        kvm_reply_hotkeys_entry_t e;
+        e.hits = kvm_util_host_to_transport64(keys[i].hits);
+        e.rate = kvm_util_host_to_transport32(keys[i].rate);
+        e.key_size = kvm_util_host_to_transport32(keys[i].key_size);
+        e.prefix_size = (uint8_t) keys[i].prefix_size;
+
+        memcpy(r, &e, sizeof(e));
+        r += sizeof(e);
+        memcpy(r, keys[i].key_prefix, keys[i].prefix_size);
+        r += keys[i].prefix_size;
+    }
+
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t
+handle_put_begin_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_put_begin_t begin_req;
+
+    if (request_size < sizeof(begin_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    request_size -= sizeof(begin_req);
+
+    memcpy(&begin_req, request, sizeof(begin_req));
+    const uint32_t key_size = kvm_util_transport_to_host32(begin_req.key_size);
+    const uint32_t value_size = kvm_util_transport_to_host32(begin_req.value_size);
+    const uint32_t ttl = kvm_util_transport_to_host32(begin_req.ttl);
+
+    if (request_size < key_size || 0 == ttl)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    uint32_t stream;
+    const kvm_result_t result = stream_begin(request + sizeof(begin_req), key_size, value_size, ttl, &stream);
+    if (KVM_RESULT_INVALID_PARAM == result)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    if (KVM_RESULT_OK != result)
+    {
+        return prepare_store_reply(result, reply_size, reply);
+    }
+
+    kvm_reply_put_begin_t * r = (kvm_reply_put_begin_t *) prepare_reply(sizeof(kvm_reply_put_begin_t), reply_size, reply);
+    if (NULL == r)
+    {
+        stream_end(stream, 1);
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    r->stream = kvm_util_host_to_transport32(stream);
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t
+handle_put_chunk_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_put_chunk_t chunk_req;
+
+    if (request_size < sizeof(chunk_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    request_size -= sizeof(chunk_req);
+
+    memcpy(&chunk_req, request, sizeof(chunk_req));
+    const uint32_t chunk_size = kvm_util_transport_to_host32(chunk_req.chunk_size);
+
+    if (request_size < chunk_size || chunk_size > KVM_STREAM_CHUNK_MAX ||
+        KVM_RESULT_OK != stream_append(kvm_util_transport_to_host32(chunk_req.stream), request + sizeof(chunk_req), chunk_size))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    return prepare_generic_reply(KVM_REPLY_STATUS_OK, reply_size, reply);
+}
+
+static kvm_result_t
+handle_put_end_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_put_end_t end_req;
+
+    if (request_size != sizeof(end_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    memcpy(&end_req, request, sizeof(end_req));
+
+    const kvm_result_t result = stream_end(kvm_util_transport_to_host32(end_req.stream), 0 != (end_req.flags & KVM_PUT_END_ABORT));
+    if (KVM_RESULT_INVALID_PARAM == result)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    return prepare_store_reply(result, reply_size, reply);
+}
+
+static kvm_result_t
+handle_get_range_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_get_range_t range_req;
+
+    if (request_size < sizeof(range_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    request_size -= sizeof(range_req);
+
+    memcpy(&range_req, request, sizeof(range_req));
+    const uint32_t key_size = kvm_util_transport_to_host32(range_req.key_size);
+    const uint32_t offset = kvm_util_transport_to_host32(range_req.offset);
+    const uint32_t max_size = kvm_util_transport_to_host32(range_req.max_size);
+
+    if (request_size < key_size)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    const uint8_t * key = request + sizeof(range_req);
+    if (0 == offset)
+    {
+        /* A chunked read counts once, at its first chunk. */
+        hotkeys_sample(key, key_size);
+    }
+
+    epoch_enter();
+    const kvm_result_t result = prepare_get_range_reply(storage_lookup(key, key_size, storage_now()), offset, max_size, reply_size, reply);
+    epoch_exit();
+
+    return result;
+}
+
+static kvm_result_t prepare_get_range_reply(const kvm_entry_t * entry, uint32_t offset, uint32_t max_size, uint32_t * reply_size, uint8_t ** reply)
+{
+    if (0 == offset)
+    {
+        stats_add((NULL != entry) ? &stats_local()->hits : &stats_local()->misses, 1);
+    }
+
+    if (NULL == entry)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    const uint64_t version = storage_version(entry);
+    const uint32_t value_size = storage_value_size(entry);
+    if (offset > value_size)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    uint32_t size = value_size - offset;
+    size = (size < max_size) ? size : max_size;
+    size = (size < KVM_STREAM_CHUNK_MAX) ? size : KVM_STREAM_CHUNK_MAX;
+
+    kvm_reply_get_range_t * r = (kvm_reply_get_range_t *) prepare_reply(sizeof(kvm_reply_get_range_t) + size, reply_size, reply);
+    if (NULL == r)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    r->value_size = kvm_util_host_to_transport32(value_size);
+    r->range_size = kvm_util_host_to_transport32(size);
+    r->version = kvm_util_host_to_transport64(version);
+    if (KVM_RESULT_OK != storage_read_range(entry, offset, size, (uint8_t *) (r + 1)))
+    {
+        free(*reply);
+        return prepare_generic_reply(KVM_REPLY_SYS_FAIL, reply_size, reply);
+    }
+
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t
+handle_get_versioned_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    uint32_t key_size;
+
+    if (request_size < sizeof(key_size))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    request_size -= sizeof(key_size);
+
+    memcpy(&key_size, request, sizeof(key_size));
+    key_size = kvm_util_transport_to_host32(key_size);
+
+    if (request_size < key_size)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    const uint8_t * key = request + sizeof(key_size);
+    hotkeys_sample(key, key_size);
+
+    epoch_enter();
+    const kvm_result_t result = prepare_get_versioned_reply(storage_lookup(key, key_size, storage_now()), reply_size, reply);
+    epoch_exit();
+
+    return result;
+}
+
+static kvm_result_t prepare_get_versioned_reply(const kvm_entry_t * entry, uint32_t * reply_size, uint8_t ** reply)
+{
+    if (NULL == entry)
+    {
+        stats_add(&stats_local()->misses, 1);
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    stats_add(&stats_local()->hits, 1);
+
+    const uint64_t version = storage_version(entry);
+    const uint32_t r_size = storage_value_size(entry);
+    kvm_reply_get_versioned_t * r = (kvm_reply_get_versioned_t *) prepare_reply(r_size + sizeof(kvm_reply_get_versioned_t), reply_size, reply);
+    if (NULL == r)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    r->value_size = kvm_util_host_to_transport32(r_size);
+    r->version = kvm_util_host_to_transport64(version);
+    if (KVM_RESULT_OK != storage_read_range(entry, 0, r_size, (uint8_t *) (r + 1)))
+    {
+        free(*reply);
+        return prepare_generic_reply(KVM_REPLY_SYS_FAIL, reply_size, reply);
+    }
+
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t
+handle_put_if_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_put_if_t put_req;
+
+    if (request_size < sizeof(put_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    request_size -= sizeof(put_req);
+
+    memcpy(&put_req, request, sizeof(put_req));
+    const uint32_t key_size = kvm_util_transport_to_host32(put_req.key_size);
+    const uint32_t value_size = kvm_util_transport_to_host32(put_req.value_size);
+    const uint32_t ttl = kvm_util_transport_to_host32(put_req.ttl);
+    request += sizeof(put_req);
+
+    if ((uint64_t) key_size + value_size > request_size || 0 == ttl || put_req.condition > KVM_IF_PRESENT)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    hotkeys_sample(request, key_size);
+
+    uint64_t version;
+    const kvm_result_t result = storage_put_if(request, key_size, request + key_size, value_size, ttl,
+        put_req.condition, kvm_util_transport_to_host64(put_req.version), &version);
+    if (KVM_RESULT_OK != result)
+    {
+        return prepare_store_reply(result, reply_size, reply);
+    }
+
+    kvm_reply_put_if_t * r = (kvm_reply_put_if_t *) prepare_reply(sizeof(kvm_reply_put_if_t), reply_size, reply);
+    if (NULL == r)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    r->version = kvm_util_host_to_transport64(version);
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t
+handle_delete_if_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_delete_if_t delete_req;
+
+    if (request_size < sizeof(delete_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    request_size -= sizeof(delete_req);
+
+    memcpy(&delete_req, request, sizeof(delete_req));
+    const uint32_t key_size = kvm_util_transport_to_host32(delete_req.key_size);
+
+    if (request_size < key_size || (KVM_IF_VERSION != delete_req.condition && KVM_IF_PRESENT != delete_req.condition))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    kvm_entry_t * entry = storage_find(request + sizeof(delete_req), key_size, storage_now());
+    if (!storage_check_condition(entry, delete_req.condition, kvm_util_transport_to_host64(delete_req.version)))
+    {
+        return prepare_generic_reply(KVM_REPLY_CONFLICT, reply_size, reply);
+    }
+
+    storage_remove(entry);
+    return prepare_generic_reply(KVM_REPLY_STATUS_OK, reply_size, reply);
+}
+
+static kvm_result_t
+handle_incr_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_incr_t incr_req;
+
+    if (request_size < sizeof(incr_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    request_size -= sizeof(incr_req);
+
+    memcpy(&incr_req, request, sizeof(incr_req));
+    const uint32_t key_size = kvm_util_transport_to_host32(incr_req.key_size);
+    request += sizeof(incr_req);
+
+    if (request_size < key_size)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    hotkeys_sample(request, key_size);
+
+    int64_t value;
+    const kvm_result_t result = storage_incr(request, key_size, (int64_t) kvm_util_transport_to_host64(incr_req.delta), &value);
+    if (KVM_RESULT_INVALID_PARAM == result)
+    {
+        /* Not an integer or out of range */
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    if (KVM_RESULT_OK != result)
+    {
+        return prepare_store_reply(result, reply_size, reply);
+    }
+
+    kvm_reply_incr_t * r = (kvm_reply_incr_t *) prepare_reply(sizeof(kvm_reply_incr_t), reply_size, reply);
+    if (NULL == r)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    r->value = (int64_t) kvm_util_host_to_transport64((uint64_t) value);
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t
+handle_append_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_append_t append_req;
+
+    if (request_size < sizeof(append_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    request_size -= sizeof(append_req);
+
+    memcpy(&append_req, request, sizeof(append_req));
+    const uint32_t key_size = kvm_util_transport_to_host32(append_req.key_size);
+    const uint32_t value_size = kvm_util_transport_to_host32(append_req.value_size);
+    request += sizeof(append_req);
+
+    if ((uint64_t) key_size + value_size > request_size)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    hotkeys_sample(request, key_size);
+
+    uint32_t size;
+    const kvm_result_t result = storage_append(request, key_size, request + key_size, value_size, &size);
+    if (KVM_RESULT_INVALID_PARAM == result)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    if (KVM_RESULT_OK != result)
+    {
+        return prepare_store_reply(result, reply_size, reply);
+    }
+
+    kvm_reply_append_t * r = (kvm_reply_append_t *) prepare_reply(sizeof(kvm_reply_append_t), reply_size, reply);
+    if (NULL == r)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    r->value_size = kvm_util_host_to_transport32(size);
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t
+handle_getset_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_getset_t getset_req;
+
+    if (request_size < sizeof(getset_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    request_size -= sizeof(getset_req);
+
+    memcpy(&getset_req, request, sizeof(getset_req));
+    const uint32_t key_size = kvm_util_transport_to_host32(getset_req.key_size);
+    const uint32_t value_size = kvm_util_transport_to_host32(getset_req.value_size);
+    request += sizeof(getset_req);
+
+    if ((uint64_t) key_size + value_size > request_size)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    hotkeys_sample(request, key_size);
+
+    /* The old value goes into the reply before the new one replaces it. */
+    const uint64_t now = storage_now();
+    const kvm_entry_t * entry = storage_find(request, key_size, now);
+    stats_add((NULL != entry) ? &stats_local()->hits : &stats_local()->misses, 1);
+
+    const uint32_t old_size = (NULL != entry) ? storage_value_size(entry) : 0;
+    kvm_reply_getset_t * r = (kvm_reply_getset_t *) prepare_reply(sizeof(kvm_reply_getset_t) + old_size, reply_size, reply);
+    if (NULL == r)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    r->found = (NULL != entry);
+    r->value_size = kvm_util_host_to_transport32(old_size);
+    if (NULL != entry && KVM_RESULT_OK != storage_read_value(entry, (uint8_t *) (r + 1)))
+    {
+        free(*reply);
+        return prepare_generic_reply(KVM_REPLY_SYS_FAIL, reply_size, reply);
+    }
+
+    /* The TTL is kept, like INCR and APPEND do. */
+    const uint32_t ttl = (NULL != entry) ? storage_remaining_ttl(entry, now) : KVM_TTL_PERSIST;
+    const kvm_result_t result = storage_put(request, key_size, request + key_size, value_size, ttl);
+    if (KVM_RESULT_OK != result)
+    {
+        free(*reply);
+        return prepare_store_reply(result, reply_size, reply);
+    }
+
+    return KVM_RESULT_OK;
+}
+
+/* Operations allowed in a batch */
+#define BATCH_OP_READ   1   /* A miss does not fail the batch */
+#define BATCH_OP_WRITE  2
+
+/* Largest batch reply, leaving room to widen in the v2 encoding as SCAN does */
+#define BATCH_REPLY_MAX_SIZE    (KVM_FRAME_MAX_SIZE / 2)
+
+static int batch_op_kind(kvm_request_id_t id)
+{
+    switch (id)
+    {
+        case KVM_REQUST_GET:
+        case KVM_REQUST_COUNT:
+        case KVM_REQUST_TTL:
+        case KVM_REQUST_GET_VERSIONED:
+            return BATCH_OP_READ;
+        case KVM_REQUST_PUT:
+        case KVM_REQUST_DELETE:
+        case KVM_REQUST_PUT_TTL:
+        case KVM_REQUST_EXPIRE:
+        case KVM_REQUST_PUT_IF:
+        case KVM_REQUST_DELETE_IF:
+        case KVM_REQUST_INCR:
+        case KVM_REQUST_APPEND:
+        case KVM_REQUST_GETSET:
+            return BATCH_OP_WRITE;
+        default:
+            return 0;
+    }
+}
+
+static kvm_result_t
+handle_batch_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_batch_t batch_req;
+
+    if (request_size < sizeof(batch_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+    request_size -= sizeof(batch_req);
+
+    memcpy(&batch_req, request, sizeof(batch_req));
+    const uint32_t count = kvm_util_transport_to_host32(batch_req.count);
+    request += sizeof(batch_req);
+
+    if (0 == count || count > KVM_BATCH_MAX_OPS)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    /* The whole batch is checked before anything runs. */
+    const uint8_t * op = request;
+    uint32_t left = request_size;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        uint32_t op_size;
+        if (left < sizeof(op_size))
+        {
+            return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+        }
+        memcpy(&op_size, op, sizeof(op_size));
+        op_size = kvm_util_transport_to_host32(op_size);
+        left -= sizeof(op_size);
+        op += sizeof(op_size);
+
+        if (op_size < sizeof(kvm_request_generic_t) || op_size > left || 0 == batch_op_kind(op[0]))
+        {
+            return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+        }
+        left -= op_size;
+        op += op_size;
+    }
+
+    if (0 != left)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    uint64_t size = sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_batch_t);
+    uint64_t capacity = size + count * (sizeof(uint32_t) + sizeof(kvm_reply_generic_t));
+    uint8_t * r = (uint8_t *) malloc(capacity);
+    if (NULL == r)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    kvm_result_t result = KVM_RESULT_OK;
+    uint32_t done = 0;
+    int failed = 0;
+    int too_large = 0;
+
+    storage_batch_begin();
+    for (op = request; done < count && !failed; ++done)
+    {
+        uint32_t op_size;
+        memcpy(&op_size, op, sizeof(op_size));
+        op_size = kvm_util_transport_to_host32(op_size);
+        op += sizeof(op_size);
+
+        const int kind = batch_op_kind(op[0]);
+        uint32_t op_reply_size;
+        uint8_t * op_reply;
+        /* Through handle_request() so each operation is counted in the
+           statistics and the slow log as a request of its own. */
+        result = storage_batch_reserve();
+        if (KVM_RESULT_OK == result)
+        {
+            result = handle_request(op_size, op, &op_reply_size, &op_reply);
+        }
+        if (KVM_RESULT_OK != result)
+        {
+            break;
+        }
+        op += op_size;
+
+        failed = (KVM_REPLY_STATUS_OK != op_reply[0] && BATCH_OP_WRITE == kind);
+
+        /* The whole batch is reverted rather than sending a reply the
+           client would reject. */
+        if (size + sizeof(op_reply_size) + op_reply_size > BATCH_REPLY_MAX_SIZE)
+        {
+            free(op_reply);
+            too_large = 1;
+            break;
+        }
+
+        if (capacity - size < sizeof(op_reply_size) + op_reply_size)
+        {
+            capacity = 2 * capacity + op_reply_size;
+            if (capacity > BATCH_REPLY_MAX_SIZE)
+            {
+                capacity = BATCH_REPLY_MAX_SIZE;
+            }
+            uint8_t * grown = (uint8_t *) realloc(r, capacity);
+            if (NULL == grown)
+            {
+                free(op_reply);
+                result = KVM_RESULT_SYS_CALL_FAIL;
+                break;
+            }
+            r = grown;
+        }
+
+        const uint32_t transport_size = kvm_util_host_to_transport32(op_reply_size);
+        memcpy(r + size, &transport_size, sizeof(transport_size));
+        memcpy(r + size + sizeof(transport_size), op_reply, op_reply_size);
+        size += sizeof(transport_size) + op_reply_size;
+        free(op_reply);
+    }
+    storage_batch_end(KVM_RESULT_OK == result && !failed && !too_large);
+
+    if (KVM_RESULT_OK != result || too_large)
+    {
+        free(r);
+        return prepare_generic_reply(too_large ? KVM_REPLY_BAD_REQUEST : KVM_REPLY_SYS_FAIL, reply_size, reply);
+    }
+
+    kvm_reply_batch_t batch_reply;
+    batch_reply.committed = !failed;
+    batch_reply.count = kvm_util_host_to_transport32(done);
+
+    r[0] = KVM_REPLY_STATUS_OK;
+    memcpy(r + sizeof(kvm_reply_generic_t), &batch_reply, sizeof(batch_reply));
+
+    *reply_size = (uint32_t) size;
+    *reply = r;
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t
+handle_memory_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    if (request_size != 0)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    kvm_memory_t memory;
+    if (KVM_RESULT_OK != kvm_server_get_memory(&memory))
+    {
+        return prepare_generic_reply(KVM_REPLY_SYS_FAIL, reply_size, reply);
+    }
+
+    kvm_reply_memory_t memory_reply;
+    memory_reply.keys = kvm_util_host_to_transport64(memory.keys);
+    memory_reply.values = kvm_util_host_to_transport64(memory.values);
+    memory_reply.entry_headers = kvm_util_host_to_transport64(memory.entry_headers);
+    memory_reply.entry_slack = kvm_util_host_to_transport64(memory.entry_slack);
+    memory_reply.buckets = kvm_util_host_to_transport64(memory.buckets);
+    memory_reply.uploads = kvm_util_host_to_transport64(memory.uploads);
+    memory_reply.undo_log = kvm_util_host_to_transport64(memory.undo_log);
+    memory_reply.retired = kvm_util_host_to_transport64(memory.retired);
+    memory_reply.connections = kvm_util_host_to_transport64(memory.connections);
+    memory_reply.rss = kvm_util_host_to_transport64(memory.rss);
+    memory_reply.heap_in_use = kvm_util_host_to_transport64(memory.heap_in_use);
+    memory_reply.heap_free = kvm_util_host_to_transport64(memory.heap_free);
+    memory_reply.heap_releasable = kvm_util_host_to_transport64(memory.heap_releasable);
+
+    uint8_t * r = prepare_reply(sizeof(memory_reply), reply_size, reply);
+    if (NULL == r)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+    memcpy(r, &memory_reply, sizeof(memory_reply));
+
+    return KVM_RESULT_OK;
+}
+
+/* Pairs of a SCAN page, collected before the reply is sized */
+typedef struct scan_item_s
+{
+    const kvm_entry_t * entry;
+    uint32_t            ttl;
+    uint32_t            value_size;
+    uint8_t             has_value;
+} scan_item_t;
+
+typedef struct scan_page_s
+{
+    scan_item_t *   items;
+    uint32_t        count;
+    uint32_t        capacity;
+    uint32_t        max_bytes;
+    uint64_t        data_size;      /* Key and value data of the items */
+    int             failed;
+} scan_page_t;
+
+static void scan_collect(void * context, const kvm_entry_t * entry, uint32_t ttl)
+{
+    scan_page_t * page = (scan_page_t *) context;
+    if (page->failed)
+    {
+        return;
+    }
+
+    if (page->count == page->capacity)
+    {
+        const uint32_t capacity = (0 != page->capacity) ? 2 * page->capacity : 64;
+        scan_item_t * items = (scan_item_t *) realloc(page->items, capacity * sizeof(scan_item_t));
+        if (NULL == items)
+        {
+            page->failed = 1;
+            return;
+        }
+        page->items = items;
+        page->capacity = capacity;
+    }
+
+    /* A bucket is never split between pages, so a page may run over
+       max_bytes; values past twice that are left to GET_RANGE. */
+    scan_item_t * item = &page->items[page->count++];
+    item->entry = entry;
+    item->ttl = ttl;
+    item->value_size = storage_value_size(entry);
+    item->has_value = (item->value_size <= page->max_bytes &&
+        page->data_size + item->value_size <= 2 * (uint64_t) page->max_bytes);
+
+    page->data_size += entry->key_size + (item->has_value ? item->value_size : 0);
+}
+
+static kvm_result_t
+handle_scan_request(
+    uint32_t        request_size,
+    const uint8_t * request,
+    uint32_t *      reply_size,
+    uint8_t **      reply)
+{
+    kvm_request_scan_t scan_req;
+
+    if (request_size != sizeof(scan_req))
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    memcpy(&scan_req, request, sizeof(scan_req));
+    uint32_t cursor = kvm_util_transport_to_host32(scan_req.cursor);
+    const uint32_t max_bytes = kvm_util_transport_to_host32(scan_req.max_bytes);
+
+    if (0 == max_bytes || max_bytes > KVM_SCAN_MAX_BYTES)
+    {
+        return prepare_generic_reply(KVM_REPLY_BAD_REQUEST, reply_size, reply);
+    }
+
+    scan_page_t page;
+    memset(&page, 0, sizeof(page));
+    page.max_bytes = max_bytes;
+
+    const uint64_t now = storage_now();
+    do
+    {
+        cursor = storage_scan(cursor, now, scan_collect, &page);
+    } while (0 != cursor && page.data_size < max_bytes);
+
+    const uint64_t size = sizeof(kvm_reply_scan_t) +
+        (uint64_t) page.count * (sizeof(uint32_t) + sizeof(kvm_reply_scan_entry_t)) + page.data_size;
+    uint8_t * r = (page.failed || size > KVM_FRAME_MAX_SIZE / 2) ? NULL : prepare_reply((uint32_t) size, reply_size, reply);
+    if (NULL == r)
+    {
+        free(page.items);
+        return prepare_generic_reply(KVM_REPLY_SYS_FAIL, reply_size, reply);
+    }
+
+    kvm_reply_scan_t scan_reply;
+    scan_reply.cursor = kvm_util_host_to_transport32(cursor);
+    scan_reply.count = kvm_util_host_to_transport32(page.count);
+    memcpy(r, &scan_reply, sizeof(scan_reply));
+    r += sizeof(scan_reply);
+
+    for (uint32_t i = 0; i < page.count; ++i)
+    {
+        const scan_item_t * item = &page.items[i];
+        const uint32_t data_size = item->entry->key_size + (item->has_value ? item->value_size : 0);
+
+        const uint32_t entry_size = kvm_util_host_to_transport32(sizeof(kvm_reply_scan_entry_t) + data_size);
+        memcpy(r, &entry_size, sizeof(entry_size));
+        r += sizeof(entry_size);
+
+        kvm_reply_scan_entry_t entry;
+        entry.key_size = kvm_util_host_to_transport32(item->entry->key_size);
+        entry.value_size = kvm_util_host_to_transport32(item->value_size);
+        entry.ttl = kvm_util_host_to_transport32(item->ttl);
+        entry.has_value = item->has_value;
+        memcpy(r, &entry, sizeof(entry));
+        r += sizeof(entry);
+
+        memcpy(r, ENTRY_KEY(item->entry), item->entry->key_size);
+        r += item->entry->key_size;
+
+        if (item->has_value)
+        {
+            if (KVM_RESULT_OK != storage_read_range(item->entry, 0, item->value_size, r))
+            {
+                free(page.items);
+                free(*reply);
+                return prepare_generic_reply(KVM_REPLY_SYS_FAIL, reply_size, reply);
+            }
+            r += item->value_size;
+        }
+    }
+
+    free(page.items);
+    return KVM_RESULT_OK;
+}
@@ -4,69 +4,194 @@
 * @brief Key/Value Management System server implementation.
 *
 */
+#include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include "kvm_requests.h"
 #include "kvm_replies.h"
+#include "kvm_utils.h"
+#include "kvm_protocol.h"
 #include "kvm_server.h"
 #include "kvm_server_internal.h"
+#include "kvm_server_stats.h"
+#include "kvm_epoch.h"
+#include "kvm_metrics.h"
+#include "kvm_slowlog.h"
+#include "kvm_hotkeys.h"
+#include "kvm_stream.h"
+#include "kvm_handoff.h"
+#include "kvm_probes.h"
 
 kvm_server_t g_server;
 
-static kvm_result_t process_client(int client_socket);
+static kvm_result_t open_listeners(const kvm_server_config_t * config, handoff_state_t * handoff);
+static void close_listeners(int remove_files);
+static void watch_socket(int fd);
+static int listen_tcp(uint16_t port);
+static int listen_unix(const char * path);
+static void hand_off(void);
+static kvm_result_t accept_client(int listen_socket);
+static int shm_prepare_wait(void);
+static void shm_cancel_wait(void);
+static kvm_result_t shm_attach(int index, const uint8_t * request, uint32_t request_size, kvm_shm_t ** shm);
+static void shm_activate(int index, kvm_shm_t * shm);
+static void shm_release(kvm_shm_t * shm);
+static ssize_t receive(int index, uint8_t * buffer, uint32_t size);
+static kvm_result_t process_client(int index);
+static kvm_result_t parse_frame_header(uint8_t version, const uint8_t * data, uint32_t size, uint32_t * header_size, uint32_t * frame_size);
+static uint8_t * convert_buffer(uint8_t ** buffer);
+static kvm_result_t decode_request(const uint8_t * data, uint32_t size, uint8_t ** request, uint32_t * request_size);
+static kvm_result_t process_frame(int index, const uint8_t * frame, uint32_t frame_size, uint64_t received_at, uint64_t decode_start);
+static kvm_result_t send_reply(int index, uint8_t version, kvm_request_id_t id, const uint8_t * reply, uint32_t reply_size, uint64_t reply_start);
+static kvm_result_t write_frame(int index, const uint8_t * header, uint32_t header_size, const uint8_t * body, uint32_t body_size);
+static kvm_result_t write_shm(kvm_shm_ring_t * ring, const uint8_t * data, uint32_t size);
+static void release_connection(kvm_connection_t * connection);
 static void close_client(int client_socket);
 
+void
+kvm_server_config_default(
+    kvm_server_config_t * config)
+{
+    memset(config, 0, sizeof(*config));
+    config->port = 55555;
+    config->max_memory = 0;
+    config->eviction_policy = KVM_EVICTION_NONE;
+    config->compression_threshold = 0;
+    config->metrics_port = 0;
+    config->slowlog_threshold_us = 10000;
+    config->phase_clock = KVM_PHASE_CLOCK_TSC;
+    config->shm_poll_us = 0;
+    config->hotkeys_sample = 16;
+}
+
 kvm_result_t
 kvm_server_init(
-    uint16_t port)
+    const kvm_server_config_t * config)
 {
-    g_server.server_socket = socket(AF_INET, SOCK_STREAM, 0);
-    if (g_server.server_socket == -1)
+    if (NULL == config)
     {
-        return KVM_RESULT_SYS_CALL_FAIL;
+        return KVM_RESULT_INVALID_PARAM;
     }
 
-    struct sockaddr_in server_addr;
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(port);
+    if ((NULL != config->unix_path && strlen(config->unix_path) >= sizeof(g_server.unix_path)) ||
+        (NULL != config->handoff_path && strlen(config->handoff_path) >= sizeof(g_server.handoff_path)))
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    g_server.server_socket = -1;
+    g_server.unix_path[0] = '\0';
+    g_server.handoff_path[0] = '\0';
 
-    if (-1 == bind(g_server.server_socket, (struct sockaddr *)&server_addr, sizeof(server_addr)))
+    kvm_result_t result = storage_init();
+    if (KVM_RESULT_OK != result)
     {
-        close(g_server.server_socket);
-        return KVM_RESULT_SYS_CALL_FAIL;
+        return result;
     }
 
-    if (-1 == listen(g_server.server_socket, 5))
+    storage_configure(config);
+    stats_publish_storage();
+    stats_phase_configure(config->phase_clock);
+    g_server.shm_poll_ns = kvm_shm_can_spin() ? (uint64_t) config->shm_poll_us * 1000 : 0;
+    hotkeys_configure(config->hotkeys_sample);
+    slowlog_configure((0 != config->slowlog_threshold_us) ? (uint64_t) config->slowlog_threshold_us * 1000 : SLOWLOG_DISABLED);
+
+    /* A running server hands its sockets and pairs over, without one this
+       is a cold start. */
+    handoff_state_t handoff;
+    const int channel = (NULL != config->handoff_path) ? handoff_connect(config->handoff_path) : -1;
+    if (-1 != channel)
     {
-        close(g_server.server_socket);
-        return KVM_RESULT_SYS_CALL_FAIL;
+        result = handoff_receive(channel, &handoff);
+    }
+    else if (NULL != config->handoff_path && ENOENT != errno && ECONNREFUSED != errno)
+    {
+        result = KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    if (KVM_RESULT_OK == result)
+    {
+        result = open_listeners(config, (-1 != channel) ? &handoff : NULL);
+    }
+
+    if (KVM_RESULT_OK == result && 0 != config->metrics_port)
+    {
+        result = metrics_start(config->metrics_port);
+    }
+
+    if (KVM_RESULT_OK == result && -1 != channel)
+    {
+        /* The previous process lets go of everything once it is confirmed. */
+        result = handoff_confirm(channel);
+    }
+
+    if (-1 != channel)
+    {
+        close(channel);
     }
 
-    kvm_result_t result = init_apr_hashtable();
     if (KVM_RESULT_OK != result)
     {
+        /* Files of the previous process stay, it keeps serving. */
+        metrics_stop();
+        close_listeners(-1 == channel);
+        if (-1 != channel)
+        {
+            handoff_release(&handoff);
+        }
+        storage_uninit();
         return result;
     }
+    g_server.metrics_port = config->metrics_port;
 
     FD_ZERO(&g_server.readfds);
-    FD_SET(g_server.server_socket, &g_server.readfds);
-    g_server.max_fd = g_server.server_socket;
+    g_server.max_fd = 0;
+    watch_socket(g_server.server_socket);
+    if ('\0' != g_server.unix_path[0])
+    {
+        watch_socket(g_server.unix_socket);
+    }
+    if ('\0' != g_server.handoff_path[0])
+    {
+        watch_socket(g_server.handoff_socket);
+    }
 
-    return result;
+    if (-1 != channel)
+    {
+        for (uint32_t i = 0; i < handoff.connection_count; ++i)
+        {
+            g_server.client_sockets[i] = handoff.sockets[i];
+            g_server.connections[i] = handoff.connections[i];
+            watch_socket(handoff.sockets[i]);
+        }
+        handoff.connection_count = 0;
+
+        /* Closes the listeners not taken over. */
+        handoff_release(&handoff);
+    }
+
+    return KVM_RESULT_OK;
 }
 
 kvm_result_t
 kvm_server_uninit(
     void)
 {
-    uninit_apr_hashtable();
+    metrics_stop();
+    stream_release_all();
+    storage_uninit();
 
     for(int i = 0; i < MAX_CLIENT_COUNT; ++i)
     {
@@ -74,58 +199,209 @@ kvm_server_uninit(
         {
             close(g_server.client_sockets[i]);
         }
+        release_connection(&g_server.connections[i]);
     }
 
-    close(g_server.server_socket);
+    close_listeners(1);
+    free(g_server.request_buffer);
+    free(g_server.reply_buffer);
 
     memset(&g_server, 0, sizeof(g_server));
     return KVM_RESULT_OK;
 }
 
+int
+kvm_server_handed_off(
+    void)
+{
+    return g_server.handed_off;
+}
+
+kvm_result_t
+kvm_server_get_storage_stats(
+    kvm_server_storage_stats_t * stats)
+{
+    if (NULL == stats)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    storage_get_stats(stats);
+    return KVM_RESULT_OK;
+}
+
+kvm_result_t
+kvm_server_get_memory(
+    kvm_memory_t * memory)
+{
+    if (NULL == memory)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    memset(memory, 0, sizeof(*memory));
+    storage_get_memory(memory);
+    memory->retired = epoch_pending_bytes();
+
+    for (int i = 0; i < MAX_CLIENT_COUNT; ++i)
+    {
+        const kvm_connection_t * connection = &g_server.connections[i];
+        memory->connections += connection->capacity;
+        if (NULL != connection->shm)
+        {
+            memory->connections += connection->shm->region_size;
+        }
+    }
+
+    /* Resident pages are the second field. */
+    FILE * statm = fopen("/proc/self/statm", "r");
+    if (NULL != statm)
+    {
+        unsigned long long size;
+        unsigned long long resident;
+        if (2 == fscanf(statm, "%llu %llu", &size, &resident))
+        {
+            memory->rss = resident * (uint64_t) sysconf(_SC_PAGESIZE);
+        }
+        fclose(statm);
+    }
+
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    /* Large blocks are mapped on their own and never fragment the heap. */
+    const struct mallinfo2 info = mallinfo2();
+    memory->heap_in_use = info.uordblks + info.hblkhd;
+    memory->heap_free = info.fordblks;
+    memory->heap_releasable = info.keepcost;
+#endif
+
+    return KVM_RESULT_OK;
+}
+
+kvm_result_t
+kvm_server_get_stats(
+    kvm_stats_t * stats)
+{
+    if (NULL == stats)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    stats_aggregate(stats);
+    return KVM_RESULT_OK;
+}
+
 kvm_result_t
 kvm_server_wait_client_request(
     void)
 {
-    while(1)
+    while(!g_server.handed_off)
     {
         fd_set current_set = g_server.readfds;
 
-        if (-1 == select(FD_SETSIZE, &current_set, NULL, NULL, NULL))
+        /* Metrics readers get storage figures from here, never from the storage. */
+        stats_publish_storage();
+
+        /* Reap a bounded number of expired keys per iteration, so mass
+           expiration is spread over time instead of stalling the clients. */
+        expire_entries(EXPIRE_CYCLE_BUDGET);
+
+        /* Free what removals and expiration retired, unless a reader
+           thread still holds an older epoch. */
+        epoch_reclaim();
+
+        struct timeval expire_period;
+        struct timeval * timeout = NULL;
+        if (has_expiring_entries())
+        {
+            expire_period.tv_sec = 0;
+            expire_period.tv_usec = EXPIRE_CYCLE_PERIOD_MS * 1000;
+            timeout = &expire_period;
+        }
+
+        /* Requests waiting in the rings do not make any descriptor readable. */
+        const int shm_pending = (0 != g_server.shm_count) && shm_prepare_wait();
+        if (shm_pending)
+        {
+            expire_period.tv_sec = 0;
+            expire_period.tv_usec = 0;
+            timeout = &expire_period;
+        }
+
+        const int ready = select(FD_SETSIZE, &current_set, NULL, NULL, timeout);
+        if (-1 == ready)
         {
             return KVM_RESULT_SYS_CALL_FAIL;
         }
+        g_server.ready_at = stats_phase_now();
 
-        if (FD_ISSET(g_server.server_socket, &current_set))
+        if (0 != g_server.shm_count)
+        {
+            shm_cancel_wait();
+        }
+
+        if (0 == ready && !shm_pending)
         {
-            int client_sock = accept(g_server.server_socket, NULL, NULL);
-            if (-1 == client_sock)
+            continue;
+        }
+
+        if ('\0' != g_server.handoff_path[0] && FD_ISSET(g_server.handoff_socket, &current_set))
+        {
+            hand_off();
+            if (g_server.handed_off)
             {
-                return KVM_RESULT_SYS_CALL_FAIL;
+                break;
             }
+        }
 
-            for (int i = 0; i < MAX_CLIENT_COUNT; i++)
+        if (FD_ISSET(g_server.server_socket, &current_set))
+        {
+            const kvm_result_t result = accept_client(g_server.server_socket);
+            if (KVM_RESULT_OK != result)
             {
-                if (0 == g_server.client_sockets[i])
-                {
-                    g_server.client_sockets[i] = client_sock;
-                    break;
-                }
+                return result;
             }
+        }
 
-            FD_SET(client_sock, &g_server.readfds);
-
-            if (client_sock > g_server.max_fd)
+        if ('\0' != g_server.unix_path[0] && FD_ISSET(g_server.unix_socket, &current_set))
+        {
+            const kvm_result_t result = accept_client(g_server.unix_socket);
+            if (KVM_RESULT_OK != result)
             {
-                g_server.max_fd = client_sock;
+                return result;
             }
-
         }
 
         memset(&g_server.active_client_sockets, 0, sizeof(g_server.active_client_sockets));
         int found_count = 0;
         for (int i = 0; i < MAX_CLIENT_COUNT; i++)
         {
-            if (0 != g_server.client_sockets[i] && FD_ISSET(g_server.client_sockets[i], &current_set))
+            const kvm_shm_t * shm = g_server.connections[i].shm;
+            if (0 == g_server.client_sockets[i])
+            {
+                continue;
+            }
+
+            if (NULL != shm)
+            {
+                if (FD_ISSET(shm->request.wake_fd, &current_set))
+                {
+                    uint64_t wakeups;
+                    ssize_t result = read(shm->request.wake_fd, &wakeups, sizeof(wakeups));
+                    (void) result;
+                }
+
+                if (FD_ISSET(g_server.client_sockets[i], &current_set))
+                {
+                    /* Nothing is sent on the socket after attaching, it is closed. */
+                    close_client(g_server.client_sockets[i]);
+                }
+                else if (kvm_shm_ring_readable(&shm->request))
+                {
+                    g_server.active_client_sockets[i] = g_server.client_sockets[i];
+                    found_count++;
+                }
+            }
+            else if (FD_ISSET(g_server.client_sockets[i], &current_set))
             {
                 g_server.active_client_sockets[i] = g_server.client_sockets[i];
                 found_count++;
@@ -151,68 +427,857 @@ kvm_server_handle_request(
     {
         if (0 != g_server.active_client_sockets[i])
         {
-           process_client(g_server.active_client_sockets[i]);
+           process_client(i);
+        }
+    }
+    return KVM_RESULT_OK;
+}
+
+/* Takes over the listeners passed by the previous process if they match
+   the configuration, opens the others. The handoff socket of the previous
+   process is replaced, it is not needed once the handoff is confirmed. */
+static kvm_result_t open_listeners(const kvm_server_config_t * config, handoff_state_t * handoff)
+{
+    if (NULL != handoff)
+    {
+        struct sockaddr_in addr;
+        socklen_t size = sizeof(addr);
+        if (0 == getsockname(handoff->server_socket, (struct sockaddr *) &addr, &size) &&
+            AF_INET == addr.sin_family && htons(config->port) == addr.sin_port)
+        {
+            g_server.server_socket = handoff->server_socket;
+            handoff->server_socket = -1;
+        }
+
+        if (-1 != handoff->unix_socket && NULL != config->unix_path && 0 == strcmp(handoff->unix_path, config->unix_path))
+        {
+            g_server.unix_socket = handoff->unix_socket;
+            handoff->unix_socket = -1;
+            strcpy(g_server.unix_path, config->unix_path);
+        }
+    }
+
+    if (-1 == g_server.server_socket)
+    {
+        g_server.server_socket = listen_tcp(config->port);
+        if (-1 == g_server.server_socket)
+        {
+            return KVM_RESULT_SYS_CALL_FAIL;
+        }
+    }
+
+    if (NULL != config->unix_path && '\0' == g_server.unix_path[0])
+    {
+        g_server.unix_socket = listen_unix(config->unix_path);
+        if (-1 == g_server.unix_socket)
+        {
+            close_listeners(1);
+            return KVM_RESULT_SYS_CALL_FAIL;
+        }
+        strcpy(g_server.unix_path, config->unix_path);
+    }
+
+    if (NULL != config->handoff_path)
+    {
+        /* Whoever connects takes the server over, only the owner may. */
+        g_server.handoff_socket = listen_unix(config->handoff_path);
+        if (-1 == g_server.handoff_socket || -1 == chmod(config->handoff_path, S_IRUSR | S_IWUSR))
+        {
+            if (-1 != g_server.handoff_socket)
+            {
+                close(g_server.handoff_socket);
+            }
+            close_listeners(NULL == handoff);
+            return KVM_RESULT_SYS_CALL_FAIL;
         }
+        strcpy(g_server.handoff_path, config->handoff_path);
     }
+
     return KVM_RESULT_OK;
 }
 
-kvm_result_t process_client(int client_socket)
+/* Socket files are kept when they may belong to another process. */
+static void close_listeners(int remove_files)
+{
+    if (-1 != g_server.server_socket)
+    {
+        close(g_server.server_socket);
+        g_server.server_socket = -1;
+    }
+
+    if ('\0' != g_server.unix_path[0])
+    {
+        close(g_server.unix_socket);
+        if (remove_files)
+        {
+            unlink(g_server.unix_path);
+        }
+        g_server.unix_path[0] = '\0';
+    }
+
+    if ('\0' != g_server.handoff_path[0])
+    {
+        close(g_server.handoff_socket);
+        if (remove_files)
+        {
+            unlink(g_server.handoff_path);
+        }
+        g_server.handoff_path[0] = '\0';
+    }
+}
+
+static void watch_socket(int fd)
+{
+    FD_SET(fd, &g_server.readfds);
+    if (fd > g_server.max_fd)
+    {
+        g_server.max_fd = fd;
+    }
+}
+
+static int listen_tcp(uint16_t port)
 {
-    uint32_t request_size;
+    const int tcp_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if (-1 == tcp_socket)
+    {
+        return -1;
+    }
+
+    struct sockaddr_in server_addr;
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons(port);
 
-    uint32_t read_len = read(client_socket, &request_size, sizeof(request_size));
-    if (sizeof(request_size) != read_len)
+    if (-1 == bind(tcp_socket, (struct sockaddr *) &server_addr, sizeof(server_addr)) ||
+        -1 == listen(tcp_socket, 5))
     {
-        close_client(client_socket);
-        return KVM_RESULT_CONNECTION_FAIL;
+        close(tcp_socket);
+        return -1;
     }
 
-    uint8_t * request = malloc(request_size);
-    if (NULL == request)
+    return tcp_socket;
+}
+
+/* Local clients skip the TCP/IP stack: no checksums, segmentation, ACKs or
+   Nagle. A stale socket file of a previous run is replaced. */
+static int listen_unix(const char * path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    const int unix_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (-1 == unix_socket)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (0 == stat(path, &st) && S_ISSOCK(st.st_mode))
+    {
+        unlink(path);
+    }
+
+    if (-1 == bind(unix_socket, (struct sockaddr *) &addr, sizeof(addr)) ||
+        -1 == listen(unix_socket, 5))
+    {
+        close(unix_socket);
+        return -1;
+    }
+
+    return unix_socket;
+}
+
+/* Passes the listeners, the connections and the pairs to a new server
+   process. Connections using shared memory rings are closed, the rings
+   are mapped by this process only. */
+static void hand_off(void)
+{
+    const int channel = accept(g_server.handoff_socket, NULL, NULL);
+    if (-1 == channel)
+    {
+        return;
+    }
+
+    handoff_state_t state;
+    memset(&state, 0, sizeof(state));
+    state.server_socket = g_server.server_socket;
+    state.unix_socket = ('\0' != g_server.unix_path[0]) ? g_server.unix_socket : -1;
+    strcpy(state.unix_path, g_server.unix_path);
+    for (int i = 0; i < MAX_CLIENT_COUNT; i++)
+    {
+        if (0 != g_server.client_sockets[i] && NULL == g_server.connections[i].shm)
+        {
+            state.sockets[state.connection_count] = g_server.client_sockets[i];
+            state.connections[state.connection_count] = g_server.connections[i];
+            state.connection_count++;
+        }
+    }
+
+    /* The new process binds the metrics port before it confirms. */
+    metrics_stop();
+
+    const kvm_result_t result = handoff_send(channel, &state);
+    close(channel);
+    if (KVM_RESULT_OK != result)
+    {
+        if (0 != g_server.metrics_port)
+        {
+            metrics_start(g_server.metrics_port);
+        }
+        return;
+    }
+
+    /* Descriptors are closed without shutdown(), the connections stay
+       open in the new process. Socket files belong to it now. */
+    for (int i = 0; i < MAX_CLIENT_COUNT; i++)
+    {
+        if (0 != g_server.client_sockets[i])
+        {
+            close_client(g_server.client_sockets[i]);
+        }
+    }
+
+    if ('\0' != g_server.unix_path[0])
+    {
+        close(g_server.unix_socket);
+        g_server.unix_path[0] = '\0';
+    }
+    close(g_server.handoff_socket);
+    g_server.handoff_path[0] = '\0';
+
+    g_server.handed_off = 1;
+}
+
+static kvm_result_t accept_client(int listen_socket)
+{
+    int client_sock = accept(listen_socket, NULL, NULL);
+    if (-1 == client_sock)
     {
         return KVM_RESULT_SYS_CALL_FAIL;
     }
 
-    read_len = read(client_socket, request, request_size);
-    if (request_size != read_len)
+    stats_add(&stats_local()->connections_accepted, 1);
+    KVM_PROBE1(accept, client_sock);
+
+    if (listen_socket == g_server.server_socket)
     {
-        close_client(client_socket);
-        return KVM_RESULT_CONNECTION_FAIL;
+        /* Replies to pipelined requests are written one by one, Nagle's
+           algorithm would hold each of them until the previous is acknowledged. */
+        const int no_delay = 1;
+        setsockopt(client_sock, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
     }
 
-    uint32_t reply_size;
-    uint8_t * reply;
-    kvm_result_t result = handle_request(request_size, request, &reply_size, &reply);
+    int slot = -1;
+    for (int i = 0; i < MAX_CLIENT_COUNT; i++)
+    {
+        if (0 == g_server.client_sockets[i])
+        {
+            g_server.client_sockets[i] = client_sock;
+            slot = i;
+            break;
+        }
+    }
+
+    if (-1 == slot)
+    {
+        /* No room for the connection state. */
+        close(client_sock);
+        stats_add(&stats_local()->connections_closed, 1);
+    }
+    else
+    {
+        kvm_connection_t * connection = &g_server.connections[slot];
+        memset(connection, 0, sizeof(*connection));
+        connection->version = KVM_PROTOCOL_V1;
+        connection->is_unix = (listen_socket != g_server.server_socket);
+
+        FD_SET(client_sock, &g_server.readfds);
+
+        if (client_sock > g_server.max_fd)
+        {
+            g_server.max_fd = client_sock;
+        }
+    }
+
+    return KVM_RESULT_OK;
+}
+
+/* Polls the rings for up to shm_poll_ns, then tells the clients the server
+   is going to sleep. Returns non zero if a ring has requests. */
+static int shm_prepare_wait(void)
+{
+    const uint64_t start = (0 != g_server.shm_poll_ns) ? stats_clock_ns() : 0;
+    do
+    {
+        for (int i = 0; i < MAX_CLIENT_COUNT; i++)
+        {
+            if (NULL != g_server.connections[i].shm && kvm_shm_ring_readable(&g_server.connections[i].shm->request))
+            {
+                return 1;
+            }
+        }
+    } while (0 != g_server.shm_poll_ns && stats_clock_ns() - start < g_server.shm_poll_ns);
+
+    for (int i = 0; i < MAX_CLIENT_COUNT; i++)
+    {
+        if (NULL != g_server.connections[i].shm && kvm_shm_ring_prepare_wait(&g_server.connections[i].shm->request))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void shm_cancel_wait(void)
+{
+    for (int i = 0; i < MAX_CLIENT_COUNT; i++)
+    {
+        if (NULL != g_server.connections[i].shm)
+        {
+            kvm_shm_ring_cancel_wait(&g_server.connections[i].shm->request);
+        }
+    }
+}
+
+/* Maps the rings passed with the request. They are used for the frames
+   after the reply, see shm_activate(). */
+static kvm_result_t shm_attach(int index, const uint8_t * request, uint32_t request_size, kvm_shm_t ** shm)
+{
+    kvm_connection_t * connection = &g_server.connections[index];
+    kvm_request_shm_attach_t attach_req;
+
+    if (NULL != connection->shm || SHM_ATTACH_FD_COUNT != connection->passed_fd_count ||
+        sizeof(attach_req) != request_size)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+    memcpy(&attach_req, request, sizeof(attach_req));
+
+    kvm_shm_t * attached = (kvm_shm_t *) malloc(sizeof(*attached));
+    if (NULL == attached)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    const kvm_result_t result = kvm_shm_map(connection->passed_fds[0], kvm_util_transport_to_host32(attach_req.ring_size), attached);
     if (KVM_RESULT_OK != result)
     {
+        free(attached);
         return result;
     }
 
-    uint32_t wr_len = write(client_socket, &reply_size, sizeof(reply_size));
-    if (sizeof(request_size) != wr_len)
+    /* The wake descriptor is drained after select(), it must not block. */
+    const int wake_fd = connection->passed_fds[1];
+    fcntl(wake_fd, F_SETFL, fcntl(wake_fd, F_GETFL) | O_NONBLOCK);
+
+    close(connection->passed_fds[0]);
+    connection->passed_fd_count = 0;
+    attached->request.wake_fd = wake_fd;
+
+    *shm = attached;
+    return KVM_RESULT_OK;
+}
+
+static void shm_activate(int index, kvm_shm_t * shm)
+{
+    g_server.connections[index].shm = shm;
+    g_server.shm_count++;
+
+    FD_SET(shm->request.wake_fd, &g_server.readfds);
+    if (shm->request.wake_fd > g_server.max_fd)
     {
-        free(reply);
-        close_client(client_socket);
-        return KVM_RESULT_CONNECTION_FAIL;
+        g_server.max_fd = shm->request.wake_fd;
+    }
+}
+
+static void shm_release(kvm_shm_t * shm)
+{
+    FD_CLR(shm->request.wake_fd, &g_server.readfds);
+    close(shm->request.wake_fd);
+    kvm_shm_unmap(shm);
+    free(shm);
+}
+
+/* Reads from the socket, or from the request ring after SHM_ATTACH.
+   Descriptors passed over the Unix domain socket are kept for SHM_ATTACH. */
+static ssize_t receive(int index, uint8_t * buffer, uint32_t size)
+{
+    const int client_socket = g_server.client_sockets[index];
+    kvm_connection_t * connection = &g_server.connections[index];
+
+    if (NULL != connection->shm)
+    {
+        uint32_t read_len;
+        if (KVM_RESULT_OK != kvm_shm_ring_read(&connection->shm->request, buffer, size, &read_len))
+        {
+            return -1;
+        }
+        return read_len;
     }
 
-    wr_len = write(client_socket, reply, reply_size);
-    if (reply_size != wr_len)
+    if (!connection->is_unix)
+    {
+        return read(client_socket, buffer, size);
+    }
+
+    union
+    {
+        struct cmsghdr  header;
+        uint8_t         data[CMSG_SPACE(sizeof(int) * SHM_ATTACH_FD_COUNT)];
+    } control;
+
+    struct iovec iov;
+    iov.iov_base = buffer;
+    iov.iov_len = size;
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data;
+    msg.msg_controllen = sizeof(control.data);
+
+    const ssize_t read_len = recvmsg(client_socket, &msg, MSG_CMSG_CLOEXEC);
+    for (struct cmsghdr * cmsg = CMSG_FIRSTHDR(&msg); NULL != cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if (SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type)
+        {
+            continue;
+        }
+
+        for (uint8_t i = 0; i < connection->passed_fd_count; ++i)
+        {
+            close(connection->passed_fds[i]);
+        }
+        connection->passed_fd_count = 0;
+
+        const uint32_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+            if (i < SHM_ATTACH_FD_COUNT)
+            {
+                connection->passed_fds[connection->passed_fd_count++] = fd;
+            }
+            else
+            {
+                close(fd);
+            }
+        }
+    }
+
+    return read_len;
+}
+
+static kvm_result_t process_client(int index)
+{
+    const int client_socket = g_server.client_sockets[index];
+    kvm_connection_t * connection = &g_server.connections[index];
+
+    if (connection->capacity - connection->size < CONNECTION_READ_SIZE)
+    {
+        uint32_t capacity = connection->capacity * 2;
+        if (capacity < connection->size + CONNECTION_READ_SIZE)
+        {
+            capacity = connection->size + CONNECTION_READ_SIZE;
+        }
+
+        uint8_t * buffer = (uint8_t *) realloc(connection->buffer, capacity);
+        if (NULL == buffer)
+        {
+            close_client(client_socket);
+            return KVM_RESULT_SYS_CALL_FAIL;
+        }
+        connection->buffer = buffer;
+        connection->capacity = capacity;
+    }
+
+    /* Read whatever is available. A frame may arrive in parts and
+       several pipelined frames may arrive at once. */
+    const uint64_t read_start = stats_phase_now();
+    const uint64_t received_at = stats_clock_ns();
+    const ssize_t read_len = receive(index, connection->buffer + connection->size, connection->capacity - connection->size);
+    if (0 == read_len && NULL != connection->shm)
+    {
+        return KVM_RESULT_OK;
+    }
+    if (read_len <= 0)
     {
-        free(reply);
         close_client(client_socket);
         return KVM_RESULT_CONNECTION_FAIL;
     }
+    connection->size += read_len;
+    stats_add(&stats_local()->bytes_in, read_len);
+    stats_record_phase(KVM_STATS_PHASE_QUEUE, g_server.ready_at, read_start);
+    stats_record_phase(KVM_STATS_PHASE_READ, read_start, stats_phase_now());
+
+    uint32_t offset = 0;
+    while (offset < connection->size)
+    {
+        const uint64_t decode_start = stats_phase_now();
+        uint32_t header_size;
+        uint32_t frame_size;
+        kvm_result_t result = parse_frame_header(connection->version, connection->buffer + offset, connection->size - offset, &header_size, &frame_size);
+        if (KVM_RESULT_CONNECTION_FAIL == result)
+        {
+            /* Header is not complete yet. */
+            break;
+        }
+
+        if (KVM_RESULT_OK != result || frame_size > KVM_FRAME_MAX_SIZE)
+        {
+            close_client(client_socket);
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+
+        if (connection->size - offset - header_size < frame_size)
+        {
+            /* Frame is not complete yet. */
+            break;
+        }
+
+        KVM_PROBE3(frame_read, client_socket, frame_size, connection->version);
+        result = process_frame(index, connection->buffer + offset + header_size, frame_size, received_at, decode_start);
+        if (KVM_RESULT_OK != result)
+        {
+            close_client(client_socket);
+            return result;
+        }
+
+        offset += header_size + frame_size;
+    }
+
+    connection->size -= offset;
+    if (0 == connection->size && connection->capacity > CONNECTION_READ_SIZE * 2)
+    {
+        /* Do not keep memory of a large frame. */
+        free(connection->buffer);
+        connection->buffer = NULL;
+        connection->capacity = 0;
+    }
+    else if (0 != offset)
+    {
+        memmove(connection->buffer, connection->buffer + offset, connection->size);
+    }
 
     return KVM_RESULT_OK;
 }
 
+static kvm_result_t parse_frame_header(uint8_t version, const uint8_t * data, uint32_t size, uint32_t * header_size, uint32_t * frame_size)
+{
+    if (KVM_PROTOCOL_V1 == version)
+    {
+        if (size < sizeof(uint32_t))
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+
+        memcpy(frame_size, data, sizeof(uint32_t));
+        *frame_size = kvm_util_transport_to_host32(*frame_size);
+        *header_size = sizeof(uint32_t);
+        return KVM_RESULT_OK;
+    }
+
+    return kvm_varint_decode(data, size, frame_size, header_size);
+}
+
+/* The conversion buffers are allocated on first use and kept. */
+static uint8_t * convert_buffer(uint8_t ** buffer)
+{
+    if (NULL == *buffer)
+    {
+        *buffer = (uint8_t *) malloc(CONVERT_BUFFER_SIZE);
+    }
+    return *buffer;
+}
+
+/* Converts a v2 request in one pass into the kept buffer. A larger request
+   is measured by that pass and converted by a second one into its own. */
+static kvm_result_t decode_request(const uint8_t * data, uint32_t size, uint8_t ** request, uint32_t * request_size)
+{
+    uint8_t * decoded = convert_buffer(&g_server.request_buffer);
+    kvm_result_t result = (NULL != decoded) ? kvm_protocol_request_from_v2(data, size, decoded, CONVERT_BUFFER_SIZE, request_size) : KVM_RESULT_SYS_CALL_FAIL;
+    if (KVM_RESULT_OK == result && *request_size > CONVERT_BUFFER_SIZE)
+    {
+        decoded = (uint8_t *) malloc(*request_size);
+        result = (NULL != decoded) ? kvm_protocol_request_from_v2(data, size, decoded, *request_size, request_size) : KVM_RESULT_SYS_CALL_FAIL;
+        if (KVM_RESULT_OK != result)
+        {
+            free(decoded);
+        }
+    }
+
+    if (KVM_RESULT_OK == result)
+    {
+        *request = decoded;
+    }
+    return result;
+}
+
+static kvm_result_t process_frame(int index, const uint8_t * frame, uint32_t frame_size, uint64_t received_at, uint64_t decode_start)
+{
+    const int client_socket = g_server.client_sockets[index];
+    kvm_connection_t * connection = &g_server.connections[index];
+    const uint8_t version = connection->version;
+
+    const uint8_t * request = frame;
+    uint32_t request_size = frame_size;
+    uint8_t * decoded = NULL;
+    uint8_t status = KVM_REPLY_BAD_REQUEST;
+
+    if (KVM_PROTOCOL_V2 == version)
+    {
+        if (0 == frame_size)
+        {
+            /* Flags are missing. */
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+
+        const uint8_t flags = frame[0];
+        request = NULL;
+
+        if (KVM_FRAME_FLAGS_NONE == flags)
+        {
+            const kvm_result_t result = decode_request(frame + 1, frame_size - 1, &decoded, &request_size);
+            if (KVM_RESULT_OK == result)
+            {
+                request = decoded;
+            }
+            else if (KVM_RESULT_SYS_CALL_FAIL == result)
+            {
+                status = KVM_REPLY_SYS_FAIL;
+            }
+        }
+    }
+
+    kvm_request_id_t id = KVM_REQUST_NOOP;
+    uint32_t reply_size = sizeof(status);
+    uint8_t * reply = NULL;
+    kvm_shm_t * shm = NULL;
+
+    if (NULL != request && 0 != request_size && KVM_REQUST_SHM_ATTACH == ((const kvm_request_generic_t *) request)->id)
+    {
+        /* Connection level request, the storage is not involved. */
+        id = KVM_REQUST_SHM_ATTACH;
+        status = (KVM_RESULT_OK == shm_attach(index, request + sizeof(kvm_request_generic_t),
+            request_size - sizeof(kvm_request_generic_t), &shm)) ? KVM_REPLY_STATUS_OK : KVM_REPLY_BAD_REQUEST;
+    }
+    else if (NULL != request && 0 != request_size)
+    {
+        stats_record_phase(KVM_STATS_PHASE_DECODE, decode_start, stats_phase_now());
+        slowlog_set_client(client_socket);
+        stream_set_client(client_socket);
+        id = ((const kvm_request_generic_t *) request)->id;
+        if (KVM_RESULT_OK != handle_request(request_size, request, &reply_size, &reply))
+        {
+            reply = NULL;
+            reply_size = sizeof(status);
+            status = KVM_REPLY_SYS_FAIL;
+        }
+    }
+
+    kvm_result_t result = send_reply(index, version, id, (NULL != reply) ? reply : &status, reply_size, stats_phase_now());
+    KVM_PROBE3(reply_write, client_socket, reply_size, result);
+
+    if (NULL != shm)
+    {
+        /* The rings carry the frames after the reply. */
+        if (KVM_RESULT_OK == result)
+        {
+            shm_activate(index, shm);
+        }
+        else
+        {
+            shm_release(shm);
+        }
+    }
+
+    if (SLOWLOG_DISABLED != slowlog_threshold_ns && NULL != request && 0 != request_size && KVM_REQUST_SHM_ATTACH != id)
+    {
+        /* From the read completing the request, pipelined frames include
+           the time spent on frames before them. */
+        const uint64_t duration = stats_clock_ns() - received_at;
+        if (slowlog_is_slow(duration))
+        {
+            slowlog_record(KVM_SLOWLOG_END_TO_END, request, request_size, reply_size, duration);
+        }
+    }
+
+    if (decoded != g_server.request_buffer)
+    {
+        free(decoded);
+    }
+
+    if (KVM_RESULT_OK == result && KVM_REQUST_HELLO == id &&
+        sizeof(kvm_reply_generic_t) + sizeof(kvm_reply_hello_t) == reply_size &&
+        KVM_REPLY_STATUS_OK == ((kvm_reply_generic_t *) reply)->status)
+    {
+        /* Negotiated version applies to the frames after HELLO reply. */
+        connection->version = ((kvm_reply_hello_t *) (reply + sizeof(kvm_reply_generic_t)))->version;
+    }
+
+    free(reply);
+    return result;
+}
+
+static kvm_result_t send_reply(int index, uint8_t version, kvm_request_id_t id, const uint8_t * reply, uint32_t reply_size, uint64_t reply_start)
+{
+    uint8_t header[KVM_FRAME_V2_HEADER_MAX_SIZE];
+
+    if (KVM_PROTOCOL_V1 == version)
+    {
+        const uint32_t size = kvm_util_host_to_transport32(reply_size);
+        memcpy(header, &size, sizeof(size));
+
+        const uint64_t write_start = stats_phase_now();
+        stats_record_phase(KVM_STATS_PHASE_REPLY, reply_start, write_start);
+        const kvm_result_t result = write_frame(index, header, sizeof(size), reply, reply_size);
+        stats_record_phase(KVM_STATS_PHASE_WRITE, write_start, stats_phase_now());
+        return result;
+    }
+
+    /* A single pass into the kept buffer, or one sized by the bound. */
+    uint32_t capacity = KVM_PROTOCOL_V2_MAX_SIZE(reply_size);
+    uint8_t * encoded = NULL;
+    if (capacity <= CONVERT_BUFFER_SIZE)
+    {
+        capacity = CONVERT_BUFFER_SIZE;
+        encoded = convert_buffer(&g_server.reply_buffer);
+    }
+    else
+    {
+        encoded = (uint8_t *) malloc(capacity);
+    }
+
+    uint32_t encoded_size;
+    if (NULL == encoded || KVM_RESULT_OK != kvm_protocol_reply_to_v2(id, reply, reply_size, encoded, capacity, &encoded_size))
+    {
+        if (encoded != g_server.reply_buffer)
+        {
+            free(encoded);
+        }
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    uint32_t header_size = kvm_varint_encode(encoded_size + 1, header);
+    header[header_size++] = KVM_FRAME_FLAGS_NONE;
+
+    const uint64_t write_start = stats_phase_now();
+    stats_record_phase(KVM_STATS_PHASE_REPLY, reply_start, write_start);
+    const kvm_result_t result = write_frame(index, header, header_size, encoded, encoded_size);
+    stats_record_phase(KVM_STATS_PHASE_WRITE, write_start, stats_phase_now());
+
+    if (encoded != g_server.reply_buffer)
+    {
+        free(encoded);
+    }
+
+    return result;
+}
+
+static kvm_result_t write_frame(int index, const uint8_t * header, uint32_t header_size, const uint8_t * body, uint32_t body_size)
+{
+    const int client_socket = g_server.client_sockets[index];
+    kvm_shm_t * shm = g_server.connections[index].shm;
+
+    if (NULL != shm)
+    {
+        kvm_result_t result = write_shm(&shm->reply, header, header_size);
+        if (KVM_RESULT_OK == result)
+        {
+            result = write_shm(&shm->reply, body, body_size);
+        }
+        return result;
+    }
+
+    struct iovec iov[2];
+    iov[0].iov_base = (void *) header;
+    iov[0].iov_len = header_size;
+    iov[1].iov_base = (void *) body;
+    iov[1].iov_len = body_size;
+
+    /* Header and body go in a single system call. */
+    struct iovec * current = iov;
+    int count = 2;
+    while (0 != count)
+    {
+        ssize_t written = writev(client_socket, current, count);
+        if (written <= 0)
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+        stats_add(&stats_local()->bytes_out, written);
+
+        while (0 != count && (size_t) written >= current->iov_len)
+        {
+            written -= current->iov_len;
+            current++;
+            count--;
+        }
+
+        if (0 != count)
+        {
+            current->iov_base = (uint8_t *) current->iov_base + written;
+            current->iov_len -= written;
+        }
+    }
+
+    return KVM_RESULT_OK;
+}
+
+static kvm_result_t write_shm(kvm_shm_ring_t * ring, const uint8_t * data, uint32_t size)
+{
+    while (0 != size)
+    {
+        uint32_t written;
+        if (KVM_RESULT_OK != kvm_shm_ring_write(ring, data, size, &written))
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+        stats_add(&stats_local()->bytes_out, written);
+        data += written;
+        size -= written;
+
+        /* A large reply is streamed while the client reads it. */
+        if (0 != size && KVM_RESULT_OK != kvm_shm_ring_wait_writable(ring, g_server.shm_poll_ns, SHM_WRITE_TIMEOUT_MS))
+        {
+            return KVM_RESULT_CONNECTION_FAIL;
+        }
+    }
+
+    return KVM_RESULT_OK;
+}
+
+static void release_connection(kvm_connection_t * connection)
+{
+    free(connection->buffer);
+
+    for (uint8_t i = 0; i < connection->passed_fd_count; ++i)
+    {
+        close(connection->passed_fds[i]);
+    }
+
+    if (NULL != connection->shm)
+    {
+        shm_release(connection->shm);
+        g_server.shm_count--;
+    }
+
+    memset(connection, 0, sizeof(*connection));
+}
+
 static void close_client(int client_socket)
 {
+    KVM_PROBE1(close, client_socket);
     close(client_socket);
+    stats_add(&stats_local()->connections_closed, 1);
 
     FD_CLR(client_socket, &g_server.readfds);
+    stream_release_client(client_socket);
 
     for (int i = 0; i < MAX_CLIENT_COUNT; i++)
     {
@@ -224,6 +1289,7 @@ static void close_client(int client_socket)
         if (g_server.client_sockets[i] == client_socket)
         {
             g_server.client_sockets[i] = 0;
+            release_connection(&g_server.connections[i]);
         }
     }
 }
\ No newline at end of file
@@ -10,7 +10,10 @@
 #define __kvm_server_internal_h__
 
 #include <sys/select.h>
+#include <sys/un.h>
 #include "kvm_results.h"
+#include "kvm_shm.h"
+#include "kvm_storage.h"
 
 #ifdef __cplusplus
 extern "C"
@@ -19,19 +22,63 @@ extern "C"
 
 #define MAX_CLIENT_COUNT 64
 
+/* Maximum number of expired keys reaped per event loop iteration */
+#define EXPIRE_CYCLE_BUDGET 256
+
+/* Event loop wake up period while there are keys with TTL */
+#define EXPIRE_CYCLE_PERIOD_MS 10
+
+/* Minimum free space in connection receive buffer before each read */
+#define CONNECTION_READ_SIZE 4096
+
+/* v2 requests and replies are converted in buffers of this size kept
+   between frames, larger ones in their own */
+#define CONVERT_BUFFER_SIZE (64 * 1024)
+
+/* Descriptors passed with KVM_REQUST_SHM_ATTACH: memfd and eventfd */
+#define SHM_ATTACH_FD_COUNT 2
+
+/* A client not draining its reply ring for this long is disconnected */
+#define SHM_WRITE_TIMEOUT_MS 1000
+
+/* Client connection state */
+typedef struct kvm_connection_s
+{
+    uint8_t     version;    /* KVM_PROTOCOL_VXXX of the frames */
+    uint8_t *   buffer;     /* Received data not processed yet */
+    uint32_t    size;
+    uint32_t    capacity;
+    uint8_t     is_unix;    /* Accepted on the Unix domain socket, may pass descriptors */
+    uint8_t     passed_fd_count;
+    int         passed_fds[SHM_ATTACH_FD_COUNT];    /* Received with the last message */
+    kvm_shm_t * shm;        /* Frames go through the rings after KVM_REQUST_SHM_ATTACH */
+} kvm_connection_t;
+
 typedef struct kvm_server_s
 {
     int server_socket;
+    int unix_socket;        /* Valid if unix_path is not empty */
+    char unix_path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
 
     fd_set readfds;
     int max_fd;
 
     int client_sockets[MAX_CLIENT_COUNT];
     int active_client_sockets[MAX_CLIENT_COUNT];
-} kvm_server_t;
+    kvm_connection_t connections[MAX_CLIENT_COUNT];
+    uint64_t ready_at;      /* stats_phase_now() when select() reported the sockets */
 
-kvm_result_t init_apr_hashtable(void);
-void uninit_apr_hashtable(void);
+    int shm_count;          /* Connections using shared memory rings */
+    uint64_t shm_poll_ns;   /* Time to poll the rings before sleeping in select() */
+
+    int handoff_socket;     /* Valid if handoff_path is not empty */
+    char handoff_path[sizeof(((struct sockaddr_un *) 0)->sun_path)];
+    int handed_off;         /* Sockets and pairs belong to a new process */
+    uint16_t metrics_port;  /* Restarted if a handoff fails */
+
+    uint8_t * request_buffer;   /* v1 request converted from the v2 frame, see CONVERT_BUFFER_SIZE */
+    uint8_t * reply_buffer;     /* v2 reply being written */
+} kvm_server_t;
 
 kvm_result_t handle_request(uint32_t request_size, const uint8_t * request, uint32_t * reply_size, uint8_t ** reply);
 
@@ -0,0 +1,218 @@
+/**
+* @file kvm_server_stats.c
+*
+* @brief The module contains server statistics recording implementation.
+*
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+#include "kvm_server.h"
+#include "kvm_server_stats.h"
+#include "kvm_storage.h"
+
+typedef struct stats_block_s
+{
+    kvm_stats_t             stats;
+    struct stats_block_s *  next;
+} stats_block_t;
+
+__thread kvm_stats_t * stats_thread_block = NULL;
+
+kvm_phase_clock_t stats_phase_clock = KVM_PHASE_CLOCK_NONE;
+
+/* Nanoseconds per time stamp counter tick, 32.32 fixed point */
+static uint64_t tsc_ns_mult;
+
+/* Blocks are never freed: counters of finished threads still count. */
+static stats_block_t * blocks = NULL;
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+kvm_stats_t * stats_register_thread(void)
+{
+    stats_block_t * block = (stats_block_t *) calloc(1, sizeof(stats_block_t));
+    if (NULL == block)
+    {
+        /* Recording is best effort, an out of memory server keeps serving. */
+        static __thread kvm_stats_t discard;
+        return &discard;
+    }
+
+    pthread_mutex_lock(&blocks_lock);
+    block->next = blocks;
+    blocks = block;
+    pthread_mutex_unlock(&blocks_lock);
+
+    stats_thread_block = &block->stats;
+    return stats_thread_block;
+}
+
+uint64_t stats_clock_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int tsc_is_invariant(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx))
+    {
+        /* Constant rate in all ACPI P-, C- and T-states */
+        return 0 != (edx & (1u << 8));
+    }
+#endif
+    return 0;
+}
+
+kvm_phase_clock_t stats_phase_configure(kvm_phase_clock_t clock)
+{
+    if (KVM_PHASE_CLOCK_TSC == clock && !tsc_is_invariant())
+    {
+        clock = KVM_PHASE_CLOCK_COARSE;
+    }
+
+    if (KVM_PHASE_CLOCK_TSC == clock)
+    {
+        stats_phase_clock = KVM_PHASE_CLOCK_TSC;
+
+        const uint64_t start_ns = stats_clock_ns();
+        const uint64_t start_ticks = stats_phase_now();
+        const struct timespec wait = {0, 10000000};
+        nanosleep(&wait, NULL);
+        const uint64_t ns = stats_clock_ns() - start_ns;
+        const uint64_t ticks = stats_phase_now() - start_ticks;
+
+        if (0 == ticks)
+        {
+            clock = KVM_PHASE_CLOCK_COARSE;
+        }
+        else
+        {
+            tsc_ns_mult = (uint64_t) (((unsigned __int128) ns << 32) / ticks);
+        }
+    }
+
+    stats_phase_clock = clock;
+    return clock;
+}
+
+void stats_record_phase(uint32_t phase, uint64_t start, uint64_t end)
+{
+    if (KVM_PHASE_CLOCK_NONE == stats_phase_clock || phase >= KVM_STATS_PHASES)
+    {
+        return;
+    }
+
+    /* Counters of different cores may be slightly apart. */
+    uint64_t duration_ns = (end > start) ? end - start : 0;
+    if (KVM_PHASE_CLOCK_TSC == stats_phase_clock)
+    {
+        duration_ns = (uint64_t) (((unsigned __int128) duration_ns * tsc_ns_mult) >> 32);
+    }
+
+    kvm_stats_t * stats = stats_local();
+    stats_add(&stats->phase_sum[phase], duration_ns);
+    stats_add(&stats->phase[phase][kvm_histogram_index(duration_ns)], 1);
+}
+
+void stats_record_request(kvm_request_id_t id, uint64_t duration_ns)
+{
+    if (id >= KVM_STATS_MAX_OPS)
+    {
+        return;
+    }
+
+    kvm_stats_t * stats = stats_local();
+    const uint32_t index = kvm_histogram_index(duration_ns);
+    stats_add(&stats->requests[id], 1);
+    stats_add(&stats->latency_sum[id], duration_ns);
+    stats_add(&stats->latency[id][index], 1);
+
+    /* Handler time is already measured, the execute phase reuses it. */
+    if (KVM_PHASE_CLOCK_NONE != stats_phase_clock)
+    {
+        stats_add(&stats->phase_sum[KVM_STATS_PHASE_EXECUTE], duration_ns);
+        stats_add(&stats->phase[KVM_STATS_PHASE_EXECUTE][index], 1);
+    }
+}
+
+static void sum(uint64_t * total, const uint64_t * counters, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        total[i] += __atomic_load_n(&counters[i], __ATOMIC_RELAXED);
+    }
+}
+
+void stats_aggregate(kvm_stats_t * stats)
+{
+    memset(stats, 0, sizeof(*stats));
+
+    pthread_mutex_lock(&blocks_lock);
+    for (const stats_block_t * block = blocks; NULL != block; block = block->next)
+    {
+        const kvm_stats_t * s = &block->stats;
+
+        sum(stats->requests, s->requests, KVM_STATS_MAX_OPS);
+        sum(&stats->hits, &s->hits, 1);
+        sum(&stats->misses, &s->misses, 1);
+        sum(&stats->bytes_in, &s->bytes_in, 1);
+        sum(&stats->bytes_out, &s->bytes_out, 1);
+        sum(&stats->connections_accepted, &s->connections_accepted, 1);
+        sum(&stats->connections_closed, &s->connections_closed, 1);
+        sum(&stats->keys, &s->keys, 1);
+        sum(&stats->used_memory, &s->used_memory, 1);
+        sum(&stats->evicted_keys, &s->evicted_keys, 1);
+        sum(&stats->decompression_time_ns, &s->decompression_time_ns, 1);
+        sum(stats->latency_sum, s->latency_sum, KVM_STATS_MAX_OPS);
+        sum(&stats->latency[0][0], &s->latency[0][0], KVM_STATS_MAX_OPS * KVM_HISTOGRAM_BUCKETS);
+        sum(stats->phase_sum, s->phase_sum, KVM_STATS_PHASES);
+        sum(&stats->phase[0][0], &s->phase[0][0], KVM_STATS_PHASES * KVM_HISTOGRAM_BUCKETS);
+    }
+    pthread_mutex_unlock(&blocks_lock);
+}
+
+uint64_t stats_decompression_time(void)
+{
+    uint64_t total = 0;
+
+    pthread_mutex_lock(&blocks_lock);
+    for (const stats_block_t * block = blocks; NULL != block; block = block->next)
+    {
+        sum(&total, &block->stats.decompression_time_ns, 1);
+    }
+    pthread_mutex_unlock(&blocks_lock);
+
+    return total;
+}
+
+void stats_publish_storage(void)
+{
+    kvm_server_storage_stats_t storage;
+    storage_get_stats(&storage);
+
+    kvm_stats_t * stats = stats_local();
+    __atomic_store_n(&stats->keys, storage_count(), __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->used_memory, storage.used_memory, __ATOMIC_RELAXED);
+    __atomic_store_n(&stats->evicted_keys, storage.evicted_keys, __ATOMIC_RELAXED);
+}
+
+void stats_reset(void)
+{
+    pthread_mutex_lock(&blocks_lock);
+    for (stats_block_t * block = blocks; NULL != block; block = block->next)
+    {
+        memset(&block->stats, 0, sizeof(block->stats));
+    }
+    pthread_mutex_unlock(&blocks_lock);
+}
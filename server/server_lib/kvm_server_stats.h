@@ -0,0 +1,150 @@
+/**
+ * @file kvm_server_stats.h
+ *
+ * @brief Defines server statistics recording.
+ *
+ * Every thread records into its own kvm_stats_t block, so the hot path
+ * takes no locks and uses no atomic read-modify-write. Blocks are
+ * registered once per thread and summed when statistics are read.
+ *
+ */
+
+#ifndef __kvm_server_stats_h__
+#define __kvm_server_stats_h__
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "kvm_requests.h"
+#include "kvm_stats.h"
+#include "kvm_server.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* Block of the current thread, NULL until the thread records anything */
+extern __thread kvm_stats_t * stats_thread_block;
+
+kvm_stats_t * stats_register_thread(void);
+
+static inline kvm_stats_t * stats_local(void)
+{
+    kvm_stats_t * block = stats_thread_block;
+    return (NULL != block) ? block : stats_register_thread();
+}
+
+/* Only the owning thread writes the counter; the relaxed store keeps
+   concurrent readers from seeing torn values. */
+static inline void stats_add(uint64_t * counter, uint64_t value)
+{
+    __atomic_store_n(counter, *counter + value, __ATOMIC_RELAXED);
+}
+
+/*!
+*******************************************************************************
+** Gets monotonic time used for latency measurement.
+**
+** @return
+**      - Time in nanoseconds.
+*/
+uint64_t stats_clock_ns(void);
+
+/* Clock in use for request phases, KVM_PHASE_CLOCK_NONE until configured */
+extern kvm_phase_clock_t stats_phase_clock;
+
+/* Phase timestamp in clock specific units, 0 if phases are not measured.
+   Only differences of two timestamps are meaningful. */
+static inline uint64_t stats_phase_now(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (KVM_PHASE_CLOCK_TSC == stats_phase_clock)
+    {
+        return __rdtsc();
+    }
+#endif
+
+    if (KVM_PHASE_CLOCK_COARSE == stats_phase_clock)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+    }
+
+    return 0;
+}
+
+/*!
+*******************************************************************************
+** Selects the clock of request phase timestamps. Calibrates the time stamp
+** counter against CLOCK_MONOTONIC, which takes about 10 ms.
+**
+** @param[in]   clock   Requested clock.
+**
+** @return
+**      - Clock in use, KVM_PHASE_CLOCK_COARSE if the time stamp counter was
+**        requested but it is not invariant or not available.
+*/
+kvm_phase_clock_t stats_phase_configure(kvm_phase_clock_t clock);
+
+/*!
+*******************************************************************************
+** Records time spent in a request processing phase.
+**
+** @param[in]   phase   KVM_STATS_PHASE_XXX.
+** @param[in]   start   stats_phase_now() at the phase start.
+** @param[in]   end     stats_phase_now() at the phase end.
+*/
+void stats_record_phase(uint32_t phase, uint64_t start, uint64_t end);
+
+/*!
+*******************************************************************************
+** Records a handled request.
+**
+** @param[in]   id          Request id.
+** @param[in]   duration_ns Time spent in request handler.
+*/
+void stats_record_request(kvm_request_id_t id, uint64_t duration_ns);
+
+/*!
+*******************************************************************************
+** Copies storage figures (keys, memory, evictions) into the block of the
+** calling thread. Called by the thread owning the storage, so readers on
+** other threads never touch the storage itself.
+*/
+void stats_publish_storage(void);
+
+/*!
+*******************************************************************************
+** Sums statistics of all threads. Safe to call from any thread.
+**
+** @param[out]  stats   Pointer where statistics will be stored.
+*/
+void stats_aggregate(kvm_stats_t * stats);
+
+/*!
+*******************************************************************************
+** Sums the time all threads spent decompressing values. Safe to call from
+** any thread.
+**
+** @return
+**      - Time in nanoseconds.
+*/
+uint64_t stats_decompression_time(void);
+
+/*!
+*******************************************************************************
+** Clears statistics of all threads.
+*/
+void stats_reset(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __kvm_server_stats_h__ */
@@ -0,0 +1,133 @@
+/**
+* @file kvm_slowlog.c
+*
+* @brief The module contains the slow request log implementation.
+*
+*/
+
+#include <string.h>
+#include <time.h>
+
+#include "kvm_utils.h"
+#include "kvm_slowlog.h"
+
+uint64_t slowlog_threshold_ns = SLOWLOG_DISABLED;
+
+static kvm_slowlog_entry_t entries[SLOWLOG_SIZE];
+static uint32_t next_index;     /* Where the next entry goes */
+static uint32_t entry_count;
+static uint64_t next_id;
+static int current_client = -1;
+
+/* Size of the fields preceding the key, 0 for requests without a key.
+   The first field of all of them is the key size. */
+static uint32_t key_offset(kvm_request_id_t id)
+{
+    switch (id)
+    {
+        case KVM_REQUST_GET:
+        case KVM_REQUST_DELETE:
+        case KVM_REQUST_TTL:
+        case KVM_REQUST_GET_ENCODED:
+        case KVM_REQUST_GET_VERSIONED:
+            return sizeof(kvm_request_by_key_t);
+        case KVM_REQUST_PUT:
+        case KVM_REQUST_APPEND:
+        case KVM_REQUST_GETSET:
+            return sizeof(kvm_request_put_t);
+        case KVM_REQUST_INCR:
+            return sizeof(kvm_request_incr_t);
+        case KVM_REQUST_EXPIRE:
+            return sizeof(kvm_request_expire_t);
+        case KVM_REQUST_PUT_TTL:
+            return sizeof(kvm_request_put_ttl_t);
+        case KVM_REQUST_PUT_BEGIN:
+            return sizeof(kvm_request_put_begin_t);
+        case KVM_REQUST_GET_RANGE:
+            return sizeof(kvm_request_get_range_t);
+        case KVM_REQUST_PUT_IF:
+            return sizeof(kvm_request_put_if_t);
+        case KVM_REQUST_DELETE_IF:
+            return sizeof(kvm_request_delete_if_t);
+        default:
+            return 0;
+    }
+}
+
+void slowlog_configure(uint64_t threshold_ns)
+{
+    slowlog_threshold_ns = threshold_ns;
+    slowlog_reset();
+}
+
+void slowlog_set_client(int fd)
+{
+    current_client = fd;
+}
+
+void slowlog_record(uint8_t kind, const uint8_t * request, uint32_t request_size, uint32_t reply_size, uint64_t duration_ns)
+{
+    kvm_slowlog_entry_t * entry = &entries[next_index];
+    next_index = (next_index + 1) % SLOWLOG_SIZE;
+    if (entry_count < SLOWLOG_SIZE)
+    {
+        entry_count++;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    entry->id = next_id++;
+    entry->timestamp_ms = (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+    entry->duration_ns = duration_ns;
+    entry->kind = kind;
+    entry->op = (0 != request_size) ? request[0] : KVM_REQUST_NOOP;
+    entry->fd = current_client;
+    entry->key_size = 0;
+    entry->request_size = request_size;
+    entry->reply_size = reply_size;
+    entry->prefix_size = 0;
+
+    const uint32_t offset = sizeof(kvm_request_generic_t) + key_offset(entry->op);
+    if (offset > sizeof(kvm_request_generic_t) && request_size >= offset)
+    {
+        uint32_t key_size;
+        memcpy(&key_size, request + sizeof(kvm_request_generic_t), sizeof(key_size));
+        entry->key_size = kvm_util_transport_to_host32(key_size);
+
+        /* Malformed requests are logged too, keep what is there. */
+        uint32_t prefix_size = request_size - offset;
+        if (prefix_size > entry->key_size)
+        {
+            prefix_size = entry->key_size;
+        }
+        if (prefix_size > KVM_SLOWLOG_KEY_PREFIX)
+        {
+            prefix_size = KVM_SLOWLOG_KEY_PREFIX;
+        }
+
+        memcpy(entry->key_prefix, request + offset, prefix_size);
+        entry->prefix_size = prefix_size;
+    }
+}
+
+uint32_t slowlog_count(void)
+{
+    return entry_count;
+}
+
+const kvm_slowlog_entry_t * slowlog_get(uint32_t index)
+{
+    if (index >= entry_count)
+    {
+        return NULL;
+    }
+
+    return &entries[(next_index + SLOWLOG_SIZE - 1 - index) % SLOWLOG_SIZE];
+}
+
+void slowlog_reset(void)
+{
+    next_index = 0;
+    entry_count = 0;
+}
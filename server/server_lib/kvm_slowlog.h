@@ -0,0 +1,97 @@
+/**
+ * @file kvm_slowlog.h
+ *
+ * @brief Defines the slow request log.
+ *
+ * Requests exceeding the threshold are kept in a fixed size ring, newest
+ * overwriting oldest. Recording does not allocate. The ring belongs to
+ * the request loop thread.
+ *
+ */
+
+#ifndef __kvm_slowlog_h__
+#define __kvm_slowlog_h__
+
+#include <stdint.h>
+
+#include "kvm_requests.h"
+#include "kvm_stats.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* Number of entries kept */
+#define SLOWLOG_SIZE 128
+
+/* Threshold value disabling the log */
+#define SLOWLOG_DISABLED UINT64_MAX
+
+/* Current threshold, requests taking longer are logged */
+extern uint64_t slowlog_threshold_ns;
+
+static inline int slowlog_is_slow(uint64_t duration_ns)
+{
+    return duration_ns > slowlog_threshold_ns;
+}
+
+/*!
+*******************************************************************************
+** Sets the threshold and clears the log.
+**
+** @param[in]   threshold_ns    Threshold or SLOWLOG_DISABLED.
+*/
+void slowlog_configure(uint64_t threshold_ns);
+
+/*!
+*******************************************************************************
+** Sets the client socket recorded with entries of the following requests.
+**
+** @param[in]   fd      Client socket or -1.
+*/
+void slowlog_set_client(int fd);
+
+/*!
+*******************************************************************************
+** Records a slow request.
+**
+** @param[in]   kind            KVM_SLOWLOG_XXX.
+** @param[in]   request         v1 request, starting with the request id.
+** @param[in]   request_size    Size of the request.
+** @param[in]   reply_size      Size of the reply.
+** @param[in]   duration_ns     Measured time.
+*/
+void slowlog_record(uint8_t kind, const uint8_t * request, uint32_t request_size, uint32_t reply_size, uint64_t duration_ns);
+
+/*!
+*******************************************************************************
+** Gets number of entries in the log.
+**
+** @return
+**      - Number of entries, at most SLOWLOG_SIZE.
+*/
+uint32_t slowlog_count(void);
+
+/*!
+*******************************************************************************
+** Gets the log entry.
+**
+** @param[in]   index   Entry index, 0 is the newest.
+**
+** @return
+**      - Entry or NULL if index is out of range.
+*/
+const kvm_slowlog_entry_t * slowlog_get(uint32_t index);
+
+/*!
+*******************************************************************************
+** Removes all entries.
+*/
+void slowlog_reset(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __kvm_slowlog_h__ */
@@ -0,0 +1,1327 @@
+/**
+* @file kvm_storage.c
+*
+* @brief The module contains key/value storage implementation.
+*
+* Entries live in a chained hash table. Each entry is a single allocation
+* holding the header, the key and the value, so a lookup touches one
+* bucket pointer and the entries of its chain only.
+*
+* The event loop is the only writer. storage_lookup() may run on any thread
+* inside an epoch critical section: entries are published with release
+* stores and retired instead of freed (see kvm_epoch.h). Growing the table
+* relinks live entries, readers which miss during it retry.
+*
+*/
+
+#include <errno.h>
+#include <inttypes.h>
+#include <malloc.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+
+#include "kvm_replies.h"
+#include "kvm_epoch.h"
+#include "kvm_hash.h"
+#include "kvm_lz4.h"
+#include "kvm_storage.h"
+#include "kvm_server_stats.h"
+
+/* LFU counter parameters */
+#define LFU_INIT_VALUE      5
+#define LFU_LOG_FACTOR      10
+#define LFU_DECAY_MINUTES   1
+
+/* LRU access time is refreshed when it is this much out of date, so a hot
+   entry's cache line is written about once a second, not on every read. */
+#define LRU_TOUCH_MS        1000
+
+#define ENTRY_FOOTPRINT(entry) (sizeof(kvm_entry_t) + (entry)->key_size + (entry)->value_size)
+
+/* Longest decimal int64_t, "-9223372036854775808" */
+#define INTEGER_MAX_DIGITS  20
+
+/* Undo records a single operation can log: expired entry found, replaced
+   entry removed to evict, evictions and the new entry linked */
+#define UNDO_RECORDS_PER_OP (EVICTION_PUT_BUDGET + 4)
+
+typedef enum
+{
+    UNDO_LINK,      /* entry linked for a new key */
+    UNDO_REPLACE,   /* old replaced by entry */
+    UNDO_UNLINK,    /* entry removed */
+    UNDO_GROW,      /* entry value appended in place */
+    UNDO_TTL        /* entry expiration changed */
+} undo_kind_t;
+
+typedef struct undo_record_s
+{
+    undo_kind_t     kind;
+    kvm_entry_t *   entry;
+    kvm_entry_t *   old;
+    uint64_t        expire_at;  /* UNDO_TTL */
+    uint64_t        version;    /* UNDO_GROW */
+    uint32_t        value_size; /* UNDO_GROW */
+} undo_record_t;
+
+/* Hash table. Doubles when the number of entries exceeds the number of buckets. */
+static kvm_entry_t **   buckets = NULL;
+static uint32_t         bucket_mask = 0;
+static uint32_t         entry_count = 0;
+
+/* Odd while grow_buckets() relinks entries. */
+static uint32_t         resize_seq = 0;
+
+/* Per process random seed, so colliding keys can not be crafted up front. */
+static uint64_t         hash_seed = 0;
+
+kvm_timer_wheel_t expire_wheel;
+
+static uint64_t                 used_memory = 0;
+static uint64_t                 reserved_memory = 0;    /* Entries of chunked PUTs in progress */
+static uint64_t                 key_memory = 0;         /* Key data of linked entries */
+static uint64_t                 allocated_memory = 0;   /* Allocations of linked entries, as sized by the allocator */
+static uint64_t                 max_memory = 0;
+static kvm_eviction_policy_t    eviction_policy = KVM_EVICTION_NONE;
+static uint64_t                 evicted_keys = 0;
+static uint64_t                 rejected_puts = 0;
+static uint64_t                 appended_in_place = 0;
+
+/* Version of the last stored value */
+static uint64_t                 last_version = 0;
+
+/* Undo log of the open batch */
+static int                      batch_open = 0;
+static undo_record_t *          undo_log = NULL;
+static uint32_t                 undo_count = 0;
+static uint32_t                 undo_capacity = 0;
+
+/* Compression */
+static uint32_t compression_threshold = 0;
+static uint64_t compressed_values = 0;
+static uint64_t compression_input_bytes = 0;
+static uint64_t compression_output_bytes = 0;
+static uint64_t compression_time_ns = 0;
+
+/* Per thread, readers update LFU counters as well. */
+static __thread uint64_t random_state = 0x9E3779B97F4A7C15ULL;
+
+static uint32_t hash_key(const uint8_t * key, uint32_t key_size);
+static kvm_entry_t * lookup(const uint8_t * key, uint32_t key_size, uint32_t hash);
+static void grow_buckets(void);
+static void init_entry(kvm_entry_t * entry, uint32_t hash, uint32_t ttl, uint64_t now);
+static void replace_entry(kvm_entry_t * old, kvm_entry_t * entry);
+static void unlink_entry(kvm_entry_t * entry);
+static void set_ttl(kvm_entry_t * entry, uint32_t ttl, uint64_t now);
+static kvm_result_t grow_undo_log(void);
+static undo_record_t * log_undo(undo_kind_t kind, kvm_entry_t * entry);
+static void undo(const undo_record_t * record);
+static void link_entry(kvm_entry_t * entry);
+static void on_entry_expired(void * context, kvm_timer_t * timer);
+static uint32_t lfu_minutes(uint64_t now);
+static uint32_t lfu_decayed_counter(const kvm_entry_t * entry, uint64_t now);
+static void touch_entry(kvm_entry_t * entry, uint64_t now);
+static uint64_t eviction_score(const kvm_entry_t * entry, uint64_t now);
+static kvm_entry_t * sample_entry(void);
+static int evict_entries(uint64_t required, uint64_t now, const kvm_entry_t * kept);
+static uint64_t next_random(void);
+static uint32_t reverse_bits(uint32_t value);
+static uint64_t now_ns(void);
+static kvm_entry_t * alloc_entry(const uint8_t * key, uint32_t key_size, const uint8_t * value, uint32_t value_size);
+static kvm_result_t insert_entry(kvm_entry_t * entry, uint32_t ttl);
+static uint32_t remaining_ttl(const kvm_entry_t * entry, uint64_t now);
+static int parse_integer(const kvm_entry_t * entry, int64_t * value);
+
+kvm_result_t storage_init(void)
+{
+    if (NULL != buckets)
+    {
+        return KVM_RESULT_OK;
+    }
+
+    buckets = (kvm_entry_t **) calloc(STORAGE_INITIAL_BUCKETS, sizeof(kvm_entry_t *));
+    if (NULL == buckets)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    bucket_mask = STORAGE_INITIAL_BUCKETS - 1;
+    entry_count = 0;
+    hash_seed = kvm_hash_random_seed();
+    used_memory = STORAGE_INITIAL_BUCKETS * sizeof(kvm_entry_t *);
+
+    const uint64_t now = storage_now();
+    kvm_timer_wheel_init(&expire_wheel, now);
+    random_state ^= now;
+    epoch_init();
+
+    return KVM_RESULT_OK;
+}
+
+void storage_uninit(void)
+{
+    if (NULL != buckets)
+    {
+        for (uint32_t i = 0; i <= bucket_mask; ++i)
+        {
+            kvm_entry_t * entry = buckets[i];
+            while (NULL != entry)
+            {
+                kvm_entry_t * next = entry->next;
+                free(entry);
+                entry = next;
+            }
+        }
+
+        free(buckets);
+        free(undo_log);
+        undo_log = NULL;
+        undo_count = 0;
+        undo_capacity = 0;
+        batch_open = 0;
+        epoch_reclaim_all();
+        buckets = NULL;
+        bucket_mask = 0;
+        entry_count = 0;
+        used_memory = 0;
+        reserved_memory = 0;
+        key_memory = 0;
+        allocated_memory = 0;
+        max_memory = 0;
+        eviction_policy = KVM_EVICTION_NONE;
+        evicted_keys = 0;
+        rejected_puts = 0;
+        appended_in_place = 0;
+        compression_threshold = 0;
+        compressed_values = 0;
+        compression_input_bytes = 0;
+        compression_output_bytes = 0;
+        compression_time_ns = 0;
+    }
+}
+
+void storage_configure(const kvm_server_config_t * config)
+{
+    max_memory = config->max_memory;
+    eviction_policy = config->eviction_policy;
+    compression_threshold = config->compression_threshold;
+}
+
+void storage_get_stats(kvm_server_storage_stats_t * stats)
+{
+    stats->used_memory = used_memory;
+    stats->evicted_keys = evicted_keys;
+    stats->rejected_puts = rejected_puts;
+    stats->appended_in_place = appended_in_place;
+    stats->compressed_values = compressed_values;
+    stats->compression_input_bytes = compression_input_bytes;
+    stats->compression_output_bytes = compression_output_bytes;
+    stats->compression_time_ns = compression_time_ns;
+    /* Readers record it in their own statistics blocks. */
+    stats->decompression_time_ns = stats_decompression_time();
+}
+
+void storage_get_memory(kvm_memory_t * memory)
+{
+    /* Used memory counts the buckets, the headers, keys and values of the
+       linked entries; the allocations of the entries hold the rest. */
+    const uint64_t bucket_memory = (uint64_t) (bucket_mask + 1) * sizeof(kvm_entry_t *);
+    const uint64_t entry_memory = used_memory - bucket_memory;
+
+    memory->keys = key_memory;
+    memory->entry_headers = (uint64_t) entry_count * sizeof(kvm_entry_t);
+    memory->values = entry_memory - memory->keys - memory->entry_headers;
+    memory->entry_slack = (allocated_memory > entry_memory) ? allocated_memory - entry_memory : 0;
+    memory->buckets = bucket_memory;
+    memory->uploads = reserved_memory;
+    memory->undo_log = (uint64_t) undo_capacity * sizeof(undo_record_t);
+}
+
+uint64_t storage_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+kvm_entry_t * storage_find(const uint8_t * key, uint32_t key_size, uint64_t now)
+{
+    kvm_entry_t * entry = lookup(key, key_size, hash_key(key, key_size));
+    if (NULL == entry)
+    {
+        return NULL;
+    }
+
+    if (0 != entry->timer.expire_at && entry->timer.expire_at <= now)
+    {
+        /* Expired but not reaped yet. */
+        storage_remove(entry);
+        return NULL;
+    }
+
+    touch_entry(entry, now);
+    return entry;
+}
+
+const kvm_entry_t * storage_lookup(const uint8_t * key, uint32_t key_size, uint64_t now)
+{
+    const uint32_t hash = hash_key(key, key_size);
+    kvm_entry_t * entry = NULL;
+
+    for (;;)
+    {
+        const uint32_t seq = __atomic_load_n(&resize_seq, __ATOMIC_ACQUIRE);
+        if (0 == (seq & 1))
+        {
+            /* The mask is stored after the buckets, a larger mask is never
+               used with the smaller array. */
+            const uint32_t mask = __atomic_load_n(&bucket_mask, __ATOMIC_ACQUIRE);
+            kvm_entry_t ** table = __atomic_load_n(&buckets, __ATOMIC_RELAXED);
+
+            for (entry = __atomic_load_n(&table[hash & mask], __ATOMIC_ACQUIRE); NULL != entry; entry = __atomic_load_n(&entry->next, __ATOMIC_ACQUIRE))
+            {
+                if (entry->hash == hash && entry->key_size == key_size && 0 == memcmp(ENTRY_KEY(entry), key, key_size))
+                {
+                    break;
+                }
+            }
+
+            /* A hit is valid either way, a miss only if no entry moved. */
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (NULL != entry || seq == __atomic_load_n(&resize_seq, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+
+        sched_yield();
+    }
+
+    if (NULL == entry)
+    {
+        return NULL;
+    }
+
+    /* Expired but not reaped yet: the writer removes it. */
+    const uint64_t expire_at = __atomic_load_n(&entry->timer.expire_at, __ATOMIC_RELAXED);
+    if (0 != expire_at && expire_at <= now)
+    {
+        return NULL;
+    }
+
+    touch_entry(entry, now);
+    return entry;
+}
+
+kvm_result_t storage_put(const uint8_t * key, uint32_t key_size, const uint8_t * value, uint32_t value_size, uint32_t ttl)
+{
+    /* Allocate and fill the entry first, so the memory limit accounts
+       for the compressed value size. */
+    kvm_entry_t * entry = alloc_entry(key, key_size, value, value_size);
+    if (NULL == entry)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    return insert_entry(entry, ttl);
+}
+
+kvm_result_t storage_restore(const uint8_t * key, uint32_t key_size, const uint8_t * value, uint32_t value_size, uint32_t ttl, uint64_t version)
+{
+    kvm_entry_t * entry = alloc_entry(key, key_size, value, value_size);
+    if (NULL == entry)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    /* Values stored later get versions above every restored one. */
+    if (version > last_version)
+    {
+        last_version = version;
+    }
+
+    const kvm_result_t result = insert_entry(entry, ttl);
+    if (KVM_RESULT_OK == result)
+    {
+        entry->version = version;
+    }
+    return result;
+}
+
+void storage_remove(kvm_entry_t * entry)
+{
+    kvm_timer_wheel_remove(&expire_wheel, &entry->timer);
+    unlink_entry(entry);
+}
+
+void storage_set_ttl(kvm_entry_t * entry, uint32_t ttl, uint64_t now)
+{
+    undo_record_t * record = log_undo(UNDO_TTL, entry);
+    if (NULL != record)
+    {
+        record->expire_at = entry->timer.expire_at;
+    }
+
+    set_ttl(entry, ttl, now);
+}
+
+uint32_t storage_remaining_ttl(const kvm_entry_t * entry, uint64_t now)
+{
+    return remaining_ttl(entry, now);
+}
+
+void storage_batch_begin(void)
+{
+    batch_open = 1;
+    undo_count = 0;
+}
+
+kvm_result_t storage_batch_reserve(void)
+{
+    if (undo_capacity - undo_count >= UNDO_RECORDS_PER_OP)
+    {
+        return KVM_RESULT_OK;
+    }
+
+    return grow_undo_log();
+}
+
+void storage_batch_end(int commit)
+{
+    batch_open = 0;
+
+    if (commit)
+    {
+        /* Entries kept for undo go the usual way now. */
+        for (uint32_t i = 0; i < undo_count; ++i)
+        {
+            if (UNDO_REPLACE == undo_log[i].kind)
+            {
+                epoch_retire(undo_log[i].old);
+            }
+            else if (UNDO_UNLINK == undo_log[i].kind)
+            {
+                epoch_retire(undo_log[i].entry);
+            }
+        }
+    }
+    else
+    {
+        for (uint32_t i = undo_count; 0 != i--; )
+        {
+            undo(&undo_log[i]);
+        }
+    }
+
+    undo_count = 0;
+}
+
+kvm_result_t storage_put_if(const uint8_t * key, uint32_t key_size, const uint8_t * value, uint32_t value_size, uint32_t ttl,
+    kvm_condition_t condition, uint64_t version, uint64_t * stored_version)
+{
+    /* The event loop is the only writer, nothing changes the key between
+       the check and the store. */
+    if (!storage_check_condition(storage_find(key, key_size, storage_now()), condition, version))
+    {
+        return KVM_RESULT_CONFLICT;
+    }
+
+    kvm_entry_t * entry = alloc_entry(key, key_size, value, value_size);
+    if (NULL == entry)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    const kvm_result_t result = insert_entry(entry, ttl);
+    if (KVM_RESULT_OK == result)
+    {
+        *stored_version = entry->version;
+    }
+
+    return result;
+}
+
+int storage_check_condition(const kvm_entry_t * entry, kvm_condition_t condition, uint64_t version)
+{
+    switch (condition)
+    {
+        case KVM_IF_VERSION:
+            return NULL != entry && entry->version == version;
+        case KVM_IF_ABSENT:
+            return NULL == entry;
+        case KVM_IF_PRESENT:
+            return NULL != entry;
+        default:
+            return 0;
+    }
+}
+
+kvm_result_t storage_incr(const uint8_t * key, uint32_t key_size, int64_t delta, int64_t * value)
+{
+    const uint64_t now = storage_now();
+    kvm_entry_t * entry = storage_find(key, key_size, now);
+
+    int64_t current = 0;
+    if (NULL != entry && !parse_integer(entry, &current))
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    if ((delta > 0 && current > INT64_MAX - delta) || (delta < 0 && current < INT64_MIN - delta))
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+    current += delta;
+
+    char text[INTEGER_MAX_DIGITS + 1];
+    const int text_size = snprintf(text, sizeof(text), "%" PRId64, current);
+
+    /* A few bytes, replaced rather than rewritten under readers. */
+    kvm_entry_t * updated = alloc_entry(key, key_size, (const uint8_t *) text, (uint32_t) text_size);
+    if (NULL == updated)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    const kvm_result_t result = insert_entry(updated, (NULL != entry) ? remaining_ttl(entry, now) : KVM_TTL_PERSIST);
+    if (KVM_RESULT_OK == result)
+    {
+        *value = current;
+    }
+
+    return result;
+}
+
+kvm_result_t storage_append(const uint8_t * key, uint32_t key_size, const uint8_t * data, uint32_t size, uint32_t * value_size)
+{
+    const uint64_t now = storage_now();
+    kvm_entry_t * entry = storage_find(key, key_size, now);
+    if (NULL == entry)
+    {
+        *value_size = size;
+        return storage_put(key, key_size, data, size, KVM_TTL_PERSIST);
+    }
+
+    const uint32_t old_size = storage_value_size(entry);
+    if (size > UINT32_MAX - sizeof(kvm_entry_t) - key_size - old_size)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    if (KVM_CODEC_NONE == (entry->flags & ENTRY_FLAG_CODEC_MASK) &&
+        malloc_usable_size(entry) - ENTRY_FOOTPRINT(entry) >= size &&
+        (0 == max_memory || used_memory + reserved_memory + size <= max_memory))
+    {
+        /* Readers copy no more than the size they loaded, the bytes past it
+           are not seen before the new size. */
+        undo_record_t * record = log_undo(UNDO_GROW, entry);
+        if (NULL != record)
+        {
+            record->value_size = old_size;
+            record->version = entry->version;
+        }
+
+        memcpy(ENTRY_VALUE(entry) + old_size, data, size);
+        __atomic_store_n(&entry->value_size, old_size + size, __ATOMIC_RELEASE);
+        __atomic_store_n(&entry->version, ++last_version, __ATOMIC_RELEASE);
+
+        used_memory += size;
+        appended_in_place++;
+        *value_size = old_size + size;
+        return KVM_RESULT_OK;
+    }
+
+    /* Copy to a larger allocation, decoded: the value keeps changing and
+       would be recompressed on every append. */
+    const uint32_t total = old_size + size;
+    uint32_t headroom = (total / 2 < APPEND_HEADROOM_MAX) ? total / 2 : APPEND_HEADROOM_MAX;
+    if (0 != max_memory)
+    {
+        /* The room would be used but not counted against the limit. */
+        headroom = 0;
+    }
+    kvm_entry_t * grown = (kvm_entry_t *) malloc(sizeof(kvm_entry_t) + (size_t) key_size + total + headroom);
+    if (NULL == grown)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    grown->flags = KVM_CODEC_NONE;
+    grown->key_size = key_size;
+    grown->value_size = total;
+    memcpy(ENTRY_KEY(grown), key, key_size);
+    if (KVM_RESULT_OK != storage_read_value(entry, ENTRY_VALUE(grown)))
+    {
+        free(grown);
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+    memcpy(ENTRY_VALUE(grown) + old_size, data, size);
+
+    const kvm_result_t result = insert_entry(grown, remaining_ttl(entry, now));
+    if (KVM_RESULT_OK == result)
+    {
+        *value_size = total;
+    }
+
+    return result;
+}
+
+kvm_result_t storage_reserve(const uint8_t * key, uint32_t key_size, uint32_t value_size, kvm_entry_t ** entry)
+{
+    const uint64_t footprint = sizeof(kvm_entry_t) + (uint64_t) key_size + value_size;
+
+    if (0 != max_memory && used_memory + reserved_memory + footprint > max_memory)
+    {
+        if (!evict_entries(reserved_memory + footprint, storage_now(), NULL))
+        {
+            rejected_puts++;
+            return KVM_RESULT_NO_MEMORY;
+        }
+    }
+
+    kvm_entry_t * reserved = (kvm_entry_t *) malloc(footprint);
+    if (NULL == reserved)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    reserved->flags = KVM_CODEC_NONE;
+    reserved->key_size = key_size;
+    reserved->value_size = value_size;
+    memcpy(ENTRY_KEY(reserved), key, key_size);
+
+    reserved_memory += footprint;
+    *entry = reserved;
+    return KVM_RESULT_OK;
+}
+
+kvm_result_t storage_commit(kvm_entry_t * entry, uint32_t ttl)
+{
+    reserved_memory -= ENTRY_FOOTPRINT(entry);
+    return insert_entry(entry, ttl);
+}
+
+void storage_release(kvm_entry_t * entry)
+{
+    reserved_memory -= ENTRY_FOOTPRINT(entry);
+    free(entry);
+}
+
+uint64_t storage_version(const kvm_entry_t * entry)
+{
+    return __atomic_load_n(&entry->version, __ATOMIC_ACQUIRE);
+}
+
+uint32_t storage_value_size(const kvm_entry_t * entry)
+{
+    if (KVM_CODEC_NONE == (entry->flags & ENTRY_FLAG_CODEC_MASK))
+    {
+        return __atomic_load_n(&entry->value_size, __ATOMIC_ACQUIRE);
+    }
+
+    uint32_t raw_size;
+    memcpy(&raw_size, ENTRY_VALUE(entry), sizeof(raw_size));
+    return raw_size;
+}
+
+kvm_result_t storage_read_value(const kvm_entry_t * entry, uint8_t * value)
+{
+    const uint8_t * data = ENTRY_VALUE(entry);
+
+    if (KVM_CODEC_NONE == (entry->flags & ENTRY_FLAG_CODEC_MASK))
+    {
+        memcpy(value, data, entry->value_size);
+        return KVM_RESULT_OK;
+    }
+
+    uint32_t raw_size;
+    memcpy(&raw_size, data, sizeof(raw_size));
+
+    const uint64_t start = now_ns();
+    const kvm_result_t result = kvm_lz4_decompress(data + sizeof(raw_size), entry->value_size - sizeof(raw_size), value, raw_size);
+    stats_add(&stats_local()->decompression_time_ns, now_ns() - start);
+
+    return result;
+}
+
+kvm_result_t storage_read_range(const kvm_entry_t * entry, uint32_t offset, uint32_t size, uint8_t * data)
+{
+    if (KVM_CODEC_NONE == (entry->flags & ENTRY_FLAG_CODEC_MASK))
+    {
+        memcpy(data, ENTRY_VALUE(entry) + offset, size);
+        return KVM_RESULT_OK;
+    }
+
+    /* LZ4 blocks are only decoded as a whole. Compressed values came in a
+       single PUT frame, chunked PUTs store values uncompressed. */
+    uint8_t * value = (uint8_t *) malloc(storage_value_size(entry));
+    if (NULL == value)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    const kvm_result_t result = storage_read_value(entry, value);
+    if (KVM_RESULT_OK == result)
+    {
+        memcpy(data, value + offset, size);
+    }
+
+    free(value);
+    return result;
+}
+
+uint32_t storage_count(void)
+{
+    return entry_count;
+}
+
+uint32_t storage_live_count(uint64_t now)
+{
+    return entry_count - kvm_timer_wheel_count_due(&expire_wheel, now);
+}
+
+kvm_entry_t * storage_first(void)
+{
+    for (uint32_t i = 0; i <= bucket_mask; ++i)
+    {
+        if (NULL != buckets[i])
+        {
+            return buckets[i];
+        }
+    }
+
+    return NULL;
+}
+
+kvm_entry_t * storage_next(const kvm_entry_t * entry)
+{
+    if (NULL != entry->next)
+    {
+        return entry->next;
+    }
+
+    for (uint32_t i = (entry->hash & bucket_mask) + 1; i <= bucket_mask; ++i)
+    {
+        if (NULL != buckets[i])
+        {
+            return buckets[i];
+        }
+    }
+
+    return NULL;
+}
+
+uint32_t storage_scan(uint32_t cursor, uint64_t now, storage_scan_callback_t callback, void * context)
+{
+    for (const kvm_entry_t * entry = buckets[cursor & bucket_mask]; NULL != entry; entry = entry->next)
+    {
+        if (0 == entry->timer.expire_at || entry->timer.expire_at > now)
+        {
+            callback(context, entry, remaining_ttl(entry, now));
+        }
+    }
+
+    /* Increment the bits under the mask from the top down. */
+    cursor |= ~bucket_mask;
+    cursor = reverse_bits(cursor);
+    cursor++;
+    return reverse_bits(cursor);
+}
+
+uint32_t expire_entries(uint32_t max_count)
+{
+    if (!batch_open)
+    {
+        return kvm_timer_wheel_advance(&expire_wheel, storage_now(), max_count, on_entry_expired, NULL);
+    }
+
+    /* Every entry reaped in a batch takes an undo record, far more than an
+       operation reserves. The log grows as they are reaped, what does not
+       fit is left to expire later. */
+    const uint64_t now = storage_now();
+    uint32_t expired = 0;
+    while (expired < max_count)
+    {
+        if (undo_count == undo_capacity && KVM_RESULT_OK != grow_undo_log())
+        {
+            break;
+        }
+
+        const uint32_t room = undo_capacity - undo_count;
+        const uint32_t budget = (max_count - expired < room) ? max_count - expired : room;
+        const uint32_t reaped = kvm_timer_wheel_advance(&expire_wheel, now, budget, on_entry_expired, NULL);
+        expired += reaped;
+        if (reaped < budget)
+        {
+            break;
+        }
+    }
+    return expired;
+}
+
+int has_expiring_entries(void)
+{
+    return 0 != expire_wheel.count;
+}
+
+static uint32_t reverse_bits(uint32_t value)
+{
+    value = ((value >> 1) & 0x55555555) | ((value & 0x55555555) << 1);
+    value = ((value >> 2) & 0x33333333) | ((value & 0x33333333) << 2);
+    value = ((value >> 4) & 0x0F0F0F0F) | ((value & 0x0F0F0F0F) << 4);
+    return __builtin_bswap32(value);
+}
+
+static uint32_t hash_key(const uint8_t * key, uint32_t key_size)
+{
+    return (uint32_t) kvm_hash(key, key_size, hash_seed);
+}
+
+static kvm_entry_t * lookup(const uint8_t * key, uint32_t key_size, uint32_t hash)
+{
+    for (kvm_entry_t * entry = buckets[hash & bucket_mask]; NULL != entry; entry = entry->next)
+    {
+        if (entry->hash == hash && entry->key_size == key_size && 0 == memcmp(ENTRY_KEY(entry), key, key_size))
+        {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+static void grow_buckets(void)
+{
+    const uint32_t count = (bucket_mask + 1) * 2;
+    kvm_entry_t ** grown = (kvm_entry_t **) calloc(count, sizeof(kvm_entry_t *));
+    if (NULL == grown)
+    {
+        /* Keep working with longer chains. */
+        return;
+    }
+
+    __atomic_store_n(&resize_seq, resize_seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    for (uint32_t i = 0; i <= bucket_mask; ++i)
+    {
+        kvm_entry_t * entry = buckets[i];
+        while (NULL != entry)
+        {
+            kvm_entry_t * next = entry->next;
+            kvm_entry_t ** bucket = &grown[entry->hash & (count - 1)];
+            __atomic_store_n(&entry->next, *bucket, __ATOMIC_RELAXED);
+            *bucket = entry;
+            entry = next;
+        }
+    }
+
+    used_memory += (uint64_t) (count - (bucket_mask + 1)) * sizeof(kvm_entry_t *);
+
+    kvm_entry_t ** old = buckets;
+    __atomic_store_n(&buckets, grown, __ATOMIC_RELAXED);
+    __atomic_store_n(&bucket_mask, count - 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&resize_seq, resize_seq + 1, __ATOMIC_RELEASE);
+
+    epoch_retire(old);
+}
+
+static kvm_entry_t * alloc_entry(const uint8_t * key, uint32_t key_size, const uint8_t * value, uint32_t value_size)
+{
+    if (0 == compression_threshold || value_size < compression_threshold)
+    {
+        kvm_entry_t * entry = (kvm_entry_t *) malloc(sizeof(kvm_entry_t) + key_size + value_size);
+        if (NULL != entry)
+        {
+            entry->flags = KVM_CODEC_NONE;
+            entry->key_size = key_size;
+            entry->value_size = value_size;
+            memcpy(ENTRY_KEY(entry), key, key_size);
+            memcpy(ENTRY_VALUE(entry), value, value_size);
+        }
+        return entry;
+    }
+
+    const uint32_t bound = sizeof(uint32_t) + kvm_lz4_compress_bound(value_size);
+    kvm_entry_t * entry = (kvm_entry_t *) malloc(sizeof(kvm_entry_t) + key_size + bound);
+    if (NULL == entry)
+    {
+        return NULL;
+    }
+
+    entry->key_size = key_size;
+    memcpy(ENTRY_KEY(entry), key, key_size);
+
+    uint8_t * data = ENTRY_VALUE(entry);
+
+    const uint64_t start = now_ns();
+    const uint32_t compressed_size = kvm_lz4_compress(value, value_size, data + sizeof(uint32_t), bound - sizeof(uint32_t));
+    compression_time_ns += now_ns() - start;
+    compression_input_bytes += value_size;
+
+    /* Keep the value as is, unless compression saves at least 1/8 of it. */
+    if (0 != compressed_size && compressed_size + sizeof(uint32_t) <= value_size - value_size / 8)
+    {
+        memcpy(data, &value_size, sizeof(value_size));
+        entry->flags = KVM_CODEC_LZ4;
+        entry->value_size = compressed_size + sizeof(uint32_t);
+        compressed_values++;
+    }
+    else
+    {
+        entry->flags = KVM_CODEC_NONE;
+        entry->value_size = value_size;
+        memcpy(data, value, value_size);
+    }
+    compression_output_bytes += entry->value_size;
+
+    /* Give back the unused tail of the buffer. */
+    kvm_entry_t * shrunk = (kvm_entry_t *) realloc(entry, ENTRY_FOOTPRINT(entry));
+    return (NULL != shrunk) ? shrunk : entry;
+}
+
+static kvm_result_t insert_entry(kvm_entry_t * entry, uint32_t ttl)
+{
+    const uint64_t now = storage_now();
+    const uint32_t hash = hash_key(ENTRY_KEY(entry), entry->key_size);
+    const uint64_t footprint = ENTRY_FOOTPRINT(entry);
+
+    /* The replaced entry stays linked until the new one fits, so a rejected
+       PUT leaves the previous value in place. */
+    kvm_entry_t * old = lookup(ENTRY_KEY(entry), entry->key_size, hash);
+    const uint64_t freed = (NULL != old) ? ENTRY_FOOTPRINT(old) : 0;
+    if (0 != max_memory && used_memory - freed + reserved_memory + footprint > max_memory)
+    {
+        if (!evict_entries(reserved_memory + footprint, now, old))
+        {
+            free(entry);
+            rejected_puts++;
+            return KVM_RESULT_NO_MEMORY;
+        }
+    }
+
+    init_entry(entry, hash, ttl, now);
+    if (NULL != old)
+    {
+        /* Swap in place, so readers see either value but never a miss. */
+        replace_entry(old, entry);
+        return KVM_RESULT_OK;
+    }
+
+    link_entry(entry);
+    log_undo(UNDO_LINK, entry);
+
+    if (entry_count > bucket_mask + 1)
+    {
+        grow_buckets();
+    }
+
+    return KVM_RESULT_OK;
+}
+
+static void link_entry(kvm_entry_t * entry)
+{
+    kvm_entry_t ** bucket = &buckets[entry->hash & bucket_mask];
+    entry->next = *bucket;
+    __atomic_store_n(bucket, entry, __ATOMIC_RELEASE);
+    entry_count++;
+    used_memory += ENTRY_FOOTPRINT(entry);
+    key_memory += entry->key_size;
+    allocated_memory += malloc_usable_size(entry);
+}
+
+static uint32_t remaining_ttl(const kvm_entry_t * entry, uint64_t now)
+{
+    if (0 == entry->timer.expire_at)
+    {
+        return KVM_TTL_PERSIST;
+    }
+
+    /* Found entries are not expired, the TTL is at least 1. */
+    const uint64_t ttl = entry->timer.expire_at - now;
+    return (ttl < KVM_TTL_PERSIST) ? (uint32_t) ttl : KVM_TTL_PERSIST - 1;
+}
+
+static int parse_integer(const kvm_entry_t * entry, int64_t * value)
+{
+    const uint32_t size = storage_value_size(entry);
+    if (0 == size || size > INTEGER_MAX_DIGITS)
+    {
+        return 0;
+    }
+
+    char text[INTEGER_MAX_DIGITS + 1];
+    if (KVM_RESULT_OK != storage_read_value(entry, (uint8_t *) text))
+    {
+        return 0;
+    }
+    text[size] = '\0';
+
+    /* Plain decimal only, no spaces or '+' strtoll() would let through. */
+    for (uint32_t i = ('-' == text[0] && 1 < size) ? 1 : 0; i < size; ++i)
+    {
+        if (text[i] < '0' || text[i] > '9')
+        {
+            return 0;
+        }
+    }
+
+    errno = 0;
+    *value = strtoll(text, NULL, 10);
+    return 0 == errno;
+}
+
+static void init_entry(kvm_entry_t * entry, uint32_t hash, uint32_t ttl, uint64_t now)
+{
+    entry->hash = hash;
+    entry->version = ++last_version;
+
+    entry->timer.next = NULL;
+    entry->timer.prev = NULL;
+    entry->timer.expire_at = 0;
+    set_ttl(entry, ttl, now);
+
+    if (KVM_EVICTION_LFU == eviction_policy)
+    {
+        entry->access = (lfu_minutes(now) << 8) | LFU_INIT_VALUE;
+    }
+    else
+    {
+        entry->access = (uint32_t) now;
+    }
+}
+
+static void replace_entry(kvm_entry_t * old, kvm_entry_t * entry)
+{
+    kvm_entry_t ** link = &buckets[old->hash & bucket_mask];
+    while (*link != old)
+    {
+        link = &(*link)->next;
+    }
+
+    kvm_timer_wheel_remove(&expire_wheel, &old->timer);
+    entry->next = old->next;
+    __atomic_store_n(link, entry, __ATOMIC_RELEASE);
+
+    used_memory += ENTRY_FOOTPRINT(entry);
+    used_memory -= ENTRY_FOOTPRINT(old);
+    allocated_memory += malloc_usable_size(entry);
+    allocated_memory -= malloc_usable_size(old);
+
+    undo_record_t * record = log_undo(UNDO_REPLACE, entry);
+    if (NULL != record)
+    {
+        record->old = old;
+    }
+    else
+    {
+        epoch_retire(old);
+    }
+}
+
+static void unlink_entry(kvm_entry_t * entry)
+{
+    kvm_entry_t ** link = &buckets[entry->hash & bucket_mask];
+    while (*link != entry)
+    {
+        link = &(*link)->next;
+    }
+
+    /* Readers standing on the entry still follow its next pointer. */
+    __atomic_store_n(link, entry->next, __ATOMIC_RELEASE);
+
+    entry_count--;
+    used_memory -= ENTRY_FOOTPRINT(entry);
+    key_memory -= entry->key_size;
+    allocated_memory -= malloc_usable_size(entry);
+
+    if (NULL == log_undo(UNDO_UNLINK, entry))
+    {
+        epoch_retire(entry);
+    }
+}
+
+static void set_ttl(kvm_entry_t * entry, uint32_t ttl, uint64_t now)
+{
+    kvm_timer_wheel_remove(&expire_wheel, &entry->timer);
+    entry->timer.expire_at = 0;
+
+    if (KVM_TTL_PERSIST != ttl)
+    {
+        kvm_timer_wheel_add(&expire_wheel, &entry->timer, now + ttl);
+    }
+}
+
+static kvm_result_t grow_undo_log(void)
+{
+    const uint32_t capacity = 2 * undo_capacity + UNDO_RECORDS_PER_OP;
+    undo_record_t * grown = (undo_record_t *) realloc(undo_log, capacity * sizeof(undo_record_t));
+    if (NULL == grown)
+    {
+        return KVM_RESULT_SYS_CALL_FAIL;
+    }
+
+    undo_log = grown;
+    undo_capacity = capacity;
+    return KVM_RESULT_OK;
+}
+
+static undo_record_t * log_undo(undo_kind_t kind, kvm_entry_t * entry)
+{
+    /* Room was made by storage_batch_reserve(). */
+    if (!batch_open || undo_count == undo_capacity)
+    {
+        return NULL;
+    }
+
+    undo_record_t * record = &undo_log[undo_count++];
+    record->kind = kind;
+    record->entry = entry;
+    return record;
+}
+
+static void undo(const undo_record_t * record)
+{
+    kvm_entry_t * entry = record->entry;
+
+    switch (record->kind)
+    {
+        case UNDO_LINK:
+        {
+            /* Not logged, the batch is closed. */
+            storage_remove(entry);
+            break;
+        }
+        case UNDO_REPLACE:
+        {
+            kvm_entry_t * old = record->old;
+            kvm_entry_t ** link = &buckets[entry->hash & bucket_mask];
+            while (*link != entry)
+            {
+                link = &(*link)->next;
+            }
+
+            kvm_timer_wheel_remove(&expire_wheel, &entry->timer);
+            old->next = entry->next;
+            __atomic_store_n(link, old, __ATOMIC_RELEASE);
+            if (0 != old->timer.expire_at)
+            {
+                kvm_timer_wheel_add(&expire_wheel, &old->timer, old->timer.expire_at);
+            }
+
+            used_memory += ENTRY_FOOTPRINT(old);
+            used_memory -= ENTRY_FOOTPRINT(entry);
+            allocated_memory += malloc_usable_size(old);
+            allocated_memory -= malloc_usable_size(entry);
+            epoch_retire(entry);
+            break;
+        }
+        case UNDO_UNLINK:
+        {
+            link_entry(entry);
+            if (0 != entry->timer.expire_at)
+            {
+                kvm_timer_wheel_add(&expire_wheel, &entry->timer, entry->timer.expire_at);
+            }
+            break;
+        }
+        case UNDO_GROW:
+        {
+            /* The appended bytes stay past the end, unseen. */
+            used_memory -= entry->value_size - record->value_size;
+            __atomic_store_n(&entry->value_size, record->value_size, __ATOMIC_RELEASE);
+            __atomic_store_n(&entry->version, record->version, __ATOMIC_RELEASE);
+            break;
+        }
+        case UNDO_TTL:
+        {
+            kvm_timer_wheel_remove(&expire_wheel, &entry->timer);
+            entry->timer.expire_at = 0;
+            if (0 != record->expire_at)
+            {
+                kvm_timer_wheel_add(&expire_wheel, &entry->timer, record->expire_at);
+            }
+            break;
+        }
+    }
+}
+
+static void on_entry_expired(void * context, kvm_timer_t * timer)
+{
+    /* Timer is already unlinked from the wheel. */
+    unlink_entry((kvm_entry_t *) ((uint8_t *) timer - offsetof(kvm_entry_t, timer)));
+}
+
+static uint32_t lfu_minutes(uint64_t now)
+{
+    return (uint32_t) (now / 60000) & 0xFFFFFF;
+}
+
+static uint32_t lfu_decayed_counter(const kvm_entry_t * entry, uint64_t now)
+{
+    const uint32_t elapsed = (lfu_minutes(now) - (entry->access >> 8)) & 0xFFFFFF;
+    const uint32_t decay = elapsed / LFU_DECAY_MINUTES;
+    const uint32_t counter = entry->access & 0xFF;
+    return (decay > counter) ? 0 : counter - decay;
+}
+
+static void touch_entry(kvm_entry_t * entry, uint64_t now)
+{
+    /* Readers on other threads may race here; the access field is a hint,
+       so a lost update only makes eviction a little less exact. It is
+       written only when it changes, reads keep the cache line shared. */
+    const uint32_t access = __atomic_load_n(&entry->access, __ATOMIC_RELAXED);
+
+    if (KVM_EVICTION_LFU != eviction_policy)
+    {
+        if ((uint32_t) now - access >= LRU_TOUCH_MS)
+        {
+            __atomic_store_n(&entry->access, (uint32_t) now, __ATOMIC_RELAXED);
+        }
+        return;
+    }
+
+    /* Logarithmic counter: the higher it is, the less likely it grows. */
+    uint32_t counter = lfu_decayed_counter(entry, now);
+    if (counter < 0xFF)
+    {
+        const uint32_t base = (counter > LFU_INIT_VALUE) ? counter - LFU_INIT_VALUE : 0;
+        const uint64_t limit = UINT64_MAX / (base * LFU_LOG_FACTOR + 1);
+        if (next_random() <= limit)
+        {
+            counter++;
+        }
+    }
+
+    const uint32_t touched = (lfu_minutes(now) << 8) | counter;
+    if (touched != access)
+    {
+        __atomic_store_n(&entry->access, touched, __ATOMIC_RELAXED);
+    }
+}
+
+static uint64_t eviction_score(const kvm_entry_t * entry, uint64_t now)
+{
+    /* Higher score - better eviction candidate. */
+    switch (eviction_policy)
+    {
+        case KVM_EVICTION_LFU:
+        {
+            return 0xFF - lfu_decayed_counter(entry, now);
+        }
+        case KVM_EVICTION_TTL:
+        {
+            if (0 != entry->timer.expire_at)
+            {
+                /* Volatile keys always go before persistent ones. */
+                return UINT64_MAX - entry->timer.expire_at;
+            }
+        }
+        /* fall through */
+        default:
+        {
+            return (uint32_t) ((uint32_t) now - entry->access);
+        }
+    }
+}
+
+static kvm_entry_t * sample_entry(void)
+{
+    /* Random non empty bucket, then a random entry of its chain. Scanning
+       forward from an empty bucket favours entries after long empty runs,
+       so only fall back to it when random probes keep missing.
+       Requires at least one entry in the table. */
+    uint32_t i = (uint32_t) next_random() & bucket_mask;
+    for (int probe = 0; probe < EVICTION_BUCKET_PROBES && NULL == buckets[i]; ++probe)
+    {
+        i = (uint32_t) next_random() & bucket_mask;
+    }
+    while (NULL == buckets[i])
+    {
+        i = (i + 1) & bucket_mask;
+    }
+
+    uint32_t length = 0;
+    for (kvm_entry_t * entry = buckets[i]; NULL != entry; entry = entry->next)
+    {
+        length++;
+    }
+
+    kvm_entry_t * entry = buckets[i];
+    for (uint32_t skip = (uint32_t) (next_random() % length); 0 != skip; --skip)
+    {
+        entry = entry->next;
+    }
+
+    return entry;
+}
+
+/* The kept entry is the one being replaced: it is never picked, and its
+   footprint counts as freed. */
+static int evict_entries(uint64_t required, uint64_t now, const kvm_entry_t * kept)
+{
+    if (KVM_EVICTION_NONE == eviction_policy)
+    {
+        return 0;
+    }
+
+    const uint64_t freed = (NULL != kept) ? ENTRY_FOOTPRINT(kept) : 0;
+
+    for (int evicted = 0; evicted < EVICTION_PUT_BUDGET && 0 != entry_count; ++evicted)
+    {
+        kvm_entry_t * victim = NULL;
+        uint64_t victim_score = 0;
+
+        for (int i = 0; i < EVICTION_SAMPLES; ++i)
+        {
+            kvm_entry_t * candidate = sample_entry();
+            if (candidate == kept)
+            {
+                continue;
+            }
+
+            const uint64_t score = eviction_score(candidate, now);
+            if (NULL == victim || score > victim_score)
+            {
+                victim = candidate;
+                victim_score = score;
+            }
+        }
+
+        if (NULL == victim)
+        {
+            /* Every sample hit the kept entry, it may be the only one left. */
+            break;
+        }
+
+        storage_remove(victim);
+        evicted_keys++;
+
+        if (used_memory - freed + required <= max_memory)
+        {
+            return 1;
+        }
+    }
+
+    return used_memory - freed + required <= max_memory;
+}
+
+static uint64_t next_random(void)
+{
+    /* xorshift64* */
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+    return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,153 @@
+/**
+ * @file kvm_storage.h
+ *
+ * @brief Defines the key/value storage used by request handlers.
+ *
+ */
+
+#ifndef __kvm_storage_h__
+#define __kvm_storage_h__
+
+#include <stdint.h>
+
+#include "kvm_results.h"
+#include "kvm_server.h"
+#include "kvm_timer_wheel.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* Number of keys sampled to pick an eviction victim */
+#define EVICTION_SAMPLES 5
+
+/* Maximum number of keys evicted by a single PUT */
+#define EVICTION_PUT_BUDGET 32
+
+/* Random buckets probed for an eviction sample before scanning for a non empty one */
+#define EVICTION_BUCKET_PROBES 16
+
+/* Entry flags. Low bits hold KVM_CODEC_XXX the value is encoded with. */
+#define ENTRY_FLAG_CODEC_MASK   0x0F
+
+/* Room left after a value copied by APPEND, half its size up to the
+   maximum, so a run of appends mostly grows the value in place. Not left
+   under a memory limit, which counts values by their size. */
+#define APPEND_HEADROOM_MAX (1024 * 1024)
+
+/* Initial number of hash table buckets. Must be a power of two. */
+#define STORAGE_INITIAL_BUCKETS 64
+
+/* Stored key/value pair. Header, key and value share a single allocation
+   and hash table buckets point to it directly.
+   Compressed value data is prefixed with uint32_t uncompressed size. */
+typedef struct kvm_entry_s
+{
+    struct kvm_entry_s *    next;       /* Next entry in the hash table bucket */
+    kvm_timer_t             timer;      /* Linked into expiration wheel when entry has TTL */
+    uint32_t                hash;
+    uint32_t                key_size;
+    uint32_t                value_size; /* Size of stored, possibly encoded, value data. Grows in place by APPEND */
+    uint32_t                access;     /* LRU: access time in ms, LFU: decay time in minutes << 8 | log counter */
+    uint64_t                version;    /* Unique per stored value, set when the entry is linked */
+    uint8_t                 flags;
+    /* Followed by key data, then value data */
+} kvm_entry_t;
+
+#define ENTRY_KEY(entry)    ((uint8_t *) ((entry) + 1))
+#define ENTRY_VALUE(entry)  (ENTRY_KEY(entry) + (entry)->key_size)
+
+kvm_result_t storage_init(void);
+void storage_uninit(void);
+
+void storage_configure(const kvm_server_config_t * config);
+void storage_get_stats(kvm_server_storage_stats_t * stats);
+
+/* Fills the storage categories of the memory report. */
+void storage_get_memory(kvm_memory_t * memory);
+
+uint64_t storage_now(void);
+
+kvm_entry_t * storage_find(const uint8_t * key, uint32_t key_size, uint64_t now);
+
+/* Read only lookup for any thread, called between epoch_enter() and
+   epoch_exit(). The entry stays valid until epoch_exit(). Expired entries
+   are reported missing but left to the writer to remove. */
+const kvm_entry_t * storage_lookup(const uint8_t * key, uint32_t key_size, uint64_t now);
+kvm_result_t storage_put(const uint8_t * key, uint32_t key_size, const uint8_t * value, uint32_t value_size, uint32_t ttl);
+
+/* PUT of a pair handed over by the previous server process, keeping the
+   version of its value. Runs before any reader thread. */
+kvm_result_t storage_restore(const uint8_t * key, uint32_t key_size, const uint8_t * value, uint32_t value_size, uint32_t ttl, uint64_t version);
+
+/* Conditional PUT, KVM_RESULT_CONFLICT if the condition does not hold.
+   The version of the stored value is returned in stored_version. */
+kvm_result_t storage_put_if(const uint8_t * key, uint32_t key_size, const uint8_t * value, uint32_t value_size, uint32_t ttl,
+    kvm_condition_t condition, uint64_t version, uint64_t * stored_version);
+
+/* Checks a KVM_IF_XXX condition against an entry found by storage_find(), NULL if missing. */
+int storage_check_condition(const kvm_entry_t * entry, kvm_condition_t condition, uint64_t version);
+
+/* Adds delta to the decimal integer value of the key, KVM_RESULT_INVALID_PARAM
+   if the value is not an integer or the result overflows. */
+kvm_result_t storage_incr(const uint8_t * key, uint32_t key_size, int64_t delta, int64_t * value);
+
+/* Appends data to the value of the key. Uncompressed values grow in place
+   while their allocation has room: the data is written past the end, then
+   the size and the version are published, so readers see either value. */
+kvm_result_t storage_append(const uint8_t * key, uint32_t key_size, const uint8_t * data, uint32_t size, uint32_t * value_size);
+void storage_remove(kvm_entry_t * entry);
+
+/* Chunked PUT: the entry is allocated up front and its value filled in by
+   the caller. Its memory counts against the limit until it is stored by
+   storage_commit() or freed by storage_release(). Values are stored as
+   received, without compression. */
+kvm_result_t storage_reserve(const uint8_t * key, uint32_t key_size, uint32_t value_size, kvm_entry_t ** entry);
+kvm_result_t storage_commit(kvm_entry_t * entry, uint32_t ttl);
+void storage_release(kvm_entry_t * entry);
+
+void storage_set_ttl(kvm_entry_t * entry, uint32_t ttl, uint64_t now);
+
+/* TTL left to an entry found by storage_find(), KVM_TTL_PERSIST if none. */
+uint32_t storage_remaining_ttl(const kvm_entry_t * entry, uint64_t now);
+
+/* Batches: changes between storage_batch_begin() and storage_batch_end()
+   are kept in an undo log and reverted by storage_batch_end(0). Replaced
+   and removed entries stay allocated until the end instead of being
+   retired, so reverting allocates nothing and can not fail. Keys evicted
+   or expired meanwhile come back too. storage_batch_reserve() makes room
+   in the log for one more operation and must succeed before it runs. */
+void storage_batch_begin(void);
+kvm_result_t storage_batch_reserve(void);
+void storage_batch_end(int commit);
+
+/* Values may grow by APPEND under readers. A reader takes the version
+   first, then the size once, and copies that much by storage_read_range();
+   storage_read_value() is for the writer. */
+uint64_t storage_version(const kvm_entry_t * entry);
+uint32_t storage_value_size(const kvm_entry_t * entry);
+kvm_result_t storage_read_value(const kvm_entry_t * entry, uint8_t * value);
+kvm_result_t storage_read_range(const kvm_entry_t * entry, uint32_t offset, uint32_t size, uint8_t * data);
+
+uint32_t storage_count(void);
+/* Entries not expired by now, the expired ones may still wait for reaping. */
+uint32_t storage_live_count(uint64_t now);
+kvm_entry_t * storage_first(void);
+kvm_entry_t * storage_next(const kvm_entry_t * entry);
+
+/* Calls the callback for every unexpired entry of the bucket at the cursor
+   with its remaining TTL and returns the cursor of the next bucket, 0 after
+   the last one. Bucket indexes are counted up in reverse bit order, so the
+   buckets already visited stay visited when the table grows. */
+typedef void (* storage_scan_callback_t)(void * context, const kvm_entry_t * entry, uint32_t ttl);
+uint32_t storage_scan(uint32_t cursor, uint64_t now, storage_scan_callback_t callback, void * context);
+
+uint32_t expire_entries(uint32_t max_count);
+int has_expiring_entries(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __kvm_storage_h__ */
@@ -0,0 +1,153 @@
+/**
+* @file kvm_stream.c
+*
+* @brief The module contains chunked PUT upload implementation.
+*
+* Uploads live in a small fixed table searched linearly; ids are never
+* reused while the server runs, so a stale id of a finished upload can not
+* reach a new one.
+*
+*/
+
+#include <string.h>
+
+#include "kvm_storage.h"
+#include "kvm_stream.h"
+
+typedef struct stream_upload_s
+{
+    uint32_t        id;         /* 0 - free slot */
+    int             client;
+    uint32_t        ttl;
+    uint32_t        received;
+    kvm_entry_t *   entry;      /* Reserved in the storage, not linked yet */
+} stream_upload_t;
+
+static stream_upload_t uploads[STREAM_MAX_UPLOADS];
+static uint32_t last_id = 0;
+static int current_client = -1;
+
+static stream_upload_t * find_upload(uint32_t id);
+static void release_upload(stream_upload_t * upload);
+
+void stream_set_client(int fd)
+{
+    current_client = fd;
+}
+
+kvm_result_t stream_begin(const uint8_t * key, uint32_t key_size, uint32_t value_size, uint32_t ttl, uint32_t * id)
+{
+    stream_upload_t * free_slot = NULL;
+    uint32_t client_uploads = 0;
+    for (uint32_t i = 0; i < STREAM_MAX_UPLOADS; ++i)
+    {
+        if (0 == uploads[i].id)
+        {
+            free_slot = (NULL != free_slot) ? free_slot : &uploads[i];
+        }
+        else if (uploads[i].client == current_client)
+        {
+            client_uploads++;
+        }
+    }
+
+    if (NULL == free_slot || client_uploads >= STREAM_MAX_CLIENT_UPLOADS)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    const kvm_result_t result = storage_reserve(key, key_size, value_size, &free_slot->entry);
+    if (KVM_RESULT_OK != result)
+    {
+        return result;
+    }
+
+    if (0 == ++last_id)
+    {
+        ++last_id;
+    }
+
+    free_slot->id = last_id;
+    free_slot->client = current_client;
+    free_slot->ttl = ttl;
+    free_slot->received = 0;
+
+    *id = last_id;
+    return KVM_RESULT_OK;
+}
+
+kvm_result_t stream_append(uint32_t id, const uint8_t * data, uint32_t size)
+{
+    stream_upload_t * upload = find_upload(id);
+    if (NULL == upload || size > upload->entry->value_size - upload->received)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    memcpy(ENTRY_VALUE(upload->entry) + upload->received, data, size);
+    upload->received += size;
+
+    return KVM_RESULT_OK;
+}
+
+kvm_result_t stream_end(uint32_t id, int abort)
+{
+    stream_upload_t * upload = find_upload(id);
+    if (NULL == upload)
+    {
+        return KVM_RESULT_INVALID_PARAM;
+    }
+
+    if (abort || upload->received != upload->entry->value_size)
+    {
+        release_upload(upload);
+        return abort ? KVM_RESULT_OK : KVM_RESULT_INVALID_PARAM;
+    }
+
+    /* The storage owns the entry from here, or has freed it. */
+    const kvm_result_t result = storage_commit(upload->entry, upload->ttl);
+    memset(upload, 0, sizeof(*upload));
+
+    return result;
+}
+
+void stream_release_client(int fd)
+{
+    for (uint32_t i = 0; i < STREAM_MAX_UPLOADS; ++i)
+    {
+        if (0 != uploads[i].id && uploads[i].client == fd)
+        {
+            release_upload(&uploads[i]);
+        }
+    }
+}
+
+void stream_release_all(void)
+{
+    for (uint32_t i = 0; i < STREAM_MAX_UPLOADS; ++i)
+    {
+        if (0 != uploads[i].id)
+        {
+            release_upload(&uploads[i]);
+        }
+    }
+}
+
+static stream_upload_t * find_upload(uint32_t id)
+{
+    for (uint32_t i = 0; i < STREAM_MAX_UPLOADS; ++i)
+    {
+        if (0 != id && uploads[i].id == id && uploads[i].client == current_client)
+        {
+            return &uploads[i];
+        }
+    }
+
+    return NULL;
+}
+
+static void release_upload(stream_upload_t * upload)
+{
+    storage_release(upload->entry);
+    memset(upload, 0, sizeof(*upload));
+}
@@ -0,0 +1,104 @@
+/**
+ * @file kvm_stream.h
+ *
+ * @brief Defines chunked PUT uploads.
+ *
+ * PUT_BEGIN reserves the whole entry in the storage, PUT_CHUNK requests
+ * copy their data straight into it and PUT_END links it, so no frame
+ * carries more than a chunk and the value is copied once. An upload
+ * belongs to the connection which began it and is dropped when that
+ * connection closes. The state belongs to the request loop thread.
+ *
+ */
+
+#ifndef __kvm_stream_h__
+#define __kvm_stream_h__
+
+#include <stdint.h>
+
+#include "kvm_results.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+/* Uploads in progress over all connections */
+#define STREAM_MAX_UPLOADS          64
+
+/* Uploads in progress of a single connection */
+#define STREAM_MAX_CLIENT_UPLOADS   4
+
+/*!
+*******************************************************************************
+** Sets the client socket owning uploads begun by the following requests.
+**
+** @param[in]   fd      Client socket or -1.
+*/
+void stream_set_client(int fd);
+
+/*!
+*******************************************************************************
+** Begins an upload of the current client.
+**
+** @param[in]   key         Key data.
+** @param[in]   key_size    Size of the key.
+** @param[in]   value_size  Total size of the value.
+** @param[in]   ttl         Time to live applied when the value is stored.
+** @param[out]  id          Id of the upload.
+**
+** @return
+**      - KVM_RESULT_OK, KVM_RESULT_NO_MEMORY if the value does not fit the
+**        memory limit or KVM_RESULT_INVALID_PARAM if the client has too
+**        many uploads in progress.
+*/
+kvm_result_t stream_begin(const uint8_t * key, uint32_t key_size, uint32_t value_size, uint32_t ttl, uint32_t * id);
+
+/*!
+*******************************************************************************
+** Appends a chunk to an upload of the current client.
+**
+** @param[in]   id          Id of the upload.
+** @param[in]   data        Chunk data.
+** @param[in]   size        Size of the chunk.
+**
+** @return
+**      - KVM_RESULT_OK or KVM_RESULT_INVALID_PARAM if there is no such
+**        upload or the chunk overflows the value.
+*/
+kvm_result_t stream_append(uint32_t id, const uint8_t * data, uint32_t size);
+
+/*!
+*******************************************************************************
+** Ends an upload of the current client. The upload is gone afterwards,
+** whatever the result.
+**
+** @param[in]   id          Id of the upload.
+** @param[in]   abort       Non zero to drop the value instead of storing it.
+**
+** @return
+**      - KVM_RESULT_OK, KVM_RESULT_INVALID_PARAM if there is no such upload
+**        or it is incomplete, KVM_RESULT_NO_MEMORY if the value no longer
+**        fits the memory limit.
+*/
+kvm_result_t stream_end(uint32_t id, int abort);
+
+/*!
+*******************************************************************************
+** Drops all uploads of a closed client.
+**
+** @param[in]   fd      Client socket.
+*/
+void stream_release_client(int fd);
+
+/*!
+*******************************************************************************
+** Drops all uploads, before the storage is released.
+*/
+void stream_release_all(void);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __kvm_stream_h__ */
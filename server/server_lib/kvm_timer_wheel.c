@@ -0,0 +1,257 @@
+/**
+* @file kvm_timer_wheel.c
+*
+* @brief The module contains hierarchical timer wheel implementation.
+*
+*/
+
+#include <stddef.h>
+
+#include "kvm_timer_wheel.h"
+
+#define SLOT_MASK ((uint64_t) (KVM_TIMER_WHEEL_SLOTS - 1))
+#define LEVEL_SPAN(level) (((uint64_t) 1) << ((level) * KVM_TIMER_WHEEL_SLOT_BITS))
+
+/* List heads keep the number of linked timers in expire_at. */
+static void list_init(kvm_timer_t * head)
+{
+    head->next = head;
+    head->prev = head;
+    head->expire_at = 0;
+}
+
+static void list_append(kvm_timer_t * head, kvm_timer_t * timer)
+{
+    timer->prev = head->prev;
+    timer->next = head;
+    head->prev->next = timer;
+    head->prev = timer;
+    head->expire_at++;
+}
+
+static void list_unlink(kvm_timer_t * timer)
+{
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->next = NULL;
+    timer->prev = NULL;
+}
+
+static kvm_timer_t * timer_slot(kvm_timer_wheel_t * wheel, uint64_t expire_at)
+{
+    const uint64_t when = (expire_at < wheel->current) ? wheel->current : expire_at;
+    const uint64_t differ = when ^ wheel->current;
+
+    int level = 0;
+    while (level < KVM_TIMER_WHEEL_LEVELS && differ >= LEVEL_SPAN(level + 1))
+    {
+        ++level;
+    }
+
+    if (KVM_TIMER_WHEEL_LEVELS == level)
+    {
+        /* Too far in the future, it is re-inserted on the top level wrap. */
+        return &wheel->overflow;
+    }
+
+    const uint64_t index = (when >> (level * KVM_TIMER_WHEEL_SLOT_BITS)) & SLOT_MASK;
+    return &wheel->slots[level][index];
+}
+
+static void place_timer(kvm_timer_wheel_t * wheel, kvm_timer_t * timer)
+{
+    list_append(timer_slot(wheel, timer->expire_at), timer);
+}
+
+static void cascade(kvm_timer_wheel_t * wheel, kvm_timer_t * head)
+{
+    kvm_timer_t pending;
+
+    if (head->next == head)
+    {
+        return;
+    }
+
+    /* Detach the whole slot first, so re-inserted timers can't be visited twice. */
+    pending.next = head->next;
+    pending.prev = head->prev;
+    pending.next->prev = &pending;
+    pending.prev->next = &pending;
+    list_init(head);
+
+    while (pending.next != &pending)
+    {
+        kvm_timer_t * timer = pending.next;
+        list_unlink(timer);
+        place_timer(wheel, timer);
+    }
+}
+
+void
+kvm_timer_wheel_init(
+    kvm_timer_wheel_t * wheel,
+    uint64_t            now)
+{
+    for (int level = 0; level < KVM_TIMER_WHEEL_LEVELS; ++level)
+    {
+        for (int slot = 0; slot < KVM_TIMER_WHEEL_SLOTS; ++slot)
+        {
+            list_init(&wheel->slots[level][slot]);
+        }
+    }
+    list_init(&wheel->overflow);
+
+    wheel->current = now;
+    wheel->count = 0;
+}
+
+void
+kvm_timer_wheel_add(
+    kvm_timer_wheel_t * wheel,
+    kvm_timer_t *       timer,
+    uint64_t            expire_at)
+{
+    timer->expire_at = expire_at;
+    place_timer(wheel, timer);
+    wheel->count++;
+}
+
+void
+kvm_timer_wheel_remove(
+    kvm_timer_wheel_t * wheel,
+    kvm_timer_t *       timer)
+{
+    if (NULL != timer->next)
+    {
+        timer_slot(wheel, timer->expire_at)->expire_at--;
+        list_unlink(timer);
+        wheel->count--;
+    }
+}
+
+uint32_t
+kvm_timer_wheel_advance(
+    kvm_timer_wheel_t *     wheel,
+    uint64_t                now,
+    uint32_t                max_count,
+    kvm_timer_callback_t    callback,
+    void *                  context)
+{
+    uint32_t fired = 0;
+
+    while (fired < max_count)
+    {
+        if (0 == wheel->count)
+        {
+            /* Nothing scheduled. Jump straight to the current time. */
+            if (now > wheel->current)
+            {
+                wheel->current = now;
+            }
+            break;
+        }
+
+        kvm_timer_t * head = &wheel->slots[0][wheel->current & SLOT_MASK];
+        while (head->next != head && fired < max_count)
+        {
+            kvm_timer_t * timer = head->next;
+            list_unlink(timer);
+            head->expire_at--;
+            wheel->count--;
+            fired++;
+            callback(context, timer);
+        }
+
+        if (head->next != head || wheel->current >= now)
+        {
+            break;
+        }
+
+        wheel->current++;
+
+        /* Higher levels first, their timers may land in the lower level slot
+           the current time has just entered. */
+        int level = 1;
+        while (level <= KVM_TIMER_WHEEL_LEVELS && 0 == (wheel->current & (LEVEL_SPAN(level) - 1)))
+        {
+            ++level;
+        }
+
+        if (level > KVM_TIMER_WHEEL_LEVELS)
+        {
+            cascade(wheel, &wheel->overflow);
+            level = KVM_TIMER_WHEEL_LEVELS;
+        }
+
+        while (--level > 0)
+        {
+            const int shift = level * KVM_TIMER_WHEEL_SLOT_BITS;
+            cascade(wheel, &wheel->slots[level][(wheel->current >> shift) & SLOT_MASK]);
+        }
+    }
+
+    return fired;
+}
+
+uint32_t
+kvm_timer_wheel_count_due(
+    const kvm_timer_wheel_t *   wheel,
+    uint64_t                    now)
+{
+    uint32_t due = 0;
+
+    for (int level = 0; level < KVM_TIMER_WHEEL_LEVELS; ++level)
+    {
+        const int shift = level * KVM_TIMER_WHEEL_SLOT_BITS;
+        const uint64_t span = LEVEL_SPAN(level);
+        const uint64_t base = wheel->current & ~(LEVEL_SPAN(level + 1) - 1);
+
+        /* Slots before the current digit are empty, so is the current one
+           above level 0, as its timers were cascaded on entering it. */
+        uint64_t index = (wheel->current >> shift) & SLOT_MASK;
+        if (0 != level)
+        {
+            ++index;
+        }
+
+        for (; index < KVM_TIMER_WHEEL_SLOTS; ++index)
+        {
+            const uint64_t first = base + index * span;
+            if (first > now)
+            {
+                break;
+            }
+
+            const kvm_timer_t * head = &wheel->slots[level][index];
+            if (first + span - 1 <= now)
+            {
+                due += (uint32_t) head->expire_at;
+                continue;
+            }
+
+            for (const kvm_timer_t * timer = head->next; timer != head; timer = timer->next)
+            {
+                if (timer->expire_at <= now)
+                {
+                    ++due;
+                }
+            }
+        }
+    }
+
+    /* Overflow timers are past the current top level span. */
+    const uint64_t top = LEVEL_SPAN(KVM_TIMER_WHEEL_LEVELS);
+    if ((wheel->current & ~(top - 1)) + top <= now)
+    {
+        const kvm_timer_t * head = &wheel->overflow;
+        for (const kvm_timer_t * timer = head->next; timer != head; timer = timer->next)
+        {
+            if (timer->expire_at <= now)
+            {
+                ++due;
+            }
+        }
+    }
+
+    return due;
+}
@@ -0,0 +1,131 @@
+/**
+ * @file kvm_timer_wheel.h
+ *
+ * @brief Defines hierarchical timer wheel used for key expiration.
+ *
+ */
+
+#ifndef __kvm_timer_wheel_h__
+#define __kvm_timer_wheel_h__
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif /* __cplusplus */
+
+#define KVM_TIMER_WHEEL_LEVELS      4
+#define KVM_TIMER_WHEEL_SLOT_BITS   6
+#define KVM_TIMER_WHEEL_SLOTS       (1 << KVM_TIMER_WHEEL_SLOT_BITS)
+
+/* Timer node. Intended to be embedded into the object which has to expire. */
+typedef struct kvm_timer_s
+{
+    struct kvm_timer_s *    next;
+    struct kvm_timer_s *    prev;
+    uint64_t                expire_at;
+} kvm_timer_t;
+
+/* Hierarchical timer wheel. Each tick is one millisecond. Level N slot covers
+   64^N ticks, so four levels cover ~4.6 hours. A timer sits on the level of
+   the highest base 64 digit in which its time differs from the current one,
+   so its slot follows from the two times. Timers further in the future wait
+   in the overflow list, re-inserted when the current time enters their
+   range. Slot heads keep the number of their timers in expire_at. */
+typedef struct kvm_timer_wheel_s
+{
+    uint64_t    current;
+    uint32_t    count;
+    kvm_timer_t slots[KVM_TIMER_WHEEL_LEVELS][KVM_TIMER_WHEEL_SLOTS];
+    kvm_timer_t overflow;
+} kvm_timer_wheel_t;
+
+/**< Timer expiration callback type. The timer is already unlinked. */
+typedef void (* kvm_timer_callback_t)(
+    void *          context,
+    kvm_timer_t *   timer);
+
+/*!
+*******************************************************************************
+** Initializes the timer wheel.
+**
+** @param[in]   wheel   Timer wheel.
+** @param[in]   now     Current time in milliseconds.
+*/
+void
+kvm_timer_wheel_init(
+    kvm_timer_wheel_t * wheel,
+    uint64_t            now);
+
+/*!
+*******************************************************************************
+** Schedules the timer. Timer must not be linked.
+**
+** @param[in]   wheel       Timer wheel.
+** @param[in]   timer       Timer to schedule.
+** @param[in]   expire_at   Absolute expiration time in milliseconds.
+*/
+void
+kvm_timer_wheel_add(
+    kvm_timer_wheel_t * wheel,
+    kvm_timer_t *       timer,
+    uint64_t            expire_at);
+
+/*!
+*******************************************************************************
+** Cancels the timer. Does nothing if the timer is not linked.
+**
+** @param[in]   wheel   Timer wheel.
+** @param[in]   timer   Timer to cancel.
+*/
+void
+kvm_timer_wheel_remove(
+    kvm_timer_wheel_t * wheel,
+    kvm_timer_t *       timer);
+
+/*!
+*******************************************************************************
+** Advances the wheel up to the specified time and fires expired timers.
+** Stops after max_count timers were fired, the rest is fired by next calls.
+**
+** @param[in]   wheel       Timer wheel.
+** @param[in]   now         Current time in milliseconds.
+** @param[in]   max_count   Maximum number of timers to fire.
+** @param[in]   callback    Callback to call for each expired timer.
+** @param[in]   context     User context provided to the callback.
+**
+** @return
+**      - Number of fired timers.
+*/
+uint32_t
+kvm_timer_wheel_advance(
+    kvm_timer_wheel_t *     wheel,
+    uint64_t                now,
+    uint32_t                max_count,
+    kvm_timer_callback_t    callback,
+    void *                  context);
+
+/*!
+*******************************************************************************
+** Counts the timers expired but not fired yet. Slots wholly expired are
+** counted by their heads, only the timers of a slot per level whose span
+** contains the time are visited.
+**
+** @param[in]   wheel   Timer wheel.
+** @param[in]   now     Current time in milliseconds, not before the time
+**                      the wheel was advanced to.
+**
+** @return
+**      - Number of timers with expiration time up to now.
+*/
+uint32_t
+kvm_timer_wheel_count_due(
+    const kvm_timer_wheel_t *   wheel,
+    uint64_t                    now);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* __kvm_timer_wheel_h__ */